@@ -29,6 +29,9 @@ typedef struct RestartMessage RestartMessage;
 typedef struct ChangeWindowSize ChangeWindowSize;
 typedef struct CommandSuspend CommandSuspend;
 typedef struct ClientHello ClientHello;
+typedef struct CloseStream CloseStream;
+typedef struct IoRecord IoRecord;
+typedef struct IoBufferBatch IoBufferBatch;
 typedef struct ServerMessage ServerMessage;
 typedef struct ServerHello ServerHello;
 
@@ -52,7 +55,10 @@ typedef enum {
   CLIENT_MESSAGE__TYPE_STDERR_BUF = 10,
   CLIENT_MESSAGE__TYPE_WINSIZE_EVENT = 11,
   CLIENT_MESSAGE__TYPE_SUSPEND_EVENT = 12,
-  CLIENT_MESSAGE__TYPE_HELLO_MSG = 13
+  CLIENT_MESSAGE__TYPE_HELLO_MSG = 13,
+  CLIENT_MESSAGE__TYPE_CLOSE_STREAM_MSG = 14,
+  CLIENT_MESSAGE__TYPE_IOBUF_BATCH = 16,
+  CLIENT_MESSAGE__TYPE_COMPRESSED = 17
     PROTOBUF_C__FORCE_ENUM_TO_BE_INT_SIZE(CLIENT_MESSAGE__TYPE__CASE)
 } ClientMessage__TypeCase;
 
@@ -63,6 +69,10 @@ typedef enum {
 struct  ClientMessage
 {
   ProtobufCMessage base;
+  /*
+   * multiplexed stream, 0 if none 
+   */
+  uint32_t stream_id;
   ClientMessage__TypeCase type_case;
   union {
     AcceptMessage *accept_msg;
@@ -78,11 +88,14 @@ struct  ClientMessage
     ChangeWindowSize *winsize_event;
     CommandSuspend *suspend_event;
     ClientHello *hello_msg;
+    CloseStream *close_stream_msg;
+    IoBufferBatch *iobuf_batch;
+    ProtobufCBinaryData compressed;
   } u;
 };
 #define CLIENT_MESSAGE__INIT \
  { PROTOBUF_C_MESSAGE_INIT (&client_message__descriptor) \
-    , CLIENT_MESSAGE__TYPE__NOT_SET, {0} }
+    , 0, CLIENT_MESSAGE__TYPE__NOT_SET, {0} }
 
 
 /*
@@ -358,12 +371,77 @@ struct  ClientHello
    * free-form client description 
    */
   char *client_id;
+  /*
+   * flag: client can send IoBufferBatch 
+   */
+  protobuf_c_boolean iobuf_batch;
+  /*
+   * flag: client can send compressed messages 
+   */
+  protobuf_c_boolean compression;
 };
 #define CLIENT_HELLO__INIT \
  { PROTOBUF_C_MESSAGE_INIT (&client_hello__descriptor) \
+    , (char *)protobuf_c_empty_string, 0, 0 }
+
+
+/*
+ * Sent by client to abandon a multiplexed stream before it finishes. 
+ */
+struct  CloseStream
+{
+  ProtobufCMessage base;
+  /*
+   * reason the stream was closed 
+   */
+  char *reason;
+};
+#define CLOSE_STREAM__INIT \
+ { PROTOBUF_C_MESSAGE_INIT (&close_stream__descriptor) \
     , (char *)protobuf_c_empty_string }
 
 
+/*
+ * A single I/O buffer in an IoBufferBatch 
+ */
+struct  IoRecord
+{
+  ProtobufCMessage base;
+  /*
+   * 0=stdin 1=stdout 2=stderr 3=ttyin 4=ttyout 
+   */
+  int32_t iofd;
+  /*
+   * elapsed time since last record 
+   */
+  TimeSpec *delay;
+  /*
+   * keystroke data 
+   */
+  ProtobufCBinaryData data;
+};
+#define IO_RECORD__INIT \
+ { PROTOBUF_C_MESSAGE_INIT (&io_record__descriptor) \
+    , 0, NULL, {0,NULL} }
+
+
+/*
+ * Several I/O buffers sent as a single message. 
+ */
+struct  IoBufferBatch
+{
+  ProtobufCMessage base;
+  /*
+   * I/O buffers in the order written 
+   */
+  size_t n_records;
+  IoRecord **records;
+};
+#define IO_BUFFER_BATCH__INIT \
+ { PROTOBUF_C_MESSAGE_INIT (&io_buffer_batch__descriptor) \
+    , 0,NULL }
+
+
 typedef enum {
   SERVER_MESSAGE__TYPE__NOT_SET = 0,
   SERVER_MESSAGE__TYPE_HELLO = 1,
@@ -381,6 +459,10 @@ typedef enum {
 struct  ServerMessage
 {
   ProtobufCMessage base;
+  /*
+   * multiplexed stream, 0 if none 
+   */
+  uint32_t stream_id;
   ServerMessage__TypeCase type_case;
   union {
     /*
@@ -407,7 +489,7 @@ struct  ServerMessage
 };
 #define SERVER_MESSAGE__INIT \
  { PROTOBUF_C_MESSAGE_INIT (&server_message__descriptor) \
-    , SERVER_MESSAGE__TYPE__NOT_SET, {0} }
+    , 0, SERVER_MESSAGE__TYPE__NOT_SET, {0} }
 
 
 /*
@@ -433,10 +515,22 @@ struct  ServerHello
    * flag: server supports sub-commands 
    */
   protobuf_c_boolean subcommands;
+  /*
+   * flag: server supports multiplexed streams 
+   */
+  protobuf_c_boolean multiplex;
+  /*
+   * flag: server supports IoBufferBatch 
+   */
+  protobuf_c_boolean iobuf_batch;
+  /*
+   * flag: server accepts compressed messages 
+   */
+  protobuf_c_boolean compression;
 };
 #define SERVER_HELLO__INIT \
  { PROTOBUF_C_MESSAGE_INIT (&server_hello__descriptor) \
-    , (char *)protobuf_c_empty_string, (char *)protobuf_c_empty_string, 0,NULL, 0 }
+    , (char *)protobuf_c_empty_string, (char *)protobuf_c_empty_string, 0,NULL, 0, 0, 0, 0 }
 
 
 /* ClientMessage methods */
@@ -673,6 +767,63 @@ ClientHello *
 void   client_hello__free_unpacked
                      (ClientHello *message,
                       ProtobufCAllocator *allocator);
+/* CloseStream methods */
+void   close_stream__init
+                     (CloseStream         *message);
+size_t close_stream__get_packed_size
+                     (const CloseStream   *message);
+size_t close_stream__pack
+                     (const CloseStream   *message,
+                      uint8_t             *out);
+size_t close_stream__pack_to_buffer
+                     (const CloseStream   *message,
+                      ProtobufCBuffer     *buffer);
+CloseStream *
+       close_stream__unpack
+                     (ProtobufCAllocator  *allocator,
+                      size_t               len,
+                      const uint8_t       *data);
+void   close_stream__free_unpacked
+                     (CloseStream *message,
+                      ProtobufCAllocator *allocator);
+/* IoRecord methods */
+void   io_record__init
+                     (IoRecord         *message);
+size_t io_record__get_packed_size
+                     (const IoRecord   *message);
+size_t io_record__pack
+                     (const IoRecord   *message,
+                      uint8_t             *out);
+size_t io_record__pack_to_buffer
+                     (const IoRecord   *message,
+                      ProtobufCBuffer     *buffer);
+IoRecord *
+       io_record__unpack
+                     (ProtobufCAllocator  *allocator,
+                      size_t               len,
+                      const uint8_t       *data);
+void   io_record__free_unpacked
+                     (IoRecord *message,
+                      ProtobufCAllocator *allocator);
+/* IoBufferBatch methods */
+void   io_buffer_batch__init
+                     (IoBufferBatch         *message);
+size_t io_buffer_batch__get_packed_size
+                     (const IoBufferBatch   *message);
+size_t io_buffer_batch__pack
+                     (const IoBufferBatch   *message,
+                      uint8_t             *out);
+size_t io_buffer_batch__pack_to_buffer
+                     (const IoBufferBatch   *message,
+                      ProtobufCBuffer     *buffer);
+IoBufferBatch *
+       io_buffer_batch__unpack
+                     (ProtobufCAllocator  *allocator,
+                      size_t               len,
+                      const uint8_t       *data);
+void   io_buffer_batch__free_unpacked
+                     (IoBufferBatch *message,
+                      ProtobufCAllocator *allocator);
 /* ServerMessage methods */
 void   server_message__init
                      (ServerMessage         *message);
@@ -755,6 +906,15 @@ typedef void (*CommandSuspend_Closure)
 typedef void (*ClientHello_Closure)
                  (const ClientHello *message,
                   void *closure_data);
+typedef void (*CloseStream_Closure)
+                 (const CloseStream *message,
+                  void *closure_data);
+typedef void (*IoRecord_Closure)
+                 (const IoRecord *message,
+                  void *closure_data);
+typedef void (*IoBufferBatch_Closure)
+                 (const IoBufferBatch *message,
+                  void *closure_data);
 typedef void (*ServerMessage_Closure)
                  (const ServerMessage *message,
                   void *closure_data);
@@ -781,6 +941,9 @@ extern const ProtobufCMessageDescriptor restart_message__descriptor;
 extern const ProtobufCMessageDescriptor change_window_size__descriptor;
 extern const ProtobufCMessageDescriptor command_suspend__descriptor;
 extern const ProtobufCMessageDescriptor client_hello__descriptor;
+extern const ProtobufCMessageDescriptor close_stream__descriptor;
+extern const ProtobufCMessageDescriptor io_record__descriptor;
+extern const ProtobufCMessageDescriptor io_buffer_batch__descriptor;
 extern const ProtobufCMessageDescriptor server_message__descriptor;
 extern const ProtobufCMessageDescriptor server_hello__descriptor;
 
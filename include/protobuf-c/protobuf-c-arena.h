@@ -0,0 +1,63 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef PROTOBUF_C_ARENA_H
+#define PROTOBUF_C_ARENA_H
+
+#include "protobuf-c/protobuf-c.h"
+
+PROTOBUF_C__BEGIN_DECLS
+
+/*
+ * A bump allocator for use with the protobuf-c unpack functions.
+ * Memory is carved out of large blocks and is only released when the
+ * arena is reset or destroyed; the free function is a no-op.
+ * Messages unpacked using an arena must not be passed to the
+ * *__free_unpacked() functions, reset the arena instead.
+ */
+typedef struct ProtobufCArenaBlock ProtobufCArenaBlock;
+
+typedef struct ProtobufCArena {
+	/* Must be first so a ProtobufCArena * can be used as an allocator. */
+	ProtobufCAllocator base;
+	/* Allocator used for the blocks themselves, NULL for malloc/free. */
+	ProtobufCAllocator *parent;
+	/* Current block first, followed by full and oversized blocks. */
+	ProtobufCArenaBlock *blocks;
+	size_t block_size;
+} ProtobufCArena;
+
+/* Default size of an arena block, enough for a full IoBuffer message. */
+#define PROTOBUF_C_ARENA_BLOCK_SIZE	(72 * 1024)
+
+PROTOBUF_C__API
+void
+protobuf_c_arena_init(ProtobufCArena *arena, size_t block_size,
+		      ProtobufCAllocator *parent);
+
+PROTOBUF_C__API
+void
+protobuf_c_arena_reset(ProtobufCArena *arena);
+
+PROTOBUF_C__API
+void
+protobuf_c_arena_destroy(ProtobufCArena *arena);
+
+PROTOBUF_C__END_DECLS
+
+#endif /* PROTOBUF_C_ARENA_H */
@@ -32,14 +32,15 @@ struct timeval;		/* for deprecated APIs */
 #define SUDO_EV_PERSIST		0x08	/* persist until deleted */
 #define SUDO_EV_SIGNAL		0x10	/* fire on signal receipt */
 #define SUDO_EV_SIGINFO		0x20	/* fire on signal receipt (siginfo) */
+#define SUDO_EV_ET		0x40	/* edge-triggered, if backend supports it */
 
 /* User-settable events for sudo_ev_init() (SUDO_EV_TIMEOUT not valid here) */
-#define SUDO_EV_MASK		(SUDO_EV_READ|SUDO_EV_WRITE|SUDO_EV_PERSIST|SUDO_EV_SIGNAL|SUDO_EV_SIGINFO)
+#define SUDO_EV_MASK		(SUDO_EV_READ|SUDO_EV_WRITE|SUDO_EV_PERSIST|SUDO_EV_SIGNAL|SUDO_EV_SIGINFO|SUDO_EV_ET)
 
 /* Event flags (internal) */
 #define SUDO_EVQ_INSERTED	0x01	/* event is on the event queue */
 #define SUDO_EVQ_ACTIVE		0x02	/* event is on the active queue */
-#define SUDO_EVQ_TIMEOUTS	0x04	/* event is on the timeouts queue */
+#define SUDO_EVQ_TIMEOUTS	0x04	/* event is on the timeouts heap */
 
 /* Event loop flags */
 #define SUDO_EVLOOP_ONCE	0x01	/* Only run once through the loop */
@@ -54,6 +55,9 @@ struct timeval;		/* for deprecated APIs */
 #define SUDO_EVBASE_GOT_BREAK	0x20
 #define SUDO_EVBASE_GOT_MASK	0xf0
 
+/* Event base options for sudo_ev_base_alloc_flags() */
+#define SUDO_EVBASE_OPT_SIGNALFD 0x01	/* use signalfd(2) for signals if possible */
+
 /* Must match sudo_plugin_ev_callback_t in sudo_plugin.h */
 typedef void (*sudo_ev_callback_t)(int fd, int what, void *closure);
 
@@ -71,23 +75,32 @@ struct sudo_ev_siginfo_container {
 struct sudo_event {
     TAILQ_ENTRY(sudo_event) entries;
     TAILQ_ENTRY(sudo_event) active_entries;
-    TAILQ_ENTRY(sudo_event) timeouts_entries;
+#ifdef HAVE_EPOLL
+    TAILQ_ENTRY(sudo_event) fd_entries; /* events sharing the same fd */
+#endif
     struct sudo_event_base *base; /* base this event belongs to */
     int fd;			/* fd/signal we are interested in */
     short events;		/* SUDO_EV_* flags (in) */
     short revents;		/* SUDO_EV_* flags (out) */
     short flags;		/* internal event flags */
     short pfd_idx;		/* index into pfds array (XXX) */
+    int timeout_idx;		/* index into timeouts heap */
     sudo_ev_callback_t callback;/* user-provided callback */
     struct timespec timeout;	/* for SUDO_EV_TIMEOUT */
     void *closure;		/* user-provided data pointer */
 };
 TAILQ_HEAD(sudo_event_list, sudo_event);
 
+#ifdef HAVE_EPOLL
+struct sudo_ev_epoll_fd;	/* private to event_epoll.c */
+#endif
+
 struct sudo_event_base {
     struct sudo_event_list events; /* tail queue of all events */
     struct sudo_event_list active; /* tail queue of active events */
-    struct sudo_event_list timeouts; /* tail queue of timeout events */
+    struct sudo_event **timeouts; /* binary min-heap of timeout events */
+    int timeouts_len;		/* number of events in the timeouts heap */
+    int timeouts_max;		/* size of the timeouts heap */
     struct sudo_event signal_event; /* storage for signal pipe event */
     struct sudo_event_list signals[NSIG]; /* array of signal event tail queues */
     struct sigaction *orig_handlers[NSIG]; /* original signal handlers */
@@ -96,7 +109,26 @@ struct sudo_event_base {
     sig_atomic_t signal_caught;	/* at least one signal caught */
     int num_handlers;		/* number of installed handlers */
     int signal_pipe[2];		/* so we can wake up on signal */
-#if defined(HAVE_POLL) || defined(HAVE_PPOLL)
+#ifdef HAVE_SIGNALFD
+    struct sudo_event signalfd_event; /* storage for signalfd event */
+    sigset_t signalfd_mask;	/* signals delivered via signalfd */
+    sigset_t signalfd_omask;	/* signal mask when the loop was entered */
+    int signalfd;		/* signalfd or -1 if not in use */
+    bool signalfd_blocked;	/* signalfd_mask blocked by the event loop */
+#endif
+    unsigned int options;	/* SUDO_EVBASE_OPT_* */
+#if defined(HAVE_EPOLL)
+    struct sudo_ev_epoll_fd **ep_fds; /* per-fd state, indexed by fd */
+    struct epoll_event *ep_events; /* array of struct epoll_event */
+    int *ep_ready;		/* fds epoll cannot watch (always ready) */
+    int ep_fd;			/* epoll instance */
+    int ep_fds_max;		/* size of the ep_fds array */
+    int ep_nevents;		/* size of the ep_events array */
+    int ep_nfds;		/* number of fds in the epoll set */
+    int ep_nready;		/* number of entries in ep_ready */
+    int ep_ready_max;		/* size of the ep_ready array */
+    pid_t ep_pid;		/* process that created ep_fd */
+#elif defined(HAVE_POLL) || defined(HAVE_PPOLL)
     struct pollfd *pfds;	/* array of struct pollfd */
     int pfd_max;		/* size of the pfds array */
     int pfd_high;		/* highest slot used */
@@ -108,13 +140,15 @@ struct sudo_event_base {
     void *writefds_out;		/* write I/O descriptor set (out) */
     int maxfd;			/* max fd we can store in readfds/writefds */
     int highfd;			/* highest fd to pass as 1st arg to select */
-#endif /* HAVE_POLL */
+#endif /* HAVE_EPOLL */
     unsigned int flags;		/* SUDO_EVBASE_* */
 };
 
 /* Allocate a new event base. */
 sudo_dso_public struct sudo_event_base *sudo_ev_base_alloc_v1(void);
+sudo_dso_public struct sudo_event_base *sudo_ev_base_alloc_v2(unsigned int options);
 #define sudo_ev_base_alloc() sudo_ev_base_alloc_v1()
+#define sudo_ev_base_alloc_flags(_a) sudo_ev_base_alloc_v2((_a))
 
 /* Free an event base. */
 sudo_dso_public void sudo_ev_base_free_v1(struct sudo_event_base *base);
@@ -198,6 +232,10 @@ sudo_dso_public bool sudo_ev_got_break_v1(struct sudo_event_base *base);
 /* Magic pointer value to use self pointer as callback arg. */
 #define sudo_ev_self_cbarg() ((void *)-1)
 
+/* Return the event with the earliest timeout or NULL (internal). */
+#define sudo_ev_first_timeout(_b) \
+    ((_b)->timeouts_len ? (_b)->timeouts[0] : NULL)
+
 /* Add an event to the base's active queue and mark it active (internal). */
 void sudo_ev_activate(struct sudo_event_base *base, struct sudo_event *ev);
 
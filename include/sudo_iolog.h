@@ -87,6 +87,7 @@ struct iolog_file {
 #endif
 	void *v;
     } fd;
+    int rawfd;		/* underlying descriptor, for iolog_sync() */
 };
 
 struct iolog_path_escape {
@@ -127,6 +128,8 @@ ssize_t iolog_read(struct iolog_file *iol, void *buf, size_t nbytes, const char
 ssize_t iolog_write(struct iolog_file *iol, const void *buf, size_t len, const char **errstr);
 void iolog_clearerr(struct iolog_file *iol);
 bool iolog_flush(struct iolog_file *iol, const char **errstr);
+bool iolog_sync(struct iolog_file *iol, const char **errstr);
+off_t iolog_checkpoint(struct iolog_file *iol, const char **errstr);
 void iolog_rewind(struct iolog_file *iol);
 unsigned int iolog_get_maxseq(void);
 uid_t iolog_get_uid(void);
@@ -0,0 +1,74 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * This is an open source non-commercial project. Dear PVS-Studio, please check it.
+ * PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "sudo_compat.h"
+#include "sudo_debug.h"
+#include "sudo_iolog.h"
+
+/*
+ * Flush any buffered data so that the I/O log file can later be
+ * truncated at the returned offset and reopened for appending.
+ * For compressed files the current gzip member is completed, a new
+ * one is started on the next write.
+ * Returns the offset in the underlying file, or -1 on error.
+ */
+off_t
+iolog_checkpoint(struct iolog_file *iol, const char **errstr)
+{
+    off_t ret;
+
+#ifdef HAVE_ZLIB_H
+    if (iol->compressed) {
+	int errnum;
+	if (gzflush(iol->fd.g, Z_FINISH) != Z_OK) {
+	    if (errstr != NULL) {
+		*errstr = gzerror(iol->fd.g, &errnum);
+		if (errnum == Z_ERRNO)
+		    *errstr = strerror(errno);
+	    }
+	    return -1;
+	}
+    } else
+#endif
+    {
+	if (fflush(iol->fd.f) != 0) {
+	    if (errstr != NULL)
+		*errstr = strerror(errno);
+	    return -1;
+	}
+    }
+
+    ret = lseek(iol->rawfd, 0, SEEK_CUR);
+    if (ret == -1 && errstr != NULL)
+	*errstr = strerror(errno);
+
+    return ret;
+}
@@ -52,6 +52,7 @@ iolog_open(struct iolog_file *iol, int dfd, int iofd, const char *mode)
     int flags;
     const char *file;
     unsigned char magic[2];
+    ssize_t nread;
     const uid_t iolog_uid = iolog_get_uid();
     const gid_t iolog_gid = iolog_get_gid();
     debug_decl(iolog_open, SUDO_DEBUG_UTIL);
@@ -61,6 +62,9 @@ iolog_open(struct iolog_file *iol, int dfd, int iofd, const char *mode)
     } else if (mode[0] == 'w') {
 	flags = O_CREAT|O_TRUNC;
 	flags |= mode[1] == '+' ? O_RDWR : O_WRONLY;
+    } else if (mode[0] == 'a') {
+	/* Append to an existing file, read access for the magic check. */
+	flags = O_RDWR|O_APPEND;
     } else {
 	sudo_debug_printf(SUDO_DEBUG_ERROR,
 	    "%s: invalid I/O mode %s", __func__, mode);
@@ -86,20 +90,30 @@ iolog_open(struct iolog_file *iol, int dfd, int iofd, const char *mode)
 		iol->compressed = iolog_get_compress();
 	    } else {
 		/* check for gzip magic number */
-		if (pread(fd, magic, sizeof(magic), 0) == ssizeof(magic)) {
+		nread = pread(fd, magic, sizeof(magic), 0);
+		if (nread == ssizeof(magic)) {
 		    if (magic[0] == gzip_magic[0] && magic[1] == gzip_magic[1])
 			iol->compressed = true;
+		} else if (nread == 0 && *mode == 'a') {
+		    /* Nothing written yet, use the current setting. */
+		    iol->compressed = iolog_get_compress();
 		}
 	    }
 	    if (fcntl(fd, F_SETFD, FD_CLOEXEC) != -1) {
 #ifdef HAVE_ZLIB_H
-		if (iol->compressed)
+		if (iol->compressed) {
+		    /* zlib cannot read and write the same stream. */
+		    if (mode[0] == 'r' && mode[1] == '+') {
+			mode = "r";
+			flags = O_RDONLY;
+		    }
 		    iol->fd.g = gzdopen(fd, mode);
-		else
+		} else
 #endif
 		    iol->fd.f = fdopen(fd, mode);
 	    }
 	    if (iol->fd.v != NULL) {
+		iol->rawfd = fd;
 		switch ((flags & O_ACCMODE)) {
 		case O_WRONLY:
 		case O_RDWR:
@@ -559,6 +559,141 @@ void   client_hello__free_unpacked
   assert(message->base.descriptor == &client_hello__descriptor);
   protobuf_c_message_free_unpacked ((ProtobufCMessage*)message, allocator);
 }
+void   close_stream__init
+                     (CloseStream         *message)
+{
+  static const CloseStream init_value = CLOSE_STREAM__INIT;
+  *message = init_value;
+}
+size_t close_stream__get_packed_size
+                     (const CloseStream *message)
+{
+  assert(message->base.descriptor == &close_stream__descriptor);
+  return protobuf_c_message_get_packed_size ((const ProtobufCMessage*)(message));
+}
+size_t close_stream__pack
+                     (const CloseStream *message,
+                      uint8_t       *out)
+{
+  assert(message->base.descriptor == &close_stream__descriptor);
+  return protobuf_c_message_pack ((const ProtobufCMessage*)message, out);
+}
+size_t close_stream__pack_to_buffer
+                     (const CloseStream *message,
+                      ProtobufCBuffer *buffer)
+{
+  assert(message->base.descriptor == &close_stream__descriptor);
+  return protobuf_c_message_pack_to_buffer ((const ProtobufCMessage*)message, buffer);
+}
+CloseStream *
+       close_stream__unpack
+                     (ProtobufCAllocator  *allocator,
+                      size_t               len,
+                      const uint8_t       *data)
+{
+  return (CloseStream *)
+     protobuf_c_message_unpack (&close_stream__descriptor,
+                                allocator, len, data);
+}
+void   close_stream__free_unpacked
+                     (CloseStream *message,
+                      ProtobufCAllocator *allocator)
+{
+  if(!message)
+    return;
+  assert(message->base.descriptor == &close_stream__descriptor);
+  protobuf_c_message_free_unpacked ((ProtobufCMessage*)message, allocator);
+}
+void   io_record__init
+                     (IoRecord         *message)
+{
+  static const IoRecord init_value = IO_RECORD__INIT;
+  *message = init_value;
+}
+size_t io_record__get_packed_size
+                     (const IoRecord *message)
+{
+  assert(message->base.descriptor == &io_record__descriptor);
+  return protobuf_c_message_get_packed_size ((const ProtobufCMessage*)(message));
+}
+size_t io_record__pack
+                     (const IoRecord *message,
+                      uint8_t       *out)
+{
+  assert(message->base.descriptor == &io_record__descriptor);
+  return protobuf_c_message_pack ((const ProtobufCMessage*)message, out);
+}
+size_t io_record__pack_to_buffer
+                     (const IoRecord *message,
+                      ProtobufCBuffer *buffer)
+{
+  assert(message->base.descriptor == &io_record__descriptor);
+  return protobuf_c_message_pack_to_buffer ((const ProtobufCMessage*)message, buffer);
+}
+IoRecord *
+       io_record__unpack
+                     (ProtobufCAllocator  *allocator,
+                      size_t               len,
+                      const uint8_t       *data)
+{
+  return (IoRecord *)
+     protobuf_c_message_unpack (&io_record__descriptor,
+                                allocator, len, data);
+}
+void   io_record__free_unpacked
+                     (IoRecord *message,
+                      ProtobufCAllocator *allocator)
+{
+  if(!message)
+    return;
+  assert(message->base.descriptor == &io_record__descriptor);
+  protobuf_c_message_free_unpacked ((ProtobufCMessage*)message, allocator);
+}
+void   io_buffer_batch__init
+                     (IoBufferBatch         *message)
+{
+  static const IoBufferBatch init_value = IO_BUFFER_BATCH__INIT;
+  *message = init_value;
+}
+size_t io_buffer_batch__get_packed_size
+                     (const IoBufferBatch *message)
+{
+  assert(message->base.descriptor == &io_buffer_batch__descriptor);
+  return protobuf_c_message_get_packed_size ((const ProtobufCMessage*)(message));
+}
+size_t io_buffer_batch__pack
+                     (const IoBufferBatch *message,
+                      uint8_t       *out)
+{
+  assert(message->base.descriptor == &io_buffer_batch__descriptor);
+  return protobuf_c_message_pack ((const ProtobufCMessage*)message, out);
+}
+size_t io_buffer_batch__pack_to_buffer
+                     (const IoBufferBatch *message,
+                      ProtobufCBuffer *buffer)
+{
+  assert(message->base.descriptor == &io_buffer_batch__descriptor);
+  return protobuf_c_message_pack_to_buffer ((const ProtobufCMessage*)message, buffer);
+}
+IoBufferBatch *
+       io_buffer_batch__unpack
+                     (ProtobufCAllocator  *allocator,
+                      size_t               len,
+                      const uint8_t       *data)
+{
+  return (IoBufferBatch *)
+     protobuf_c_message_unpack (&io_buffer_batch__descriptor,
+                                allocator, len, data);
+}
+void   io_buffer_batch__free_unpacked
+                     (IoBufferBatch *message,
+                      ProtobufCAllocator *allocator)
+{
+  if(!message)
+    return;
+  assert(message->base.descriptor == &io_buffer_batch__descriptor);
+  protobuf_c_message_free_unpacked ((ProtobufCMessage*)message, allocator);
+}
 void   server_message__init
                      (ServerMessage         *message)
 {
@@ -649,7 +784,7 @@ void   server_hello__free_unpacked
   assert(message->base.descriptor == &server_hello__descriptor);
   protobuf_c_message_free_unpacked ((ProtobufCMessage*)message, allocator);
 }
-static const ProtobufCFieldDescriptor client_message__field_descriptors[13] =
+static const ProtobufCFieldDescriptor client_message__field_descriptors[17] =
 {
   {
     "accept_msg",
@@ -807,17 +942,69 @@ static const ProtobufCFieldDescriptor client_message__field_descriptors[13] =
     0 | PROTOBUF_C_FIELD_FLAG_ONEOF,             /* flags */
     0,NULL,NULL    /* reserved1,reserved2, etc */
   },
+  {
+    "close_stream_msg",
+    14,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_MESSAGE,
+    offsetof(ClientMessage, type_case),
+    offsetof(ClientMessage, u.close_stream_msg),
+    &close_stream__descriptor,
+    NULL,
+    0 | PROTOBUF_C_FIELD_FLAG_ONEOF,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "stream_id",
+    15,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_UINT32,
+    0,   /* quantifier_offset */
+    offsetof(ClientMessage, stream_id),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "iobuf_batch",
+    16,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_MESSAGE,
+    offsetof(ClientMessage, type_case),
+    offsetof(ClientMessage, u.iobuf_batch),
+    &io_buffer_batch__descriptor,
+    NULL,
+    0 | PROTOBUF_C_FIELD_FLAG_ONEOF,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "compressed",
+    17,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_BYTES,
+    offsetof(ClientMessage, type_case),
+    offsetof(ClientMessage, u.compressed),
+    NULL,
+    NULL,
+    0 | PROTOBUF_C_FIELD_FLAG_ONEOF,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
 };
 static const unsigned client_message__field_indices_by_name[] = {
   0,   /* field[0] = accept_msg */
   4,   /* field[4] = alert_msg */
+  13,   /* field[13] = close_stream_msg */
+  16,   /* field[16] = compressed */
   2,   /* field[2] = exit_msg */
   12,   /* field[12] = hello_msg */
+  15,   /* field[15] = iobuf_batch */
   1,   /* field[1] = reject_msg */
   3,   /* field[3] = restart_msg */
   9,   /* field[9] = stderr_buf */
   7,   /* field[7] = stdin_buf */
   8,   /* field[8] = stdout_buf */
+  14,   /* field[14] = stream_id */
   11,   /* field[11] = suspend_event */
   5,   /* field[5] = ttyin_buf */
   6,   /* field[6] = ttyout_buf */
@@ -826,7 +1013,7 @@ static const unsigned client_message__field_indices_by_name[] = {
 static const ProtobufCIntRange client_message__number_ranges[1 + 1] =
 {
   { 1, 0 },
-  { 0, 13 }
+  { 0, 17 }
 };
 const ProtobufCMessageDescriptor client_message__descriptor =
 {
@@ -836,7 +1023,7 @@ const ProtobufCMessageDescriptor client_message__descriptor =
   "ClientMessage",
   "",
   sizeof(ClientMessage),
-  13,
+  17,
   client_message__field_descriptors,
   client_message__field_indices_by_name,
   1,  client_message__number_ranges,
@@ -1559,7 +1746,7 @@ const ProtobufCMessageDescriptor command_suspend__descriptor =
   (ProtobufCMessageInit) command_suspend__init,
   NULL,NULL,NULL    /* reserved[123] */
 };
-static const ProtobufCFieldDescriptor client_hello__field_descriptors[1] =
+static const ProtobufCFieldDescriptor client_hello__field_descriptors[3] =
 {
   {
     "client_id",
@@ -1573,14 +1760,40 @@ static const ProtobufCFieldDescriptor client_hello__field_descriptors[1] =
     0,             /* flags */
     0,NULL,NULL    /* reserved1,reserved2, etc */
   },
+  {
+    "iobuf_batch",
+    2,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_BOOL,
+    0,   /* quantifier_offset */
+    offsetof(ClientHello, iobuf_batch),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "compression",
+    3,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_BOOL,
+    0,   /* quantifier_offset */
+    offsetof(ClientHello, compression),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
 };
 static const unsigned client_hello__field_indices_by_name[] = {
   0,   /* field[0] = client_id */
+  2,   /* field[2] = compression */
+  1,   /* field[1] = iobuf_batch */
 };
 static const ProtobufCIntRange client_hello__number_ranges[1 + 1] =
 {
   { 1, 0 },
-  { 0, 1 }
+  { 0, 3 }
 };
 const ProtobufCMessageDescriptor client_hello__descriptor =
 {
@@ -1590,14 +1803,154 @@ const ProtobufCMessageDescriptor client_hello__descriptor =
   "ClientHello",
   "",
   sizeof(ClientHello),
-  1,
+  3,
   client_hello__field_descriptors,
   client_hello__field_indices_by_name,
   1,  client_hello__number_ranges,
   (ProtobufCMessageInit) client_hello__init,
   NULL,NULL,NULL    /* reserved[123] */
 };
-static const ProtobufCFieldDescriptor server_message__field_descriptors[5] =
+static const ProtobufCFieldDescriptor close_stream__field_descriptors[1] =
+{
+  {
+    "reason",
+    1,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_STRING,
+    0,   /* quantifier_offset */
+    offsetof(CloseStream, reason),
+    NULL,
+    &protobuf_c_empty_string,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+};
+static const unsigned close_stream__field_indices_by_name[] = {
+  0,   /* field[0] = reason */
+};
+static const ProtobufCIntRange close_stream__number_ranges[1 + 1] =
+{
+  { 1, 0 },
+  { 0, 1 }
+};
+const ProtobufCMessageDescriptor close_stream__descriptor =
+{
+  PROTOBUF_C__MESSAGE_DESCRIPTOR_MAGIC,
+  "CloseStream",
+  "CloseStream",
+  "CloseStream",
+  "",
+  sizeof(CloseStream),
+  1,
+  close_stream__field_descriptors,
+  close_stream__field_indices_by_name,
+  1,  close_stream__number_ranges,
+  (ProtobufCMessageInit) close_stream__init,
+  NULL,NULL,NULL    /* reserved[123] */
+};
+static const ProtobufCFieldDescriptor io_record__field_descriptors[3] =
+{
+  {
+    "iofd",
+    1,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_INT32,
+    0,   /* quantifier_offset */
+    offsetof(IoRecord, iofd),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "delay",
+    2,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_MESSAGE,
+    0,   /* quantifier_offset */
+    offsetof(IoRecord, delay),
+    &time_spec__descriptor,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "data",
+    3,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_BYTES,
+    0,   /* quantifier_offset */
+    offsetof(IoRecord, data),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+};
+static const unsigned io_record__field_indices_by_name[] = {
+  2,   /* field[2] = data */
+  1,   /* field[1] = delay */
+  0,   /* field[0] = iofd */
+};
+static const ProtobufCIntRange io_record__number_ranges[1 + 1] =
+{
+  { 1, 0 },
+  { 0, 3 }
+};
+const ProtobufCMessageDescriptor io_record__descriptor =
+{
+  PROTOBUF_C__MESSAGE_DESCRIPTOR_MAGIC,
+  "IoRecord",
+  "IoRecord",
+  "IoRecord",
+  "",
+  sizeof(IoRecord),
+  3,
+  io_record__field_descriptors,
+  io_record__field_indices_by_name,
+  1,  io_record__number_ranges,
+  (ProtobufCMessageInit) io_record__init,
+  NULL,NULL,NULL    /* reserved[123] */
+};
+static const ProtobufCFieldDescriptor io_buffer_batch__field_descriptors[1] =
+{
+  {
+    "records",
+    1,
+    PROTOBUF_C_LABEL_REPEATED,
+    PROTOBUF_C_TYPE_MESSAGE,
+    offsetof(IoBufferBatch, n_records),
+    offsetof(IoBufferBatch, records),
+    &io_record__descriptor,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+};
+static const unsigned io_buffer_batch__field_indices_by_name[] = {
+  0,   /* field[0] = records */
+};
+static const ProtobufCIntRange io_buffer_batch__number_ranges[1 + 1] =
+{
+  { 1, 0 },
+  { 0, 1 }
+};
+const ProtobufCMessageDescriptor io_buffer_batch__descriptor =
+{
+  PROTOBUF_C__MESSAGE_DESCRIPTOR_MAGIC,
+  "IoBufferBatch",
+  "IoBufferBatch",
+  "IoBufferBatch",
+  "",
+  sizeof(IoBufferBatch),
+  1,
+  io_buffer_batch__field_descriptors,
+  io_buffer_batch__field_indices_by_name,
+  1,  io_buffer_batch__number_ranges,
+  (ProtobufCMessageInit) io_buffer_batch__init,
+  NULL,NULL,NULL    /* reserved[123] */
+};
+static const ProtobufCFieldDescriptor server_message__field_descriptors[6] =
 {
   {
     "hello",
@@ -1659,6 +2012,18 @@ static const ProtobufCFieldDescriptor server_message__field_descriptors[5] =
     0 | PROTOBUF_C_FIELD_FLAG_ONEOF,             /* flags */
     0,NULL,NULL    /* reserved1,reserved2, etc */
   },
+  {
+    "stream_id",
+    6,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_UINT32,
+    0,   /* quantifier_offset */
+    offsetof(ServerMessage, stream_id),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
 };
 static const unsigned server_message__field_indices_by_name[] = {
   4,   /* field[4] = abort */
@@ -1666,11 +2031,12 @@ static const unsigned server_message__field_indices_by_name[] = {
   3,   /* field[3] = error */
   0,   /* field[0] = hello */
   2,   /* field[2] = log_id */
+  5,   /* field[5] = stream_id */
 };
 static const ProtobufCIntRange server_message__number_ranges[1 + 1] =
 {
   { 1, 0 },
-  { 0, 5 }
+  { 0, 6 }
 };
 const ProtobufCMessageDescriptor server_message__descriptor =
 {
@@ -1680,14 +2046,14 @@ const ProtobufCMessageDescriptor server_message__descriptor =
   "ServerMessage",
   "",
   sizeof(ServerMessage),
-  5,
+  6,
   server_message__field_descriptors,
   server_message__field_indices_by_name,
   1,  server_message__number_ranges,
   (ProtobufCMessageInit) server_message__init,
   NULL,NULL,NULL    /* reserved[123] */
 };
-static const ProtobufCFieldDescriptor server_hello__field_descriptors[4] =
+static const ProtobufCFieldDescriptor server_hello__field_descriptors[7] =
 {
   {
     "server_id",
@@ -1737,8 +2103,47 @@ static const ProtobufCFieldDescriptor server_hello__field_descriptors[4] =
     0,             /* flags */
     0,NULL,NULL    /* reserved1,reserved2, etc */
   },
+  {
+    "multiplex",
+    5,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_BOOL,
+    0,   /* quantifier_offset */
+    offsetof(ServerHello, multiplex),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "iobuf_batch",
+    6,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_BOOL,
+    0,   /* quantifier_offset */
+    offsetof(ServerHello, iobuf_batch),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "compression",
+    7,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_BOOL,
+    0,   /* quantifier_offset */
+    offsetof(ServerHello, compression),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
 };
 static const unsigned server_hello__field_indices_by_name[] = {
+  6,   /* field[6] = compression */
+  5,   /* field[5] = iobuf_batch */
+  4,   /* field[4] = multiplex */
   1,   /* field[1] = redirect */
   0,   /* field[0] = server_id */
   2,   /* field[2] = servers */
@@ -1747,7 +2152,7 @@ static const unsigned server_hello__field_indices_by_name[] = {
 static const ProtobufCIntRange server_hello__number_ranges[1 + 1] =
 {
   { 1, 0 },
-  { 0, 4 }
+  { 0, 7 }
 };
 const ProtobufCMessageDescriptor server_hello__descriptor =
 {
@@ -1757,7 +2162,7 @@ const ProtobufCMessageDescriptor server_hello__descriptor =
   "ServerHello",
   "",
   sizeof(ServerHello),
-  4,
+  7,
   server_hello__field_descriptors,
   server_hello__field_indices_by_name,
   1,  server_hello__number_ranges,
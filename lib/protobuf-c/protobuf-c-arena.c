@@ -0,0 +1,174 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Bump allocator for protobuf-c.  Unpacking a message results in
+ * one allocation per sub-message, string and bytes field.  When the
+ * message is only needed for a short time it is cheaper to carve
+ * those allocations out of a block that is recycled afterwards.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+
+#include "protobuf-c/protobuf-c-arena.h"
+
+/* All allocations are aligned to this boundary. */
+#define ARENA_ALIGN	16
+#define ARENA_ROUNDUP(n) (((n) + (ARENA_ALIGN - 1)) & ~((size_t)ARENA_ALIGN - 1))
+
+struct ProtobufCArenaBlock {
+	ProtobufCArenaBlock *next;
+	size_t size;		/* usable bytes following the header */
+	size_t used;
+};
+
+#define ARENA_HDR_SIZE	ARENA_ROUNDUP(sizeof(ProtobufCArenaBlock))
+
+static ProtobufCArenaBlock *
+arena_new_block(ProtobufCArena *arena, size_t size)
+{
+	ProtobufCArenaBlock *block;
+
+	if (size > (size_t)-1 - ARENA_HDR_SIZE)
+		return NULL;
+	if (arena->parent != NULL)
+		block = arena->parent->alloc(arena->parent->allocator_data,
+		    ARENA_HDR_SIZE + size);
+	else
+		block = malloc(ARENA_HDR_SIZE + size);
+	if (block != NULL) {
+		block->next = NULL;
+		block->size = size;
+		block->used = 0;
+	}
+	return block;
+}
+
+static void
+arena_free_block(ProtobufCArena *arena, ProtobufCArenaBlock *block)
+{
+	if (arena->parent != NULL)
+		arena->parent->free(arena->parent->allocator_data, block);
+	else
+		free(block);
+}
+
+static void *
+arena_alloc(void *allocator_data, size_t size)
+{
+	ProtobufCArena *arena = allocator_data;
+	ProtobufCArenaBlock *block = arena->blocks;
+
+	if (size > (size_t)-1 - ARENA_ALIGN)
+		return NULL;
+	size = ARENA_ROUNDUP(size);
+
+	if (block == NULL || block->size - block->used < size) {
+		if (size > arena->block_size / 2) {
+			/*
+			 * Large request, give it a block of its own but keep
+			 * allocating from the current block.
+			 */
+			ProtobufCArenaBlock *big = arena_new_block(arena, size);
+			if (big == NULL)
+				return NULL;
+			big->used = size;
+			if (block != NULL) {
+				big->next = block->next;
+				block->next = big;
+			} else {
+				arena->blocks = big;
+			}
+			return (char *)big + ARENA_HDR_SIZE;
+		}
+		block = arena_new_block(arena, arena->block_size);
+		if (block == NULL)
+			return NULL;
+		block->next = arena->blocks;
+		arena->blocks = block;
+	}
+
+	block->used += size;
+	return (char *)block + ARENA_HDR_SIZE + block->used - size;
+}
+
+static void
+arena_free(void *allocator_data, void *data)
+{
+	/* Memory is reclaimed by protobuf_c_arena_reset(). */
+	(void)allocator_data;
+	(void)data;
+}
+
+/*
+ * Initialize an arena.  A block_size of 0 selects the default.
+ * If parent is NULL, blocks are allocated via malloc(3).
+ */
+void
+protobuf_c_arena_init(ProtobufCArena *arena, size_t block_size,
+		      ProtobufCAllocator *parent)
+{
+	arena->base.alloc = arena_alloc;
+	arena->base.free = arena_free;
+	arena->base.allocator_data = arena;
+	arena->parent = parent;
+	arena->blocks = NULL;
+	arena->block_size = block_size ? ARENA_ROUNDUP(block_size) :
+	    PROTOBUF_C_ARENA_BLOCK_SIZE;
+}
+
+/*
+ * Release everything allocated from the arena.
+ * A single regular-sized block is kept for reuse.
+ */
+void
+protobuf_c_arena_reset(ProtobufCArena *arena)
+{
+	ProtobufCArenaBlock *block, *next, *keep = NULL;
+
+	for (block = arena->blocks; block != NULL; block = next) {
+		next = block->next;
+		if (keep == NULL && block->size == arena->block_size) {
+			keep = block;
+			continue;
+		}
+		arena_free_block(arena, block);
+	}
+	if (keep != NULL) {
+		keep->next = NULL;
+		keep->used = 0;
+	}
+	arena->blocks = keep;
+}
+
+/*
+ * Free all memory associated with the arena.
+ */
+void
+protobuf_c_arena_destroy(ProtobufCArena *arena)
+{
+	ProtobufCArenaBlock *block, *next;
+
+	for (block = arena->blocks; block != NULL; block = next) {
+		next = block->next;
+		arena_free_block(arena, block);
+	}
+	arena->blocks = NULL;
+}
@@ -25,6 +25,9 @@
 
 #include <sys/types.h>
 #include <sys/time.h>
+#ifdef HAVE_SIGNALFD
+# include <sys/signalfd.h>
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #ifdef HAVE_STDBOOL_H
@@ -89,6 +92,35 @@ sudo_ev_deactivate_all(struct sudo_event_base *base)
     debug_return;
 }
 
+/*
+ * Activate all signal events for signo, passing info to SUDO_EV_SIGINFO
+ * events.  If no siginfo is available, info should be NULL.
+ */
+static void
+sudo_ev_activate_signal(struct sudo_event_base *base, int signo,
+    const siginfo_t *info)
+{
+    struct sudo_event *ev;
+
+    TAILQ_FOREACH(ev, &base->signals[signo], entries) {
+	if (ISSET(ev->events, SUDO_EV_SIGINFO)) {
+	    struct sudo_ev_siginfo_container *sc = ev->closure;
+	    if (info == NULL) {
+		sc->siginfo = NULL;
+	    } else {
+		sc->siginfo = (siginfo_t *)sc->si_buf;
+		memcpy(sc->siginfo, info, sizeof(siginfo_t));
+	    }
+	}
+	/* Make event active (may already be active via the other path). */
+	ev->revents = ev->events & (SUDO_EV_SIGNAL|SUDO_EV_SIGINFO);
+	if (!ISSET(ev->flags, SUDO_EVQ_ACTIVE)) {
+	    TAILQ_INSERT_TAIL(&base->active, ev, active_entries);
+	    SET(ev->flags, SUDO_EVQ_ACTIVE);
+	}
+    }
+}
+
 /*
  * Activate all signal events for which the corresponding signal_pending[]
  * flag is set.
@@ -96,7 +128,6 @@ sudo_ev_deactivate_all(struct sudo_event_base *base)
 static void
 sudo_ev_activate_sigevents(struct sudo_event_base *base)
 {
-    struct sudo_event *ev;
     sigset_t set, oset;
     int i;
     debug_decl(sudo_ev_activate_sigevents, SUDO_DEBUG_EVENT);
@@ -112,22 +143,8 @@ sudo_ev_activate_sigevents(struct sudo_event_base *base)
 	if (!base->signal_pending[i])
 	    continue;
 	base->signal_pending[i] = 0;
-	TAILQ_FOREACH(ev, &base->signals[i], entries) {
-	    if (ISSET(ev->events, SUDO_EV_SIGINFO)) {
-		struct sudo_ev_siginfo_container *sc = ev->closure;
-		if (base->siginfo[i]->si_signo == 0) {
-		    /* No siginfo available. */
-		    sc->siginfo = NULL;
-		} else {
-		    sc->siginfo = (siginfo_t *)sc->si_buf;
-		    memcpy(sc->siginfo, base->siginfo[i], sizeof(siginfo_t));
-		}
-	    }
-	    /* Make event active. */
-	    ev->revents = ev->events & (SUDO_EV_SIGNAL|SUDO_EV_SIGINFO);
-	    TAILQ_INSERT_TAIL(&base->active, ev, active_entries);
-	    SET(ev->flags, SUDO_EVQ_ACTIVE);
-	}
+	sudo_ev_activate_signal(base, i,
+	    base->siginfo[i]->si_signo ? base->siginfo[i] : NULL);
     }
     sigprocmask(SIG_SETMASK, &oset, NULL);
 
@@ -165,6 +182,229 @@ signal_pipe_cb(int fd, int what, void *v)
     debug_return;
 }
 
+#ifdef HAVE_SIGNALFD
+/*
+ * Internal callback for signals delivered via signalfd.
+ * The siginfo is read directly, no signal handler is involved.
+ */
+static void
+signalfd_cb(int fd, int what, void *v)
+{
+    struct sudo_event_base *base = v;
+    struct signalfd_siginfo ssi[8];
+    ssize_t nread;
+    debug_decl(signalfd_cb, SUDO_DEBUG_EVENT);
+
+    while ((nread = read(fd, ssi, sizeof(ssi))) > 0) {
+	const size_t count = (size_t)nread / sizeof(ssi[0]);
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+	    const int signo = (int)ssi[i].ssi_signo;
+	    siginfo_t info;
+
+	    sudo_debug_printf(SUDO_DEBUG_INFO,
+		"%s: received signal %d", __func__, signo);
+	    if (signo <= 0 || signo >= NSIG)
+		continue;
+	    memset(&info, 0, sizeof(info));
+	    info.si_signo = signo;
+	    info.si_errno = ssi[i].ssi_errno;
+	    info.si_code = ssi[i].ssi_code;
+	    info.si_pid = (pid_t)ssi[i].ssi_pid;
+	    info.si_uid = (uid_t)ssi[i].ssi_uid;
+	    info.si_status = ssi[i].ssi_status;
+	    sudo_ev_activate_signal(base, signo, &info);
+	}
+    }
+    if (nread == -1 && errno != EAGAIN) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "%s: error reading from signalfd %d", __func__, fd);
+    }
+
+    debug_return;
+}
+
+/*
+ * Route signo through the base's signalfd.
+ * The signal handler remains installed; signals only reach the signalfd
+ * while they are blocked, which the event loop does while it is running.
+ * Any signal that arrives while unblocked still goes through the pipe.
+ */
+static void
+sudo_ev_signalfd_add(struct sudo_event_base *base, int signo)
+{
+    sigset_t mask = base->signalfd_mask;
+    int fd;
+    debug_decl(sudo_ev_signalfd_add, SUDO_DEBUG_EVENT);
+
+    sigaddset(&mask, signo);
+    fd = signalfd(base->signalfd, &mask, SFD_NONBLOCK|SFD_CLOEXEC);
+    if (fd == -1) {
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "%s: unable to add signal %d to signalfd", __func__, signo);
+	debug_return;
+    }
+    base->signalfd_mask = mask;
+    if (base->signalfd == -1) {
+	base->signalfd = fd;
+	sudo_ev_init(&base->signalfd_event, fd, SUDO_EV_READ|SUDO_EV_PERSIST,
+	    signalfd_cb, base);
+    }
+    if (!ISSET(base->signalfd_event.flags, SUDO_EVQ_INSERTED))
+	sudo_ev_add(base, &base->signalfd_event, NULL, true);
+    if (base->signalfd_blocked && !sigismember(&base->signalfd_omask, signo)) {
+	/* Already inside the event loop, block it now. */
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, signo);
+	sigprocmask(SIG_BLOCK, &set, NULL);
+    }
+
+    debug_return;
+}
+
+/*
+ * Stop routing signo through the base's signalfd.
+ */
+static void
+sudo_ev_signalfd_del(struct sudo_event_base *base, int signo)
+{
+    debug_decl(sudo_ev_signalfd_del, SUDO_DEBUG_EVENT);
+
+    if (base->signalfd == -1 || !sigismember(&base->signalfd_mask, signo))
+	debug_return;
+
+    sigdelset(&base->signalfd_mask, signo);
+    if (signalfd(base->signalfd, &base->signalfd_mask, 0) == -1) {
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "%s: unable to remove signal %d from signalfd", __func__, signo);
+    }
+    if (base->signalfd_blocked && !sigismember(&base->signalfd_omask, signo)) {
+	/* Deleted from inside the event loop, stop blocking it. */
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, signo);
+	sigprocmask(SIG_UNBLOCK, &set, NULL);
+    }
+    if (sigisemptyset(&base->signalfd_mask))
+	sudo_ev_del(base, &base->signalfd_event);
+
+    debug_return;
+}
+#endif /* HAVE_SIGNALFD */
+
+/*
+ * The timeouts are stored in a binary min-heap ordered by expiration
+ * time so that adding, removing or re-arming a timeout is O(log n).
+ * Each event stores its position in the heap in timeout_idx.
+ */
+static inline void
+timeout_heap_set(struct sudo_event_base *base, int idx, struct sudo_event *ev)
+{
+    base->timeouts[idx] = ev;
+    ev->timeout_idx = idx;
+}
+
+static void
+timeout_heap_sift_up(struct sudo_event_base *base, int idx)
+{
+    struct sudo_event *ev = base->timeouts[idx];
+
+    while (idx > 0) {
+	const int parent = (idx - 1) / 2;
+	if (!sudo_timespeccmp(&ev->timeout, &base->timeouts[parent]->timeout, <))
+	    break;
+	timeout_heap_set(base, idx, base->timeouts[parent]);
+	idx = parent;
+    }
+    timeout_heap_set(base, idx, ev);
+}
+
+static void
+timeout_heap_sift_down(struct sudo_event_base *base, int idx)
+{
+    struct sudo_event *ev = base->timeouts[idx];
+
+    for (;;) {
+	int child = (idx * 2) + 1;
+	if (child >= base->timeouts_len)
+	    break;
+	if (child + 1 < base->timeouts_len &&
+		sudo_timespeccmp(&base->timeouts[child + 1]->timeout,
+		&base->timeouts[child]->timeout, <))
+	    child++;
+	if (!sudo_timespeccmp(&base->timeouts[child]->timeout, &ev->timeout, <))
+	    break;
+	timeout_heap_set(base, idx, base->timeouts[child]);
+	idx = child;
+    }
+    timeout_heap_set(base, idx, ev);
+}
+
+/*
+ * Make sure there is room for one more event in the timeouts heap.
+ */
+static int
+timeout_heap_reserve(struct sudo_event_base *base)
+{
+    struct sudo_event **timeouts;
+    int new_max;
+    debug_decl(timeout_heap_reserve, SUDO_DEBUG_EVENT);
+
+    if (base->timeouts_len < base->timeouts_max)
+	debug_return_int(0);
+
+    new_max = base->timeouts_max ? base->timeouts_max * 2 : 32;
+    timeouts = reallocarray(base->timeouts, new_max, sizeof(*timeouts));
+    if (timeouts == NULL) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "%s: unable to grow timeouts heap to %d", __func__, new_max);
+	debug_return_int(-1);
+    }
+    base->timeouts = timeouts;
+    base->timeouts_max = new_max;
+    debug_return_int(0);
+}
+
+/*
+ * Insert ev into the timeouts heap, or reposition it if already present.
+ * The caller must have reserved space via timeout_heap_reserve().
+ */
+static void
+timeout_heap_update(struct sudo_event_base *base, struct sudo_event *ev)
+{
+    int idx = ev->timeout_idx;
+
+    if (!ISSET(ev->flags, SUDO_EVQ_TIMEOUTS)) {
+	idx = base->timeouts_len++;
+	timeout_heap_set(base, idx, ev);
+	SET(ev->flags, SUDO_EVQ_TIMEOUTS);
+    }
+    timeout_heap_sift_up(base, idx);
+    timeout_heap_sift_down(base, ev->timeout_idx);
+}
+
+/*
+ * Remove ev from the timeouts heap.
+ */
+static void
+timeout_heap_remove(struct sudo_event_base *base, struct sudo_event *ev)
+{
+    const int idx = ev->timeout_idx;
+    struct sudo_event *last;
+
+    CLR(ev->flags, SUDO_EVQ_TIMEOUTS);
+    ev->timeout_idx = -1;
+    last = base->timeouts[--base->timeouts_len];
+    if (last != ev) {
+	/* Move the last element into the hole and restore heap order. */
+	timeout_heap_set(base, idx, last);
+	timeout_heap_sift_up(base, idx);
+	timeout_heap_sift_down(base, last->timeout_idx);
+    }
+}
+
 static int
 sudo_ev_base_init(struct sudo_event_base *base)
 {
@@ -172,9 +412,12 @@ sudo_ev_base_init(struct sudo_event_base *base)
     debug_decl(sudo_ev_base_init, SUDO_DEBUG_EVENT);
 
     TAILQ_INIT(&base->events);
-    TAILQ_INIT(&base->timeouts);
     for (i = 0; i < NSIG; i++)
 	TAILQ_INIT(&base->signals[i]);
+#ifdef HAVE_SIGNALFD
+    sigemptyset(&base->signalfd_mask);
+    base->signalfd = -1;
+#endif
     if (sudo_ev_base_alloc_impl(base) != 0) {
 	sudo_debug_printf(SUDO_DEBUG_ERROR,
 	    "%s: unable to allocate impl base", __func__);
@@ -197,6 +440,12 @@ bad:
 
 struct sudo_event_base *
 sudo_ev_base_alloc_v1(void)
+{
+    return sudo_ev_base_alloc_v2(0);
+}
+
+struct sudo_event_base *
+sudo_ev_base_alloc_v2(unsigned int options)
 {
     struct sudo_event_base *base;
     debug_decl(sudo_ev_base_alloc, SUDO_DEBUG_EVENT);
@@ -207,6 +456,7 @@ sudo_ev_base_alloc_v1(void)
 	    "%s: unable to allocate base", __func__);
 	debug_return_ptr(NULL);
     }
+    base->options = options;
     if (sudo_ev_base_init(base) != 0) {
 	free(base);
 	debug_return_ptr(NULL);
@@ -242,6 +492,11 @@ sudo_ev_base_free_v1(struct sudo_event_base *base)
 	free(base->orig_handlers[i]);
     }
     sudo_ev_base_free_impl(base);
+    free(base->timeouts);
+#ifdef HAVE_SIGNALFD
+    if (base->signalfd != -1)
+	close(base->signalfd);
+#endif
     close(base->signal_pipe[0]);
     close(base->signal_pipe[1]);
     free(base);
@@ -272,6 +527,7 @@ sudo_ev_init(struct sudo_event *ev, int fd, short events,
     ev->fd = fd;
     ev->events = events & SUDO_EV_MASK;
     ev->pfd_idx = -1;
+    ev->timeout_idx = -1;
     ev->callback = callback;
     ev->closure = closure;
 
@@ -441,6 +697,12 @@ sudo_ev_add_signal(struct sudo_event_base *base, struct sudo_event *ev,
     if (!ISSET(base->signal_event.flags, SUDO_EVQ_INSERTED))
 	sudo_ev_add(base, &base->signal_event, NULL, true);
 
+#ifdef HAVE_SIGNALFD
+    /* Deliver via signalfd too if requested, falls back to the pipe. */
+    if (ISSET(base->options, SUDO_EVBASE_OPT_SIGNALFD))
+	sudo_ev_signalfd_add(base, signo);
+#endif
+
     /* Update global signal base so handler to update signals_pending[] */
     signal_base = base;
 
@@ -480,14 +742,19 @@ sudo_ev_add_v2(struct sudo_event_base *base, struct sudo_event *ev,
 	}
     }
 
+    /* Make sure we can add a timeout before modifying the base. */
+    if (timo != NULL && !ISSET(ev->flags, SUDO_EVQ_TIMEOUTS)) {
+	if (timeout_heap_reserve(base) != 0)
+	    debug_return_int(-1);
+    }
+
     /* Only add new events to the events list. */
     if (ISSET(ev->flags, SUDO_EVQ_INSERTED)) {
-	/* If event no longer has a timeout, remove from timeouts queue. */
+	/* If event no longer has a timeout, remove from timeouts heap. */
 	if (timo == NULL && ISSET(ev->flags, SUDO_EVQ_TIMEOUTS)) {
 	    sudo_debug_printf(SUDO_DEBUG_INFO,
-		"%s: removing event %p from timeouts queue", __func__, ev);
-	    CLR(ev->flags, SUDO_EVQ_TIMEOUTS);
-	    TAILQ_REMOVE(&base->timeouts, ev, timeouts_entries);
+		"%s: removing event %p from timeouts heap", __func__, ev);
+	    timeout_heap_remove(base, ev);
 	}
     } else {
 	/* Special handling for signal events. */
@@ -512,24 +779,10 @@ sudo_ev_add_v2(struct sudo_event_base *base, struct sudo_event *ev,
     }
     /* Timeouts can be changed for existing events. */
     if (timo != NULL) {
-	struct sudo_event *evtmp;
-	if (ISSET(ev->flags, SUDO_EVQ_TIMEOUTS)) {
-	    /* Remove from timeouts list, then add back. */
-	    TAILQ_REMOVE(&base->timeouts, ev, timeouts_entries);
-	}
-	/* Convert to absolute time and insert in sorted order; O(n). */
+	/* Convert to absolute time and insert in the heap; O(log n). */
 	sudo_gettime_mono(&ev->timeout);
 	sudo_timespecadd(&ev->timeout, timo, &ev->timeout);
-	TAILQ_FOREACH(evtmp, &base->timeouts, timeouts_entries) {
-	    if (sudo_timespeccmp(&ev->timeout, &evtmp->timeout, <))
-		break;
-	}
-	if (evtmp != NULL) {
-	    TAILQ_INSERT_BEFORE(evtmp, ev, timeouts_entries);
-	} else {
-	    TAILQ_INSERT_TAIL(&base->timeouts, ev, timeouts_entries);
-	}
-	SET(ev->flags, SUDO_EVQ_TIMEOUTS);
+	timeout_heap_update(base, ev);
     }
     debug_return_int(0);
 }
@@ -581,6 +834,9 @@ sudo_ev_del_v1(struct sudo_event_base *base, struct sudo_event *ev)
 		debug_return_int(-1);
 	    }
 	    base->num_handlers--;
+#ifdef HAVE_SIGNALFD
+	    sudo_ev_signalfd_del(base, signo);
+#endif
 	}
 	if (base->num_handlers == 0) {
 	    /* No registered signal events, remove internal event. */
@@ -600,9 +856,9 @@ sudo_ev_del_v1(struct sudo_event_base *base, struct sudo_event *ev)
 	/* Unlink from event list. */
 	TAILQ_REMOVE(&base->events, ev, entries);
 
-	/* Unlink from timeouts list. */
+	/* Remove from timeouts heap. */
 	if (ISSET(ev->flags, SUDO_EVQ_TIMEOUTS))
-	    TAILQ_REMOVE(&base->timeouts, ev, timeouts_entries);
+	    timeout_heap_remove(base, ev);
     }
 
     /* Unlink from active list. */
@@ -632,6 +888,9 @@ sudo_ev_loop_v1(struct sudo_event_base *base, int flags)
     struct timespec now;
     struct sudo_event *ev;
     int nready, rc = 0;
+#ifdef HAVE_SIGNALFD
+    bool unblock = false;
+#endif
     debug_decl(sudo_ev_loop, SUDO_DEBUG_EVENT);
 
     /*
@@ -643,6 +902,20 @@ sudo_ev_loop_v1(struct sudo_event_base *base, int flags)
     base->flags |= (flags & SUDO_EVLOOP_ONCE);
     base->flags &= (SUDO_EVBASE_LOOPEXIT|SUDO_EVBASE_LOOPONCE);
 
+#ifdef HAVE_SIGNALFD
+    /*
+     * Signals routed through signalfd must be blocked to reach it.
+     * We only block them while the loop is running (the caller may
+     * have changed the signal mask since they were added) and restore
+     * the original mask on return so it is not inherited by children.
+     */
+    if (base->signalfd != -1 && !base->signalfd_blocked) {
+	if (sigprocmask(SIG_BLOCK, &base->signalfd_mask, &base->signalfd_omask) == 0)
+	    base->signalfd_blocked = true;
+	unblock = base->signalfd_blocked;
+    }
+#endif
+
     for (;;) {
 rescan:
 	/* Make sure we have some events. */
@@ -671,12 +944,11 @@ rescan:
 	case 0:
 	    /* Timed out, activate timeout events. */
 	    sudo_gettime_mono(&now);
-	    while ((ev = TAILQ_FIRST(&base->timeouts)) != NULL) {
+	    while ((ev = sudo_ev_first_timeout(base)) != NULL) {
 		if (sudo_timespeccmp(&ev->timeout, &now, >))
 		    break;
-		/* Remove from timeouts list. */
-		CLR(ev->flags, SUDO_EVQ_TIMEOUTS);
-		TAILQ_REMOVE(&base->timeouts, ev, timeouts_entries);
+		/* Remove from timeouts heap. */
+		timeout_heap_remove(base, ev);
 		/* Make event active. */
 		ev->revents = SUDO_EV_TIMEOUT;
 		TAILQ_INSERT_TAIL(&base->active, ev, active_entries);
@@ -729,6 +1001,12 @@ rescan:
 	}
     }
 done:
+#ifdef HAVE_SIGNALFD
+    if (unblock) {
+	sigprocmask(SIG_SETMASK, &base->signalfd_omask, NULL);
+	base->signalfd_blocked = false;
+    }
+#endif
     base->flags &= SUDO_EVBASE_GOT_MASK;
     debug_return_int(rc);
 }
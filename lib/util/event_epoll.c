@@ -0,0 +1,487 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * This is an open source non-commercial project. Dear PVS-Studio, please check it.
+ * PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+ */
+
+#include <config.h>
+
+#include <sys/epoll.h>
+
+#include <stdlib.h>
+#ifdef HAVE_STDBOOL_H
+# include <stdbool.h>
+#else
+# include "compat/stdbool.h"
+#endif /* HAVE_STDBOOL_H */
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sudo_compat.h"
+#include "sudo_util.h"
+#include "sudo_fatal.h"
+#include "sudo_debug.h"
+#include "sudo_event.h"
+
+/*
+ * Per-fd state.  More than one event may refer to the same fd
+ * (e.g. separate read and write events for a socket) but epoll
+ * only lets us register an fd once, so we track the union of
+ * the requested events here.
+ */
+struct sudo_ev_epoll_fd {
+    struct sudo_event_list events;	/* events using this fd */
+    unsigned int registered;		/* EPOLL* flags in the kernel set */
+    int ready_idx;			/* index into ep_ready[] or -1 */
+};
+
+int
+sudo_ev_base_alloc_impl(struct sudo_event_base *base)
+{
+    debug_decl(sudo_ev_base_alloc_impl, SUDO_DEBUG_EVENT);
+
+    base->ep_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (base->ep_fd == -1) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "%s: unable to create epoll instance", __func__);
+	debug_return_int(-1);
+    }
+    base->ep_pid = getpid();
+    base->ep_nevents = 32;
+    base->ep_events = reallocarray(NULL, base->ep_nevents,
+	sizeof(struct epoll_event));
+    if (base->ep_events == NULL) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "%s: unable to allocate %d epoll events", __func__,
+	    base->ep_nevents);
+	close(base->ep_fd);
+	base->ep_fd = -1;
+	base->ep_nevents = 0;
+	debug_return_int(-1);
+    }
+
+    debug_return_int(0);
+}
+
+void
+sudo_ev_base_free_impl(struct sudo_event_base *base)
+{
+    int i;
+    debug_decl(sudo_ev_base_free_impl, SUDO_DEBUG_EVENT);
+
+    for (i = 0; i < base->ep_fds_max; i++)
+	free(base->ep_fds[i]);
+    free(base->ep_fds);
+    free(base->ep_events);
+    free(base->ep_ready);
+    if (base->ep_fd != -1)
+	close(base->ep_fd);
+    debug_return;
+}
+
+/*
+ * Compute the set of EPOLL* flags needed for the events on an fd.
+ * Edge-triggered mode is only used if all events on the fd request it.
+ */
+static unsigned int
+sudo_ev_epoll_mask(struct sudo_ev_epoll_fd *epfd)
+{
+    struct sudo_event *ev;
+    unsigned int mask = 0;
+    bool edge = true;
+
+    TAILQ_FOREACH(ev, &epfd->events, fd_entries) {
+	if (ISSET(ev->events, SUDO_EV_READ))
+	    mask |= EPOLLIN;
+	if (ISSET(ev->events, SUDO_EV_WRITE))
+	    mask |= EPOLLOUT;
+	if (!ISSET(ev->events, SUDO_EV_ET))
+	    edge = false;
+    }
+    if (mask != 0 && edge)
+	mask |= EPOLLET;
+    return mask;
+}
+
+/*
+ * Add fd to the list of fds that epoll cannot monitor.
+ */
+static int
+sudo_ev_epoll_ready_add(struct sudo_event_base *base, int fd,
+    struct sudo_ev_epoll_fd *epfd)
+{
+    debug_decl(sudo_ev_epoll_ready_add, SUDO_DEBUG_EVENT);
+
+    if (base->ep_nready == base->ep_ready_max) {
+	int new_max = base->ep_ready_max ? base->ep_ready_max * 2 : 8;
+	int *ready = reallocarray(base->ep_ready, new_max, sizeof(int));
+	if (ready == NULL) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"%s: unable to allocate %d ready fds", __func__, new_max);
+	    debug_return_int(-1);
+	}
+	base->ep_ready = ready;
+	base->ep_ready_max = new_max;
+    }
+    epfd->ready_idx = base->ep_nready;
+    base->ep_ready[base->ep_nready++] = fd;
+
+    debug_return_int(0);
+}
+
+/*
+ * Remove fd from the list of fds that epoll cannot monitor.
+ */
+static void
+sudo_ev_epoll_ready_del(struct sudo_event_base *base,
+    struct sudo_ev_epoll_fd *epfd)
+{
+    const int idx = epfd->ready_idx;
+    debug_decl(sudo_ev_epoll_ready_del, SUDO_DEBUG_EVENT);
+
+    /* Move last entry into the hole. */
+    if (--base->ep_nready != idx) {
+	const int lastfd = base->ep_ready[base->ep_nready];
+	base->ep_ready[idx] = lastfd;
+	base->ep_fds[lastfd]->ready_idx = idx;
+    }
+    epfd->ready_idx = -1;
+
+    debug_return;
+}
+
+/*
+ * Sync the kernel's view of fd with the events we have for it.
+ * Regular files (and some devices) are not supported by epoll;
+ * we treat those as always ready, which matches poll(2) semantics.
+ */
+static int
+sudo_ev_epoll_update(struct sudo_event_base *base, int fd,
+    struct sudo_ev_epoll_fd *epfd)
+{
+    const unsigned int mask = sudo_ev_epoll_mask(epfd);
+    struct epoll_event event;
+    int op;
+    debug_decl(sudo_ev_epoll_update, SUDO_DEBUG_EVENT);
+
+    if (epfd->ready_idx != -1) {
+	/* Not in the kernel set. */
+	if (mask == 0)
+	    sudo_ev_epoll_ready_del(base, epfd);
+	debug_return_int(0);
+    }
+    if (mask == epfd->registered)
+	debug_return_int(0);
+
+    memset(&event, 0, sizeof(event));
+    event.events = mask;
+    event.data.fd = fd;
+    if (mask == 0) {
+	op = EPOLL_CTL_DEL;
+    } else if (epfd->registered == 0) {
+	op = EPOLL_CTL_ADD;
+    } else {
+	op = EPOLL_CTL_MOD;
+    }
+    if (epoll_ctl(base->ep_fd, op, fd, &event) == -1) {
+	switch (errno) {
+	case EPERM:
+	    /* File type not supported by epoll, always ready. */
+	    if (op == EPOLL_CTL_ADD) {
+		sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+		    "%s: fd %d not pollable, treating as ready", __func__, fd);
+		if (sudo_ev_epoll_ready_add(base, fd, epfd) != 0)
+		    debug_return_int(-1);
+		debug_return_int(0);
+	    }
+	    break;
+	case ENOENT:
+	    /* The fd was closed and reused behind our back. */
+	    if (op == EPOLL_CTL_MOD) {
+		op = EPOLL_CTL_ADD;
+		if (epoll_ctl(base->ep_fd, op, fd, &event) == 0)
+		    goto done;
+	    } else if (op == EPOLL_CTL_DEL) {
+		goto done;
+	    }
+	    break;
+	case EEXIST:
+	    if (op == EPOLL_CTL_ADD) {
+		op = EPOLL_CTL_MOD;
+		if (epoll_ctl(base->ep_fd, op, fd, &event) == 0)
+		    goto done;
+	    }
+	    break;
+	case EBADF:
+	    /*
+	     * A closed fd is removed from the epoll set automatically.
+	     * This happens when one of several events on an fd is
+	     * deleted after the fd has been closed.
+	     */
+	    if (op != EPOLL_CTL_ADD) {
+		if (epfd->registered != 0)
+		    base->ep_nfds--;
+		epfd->registered = 0;
+		debug_return_int(0);
+	    }
+	    break;
+	}
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "%s: epoll_ctl(%d, %d, 0x%x)", __func__, op, fd, mask);
+	debug_return_int(-1);
+    }
+done:
+    if (epfd->registered == 0 && mask != 0)
+	base->ep_nfds++;
+    else if (epfd->registered != 0 && mask == 0)
+	base->ep_nfds--;
+    epfd->registered = mask;
+
+    debug_return_int(0);
+}
+
+/*
+ * An epoll instance is shared with any child process after fork(2).
+ * If we are not the process that created it, create a new one so we
+ * don't modify the parent's epoll set out from under it.
+ */
+static int
+sudo_ev_epoll_check_fork(struct sudo_event_base *base)
+{
+    int fd;
+    debug_decl(sudo_ev_epoll_check_fork, SUDO_DEBUG_EVENT);
+
+    if (base->ep_pid == getpid())
+	debug_return_int(0);
+
+    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	"%s: forked, re-creating epoll instance", __func__);
+    close(base->ep_fd);
+    base->ep_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (base->ep_fd == -1) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "%s: unable to create epoll instance", __func__);
+	debug_return_int(-1);
+    }
+    base->ep_pid = getpid();
+    base->ep_nfds = 0;
+    for (fd = 0; fd < base->ep_fds_max; fd++) {
+	struct sudo_ev_epoll_fd *epfd = base->ep_fds[fd];
+	if (epfd == NULL || epfd->ready_idx != -1)
+	    continue;
+	epfd->registered = 0;
+	if (sudo_ev_epoll_update(base, fd, epfd) != 0)
+	    debug_return_int(-1);
+    }
+    debug_return_int(0);
+}
+
+int
+sudo_ev_add_impl(struct sudo_event_base *base, struct sudo_event *ev)
+{
+    struct sudo_ev_epoll_fd *epfd;
+    const int fd = ev->fd;
+    debug_decl(sudo_ev_add_impl, SUDO_DEBUG_EVENT);
+
+    if (fd < 0) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "%s: invalid fd %d", __func__, fd);
+	debug_return_int(-1);
+    }
+    if (sudo_ev_epoll_check_fork(base) != 0)
+	debug_return_int(-1);
+
+    /* If fd is out of range of the ep_fds array, realloc. */
+    if (fd >= base->ep_fds_max) {
+	struct sudo_ev_epoll_fd **ep_fds;
+	int new_max = base->ep_fds_max ? base->ep_fds_max : 32;
+
+	while (fd >= new_max)
+	    new_max *= 2;
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	    "%s: ep_fds_max %d -> %d", __func__, base->ep_fds_max, new_max);
+	ep_fds = reallocarray(base->ep_fds, new_max, sizeof(*ep_fds));
+	if (ep_fds == NULL) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"%s: unable to allocate %d fd slots", __func__, new_max);
+	    debug_return_int(-1);
+	}
+	memset(ep_fds + base->ep_fds_max, 0,
+	    (new_max - base->ep_fds_max) * sizeof(*ep_fds));
+	base->ep_fds = ep_fds;
+	base->ep_fds_max = new_max;
+    }
+    if ((epfd = base->ep_fds[fd]) == NULL) {
+	epfd = malloc(sizeof(*epfd));
+	if (epfd == NULL) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"%s: unable to allocate state for fd %d", __func__, fd);
+	    debug_return_int(-1);
+	}
+	TAILQ_INIT(&epfd->events);
+	epfd->registered = 0;
+	epfd->ready_idx = -1;
+	base->ep_fds[fd] = epfd;
+    }
+
+    TAILQ_INSERT_TAIL(&epfd->events, ev, fd_entries);
+    if (sudo_ev_epoll_update(base, fd, epfd) != 0) {
+	TAILQ_REMOVE(&epfd->events, ev, fd_entries);
+	debug_return_int(-1);
+    }
+
+    /* Make sure we can return an event for every fd in the set. */
+    if (base->ep_nfds > base->ep_nevents) {
+	struct epoll_event *events;
+	const int new_max = base->ep_nevents * 2;
+
+	events = reallocarray(base->ep_events, new_max, sizeof(*events));
+	if (events != NULL) {
+	    base->ep_events = events;
+	    base->ep_nevents = new_max;
+	}
+	/* Not fatal, remaining events are returned by the next epoll_wait. */
+    }
+
+    debug_return_int(0);
+}
+
+int
+sudo_ev_del_impl(struct sudo_event_base *base, struct sudo_event *ev)
+{
+    struct sudo_ev_epoll_fd *epfd;
+    const int fd = ev->fd;
+    debug_decl(sudo_ev_del_impl, SUDO_DEBUG_EVENT);
+
+    if (fd < 0 || fd >= base->ep_fds_max || base->ep_fds[fd] == NULL) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "%s: fd %d not in event base", __func__, fd);
+	debug_return_int(-1);
+    }
+    epfd = base->ep_fds[fd];
+    TAILQ_REMOVE(&epfd->events, ev, fd_entries);
+
+    if (base->ep_pid != getpid()) {
+	/* Don't modify the parent's epoll set, see check_fork(). */
+	if (TAILQ_EMPTY(&epfd->events) && epfd->ready_idx != -1)
+	    sudo_ev_epoll_ready_del(base, epfd);
+	debug_return_int(0);
+    }
+
+    if (sudo_ev_epoll_update(base, fd, epfd) != 0)
+	debug_return_int(-1);
+
+    debug_return_int(0);
+}
+
+/*
+ * Activate the events on fd that match revents.
+ */
+static int
+sudo_ev_epoll_activate(struct sudo_event_base *base,
+    struct sudo_ev_epoll_fd *epfd, unsigned int revents)
+{
+    struct sudo_event *ev;
+    int nactive = 0;
+    debug_decl(sudo_ev_epoll_activate, SUDO_DEBUG_EVENT);
+
+    TAILQ_FOREACH(ev, &epfd->events, fd_entries) {
+	int what = 0;
+	if (revents & (EPOLLIN|EPOLLHUP|EPOLLERR))
+	    what |= (ev->events & SUDO_EV_READ);
+	if (revents & (EPOLLOUT|EPOLLHUP|EPOLLERR))
+	    what |= (ev->events & SUDO_EV_WRITE);
+	if (what == 0)
+	    continue;
+	/* Make event active. */
+	sudo_debug_printf(SUDO_DEBUG_DEBUG,
+	    "%s: polled fd %d, events %d, activating %p",
+	    __func__, ev->fd, what, ev);
+	ev->revents = what;
+	sudo_ev_activate(base, ev);
+	nactive++;
+    }
+
+    debug_return_int(nactive);
+}
+
+int
+sudo_ev_scan_impl(struct sudo_event_base *base, int flags)
+{
+    struct timespec now, ts;
+    struct sudo_event *ev;
+    int i, nready, nactive = 0, timeout;
+    debug_decl(sudo_ev_scan_impl, SUDO_DEBUG_EVENT);
+
+    if (sudo_ev_epoll_check_fork(base) != 0)
+	debug_return_int(-1);
+
+    if (base->ep_nready != 0 || ISSET(flags, SUDO_EVLOOP_NONBLOCK)) {
+	timeout = 0;
+    } else if ((ev = sudo_ev_first_timeout(base)) != NULL) {
+	sudo_gettime_mono(&now);
+	sudo_timespecsub(&ev->timeout, &now, &ts);
+	if (ts.tv_sec < 0) {
+	    timeout = 0;
+	} else if (ts.tv_sec >= INT_MAX / 1000) {
+	    timeout = INT_MAX;
+	} else {
+	    /* Round up so we don't wake before the timeout expires. */
+	    timeout = (ts.tv_sec * 1000) + ((ts.tv_nsec + 999999) / 1000000);
+	}
+    } else {
+	timeout = -1;
+    }
+
+    nready = epoll_wait(base->ep_fd, base->ep_events, base->ep_nevents,
+	timeout);
+    if (nready == -1) {
+	/* Error: EINTR (signal) or EINVAL */
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "epoll_wait");
+	debug_return_int(-1);
+    }
+    sudo_debug_printf(SUDO_DEBUG_INFO, "%s: %d fds ready, %d always ready",
+	__func__, nready, base->ep_nready);
+
+    /* Activate each I/O event that fired. */
+    for (i = 0; i < nready; i++) {
+	const int fd = base->ep_events[i].data.fd;
+	if (fd < base->ep_fds_max && base->ep_fds[fd] != NULL) {
+	    nactive += sudo_ev_epoll_activate(base, base->ep_fds[fd],
+		base->ep_events[i].events);
+	}
+    }
+
+    /* Activate events for fds that epoll cannot monitor. */
+    for (i = 0; i < base->ep_nready; i++) {
+	nactive += sudo_ev_epoll_activate(base,
+	    base->ep_fds[base->ep_ready[i]], EPOLLIN|EPOLLOUT);
+    }
+
+    if (nactive == 0) {
+	/* Front end will activate timeout events. */
+	sudo_debug_printf(SUDO_DEBUG_INFO, "%s: timeout", __func__);
+    }
+    debug_return_int(nactive);
+}
@@ -0,0 +1,590 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SUDO_ERROR_WRAP 0
+
+#include "sudo_compat.h"
+#include "sudo_fatal.h"
+#include "sudo_util.h"
+#include "sudo_event.h"
+
+sudo_dso_public int main(int argc, char *argv[]);
+
+/*
+ * Drive the event loop with a large number of descriptors and make
+ * sure exactly the ready ones are activated.  Each socketpair end
+ * has its own read event; writing to one end wakes up the other.
+ * With -v, the time per loop iteration is compared to a plain poll(2)
+ * over the same descriptors.
+ */
+
+struct test_fd {
+    struct sudo_event *ev;
+    int fd;
+    int peer;
+    int fired;
+};
+
+static int verbose;
+
+static void
+read_cb(int fd, int what, void *v)
+{
+    struct test_fd *tfd = v;
+    char ch;
+
+    if (read(fd, &ch, 1) == 1)
+	tfd->fired++;
+}
+
+static void
+count_cb(int fd, int what, void *v)
+{
+    int *counter = v;
+
+    (*counter)++;
+}
+
+static double
+elapsed(const struct timespec *start)
+{
+    struct timespec now, diff;
+
+    sudo_gettime_mono(&now);
+    sudo_timespecsub(&now, start, &diff);
+    return diff.tv_sec + diff.tv_nsec / 1000000000.0;
+}
+
+/*
+ * Wake every stride'th fd, run the loop once and verify that exactly
+ * those fds fired.
+ */
+static int
+check_round(struct sudo_event_base *base, struct test_fd *fds, int nfds,
+    int stride, int offset)
+{
+    int i, errors = 0;
+
+    for (i = 0; i < nfds; i++)
+	fds[i].fired = 0;
+    for (i = offset; i < nfds; i += stride) {
+	if (write(fds[i].peer, "x", 1) != 1)
+	    sudo_fatal("write");
+    }
+    if (sudo_ev_loop(base, SUDO_EVLOOP_ONCE) != 0) {
+	sudo_warnx_nodebug("FAIL: sudo_ev_loop returned error");
+	return 1;
+    }
+    for (i = 0; i < nfds; i++) {
+	const int expected = (i >= offset && (i - offset) % stride == 0);
+	if (fds[i].fired != expected) {
+	    if (errors++ < 10) {
+		sudo_warnx_nodebug("FAIL: fd %d fired %d times, expected %d",
+		    fds[i].fd, fds[i].fired, expected);
+	    }
+	}
+    }
+    return errors != 0;
+}
+
+/*
+ * A read and a write event on the same fd must both be delivered.
+ * Regular files are always ready, even for backends that can't poll them.
+ */
+static int
+check_special(struct sudo_event_base *base, struct test_fd *tfd)
+{
+    struct sudo_event *wev, *fev;
+    int nwrite = 0, nfile = 0, errors = 0;
+    int fd;
+
+    if ((fd = open("/dev/null", O_RDONLY)) == -1)
+	sudo_fatal("/dev/null");
+    wev = sudo_ev_alloc(tfd->fd, SUDO_EV_WRITE, count_cb, &nwrite);
+    fev = sudo_ev_alloc(fd, SUDO_EV_READ, count_cb, &nfile);
+    if (wev == NULL || fev == NULL)
+	sudo_fatalx("unable to allocate events");
+    if (sudo_ev_add(base, wev, NULL, false) == -1 ||
+	    sudo_ev_add(base, fev, NULL, false) == -1)
+	sudo_fatalx("unable to add events");
+
+    tfd->fired = 0;
+    if (write(tfd->peer, "x", 1) != 1)
+	sudo_fatal("write");
+    if (sudo_ev_loop(base, SUDO_EVLOOP_ONCE) != 0) {
+	sudo_warnx_nodebug("FAIL: sudo_ev_loop returned error");
+	errors++;
+    }
+    if (tfd->fired != 1) {
+	sudo_warnx_nodebug("FAIL: shared fd read event fired %d times",
+	    tfd->fired);
+	errors++;
+    }
+    if (nwrite != 1) {
+	sudo_warnx_nodebug("FAIL: shared fd write event fired %d times",
+	    nwrite);
+	errors++;
+    }
+    if (nfile != 1) {
+	sudo_warnx_nodebug("FAIL: /dev/null read event fired %d times", nfile);
+	errors++;
+    }
+
+    /* Removing the write event must leave the read event intact. */
+    sudo_ev_free(wev);
+    sudo_ev_free(fev);
+    close(fd);
+    tfd->fired = 0;
+    if (write(tfd->peer, "x", 1) != 1)
+	sudo_fatal("write");
+    if (sudo_ev_loop(base, SUDO_EVLOOP_ONCE) != 0 || tfd->fired != 1) {
+	sudo_warnx_nodebug("FAIL: read event lost after deleting write event");
+	errors++;
+    }
+
+    return errors;
+}
+
+/*
+ * Deleting events after their fd has been closed must succeed,
+ * even when other events on that fd are still in the queue.
+ */
+static int
+check_closed(struct sudo_event_base *base)
+{
+    struct sudo_event *rev, *wev;
+    int sv[2], nread = 0, nwrite = 0, errors = 0;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+	sudo_fatal("socketpair");
+    rev = sudo_ev_alloc(sv[0], SUDO_EV_READ, count_cb, &nread);
+    wev = sudo_ev_alloc(sv[0], SUDO_EV_WRITE, count_cb, &nwrite);
+    if (rev == NULL || wev == NULL)
+	sudo_fatalx("unable to allocate events");
+    if (sudo_ev_add(base, rev, NULL, false) == -1 ||
+	    sudo_ev_add(base, wev, NULL, false) == -1)
+	sudo_fatalx("unable to add events");
+
+    close(sv[0]);
+    close(sv[1]);
+    if (sudo_ev_del(base, rev) != 0) {
+	sudo_warnx_nodebug("FAIL: unable to delete read event on closed fd");
+	errors++;
+    }
+    if (sudo_ev_del(base, wev) != 0) {
+	sudo_warnx_nodebug("FAIL: unable to delete write event on closed fd");
+	errors++;
+    }
+    sudo_ev_free(rev);
+    sudo_ev_free(wev);
+
+    return errors;
+}
+
+struct test_timeout {
+    struct sudo_event *ev;
+    struct timespec deadline;
+    int fired;
+};
+
+static struct timespec last_deadline;
+static int timeout_errors;
+
+static void
+timeout_cb(int fd, int what, void *v)
+{
+    struct test_timeout *tt = v;
+
+    if (what != SUDO_EV_TIMEOUT) {
+	sudo_warnx_nodebug("FAIL: timeout event got events 0x%x", what);
+	timeout_errors++;
+    }
+    if (sudo_timespeccmp(&tt->deadline, &last_deadline, <)) {
+	sudo_warnx_nodebug("FAIL: timeout fired out of order");
+	timeout_errors++;
+    }
+    last_deadline = tt->deadline;
+    tt->fired++;
+}
+
+/*
+ * Add, re-arm and delete a large number of timeouts and verify that
+ * the remaining ones fire exactly once, in order of expiration.
+ */
+static int
+check_timeouts(int ntimeouts)
+{
+    struct sudo_event_base *base;
+    struct test_timeout *tts;
+    struct timespec ts, left;
+    int i, errors = 0;
+
+    if ((base = sudo_ev_base_alloc()) == NULL)
+	sudo_fatalx("unable to allocate event base");
+    tts = calloc(ntimeouts, sizeof(*tts));
+    if (tts == NULL)
+	sudo_fatalx("unable to allocate memory");
+
+    for (i = 0; i < ntimeouts; i++) {
+	tts[i].ev = sudo_ev_alloc(-1, 0, timeout_cb, &tts[i]);
+	if (tts[i].ev == NULL)
+	    sudo_fatalx("unable to allocate event");
+	ts.tv_sec = 0;
+	ts.tv_nsec = arc4random_uniform(20000) * 1000;
+	if (sudo_ev_add(base, tts[i].ev, &ts, false) == -1)
+	    sudo_fatalx("unable to add timeout event");
+    }
+
+    /* Re-arm every third event, delete every fifth. */
+    for (i = 0; i < ntimeouts; i += 3) {
+	ts.tv_sec = 0;
+	ts.tv_nsec = arc4random_uniform(20000) * 1000;
+	if (sudo_ev_add(base, tts[i].ev, &ts, false) == -1)
+	    sudo_fatalx("unable to re-add timeout event");
+	if (sudo_ev_get_timeleft(tts[i].ev, &left) == -1 ||
+		sudo_timespeccmp(&left, &ts, >)) {
+	    sudo_warnx_nodebug("FAIL: bad time left for timeout event");
+	    errors++;
+	}
+    }
+    for (i = 0; i < ntimeouts; i += 5)
+	sudo_ev_del(base, tts[i].ev);
+    for (i = 0; i < ntimeouts; i++) {
+	const struct timespec *deadline = sudo_ev_get_timeout(tts[i].ev);
+	if (deadline != NULL)
+	    tts[i].deadline = *deadline;
+    }
+
+    sudo_timespecclear(&last_deadline);
+    timeout_errors = 0;
+    if (sudo_ev_dispatch(base) != 1) {
+	sudo_warnx_nodebug("FAIL: event loop did not run out of events");
+	errors++;
+    }
+    errors += timeout_errors;
+    for (i = 0; i < ntimeouts; i++) {
+	const int expected = (i % 5 != 0);
+	if (tts[i].fired != expected) {
+	    if (errors++ < 10) {
+		sudo_warnx_nodebug("FAIL: timeout %d fired %d times, expected %d",
+		    i, tts[i].fired, expected);
+	    }
+	}
+	sudo_ev_free(tts[i].ev);
+    }
+    free(tts);
+    sudo_ev_base_free(base);
+
+    return errors != 0;
+}
+
+static int nsignals;
+
+static void
+signal_cb(int signo, int what, void *v)
+{
+    struct sudo_ev_siginfo_container *sc = v;
+
+    if (what != SUDO_EV_SIGINFO) {
+	sudo_warnx_nodebug("FAIL: signal event got events 0x%x", what);
+	return;
+    }
+    if (sc->siginfo == NULL || sc->siginfo->si_signo != signo ||
+	    sc->siginfo->si_code != SI_USER ||
+	    sc->siginfo->si_pid != getpid()) {
+	sudo_warnx_nodebug("FAIL: missing or bad siginfo for signal %d", signo);
+	return;
+    }
+    nsignals++;
+}
+
+static void
+raise_cb(int fd, int what, void *v)
+{
+    kill(getpid(), SIGUSR1);
+}
+
+/*
+ * Deliver SIGUSR1 both from inside the event loop and before it runs.
+ * With SUDO_EVBASE_OPT_SIGNALFD, the former uses signalfd (if supported)
+ * and the latter the signal pipe; both must produce correct siginfo.
+ */
+static int
+check_signals(unsigned int options)
+{
+    struct sudo_event_base *base;
+    struct sudo_event *sigev, *tev;
+    struct timespec ts = { 0, 0 };
+    sigset_t mask, omask;
+    int errors = 0;
+
+    if ((base = sudo_ev_base_alloc_flags(options)) == NULL)
+	sudo_fatalx("unable to allocate event base");
+    sigev = sudo_ev_alloc(SIGUSR1, SUDO_EV_SIGINFO, signal_cb, NULL);
+    tev = sudo_ev_alloc(-1, 0, raise_cb, NULL);
+    if (sigev == NULL || tev == NULL)
+	sudo_fatalx("unable to allocate events");
+    if (sudo_ev_add(base, sigev, NULL, false) == -1)
+	sudo_fatalx("unable to add signal event");
+#ifdef HAVE_SIGNALFD
+    if (ISSET(options, SUDO_EVBASE_OPT_SIGNALFD) && base->signalfd == -1) {
+	sudo_warnx_nodebug("FAIL: signalfd not in use");
+	errors++;
+    }
+#endif
+
+    /* Raised from inside the loop. */
+    nsignals = 0;
+    if (sudo_ev_add(base, tev, &ts, false) == -1)
+	sudo_fatalx("unable to add timeout event");
+    while (nsignals == 0) {
+	if (sudo_ev_loop(base, SUDO_EVLOOP_ONCE) != 0)
+	    break;
+    }
+    if (nsignals != 1) {
+	sudo_warnx_nodebug("FAIL: signal raised in loop delivered %d times",
+	    nsignals);
+	errors++;
+    }
+
+    /* Raised outside the loop. */
+    nsignals = 0;
+    kill(getpid(), SIGUSR1);
+    while (nsignals == 0) {
+	if (sudo_ev_loop(base, SUDO_EVLOOP_ONCE) != 0)
+	    break;
+    }
+    if (nsignals != 1) {
+	sudo_warnx_nodebug("FAIL: signal raised outside loop delivered %d times",
+	    nsignals);
+	errors++;
+    }
+
+    /* The loop must not leave SIGUSR1 blocked. */
+    sigemptyset(&mask);
+    sigprocmask(SIG_BLOCK, &mask, &omask);
+    if (sigismember(&omask, SIGUSR1)) {
+	sudo_warnx_nodebug("FAIL: SIGUSR1 left blocked after event loop");
+	errors++;
+    }
+
+    sudo_ev_free(sigev);
+    sudo_ev_free(tev);
+    sudo_ev_base_free(base);
+
+    return errors != 0;
+}
+
+/*
+ * Time niter loop iterations with a single ready fd, then the same
+ * with a plain poll(2) over all the fds.
+ */
+static void
+benchmark(struct sudo_event_base *base, struct test_fd *fds, int nfds,
+    int niter)
+{
+    struct pollfd *pfds;
+    struct timespec start;
+    double ev_secs, poll_secs;
+    char ch;
+    int i;
+
+    sudo_gettime_mono(&start);
+    for (i = 0; i < niter; i++) {
+	if (write(fds[i % nfds].peer, "x", 1) != 1)
+	    sudo_fatal("write");
+	sudo_ev_loop(base, SUDO_EVLOOP_ONCE);
+    }
+    ev_secs = elapsed(&start);
+
+    pfds = reallocarray(NULL, nfds, sizeof(*pfds));
+    if (pfds == NULL)
+	sudo_fatalx("unable to allocate memory");
+    for (i = 0; i < nfds; i++) {
+	pfds[i].fd = fds[i].fd;
+	pfds[i].events = POLLIN;
+    }
+    sudo_gettime_mono(&start);
+    for (i = 0; i < niter; i++) {
+	if (write(fds[i % nfds].peer, "x", 1) != 1)
+	    sudo_fatal("write");
+	if (poll(pfds, nfds, -1) > 0) {
+	    /* The event loop has to find the ready fd too. */
+	    int j;
+	    for (j = 0; j < nfds; j++) {
+		if (pfds[j].revents & POLLIN) {
+		    if (read(pfds[j].fd, &ch, 1) != 1)
+			sudo_fatal("read");
+		}
+	    }
+	}
+    }
+    poll_secs = elapsed(&start);
+    free(pfds);
+
+    printf("%s: %d fds, %d iterations: event loop %.1f usec/iter, "
+	"poll %.1f usec/iter\n", getprogname(), nfds, niter,
+	ev_secs * 1000000.0 / niter, poll_secs * 1000000.0 / niter);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct sudo_event_base *base;
+    struct test_fd *fds;
+    struct rlimit rl;
+    const char *errstr;
+    int ch, i, nfds = 10000, ntests = 0, errors = 0;
+
+    initprogname(argc > 0 ? argv[0] : "event_test");
+
+    while ((ch = getopt(argc, argv, "n:v")) != -1) {
+	switch (ch) {
+	case 'n':
+	    nfds = sudo_strtonum(optarg, 2, INT_MAX, &errstr);
+	    if (errstr != NULL)
+		sudo_fatalx("number of fds %s: %s", optarg, errstr);
+	    break;
+	case 'v':
+	    verbose++;
+	    break;
+	default:
+	    fprintf(stderr, "usage: %s [-v] [-n nfds]\n", getprogname());
+	    return EXIT_FAILURE;
+	}
+    }
+    argc -= optind;
+    argv += optind;
+
+    /* Raise the fd limit as far as we can, leaving room for stdio, etc. */
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+	if (rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur < rl.rlim_max) {
+	    rl.rlim_cur = rl.rlim_max;
+	    (void)setrlimit(RLIMIT_NOFILE, &rl);
+	    (void)getrlimit(RLIMIT_NOFILE, &rl);
+	}
+	if (rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur < (rlim_t)nfds + 32) {
+	    if (verbose) {
+		printf("%s: fd limit %lld, reducing %d fds to %lld\n",
+		    getprogname(), (long long)rl.rlim_cur, nfds,
+		    (long long)rl.rlim_cur - 32);
+	    }
+	    nfds = rl.rlim_cur - 32;
+	}
+    }
+    nfds &= ~1;
+
+    if ((base = sudo_ev_base_alloc()) == NULL)
+	sudo_fatalx("unable to allocate event base");
+    fds = calloc(nfds, sizeof(*fds));
+    if (fds == NULL)
+	sudo_fatalx("unable to allocate memory");
+    for (i = 0; i < nfds; i += 2) {
+	int sv[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+	    sudo_fatal("socketpair");
+	fds[i].fd = fds[i + 1].peer = sv[0];
+	fds[i + 1].fd = fds[i].peer = sv[1];
+    }
+    for (i = 0; i < nfds; i++) {
+	fds[i].ev = sudo_ev_alloc(fds[i].fd, SUDO_EV_READ|SUDO_EV_PERSIST,
+	    read_cb, &fds[i]);
+	if (fds[i].ev == NULL)
+	    sudo_fatalx("unable to allocate event");
+	if (sudo_ev_add(base, fds[i].ev, NULL, false) == -1)
+	    sudo_fatalx("unable to add event for fd %d", fds[i].fd);
+    }
+
+    /* Wake up a different subset of fds each time. */
+    errors += check_round(base, fds, nfds, 1, 0);
+    ntests++;
+    errors += check_round(base, fds, nfds, 7, 3);
+    ntests++;
+    errors += check_round(base, fds, nfds, nfds, nfds - 1);
+    ntests++;
+
+    /* Delete half the events and make sure the rest still work. */
+    for (i = 0; i < nfds; i += 2) {
+	sudo_ev_free(fds[i].ev);
+	fds[i].ev = NULL;
+    }
+    for (i = 0; i < nfds; i += 2) {
+	if (write(fds[i].peer, "x", 1) != 1)
+	    sudo_fatal("write");
+    }
+    errors += check_round(base, fds, nfds, 2, 1);
+    ntests++;
+    for (i = 0; i < nfds; i += 2) {
+	char buf[1];
+	if (read(fds[i].fd, buf, 1) != 1)
+	    sudo_fatal("read");
+	fds[i].ev = sudo_ev_alloc(fds[i].fd, SUDO_EV_READ|SUDO_EV_PERSIST,
+	    read_cb, &fds[i]);
+	if (fds[i].ev == NULL || sudo_ev_add(base, fds[i].ev, NULL, false) == -1)
+	    sudo_fatalx("unable to add event for fd %d", fds[i].fd);
+    }
+    errors += check_round(base, fds, nfds, 5, 0);
+    ntests++;
+
+    errors += check_special(base, &fds[0]) != 0;
+    ntests++;
+
+    errors += check_closed(base) != 0;
+    ntests++;
+
+    errors += check_timeouts(nfds);
+    ntests++;
+
+    errors += check_signals(0);
+    ntests++;
+    errors += check_signals(SUDO_EVBASE_OPT_SIGNALFD);
+    ntests++;
+
+    if (verbose)
+	benchmark(base, fds, nfds, 1000);
+
+    for (i = 0; i < nfds; i++) {
+	sudo_ev_free(fds[i].ev);
+	close(fds[i].fd);
+    }
+    free(fds);
+    sudo_ev_base_free(base);
+
+    if (ntests != 0) {
+	printf("%s: %d tests run, %d errors, %d%% success rate\n",
+	    getprogname(), ntests, errors, (ntests - errors) * 100 / ntests);
+    }
+    return errors;
+}
@@ -26,6 +26,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 
 #include <errno.h>
@@ -45,6 +46,7 @@
 
 #include "sudo_compat.h"
 #include "sudo_debug.h"
+#include "sudo_event.h"
 #include "sudo_eventlog.h"
 #include "sudo_gettext.h"
 #include "sudo_iolog.h"
@@ -143,7 +145,10 @@ evlog_new(TimeSpec *submit_time, InfoMessage **info_msgs, size_t infolen,
     }
 
     /* Client/peer IP address. */
-    evlog->peeraddr = closure->ipaddr;
+    if ((evlog->peeraddr = strdup(closure->ipaddr)) == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	goto bad;
+    }
 
     /* Submit time. */
     if (submit_time != NULL) {
@@ -615,6 +620,8 @@ iolog_close_all(struct connection_closure *closure)
     }
     if (closure->iolog_dir_fd != -1)
 	close(closure->iolog_dir_fd);
+    if (closure->iolog_index_fd != -1)
+	close(closure->iolog_index_fd);
 
     debug_return;
 }
@@ -638,6 +645,541 @@ iolog_flush_all(struct connection_closure *closure)
     debug_return_bool(ret);
 }
 
+bool
+iolog_sync_all(struct connection_closure *closure)
+{
+    const char *errstr;
+    int i, ret = true;
+    debug_decl(iolog_sync_all, SUDO_DEBUG_UTIL);
+
+    for (i = 0; i < IOFD_MAX; i++) {
+	if (!closure->iolog_files[i].enabled)
+	    continue;
+	if (!iolog_sync(&closure->iolog_files[i], &errstr)) {
+	    sudo_warnx(U_("error syncing iofd %d: %s"), i, errstr);
+	    closure->errstr = _("error writing IoBuffer");
+	    ret = false;
+	}
+    }
+
+    debug_return_bool(ret);
+}
+
+/*
+ * The restart index is stored in the I/O log directory.  It consists of
+ * a header followed by one entry per commit point, recording the elapsed
+ * time and the size of each I/O log file (-1 if not present).  Since
+ * compressed files are checkpointed at gzip member boundaries, a log can
+ * be restarted at any commit point by truncating each file to the stored
+ * size and appending to it, without reading or copying the existing data.
+ */
+#define IOLOG_INDEX_MAGIC	0x49494458	/* "IIDX" */
+#define IOLOG_INDEX_VERSION	1
+
+struct iolog_index_header {
+    uint32_t magic;
+    uint32_t version;
+};
+
+struct iolog_index_entry {
+    int64_t tv_sec;
+    int64_t tv_nsec;
+    int64_t offsets[IOFD_MAX];
+};
+
+/*
+ * Create (or truncate) the restart index for the connection.
+ * The index is advisory, failure to create it is not fatal.
+ */
+static void
+iolog_index_create(struct connection_closure *closure)
+{
+    struct iolog_index_header hdr = { IOLOG_INDEX_MAGIC, IOLOG_INDEX_VERSION };
+    debug_decl(iolog_index_create, SUDO_DEBUG_UTIL);
+
+    if (closure->iolog_index_fd != -1)
+	close(closure->iolog_index_fd);
+    closure->iolog_index_fd = iolog_openat(closure->iolog_dir_fd,
+	IOLOG_INDEX_FILE, O_WRONLY|O_CREAT|O_TRUNC|O_APPEND);
+    if (closure->iolog_index_fd == -1) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "unable to create %s/%s", closure->evlog->iolog_path,
+	    IOLOG_INDEX_FILE);
+	debug_return;
+    }
+    if (write(closure->iolog_index_fd, &hdr, sizeof(hdr)) != ssizeof(hdr)) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "unable to write %s/%s", closure->evlog->iolog_path,
+	    IOLOG_INDEX_FILE);
+	close(closure->iolog_index_fd);
+	closure->iolog_index_fd = -1;
+	(void)unlinkat(closure->iolog_dir_fd, IOLOG_INDEX_FILE, 0);
+    }
+
+    debug_return;
+}
+
+/*
+ * Flush each I/O log file written to since the last commit point so
+ * that the log can be restarted from here and store its size in the
+ * restart index along with the current elapsed time.
+ */
+bool
+iolog_checkpoint_all(struct connection_closure *closure)
+{
+    struct iolog_index_entry entry;
+    const char *errstr;
+    int iofd;
+    debug_decl(iolog_checkpoint_all, SUDO_DEBUG_UTIL);
+
+    entry.tv_sec = closure->elapsed_time.tv_sec;
+    entry.tv_nsec = closure->elapsed_time.tv_nsec;
+    for (iofd = 0; iofd < IOFD_MAX; iofd++) {
+	struct iolog_wbuf *wbuf = &closure->iolog_wbufs[iofd];
+
+	entry.offsets[iofd] = -1;
+	if (!closure->iolog_files[iofd].enabled)
+	    continue;
+	if (wbuf->dirty) {
+	    const off_t off =
+		iolog_checkpoint(&closure->iolog_files[iofd], &errstr);
+	    if (off == -1) {
+		sudo_warnx(U_("%s/%s: %s"), closure->evlog->iolog_path,
+		    iolog_fd_to_name(iofd), errstr);
+		closure->errstr = _("error writing IoBuffer");
+		debug_return_bool(false);
+	    }
+	    wbuf->checkpoint = off;
+	    wbuf->dirty = false;
+	}
+	entry.offsets[iofd] = wbuf->checkpoint;
+    }
+
+    if (closure->iolog_index_fd != -1) {
+	if (write(closure->iolog_index_fd, &entry, sizeof(entry)) !=
+		ssizeof(entry)) {
+	    /* A partial entry is ignored, stop adding new ones. */
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+		"unable to write %s/%s", closure->evlog->iolog_path,
+		IOLOG_INDEX_FILE);
+	    close(closure->iolog_index_fd);
+	    closure->iolog_index_fd = -1;
+	}
+    }
+
+    debug_return_bool(true);
+}
+
+/*
+ * Connections with I/O log records waiting to be written.
+ * Records are queued as they are received and written by a separate
+ * event, one slice per connection per pass, so a busy session, slow
+ * disk or expensive compression does not stall other clients.
+ */
+static TAILQ_HEAD(, connection_closure) iolog_pending =
+    TAILQ_HEAD_INITIALIZER(iolog_pending);
+static struct sudo_event *iolog_writer_ev;
+
+/*
+ * Connections with I/O log data in their write-combining buffers.
+ * Written records are buffered until IOLOG_WBUF_SIZE bytes have
+ * accumulated, IOLOG_WBUF_TIMEOUT seconds have passed or a commit
+ * point is due, which turns many small writes (and flushes) into
+ * a few large ones.
+ */
+static TAILQ_HEAD(, connection_closure) iolog_wbuf_list =
+    TAILQ_HEAD_INITIALIZER(iolog_wbuf_list);
+static struct sudo_event *iolog_wbuf_ev;
+
+/*
+ * Stop logging I/O for the connection after a write error and
+ * tell the client.
+ */
+static void
+iolog_write_error(struct connection_closure *closure)
+{
+    debug_decl(iolog_write_error, SUDO_DEBUG_UTIL);
+
+    if (closure->errstr == NULL)
+	closure->errstr = _("error writing IoBuffer");
+    iolog_discard(closure);
+    if (!schedule_error_message(closure->errstr, closure))
+	connection_close(closure);
+
+    debug_return;
+}
+
+/*
+ * Write the contents of the buffer for iofd to the I/O log file.
+ */
+static bool
+iolog_wbuf_write(struct connection_closure *closure, int iofd)
+{
+    struct iolog_wbuf *wbuf = &closure->iolog_wbufs[iofd];
+    const char *errstr;
+    debug_decl(iolog_wbuf_write, SUDO_DEBUG_UTIL);
+
+    if (wbuf->len == 0)
+	debug_return_bool(true);
+
+    if (!iolog_write(&closure->iolog_files[iofd], wbuf->data, wbuf->len,
+	    &errstr)) {
+	sudo_warnx(U_("%s/%s: %s"), closure->evlog->iolog_path,
+	    iolog_fd_to_name(iofd), errstr);
+	debug_return_bool(false);
+    }
+    closure->iolog_buffered -= wbuf->len;
+    wbuf->len = 0;
+    wbuf->dirty = true;
+
+    debug_return_bool(true);
+}
+
+/*
+ * Append data to the write-combining buffer for iofd.
+ * Data too large to be worth copying is written directly,
+ * after any data already buffered for that file.
+ */
+static bool
+iolog_wbuf_append(struct connection_closure *closure, int iofd,
+    const void *data, size_t len)
+{
+    struct iolog_wbuf *wbuf = &closure->iolog_wbufs[iofd];
+    const char *errstr;
+    debug_decl(iolog_wbuf_append, SUDO_DEBUG_UTIL);
+
+    if (len >= IOLOG_WBUF_SIZE) {
+	if (!iolog_wbuf_write(closure, iofd))
+	    debug_return_bool(false);
+	if (!iolog_write(&closure->iolog_files[iofd], data, len, &errstr)) {
+	    sudo_warnx(U_("%s/%s: %s"), closure->evlog->iolog_path,
+		iolog_fd_to_name(iofd), errstr);
+	    debug_return_bool(false);
+	}
+	wbuf->dirty = true;
+	debug_return_bool(true);
+    }
+
+    if (wbuf->len + len > wbuf->size) {
+	/* The buffer is flushed before it reaches 2 * IOLOG_WBUF_SIZE. */
+	size_t newsize = sudo_pow2_roundup((unsigned int)(wbuf->len + len));
+	uint8_t *newdata;
+
+	if (newsize < 1024)
+	    newsize = 1024;
+	if ((newdata = realloc(wbuf->data, newsize)) == NULL) {
+	    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	    closure->errstr = _("unable to allocate memory");
+	    debug_return_bool(false);
+	}
+	wbuf->data = newdata;
+	wbuf->size = newsize;
+    }
+    memcpy(wbuf->data + wbuf->len, data, len);
+    wbuf->len += len;
+    closure->iolog_buffered += len;
+
+    debug_return_bool(true);
+}
+
+/*
+ * Write out any buffered I/O log data for each connection that
+ * has been waiting on IOLOG_WBUF_TIMEOUT.
+ */
+static void
+iolog_wbuf_cb(int unused, int what, void *v)
+{
+    struct connection_closure *closure, *next;
+    debug_decl(iolog_wbuf_cb, SUDO_DEBUG_UTIL);
+
+    TAILQ_FOREACH_SAFE(closure, &iolog_wbuf_list, iolog_wbuf_entries, next) {
+	if (!iolog_wbuf_flush(closure))
+	    iolog_write_error(closure);
+    }
+
+    debug_return;
+}
+
+/*
+ * Make sure buffered data for the connection is written within
+ * IOLOG_WBUF_TIMEOUT seconds.
+ */
+static bool
+iolog_wbuf_schedule(struct connection_closure *closure)
+{
+    debug_decl(iolog_wbuf_schedule, SUDO_DEBUG_UTIL);
+
+    if (closure->iolog_wbuf_pending)
+	debug_return_bool(true);
+
+    if (iolog_wbuf_ev == NULL) {
+	iolog_wbuf_ev = sudo_ev_alloc(-1, SUDO_EV_TIMEOUT, iolog_wbuf_cb, NULL);
+	if (iolog_wbuf_ev == NULL) {
+	    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	    closure->errstr = _("unable to allocate memory");
+	    debug_return_bool(false);
+	}
+    }
+    if (!ISSET(iolog_wbuf_ev->flags, SUDO_EVQ_INSERTED)) {
+	struct timespec tv = { IOLOG_WBUF_TIMEOUT, 0 };
+	if (sudo_ev_add(closure->evbase, iolog_wbuf_ev, &tv, false) == -1) {
+	    sudo_warnx("%s", U_("unable to add event to queue"));
+	    closure->errstr = _("unable to add event to queue");
+	    debug_return_bool(false);
+	}
+    }
+    TAILQ_INSERT_TAIL(&iolog_wbuf_list, closure, iolog_wbuf_entries);
+    closure->iolog_wbuf_pending = true;
+
+    debug_return_bool(true);
+}
+
+/*
+ * Write the connection's buffered I/O log data, stream files first,
+ * followed by the timing file, and advance the elapsed time.
+ * Since commit points are based on the elapsed time, they only
+ * include records that have actually been written.
+ */
+bool
+iolog_wbuf_flush(struct connection_closure *closure)
+{
+    int iofd;
+    debug_decl(iolog_wbuf_flush, SUDO_DEBUG_UTIL);
+
+    for (iofd = 0; iofd < IOFD_MAX; iofd++) {
+	if (iofd == IOFD_TIMING)
+	    continue;
+	if (!iolog_wbuf_write(closure, iofd))
+	    debug_return_bool(false);
+    }
+    if (!iolog_wbuf_write(closure, IOFD_TIMING))
+	debug_return_bool(false);
+
+    sudo_timespecadd(&closure->elapsed_time, &closure->iolog_wbuf_time,
+	&closure->elapsed_time);
+    sudo_timespecclear(&closure->iolog_wbuf_time);
+
+    if (closure->iolog_wbuf_pending) {
+	TAILQ_REMOVE(&iolog_wbuf_list, closure, iolog_wbuf_entries);
+	closure->iolog_wbuf_pending = false;
+    }
+
+    debug_return_bool(true);
+}
+
+/*
+ * Add a queued record to the write-combining buffers, writing them
+ * out if enough data has accumulated.
+ */
+static bool
+iolog_write_record(struct iolog_record *rec, struct connection_closure *closure)
+{
+    uint8_t *data = rec->data;
+    char *newbuf = NULL;
+    bool ret = false;
+    debug_decl(iolog_write_record, SUDO_DEBUG_UTIL);
+
+    if (rec->iofd != IOFD_TIMING) {
+	if (!logsrvd_conf_iolog_log_passwords()) {
+	    if (!iolog_pwfilt_run(logsrvd_conf_iolog_passprompt_regex(),
+		    rec->iofd, (char *)data, rec->data_len, &newbuf))
+		goto done;
+	    if (newbuf != NULL)
+		data = (uint8_t *)newbuf;
+	}
+
+	/* Data for the specified I/O log file. */
+	if (!iolog_wbuf_append(closure, rec->iofd, data, rec->data_len))
+	    goto done;
+    }
+
+    /* Timing data. */
+    if (!iolog_wbuf_append(closure, IOFD_TIMING, rec->timing, rec->timing_len))
+	goto done;
+
+    sudo_timespecadd(&closure->iolog_wbuf_time, &rec->delay,
+	&closure->iolog_wbuf_time);
+
+    if (closure->iolog_buffered >= IOLOG_WBUF_SIZE)
+	ret = iolog_wbuf_flush(closure);
+    else
+	ret = iolog_wbuf_schedule(closure);
+
+done:
+    free(newbuf);
+    debug_return_bool(ret);
+}
+
+/*
+ * Write queued records until at least max_bytes have been written
+ * or the queue is empty.
+ */
+static bool
+iolog_write_records(struct connection_closure *closure, size_t max_bytes)
+{
+    struct iolog_record *rec;
+    size_t nwritten = 0;
+    debug_decl(iolog_write_records, SUDO_DEBUG_UTIL);
+
+    while (nwritten < max_bytes &&
+	    (rec = TAILQ_FIRST(&closure->iolog_records)) != NULL) {
+	if (!iolog_write_record(rec, closure)) {
+	    if (closure->errstr == NULL)
+		closure->errstr = _("error writing IoBuffer");
+	    debug_return_bool(false);
+	}
+	TAILQ_REMOVE(&closure->iolog_records, rec, entries);
+	nwritten += rec->timing_len + rec->data_len;
+	closure->iolog_queued -= rec->timing_len + rec->data_len;
+	free(rec);
+    }
+    if (TAILQ_EMPTY(&closure->iolog_records) && closure->iolog_pending) {
+	TAILQ_REMOVE(&iolog_pending, closure, iolog_entries);
+	closure->iolog_pending = false;
+    }
+    sudo_debug_printf(SUDO_DEBUG_DEBUG|SUDO_DEBUG_LINENO,
+	"%s: wrote %zu bytes, %zu bytes still queued, %zu bytes buffered",
+	closure->ipaddr, nwritten, closure->iolog_queued,
+	closure->iolog_buffered);
+
+    debug_return_bool(true);
+}
+
+/*
+ * Write the next slice of queued records for each pending connection.
+ */
+static void
+iolog_writer_cb(int unused, int what, void *v)
+{
+    struct connection_closure *closure, *next;
+    struct sudo_event_base *evbase = v;
+    struct timespec tv = { 0, 0 };
+    debug_decl(iolog_writer_cb, SUDO_DEBUG_UTIL);
+
+    TAILQ_FOREACH_SAFE(closure, &iolog_pending, iolog_entries, next) {
+	if (!iolog_write_records(closure, IOLOG_WRITE_SLICE))
+	    iolog_write_error(closure);
+    }
+
+    /* Reschedule if there is still work to do. */
+    if (!TAILQ_EMPTY(&iolog_pending)) {
+	if (sudo_ev_add(evbase, iolog_writer_ev, &tv, false) == -1)
+	    sudo_warnx("%s", U_("unable to add event to queue"));
+    }
+
+    debug_return;
+}
+
+/*
+ * Queue an I/O log record to be written by iolog_writer_cb().
+ * The timing line and data are copied.  If too much data is already
+ * queued for the connection, the queue is written synchronously.
+ */
+bool
+iolog_queue_record(int iofd, TimeSpec *delay, const char *timing,
+    size_t timing_len, const uint8_t *data, size_t data_len,
+    struct connection_closure *closure)
+{
+    struct iolog_record *rec;
+    debug_decl(iolog_queue_record, SUDO_DEBUG_UTIL);
+
+    rec = malloc(sizeof(*rec) + timing_len + data_len);
+    if (rec == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	closure->errstr = _("unable to allocate memory");
+	debug_return_bool(false);
+    }
+    rec->timing = (char *)(rec + 1);
+    memcpy(rec->timing, timing, timing_len);
+    rec->timing_len = timing_len;
+    rec->data = (uint8_t *)rec->timing + timing_len;
+    if (data_len != 0)
+	memcpy(rec->data, data, data_len);
+    rec->data_len = data_len;
+    rec->delay.tv_sec = delay->tv_sec;
+    rec->delay.tv_nsec = delay->tv_nsec;
+    rec->iofd = iofd;
+    TAILQ_INSERT_TAIL(&closure->iolog_records, rec, entries);
+    closure->iolog_queued += timing_len + data_len;
+
+    /* Don't let the queue grow without bound. */
+    if (closure->iolog_queued > IOLOG_QUEUE_MAX)
+	debug_return_bool(iolog_drain(closure));
+
+    if (!closure->iolog_pending) {
+	TAILQ_INSERT_TAIL(&iolog_pending, closure, iolog_entries);
+	closure->iolog_pending = true;
+    }
+    if (iolog_writer_ev == NULL) {
+	iolog_writer_ev = sudo_ev_alloc(-1, SUDO_EV_TIMEOUT, iolog_writer_cb,
+	    closure->evbase);
+	if (iolog_writer_ev == NULL) {
+	    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	    closure->errstr = _("unable to allocate memory");
+	    debug_return_bool(false);
+	}
+    }
+    if (!ISSET(iolog_writer_ev->flags, SUDO_EVQ_INSERTED)) {
+	struct timespec tv = { 0, 0 };
+	if (sudo_ev_add(closure->evbase, iolog_writer_ev, &tv, false) == -1) {
+	    sudo_warnx("%s", U_("unable to add event to queue"));
+	    closure->errstr = _("unable to add event to queue");
+	    debug_return_bool(false);
+	}
+    }
+
+    debug_return_bool(true);
+}
+
+/*
+ * Write all queued and buffered records for the connection.
+ */
+bool
+iolog_drain(struct connection_closure *closure)
+{
+    debug_decl(iolog_drain, SUDO_DEBUG_UTIL);
+
+    if (!iolog_write_records(closure, SIZE_MAX))
+	debug_return_bool(false);
+    debug_return_bool(iolog_wbuf_flush(closure));
+}
+
+/*
+ * Discard any queued or buffered records for the connection.
+ */
+void
+iolog_discard(struct connection_closure *closure)
+{
+    struct iolog_record *rec;
+    int i;
+    debug_decl(iolog_discard, SUDO_DEBUG_UTIL);
+
+    while ((rec = TAILQ_FIRST(&closure->iolog_records)) != NULL) {
+	TAILQ_REMOVE(&closure->iolog_records, rec, entries);
+	free(rec);
+    }
+    closure->iolog_queued = 0;
+    if (closure->iolog_pending) {
+	TAILQ_REMOVE(&iolog_pending, closure, iolog_entries);
+	closure->iolog_pending = false;
+    }
+
+    for (i = 0; i < IOFD_MAX; i++) {
+	free(closure->iolog_wbufs[i].data);
+	closure->iolog_wbufs[i].data = NULL;
+	closure->iolog_wbufs[i].len = 0;
+	closure->iolog_wbufs[i].size = 0;
+    }
+    closure->iolog_buffered = 0;
+    sudo_timespecclear(&closure->iolog_wbuf_time);
+    if (closure->iolog_wbuf_pending) {
+	TAILQ_REMOVE(&iolog_wbuf_list, closure, iolog_wbuf_entries);
+	closure->iolog_wbuf_pending = false;
+    }
+
+    debug_return;
+}
+
 bool
 iolog_init(AcceptMessage *msg, struct connection_closure *closure)
 {
@@ -662,6 +1204,8 @@ iolog_init(AcceptMessage *msg, struct connection_closure *closure)
 	!iolog_create(IOFD_TTYOUT, closure))
 	debug_return_bool(false);
 
+    iolog_index_create(closure);
+
     /* Ready to log I/O buffers. */
     debug_return_bool(true);
 }
@@ -720,7 +1264,10 @@ iolog_rename(const char *from, const char *to)
     debug_return_bool(ok);
 }
 
-/* Compressed logs don't support random access, need to rewrite them. */
+/*
+ * Compressed logs don't support random access, need to rewrite them.
+ * Only used when there is no usable restart index.
+ */
 bool
 iolog_rewrite(const struct timespec *target, struct connection_closure *closure)
 {
@@ -846,9 +1393,13 @@ iolog_rewrite(const struct timespec *target, struct connection_closure *closure)
 	    continue;
 	(void)iolog_close(&closure->iolog_files[iofd], &errstr);
 	closure->iolog_files[iofd] = new_iolog_files[iofd];
+	closure->iolog_wbufs[iofd].dirty = true;
 	new_iolog_files[iofd].enabled = false;
     }
 
+    /* Offsets in the old restart index no longer apply. */
+    iolog_index_create(closure);
+
     /* Ready to log I/O buffers. */
     ret = true;
 done:
@@ -867,6 +1418,186 @@ done:
     debug_return_bool(ret);
 }
 
+/*
+ * Restart the I/O log at target using the restart index, if possible.
+ * Each file is truncated to its size at the matching commit point and
+ * reopened for appending, so the cost does not depend on the size of
+ * the log.  Returns false if there is no usable index entry for target,
+ * in which case the I/O log files are left closed.
+ */
+bool
+iolog_resume(const struct timespec *target, struct connection_closure *closure)
+{
+    const struct eventlog *evlog = closure->evlog;
+    struct iolog_index_header hdr;
+    struct iolog_index_entry entry;
+    struct timespec ts;
+    long lo, hi, mid, nentries;
+    off_t sizes[IOFD_MAX];
+    bool truncating = false;
+    const char *errstr;
+    struct stat sb;
+    int fd, iofd;
+    debug_decl(iolog_resume, SUDO_DEBUG_UTIL);
+
+    fd = iolog_openat(closure->iolog_dir_fd, IOLOG_INDEX_FILE,
+	O_RDWR|O_APPEND);
+    if (fd == -1) {
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "unable to open %s/%s", evlog->iolog_path, IOLOG_INDEX_FILE);
+	debug_return_bool(false);
+    }
+    if (fstat(fd, &sb) == -1 || sb.st_size < ssizeof(hdr))
+	goto bad;
+    if (pread(fd, &hdr, sizeof(hdr), 0) != ssizeof(hdr))
+	goto bad;
+    if (hdr.magic != IOLOG_INDEX_MAGIC || hdr.version != IOLOG_INDEX_VERSION)
+	goto bad;
+
+    /* Binary search for the entry matching target, ignoring a partial one. */
+    nentries = (long)((sb.st_size - ssizeof(hdr)) / ssizeof(entry));
+    lo = 0;
+    hi = nentries;
+    while (lo < hi) {
+	mid = lo + (hi - lo) / 2;
+	if (pread(fd, &entry, sizeof(entry),
+		(off_t)sizeof(hdr) + (off_t)mid * ssizeof(entry)) !=
+		ssizeof(entry))
+	    goto bad;
+	ts.tv_sec = (time_t)entry.tv_sec;
+	ts.tv_nsec = (long)entry.tv_nsec;
+	if (sudo_timespeccmp(&ts, target, <))
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    if (lo == nentries)
+	goto bad;
+    if (pread(fd, &entry, sizeof(entry),
+	    (off_t)sizeof(hdr) + (off_t)lo * ssizeof(entry)) != ssizeof(entry))
+	goto bad;
+    ts.tv_sec = (time_t)entry.tv_sec;
+    ts.tv_nsec = (long)entry.tv_nsec;
+    if (sudo_timespeccmp(&ts, target, !=)) {
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	    "%s: no restart index entry for [%lld, %ld]", evlog->iolog_path,
+	    (long long)target->tv_sec, target->tv_nsec);
+	goto bad;
+    }
+
+    /*
+     * Open every file and make sure it is at least as large as when
+     * the entry was written before truncating any of them, so that
+     * a failure leaves the I/O log as it was.
+     */
+    if (entry.offsets[IOFD_TIMING] < 0)
+	goto bad;
+    for (iofd = 0; iofd < IOFD_MAX; iofd++) {
+	struct iolog_file *iol = &closure->iolog_files[iofd];
+	const char *name = iolog_fd_to_name(iofd);
+
+	iol->enabled = entry.offsets[iofd] >= 0;
+	if (!iol->enabled)
+	    continue;
+	if (!iolog_open(iol, closure->iolog_dir_fd, iofd, "a")) {
+	    sudo_warn(U_("unable to open %s/%s"), evlog->iolog_path, name);
+	    iol->enabled = false;
+	    goto bad;
+	}
+	sizes[iofd] = fstat(iol->rawfd, &sb) == 0 ? sb.st_size : -1;
+	if (sizes[iofd] < entry.offsets[iofd]) {
+	    sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+		"%s/%s: stale restart index", evlog->iolog_path, name);
+	    goto bad;
+	}
+    }
+
+    /* Truncate each file at the commit point. */
+    truncating = true;
+    for (iofd = 0; iofd < IOFD_MAX; iofd++) {
+	struct iolog_file *iol = &closure->iolog_files[iofd];
+	const char *name = iolog_fd_to_name(iofd);
+
+	closure->iolog_wbufs[iofd].checkpoint = 0;
+	closure->iolog_wbufs[iofd].dirty = false;
+	if (!iol->enabled) {
+	    /* Created after the commit point, will be recreated as needed. */
+	    (void)unlinkat(closure->iolog_dir_fd, name, 0);
+	    continue;
+	}
+	if (ftruncate(iol->rawfd, (off_t)entry.offsets[iofd]) == -1) {
+	    sudo_warn(U_("unable to truncate %s/%s"), evlog->iolog_path, name);
+	    goto bad;
+	}
+	closure->iolog_wbufs[iofd].checkpoint = (off_t)entry.offsets[iofd];
+    }
+
+    /* Drop entries past the commit point, new ones are appended. */
+    if (ftruncate(fd, (off_t)sizeof(hdr) + (off_t)(lo + 1) * ssizeof(entry)) == -1)
+	goto bad;
+    closure->iolog_index_fd = fd;
+    closure->elapsed_time = *target;
+
+    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	"%s: resumed at [%lld, %ld] using restart index", evlog->iolog_path,
+	(long long)target->tv_sec, target->tv_nsec);
+    debug_return_bool(true);
+bad:
+    for (iofd = 0; iofd < IOFD_MAX; iofd++) {
+	struct iolog_file *iol = &closure->iolog_files[iofd];
+	int dupfd = -1;
+
+	if (!iol->enabled)
+	    continue;
+	/* Closing a compressed file adds an empty gzip member, remove it. */
+	if (iol->compressed && !truncating && sizes[iofd] != -1)
+	    dupfd = dup(iol->rawfd);
+	(void)iolog_close(iol, &errstr);
+	iol->enabled = false;
+	if (dupfd != -1) {
+	    ignore_result(ftruncate(dupfd, sizes[iofd]));
+	    close(dupfd);
+	}
+    }
+    close(fd);
+    debug_return_bool(false);
+}
+
+/*
+ * Truncate the uncompressed I/O log files at the current position (the
+ * resume point) after seeking, the client will resend anything past it.
+ * Since the old restart index may refer to discarded data, a new one
+ * is started.
+ */
+bool
+iolog_truncate_all(struct connection_closure *closure)
+{
+    const struct eventlog *evlog = closure->evlog;
+    int iofd;
+    debug_decl(iolog_truncate_all, SUDO_DEBUG_UTIL);
+
+    for (iofd = 0; iofd < IOFD_MAX; iofd++) {
+	struct iolog_file *iol = &closure->iolog_files[iofd];
+	off_t pos;
+
+	if (!iol->enabled)
+	    continue;
+
+	/* Must seek or flush before switching from read -> write. */
+	if (iolog_seek(iol, 0, SEEK_CUR) == -1 ||
+		(pos = ftello(iol->fd.f)) == -1 ||
+		ftruncate(iol->rawfd, pos) == -1) {
+	    sudo_warn("%s/%s", evlog->iolog_path, iolog_fd_to_name(iofd));
+	    debug_return_bool(false);
+	}
+	closure->iolog_wbufs[iofd].checkpoint = pos;
+	closure->iolog_wbufs[iofd].dirty = false;
+    }
+    iolog_index_create(closure);
+
+    debug_return_bool(true);
+}
+
 /*
  * Add given delta to elapsed time.
  * We cannot use timespecadd here since delta is not struct timespec.
@@ -24,8 +24,12 @@
 #include <config.h>
 
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 #include <errno.h>
+#include <limits.h>
 #ifdef HAVE_STDBOOL_H
 # include <stdbool.h>
 #else
@@ -49,8 +53,16 @@
 #include "sudo_iolog.h"
 #include "sudo_util.h"
 
+#include "log_server.pb-c.h"
 #include "logsrv_util.h"
 
+/* Maximum number of buffers to send with a single writev(). */
+#if defined(IOV_MAX) && IOV_MAX < 64
+# define WRITEV_MAX	IOV_MAX
+#else
+# define WRITEV_MAX	64
+#endif
+
 /*
  * Expand buf as needed or just reset it.
  */
@@ -189,3 +201,354 @@ iolog_seekto(int iolog_dir_fd, const char *iolog_path,
 bad:
     debug_return_bool(false);
 }
+
+/*
+ * Write the unsent data in the buffers queued in bufs to fd using
+ * a single writev() call.  The caller must advance the buffers by
+ * the number of bytes written.
+ * Returns the number of bytes written or -1 on error.
+ */
+ssize_t
+writev_bufs(int fd, struct connection_buffer_list *bufs)
+{
+    struct iovec iov[WRITEV_MAX];
+    struct connection_buffer *buf;
+    int iovcnt = 0;
+    ssize_t nwritten;
+    debug_decl(writev_bufs, SUDO_DEBUG_UTIL);
+
+    TAILQ_FOREACH(buf, bufs, entries) {
+	iov[iovcnt].iov_base = buf->data + buf->off;
+	iov[iovcnt].iov_len = buf->len - buf->off;
+	if (++iovcnt == WRITEV_MAX)
+	    break;
+    }
+    nwritten = writev(fd, iov, iovcnt);
+    sudo_debug_printf(SUDO_DEBUG_INFO, "%s: wrote %zd bytes from %d buffer(s)",
+	__func__, nwritten, iovcnt);
+
+    debug_return_ssize_t(nwritten);
+}
+
+/*
+ * Append the data in the buffers queued after the first one in bufs
+ * to the first buffer, up to a total of limit bytes, so it can be sent
+ * with a single SSL_write() and TLS record.  The first buffer may be
+ * reallocated, the TLS connection must use SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER
+ * in case an SSL_write() is being retried.  Buffers that have been
+ * appended are moved to the done list for the caller to release.
+ * Returns false on memory allocation failure.
+ */
+bool
+coalesce_bufs(struct connection_buffer_list *bufs,
+    struct connection_buffer_list *done, unsigned int limit)
+{
+    struct connection_buffer *first, *buf;
+    unsigned int len;
+    debug_decl(coalesce_bufs, SUDO_DEBUG_UTIL);
+
+    if ((first = TAILQ_FIRST(bufs)) == NULL)
+	debug_return_bool(true);
+
+    /* Amount of data that will be in the first buffer. */
+    len = first->len - first->off;
+    TAILQ_FOREACH(buf, bufs, entries) {
+	if (buf == first)
+	    continue;
+	if (len > limit || buf->len - buf->off > limit - len)
+	    break;
+	len += buf->len - buf->off;
+    }
+    if (len == first->len - first->off)
+	debug_return_bool(true);
+
+    /* Discard data that has already been written. */
+    if (first->off != 0) {
+	first->len -= first->off;
+	memmove(first->data, first->data + first->off, first->len);
+	first->off = 0;
+    }
+    if (len > first->size) {
+	const unsigned int new_size = sudo_pow2_roundup(len);
+	void *newdata;
+
+	if (new_size < len || (newdata = realloc(first->data, new_size)) == NULL) {
+	    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	    debug_return_bool(false);
+	}
+	first->data = newdata;
+	first->size = new_size;
+    }
+
+    while (first->len < len) {
+	buf = TAILQ_NEXT(first, entries);
+	memcpy(first->data + first->len, buf->data + buf->off,
+	    buf->len - buf->off);
+	first->len += buf->len - buf->off;
+	TAILQ_REMOVE(bufs, buf, entries);
+	TAILQ_INSERT_TAIL(done, buf, entries);
+    }
+    sudo_debug_printf(SUDO_DEBUG_INFO, "%s: coalesced %u bytes", __func__,
+	first->len);
+
+    debug_return_bool(true);
+}
+
+#ifdef HAVE_ZLIB_H
+/*
+ * Allocate a new zlib stream used to compress ClientMessages.
+ */
+struct msg_deflate *
+msg_deflate_alloc(void)
+{
+    struct msg_deflate *z;
+    debug_decl(msg_deflate_alloc, SUDO_DEBUG_UTIL);
+
+    if ((z = calloc(1, sizeof(*z))) == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	debug_return_ptr(NULL);
+    }
+    if (deflateInit(&z->strm, Z_DEFAULT_COMPRESSION) != Z_OK) {
+	sudo_warnx(U_("%s: %s"), __func__,
+	    z->strm.msg ? z->strm.msg : U_("unable to allocate memory"));
+	free(z);
+	debug_return_ptr(NULL);
+    }
+
+    debug_return_ptr(z);
+}
+
+void
+msg_deflate_free(struct msg_deflate *z)
+{
+    debug_decl(msg_deflate_free, SUDO_DEBUG_UTIL);
+
+    if (z != NULL) {
+	deflateEnd(&z->strm);
+	free(z->inbuf);
+	free(z->outbuf);
+	free(z);
+    }
+
+    debug_return;
+}
+
+/*
+ * Compress a wire format message, including its 32-bit size, and
+ * store the result as a compressed ClientMessage in zmsg.
+ * As with uncompressed messages, the size limit does not include
+ * the 32-bit size itself.
+ * The data in zmsg is only valid until the next call.
+ * Returns true on success, false on failure.
+ */
+bool
+msg_deflate_wire(struct msg_deflate *z, const uint8_t *buf, size_t len,
+    ClientMessage *zmsg)
+{
+    size_t zlen = 0;
+    int ret;
+    debug_decl(msg_deflate_wire, SUDO_DEBUG_UTIL);
+
+    if (len < sizeof(uint32_t) || len - sizeof(uint32_t) > MESSAGE_SIZE_MAX) {
+	sudo_warnx(U_("client message too large: %zu"),
+	    len - sizeof(uint32_t));
+	debug_return_bool(false);
+    }
+
+    /* Flush after each message so it can be decompressed on arrival. */
+    z->strm.next_in = buf;
+    z->strm.avail_in = (uInt)len;
+    do {
+	if (z->outsize - zlen < 64) {
+	    size_t newsize = sudo_pow2_roundup(zlen +
+		deflateBound(&z->strm, z->strm.avail_in) + 64);
+	    void *newbuf = realloc(z->outbuf, newsize);
+	    if (newbuf == NULL) {
+		sudo_warnx(U_("%s: %s"), __func__,
+		    U_("unable to allocate memory"));
+		debug_return_bool(false);
+	    }
+	    z->outbuf = newbuf;
+	    z->outsize = newsize;
+	}
+	z->strm.next_out = z->outbuf + zlen;
+	z->strm.avail_out = (uInt)(z->outsize - zlen);
+	ret = deflate(&z->strm, Z_SYNC_FLUSH);
+	if (ret != Z_OK && ret != Z_BUF_ERROR) {
+	    sudo_warnx(U_("unable to compress message: %s"),
+		z->strm.msg ? z->strm.msg : "deflate");
+	    debug_return_bool(false);
+	}
+	zlen = z->outsize - z->strm.avail_out;
+    } while (z->strm.avail_out == 0);
+
+    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	"compressed %zu bytes to %zu", len, zlen);
+
+    zmsg->u.compressed.data = z->outbuf;
+    zmsg->u.compressed.len = zlen;
+    zmsg->type_case = CLIENT_MESSAGE__TYPE_COMPRESSED;
+
+    debug_return_bool(true);
+}
+
+/*
+ * Pack and compress a ClientMessage, storing the result as a
+ * compressed ClientMessage in zmsg.
+ * The data in zmsg is only valid until the next call.
+ * Returns true on success, false on failure.
+ */
+bool
+msg_deflate(struct msg_deflate *z, ClientMessage *msg, ClientMessage *zmsg)
+{
+    uint32_t msg_len;
+    size_t len;
+    debug_decl(msg_deflate, SUDO_DEBUG_UTIL);
+
+    len = client_message__get_packed_size(msg);
+    if (len > MESSAGE_SIZE_MAX) {
+	sudo_warnx(U_("client message too large: %zu"), len);
+	debug_return_bool(false);
+    }
+    if (z->insize < len + sizeof(msg_len)) {
+	size_t newsize = sudo_pow2_roundup(len + sizeof(msg_len));
+	void *newbuf = realloc(z->inbuf, newsize);
+	if (newbuf == NULL) {
+	    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	    debug_return_bool(false);
+	}
+	z->inbuf = newbuf;
+	z->insize = newsize;
+    }
+
+    /* Wire message size is used for length encoding, precedes message. */
+    msg_len = htonl((uint32_t)len);
+    memcpy(z->inbuf, &msg_len, sizeof(msg_len));
+    client_message__pack(msg, z->inbuf + sizeof(msg_len));
+
+    debug_return_bool(msg_deflate_wire(z, z->inbuf, len + sizeof(msg_len),
+	zmsg));
+}
+
+/*
+ * Allocate a new zlib stream used to decompress ClientMessages.
+ */
+struct msg_inflate *
+msg_inflate_alloc(void)
+{
+    struct msg_inflate *z;
+    debug_decl(msg_inflate_alloc, SUDO_DEBUG_UTIL);
+
+    if ((z = calloc(1, sizeof(*z))) == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	debug_return_ptr(NULL);
+    }
+    if (inflateInit(&z->strm) != Z_OK) {
+	sudo_warnx(U_("%s: %s"), __func__,
+	    z->strm.msg ? z->strm.msg : U_("unable to allocate memory"));
+	free(z);
+	debug_return_ptr(NULL);
+    }
+
+    debug_return_ptr(z);
+}
+
+void
+msg_inflate_free(struct msg_inflate *z)
+{
+    debug_decl(msg_inflate_free, SUDO_DEBUG_UTIL);
+
+    if (z != NULL) {
+	inflateEnd(&z->strm);
+	free(z->buf.data);
+	free(z);
+    }
+
+    debug_return;
+}
+
+/*
+ * Decompress data from a compressed ClientMessage, appending the
+ * result to z->buf.  The pending uncompressed data must stay below
+ * MSG_INFLATE_MAX, which leaves room for a message of the maximum size
+ * and part of the next one.
+ * Returns true on success, false on failure.
+ */
+bool
+msg_inflate(struct msg_inflate *z, const uint8_t *data, size_t len)
+{
+    struct connection_buffer *buf = &z->buf;
+    unsigned int avail;
+    int ret;
+    debug_decl(msg_inflate, SUDO_DEBUG_UTIL);
+
+    /* Move any partial message to the start of the buffer. */
+    if (buf->off != 0) {
+	if (!expand_buf(buf, buf->size))
+	    debug_return_bool(false);
+    }
+
+    z->strm.next_in = data;
+    z->strm.avail_in = (uInt)len;
+    do {
+	if (buf->len >= MSG_INFLATE_MAX) {
+	    sudo_warnx("%s", U_("compressed message too large"));
+	    debug_return_bool(false);
+	}
+	if (buf->len == buf->size) {
+	    if (!expand_buf(buf, buf->size ? buf->size * 2 : 64 * 1024))
+		debug_return_bool(false);
+	}
+	avail = (unsigned int)(buf->size - buf->len);
+	if (avail > MSG_INFLATE_MAX - buf->len)
+	    avail = (unsigned int)(MSG_INFLATE_MAX - buf->len);
+	z->strm.next_out = buf->data + buf->len;
+	z->strm.avail_out = avail;
+	ret = inflate(&z->strm, Z_SYNC_FLUSH);
+	buf->len += avail - z->strm.avail_out;
+	if (ret == Z_BUF_ERROR)
+	    break;
+	if (ret != Z_OK) {
+	    sudo_warnx(U_("unable to decompress message: %s"),
+		z->strm.msg ? z->strm.msg : "inflate");
+	    debug_return_bool(false);
+	}
+    } while (z->strm.avail_in != 0 || z->strm.avail_out == 0);
+
+    debug_return_bool(true);
+}
+
+/*
+ * Find the next complete wire format message in the decompressed data.
+ * On success, stores the message and its size in msgp and lenp and
+ * returns 1.  The message is only valid until the next msg_inflate() call.
+ * Returns 0 if more data is needed, or -1 if the message is too large,
+ * in which case lenp is set to the size that was read.
+ */
+int
+msg_inflate_next(struct msg_inflate *z, uint8_t **msgp, size_t *lenp)
+{
+    struct connection_buffer *buf = &z->buf;
+    uint32_t msg_len;
+    debug_decl(msg_inflate_next, SUDO_DEBUG_UTIL);
+
+    if (buf->len - buf->off < sizeof(msg_len))
+	debug_return_int(0);
+
+    /* Read wire message size (uint32_t in network byte order). */
+    memcpy(&msg_len, buf->data + buf->off, sizeof(msg_len));
+    msg_len = ntohl(msg_len);
+    *lenp = msg_len;
+
+    if (msg_len > MESSAGE_SIZE_MAX)
+	debug_return_int(-1);
+    if (msg_len + sizeof(msg_len) > buf->len - buf->off) {
+	/* Incomplete message, the rest is in the next one. */
+	debug_return_int(0);
+    }
+
+    *msgp = buf->data + buf->off + sizeof(msg_len);
+    buf->off += sizeof(msg_len) + msg_len;
+    debug_return_int(1);
+}
+#endif /* HAVE_ZLIB_H */
@@ -35,6 +35,12 @@
 /* Maximum message size (2Mb) */
 #define MESSAGE_SIZE_MAX	(2 * 1024 * 1024)
 
+/* I/O data to collect in an IoBufferBatch before sending it (64Kb) */
+#define IOBUF_BATCH_SIZE	(64 * 1024)
+
+/* Maximum plaintext in a TLS record, queued messages are combined up to it. */
+#define TLS_RECORD_SIZE		(16 * 1024)
+
 struct peer_info {
     const char *name;
 #if defined(HAVE_STRUCT_IN6_ADDR)
@@ -53,11 +59,46 @@ struct connection_buffer {
 };
 TAILQ_HEAD(connection_buffer_list, connection_buffer);
 
+#ifdef HAVE_ZLIB_H
+# include <zlib.h>
+
+/* Compresses ClientMessages sent over a connection as a single stream. */
+struct msg_deflate {
+    z_stream strm;
+    uint8_t *inbuf;		/* wire format message to compress */
+    uint8_t *outbuf;		/* compressed data */
+    size_t insize;
+    size_t outsize;
+};
+
+/* Limit on pending uncompressed data, two messages and their sizes. */
+# define MSG_INFLATE_MAX	(2 * (MESSAGE_SIZE_MAX + sizeof(uint32_t)))
+
+/* Decompresses the ClientMessages received over a connection. */
+struct msg_inflate {
+    z_stream strm;
+    struct connection_buffer buf;	/* uncompressed wire format messages */
+};
+#endif /* HAVE_ZLIB_H */
+
 /* logsrv_util.c */
 struct iolog_file;
 bool expand_buf(struct connection_buffer *buf, unsigned int needed);
 bool iolog_open_all(int dfd, const char *iolog_dir, struct iolog_file *iolog_files, const char *mode);
 bool iolog_seekto(int iolog_dir_fd, const char *iolog_path, struct iolog_file *iolog_files, struct timespec *elapsed_time, const struct timespec *target);
+ssize_t writev_bufs(int fd, struct connection_buffer_list *bufs);
+bool coalesce_bufs(struct connection_buffer_list *bufs, struct connection_buffer_list *done, unsigned int limit);
+#ifdef HAVE_ZLIB_H
+struct ClientMessage;
+struct msg_deflate *msg_deflate_alloc(void);
+void msg_deflate_free(struct msg_deflate *z);
+bool msg_deflate(struct msg_deflate *z, struct ClientMessage *msg, struct ClientMessage *zmsg);
+bool msg_deflate_wire(struct msg_deflate *z, const uint8_t *buf, size_t len, struct ClientMessage *zmsg);
+struct msg_inflate *msg_inflate_alloc(void);
+void msg_inflate_free(struct msg_inflate *z);
+bool msg_inflate(struct msg_inflate *z, const uint8_t *data, size_t len);
+int msg_inflate_next(struct msg_inflate *z, uint8_t **msgp, size_t *lenp);
+#endif /* HAVE_ZLIB_H */
 
 
 #endif /* SUDO_LOGSRV_UTIL_H */
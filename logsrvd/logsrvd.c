@@ -26,6 +26,8 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
@@ -33,6 +35,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <signal.h>
 #ifdef HAVE_STDBOOL_H
 # include <stdbool.h>
 #else
@@ -72,6 +75,7 @@
 
 #include "logsrvd.h"
 #include "hostcheck.h"
+#include "protobuf-c/protobuf-c-arena.h"
 
 #ifndef O_NOFOLLOW
 # define O_NOFOLLOW 0
@@ -81,16 +85,49 @@
  * Sudo I/O audit server.
  */
 static int logsrvd_debug_instance = SUDO_DEBUG_INSTANCE_INITIALIZER;
-TAILQ_HEAD(connection_list, connection_closure);
 static struct connection_list connections = TAILQ_HEAD_INITIALIZER(connections);
 static struct listener_list listeners = TAILQ_HEAD_INITIALIZER(listeners);
 static const char server_id[] = "Sudo Audit Server " PACKAGE_VERSION;
 static const char *conf_file = NULL;
 
+/* Worker processes, only used when "workers" is greater than one. */
+static unsigned int num_workers = 1;
+static unsigned int worker_idx;
+static pid_t *worker_pids;
+static bool workers_shutdown;
+static struct sudo_event *worker_restart_ev;
+static struct sudo_event *supervisor_signal_events[5];
+static unsigned int num_supervisor_signal_events;
+
+/* Client messages are unpacked one at a time using a reusable arena. */
+static ProtobufCArena client_msg_arena;
+
+/*
+ * Connections waiting for the next periodic commit point.
+ * They are committed as a group: the I/O logs (or journals) of
+ * all of them are written out and, if commit_sync is enabled,
+ * synced before the commit points are sent, so the cost of the
+ * commit is shared by all clients.
+ */
+static struct connection_list commit_pending =
+    TAILQ_HEAD_INITIALIZER(commit_pending);
+static struct sudo_event *group_commit_ev;
+
+/*
+ * Buffer memory used by all connections and the connections we
+ * have stopped reading from because they are over their budget.
+ */
+static struct connection_list paused_connections =
+    TAILQ_HEAD_INITIALIZER(paused_connections);
+static size_t buffered_total;
+static unsigned int num_paused;
+
 /* Event loop callbacks. */
 static void client_msg_cb(int fd, int what, void *v);
+static bool handle_client_message(uint8_t *buf, size_t len, struct connection_closure *closure);
 static void server_msg_cb(int fd, int what, void *v);
 static void server_commit_cb(int fd, int what, void *v);
+static void group_commit_cb(int fd, int what, void *v);
 #if defined(HAVE_OPENSSL)
 static void tls_handshake_cb(int fd, int what, void *v);
 #endif
@@ -106,16 +143,39 @@ connection_closure_free(struct connection_closure *closure)
     if (closure != NULL) {
 	bool shutting_down = closure->state == SHUTDOWN;
 	struct sudo_event_base *evbase = closure->evbase;
+	struct connection_closure *stream;
 	struct connection_buffer *buf;
 
-	TAILQ_REMOVE(&connections, closure, entries);
+	if (closure->parent != NULL) {
+	    /* Multiplexed stream, the write event belongs to the parent. */
+	    TAILQ_REMOVE(&closure->parent->streams, closure, stream_entries);
+	    closure->parent->nstreams--;
+	    closure->write_ev = NULL;
+	} else {
+	    TAILQ_REMOVE(&connections, closure, entries);
+	    if (closure->sock != -1)
+		metrics_connection_close();
+	}
+	if (closure->read_paused) {
+	    TAILQ_REMOVE(&paused_connections, closure, paused_entries);
+	    num_paused--;
+	}
 
-	if (closure->state == CONNECTING && closure->journal != NULL) {
+	/* Streams cannot outlive the connection they are multiplexed over. */
+	while ((stream = TAILQ_FIRST(&closure->streams)) != NULL)
+	    connection_close(stream);
+
+	/* Release the outgoing queue slot, if any. */
+	logsrvd_queue_release(closure);
+	if (closure->journal_tail != NULL || closure->journal_writer != NULL) {
+	    /* Journal is still being written, it cannot be queued yet. */
+	    journal_tail_detach(closure);
+	} else if (closure->state == CONNECTING && closure->journal != NULL) {
 	    /* Failed to relay journal file, retry later. */
 	    logsrvd_queue_insert(closure);
 	}
 	if (closure->relay_closure != NULL)
-	    relay_closure_free(closure->relay_closure);
+	    relay_detach(closure);
 #if defined(HAVE_OPENSSL)
 	if (closure->ssl != NULL) {
 	    /* Must call SSL_shutdown() before closing closure->sock. */
@@ -130,7 +190,12 @@ connection_closure_free(struct connection_closure *closure)
 	    shutdown(closure->sock, SHUT_RDWR);
 	    close(closure->sock);
 	}
+	/* Write any I/O log records received before the connection closed. */
+	iolog_drain(closure);
+	iolog_discard(closure);
 	iolog_close_all(closure);
+	if (closure->commit_pending)
+	    TAILQ_REMOVE(&commit_pending, closure, commit_entries);
 	sudo_ev_free(closure->commit_ev);
 	sudo_ev_free(closure->read_ev);
 	sudo_ev_free(closure->write_ev);
@@ -138,24 +203,30 @@ connection_closure_free(struct connection_closure *closure)
 	sudo_ev_free(closure->ssl_accept_ev);
 #endif
 	eventlog_free(closure->evlog);
-	free(closure->read_buf.data);
-	while ((buf = TAILQ_FIRST(&closure->write_bufs)) != NULL) {
+	buffer_charge(&closure->buffered, closure->read_buf.size, 0);
+	bufpool_put_data(&closure->read_buf);
+#ifdef HAVE_ZLIB_H
+	if (closure->inflate != NULL) {
+	    buffer_charge(&closure->buffered, closure->inflate->buf.size, 0);
+	    msg_inflate_free(closure->inflate);
+	}
+#endif
+	TAILQ_FOREACH(buf, &closure->write_bufs, entries) {
 	    sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
 		"discarding write buffer %p, len %u", buf, buf->len - buf->off);
-	    TAILQ_REMOVE(&closure->write_bufs, buf, entries);
-	    free(buf->data);
-	    free(buf);
-	}
-	while ((buf = TAILQ_FIRST(&closure->free_bufs)) != NULL) {
-	    TAILQ_REMOVE(&closure->free_bufs, buf, entries);
-	    free(buf->data);
-	    free(buf);
 	}
+	free_buf_list(&closure->write_bufs, &closure->buffered);
 	free(closure->journal_path);
+	free(closure->relay_log_id);
 	if (closure->journal != NULL)
 	    fclose(closure->journal);
+	if (closure->journal_index != NULL)
+	    fclose(closure->journal_index);
 	free(closure);
 
+	/* The memory we freed may let paused connections resume. */
+	connection_resume_paused();
+
 	if (shutting_down && TAILQ_EMPTY(&connections))
 	    sudo_ev_loopbreak(evbase);
     }
@@ -177,10 +248,16 @@ connection_closure_alloc(int fd, bool tls, bool relay_only,
 	debug_return_ptr(NULL);
 
     closure->iolog_dir_fd = -1;
+    closure->iolog_index_fd = -1;
     closure->sock = relay_only ? -1 : fd;
     closure->evbase = base;
+    if (!relay_only) {
+	sudo_gettime_mono(&closure->start_time);
+	metrics_connection_open(tls);
+    }
     TAILQ_INIT(&closure->write_bufs);
-    TAILQ_INIT(&closure->free_bufs);
+    TAILQ_INIT(&closure->iolog_records);
+    TAILQ_INIT(&closure->streams);
 
     /* Use different message handlers depending on the operating mode. */
     if (relay_only) {
@@ -194,10 +271,9 @@ connection_closure_alloc(int fd, bool tls, bool relay_only,
 
     TAILQ_INSERT_TAIL(&connections, closure, entries);
 
-    closure->read_buf.size = 64 * 1024;
-    closure->read_buf.data = malloc(closure->read_buf.size);
-    if (closure->read_buf.data == NULL)
+    if (!bufpool_get_data(&closure->read_buf, READ_BUF_SIZE))
 	goto bad;
+    buffer_charge(&closure->buffered, 0, closure->read_buf.size);
 
     closure->read_ev = sudo_ev_alloc(fd, SUDO_EV_READ|SUDO_EV_PERSIST,
 	client_msg_cb, closure);
@@ -230,6 +306,49 @@ bad:
     debug_return_ptr(NULL);
 }
 
+/*
+ * Allocate a closure for a stream multiplexed over a client connection.
+ * A stream has no socket of its own, server messages for it are
+ * written via the parent connection.
+ */
+static struct connection_closure *
+stream_closure_alloc(uint32_t stream_id, struct connection_closure *parent)
+{
+    struct connection_closure *closure;
+    debug_decl(stream_closure_alloc, SUDO_DEBUG_UTIL);
+
+    if ((closure = calloc(1, sizeof(*closure))) == NULL)
+	debug_return_ptr(NULL);
+
+    closure->parent = parent;
+    closure->stream_id = stream_id;
+    closure->iolog_dir_fd = -1;
+    closure->iolog_index_fd = -1;
+    closure->sock = -1;
+    closure->tls = parent->tls;
+    closure->evbase = parent->evbase;
+    closure->write_ev = parent->write_ev;
+    memcpy(closure->ipaddr, parent->ipaddr, sizeof(closure->ipaddr));
+    TAILQ_INIT(&closure->write_bufs);
+    TAILQ_INIT(&closure->iolog_records);
+    TAILQ_INIT(&closure->streams);
+    closure->store_first = parent->store_first;
+    closure->cms = parent->cms;
+
+    TAILQ_INSERT_TAIL(&parent->streams, closure, stream_entries);
+    parent->nstreams++;
+
+    closure->commit_ev = sudo_ev_alloc(-1, SUDO_EV_TIMEOUT,
+	server_commit_cb, closure);
+    if (closure->commit_ev == NULL)
+	goto bad;
+
+    debug_return_ptr(closure);
+bad:
+    connection_closure_free(closure);
+    debug_return_ptr(NULL);
+}
+
 /*
  * Close the client connection when finished.
  * If in store-and-forward mode, initiate a relay connection.
@@ -256,7 +375,12 @@ connection_close(struct connection_closure *closure)
      * create a new connection for the relay and replay the journal.
      */
     if (closure->store_first && closure->state == FINISHED &&
-	    closure->relay_closure == NULL && closure->journal != NULL) {
+	    closure->relay_closure == NULL && closure->journal_tail != NULL) {
+	/* Journal is already being relayed, let the tail finish it. */
+	journal_tail_handoff(closure);
+    } else if (closure->store_first && closure->state == FINISHED &&
+	    closure->relay_closure == NULL && closure->journal != NULL &&
+	    !closure->journal_relayed) {
 	new_closure = connection_closure_alloc(fileno(closure->journal), false,
 	    true, closure->evbase);
 	if (new_closure != NULL) {
@@ -273,10 +397,12 @@ connection_close(struct connection_closure *closure)
 	    }
 	}
     }
-    if (closure->state == FINISHED && closure->journal_path != NULL) {
+    if (closure->state == FINISHED && closure->journal_path != NULL &&
+	    closure->journal_writer == NULL) {
 	/* Journal relayed successfully, remove backing file. */
 	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
 	    "removing journal file %s", closure->journal_path);
+	journal_relay_remove(closure);
 	unlink(closure->journal_path);
 
 	/* Process the next outgoing file (if any). */
@@ -287,52 +413,267 @@ connection_close(struct connection_closure *closure)
     debug_return;
 }
 
+/*
+ * Update the buffer memory charged to a connection (or relay connection)
+ * and the total for all connections when a buffer's size changes from
+ * oldsize to newsize.
+ */
+void
+buffer_charge(size_t *buffered, size_t oldsize, size_t newsize)
+{
+    *buffered = *buffered - oldsize + newsize;
+    buffered_total = buffered_total - oldsize + newsize;
+    metrics_buffers(buffered_total, num_paused);
+}
+
+/*
+ * Returns true if buffered is more than the per-connection limit or
+ * the total for all connections is more than the global limit, each
+ * divided by divisor.  A limit of zero means there is no limit.
+ */
+static bool
+buffer_over_limit(size_t buffered, unsigned int divisor)
+{
+    const size_t max_connection = logsrvd_conf_server_max_connection_memory();
+    const size_t max_total = logsrvd_conf_server_max_memory();
+    debug_decl(buffer_over_limit, SUDO_DEBUG_UTIL);
+
+    if (max_connection != 0 && buffered > max_connection / divisor)
+	debug_return_bool(true);
+    if (max_total != 0 && buffered_total > max_total / divisor)
+	debug_return_bool(true);
+    debug_return_bool(false);
+}
+
+/*
+ * Get a buffer from the shared pool with room for at least len bytes
+ * and charge it to a connection (or relay connection).
+ */
 struct connection_buffer *
-get_free_buf(size_t len, struct connection_closure *closure)
+get_free_buf(size_t len, size_t *buffered)
 {
     struct connection_buffer *buf;
     debug_decl(get_free_buf, SUDO_DEBUG_UTIL);
 
-    buf = TAILQ_FIRST(&closure->free_bufs);
-    if (buf != NULL) {
-        TAILQ_REMOVE(&closure->free_bufs, buf, entries);
+    if ((buf = bufpool_get(len)) == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	debug_return_ptr(NULL);
+    }
+    buffer_charge(buffered, 0, buf->size);
+
+    debug_return_ptr(buf);
+}
+
+/*
+ * Return a buffer that has been written to the shared pool for reuse.
+ * If more than half the buffer memory budget is in use, the buffer
+ * is freed instead so the memory is given back promptly.
+ */
+void
+release_buf(struct connection_buffer *buf, size_t *buffered)
+{
+    debug_decl(release_buf, SUDO_DEBUG_UTIL);
+
+    buffer_charge(buffered, buf->size, 0);
+    if (buffer_over_limit(*buffered, 2)) {
+	free(buf->data);
+	free(buf);
     } else {
-        if ((buf = calloc(1, sizeof(*buf))) == NULL)
-	    goto oom;
+	bufpool_put(buf);
+    }
+
+    debug_return;
+}
+
+/*
+ * Return all the buffers in a write list to the shared pool.
+ */
+void
+free_buf_list(struct connection_buffer_list *bufs, size_t *buffered)
+{
+    struct connection_buffer *buf;
+    debug_decl(free_buf_list, SUDO_DEBUG_UTIL);
+
+    while ((buf = TAILQ_FIRST(bufs)) != NULL) {
+	TAILQ_REMOVE(bufs, buf, entries);
+	buffer_charge(buffered, buf->size, 0);
+	bufpool_put(buf);
+    }
+
+    debug_return;
+}
+
+/*
+ * Combine the messages queued in write_bufs into the first buffer,
+ * up to the size of a TLS record, and release the buffers that were
+ * combined.  Returns false on memory allocation failure.
+ */
+bool
+coalesce_write_bufs(struct connection_buffer_list *write_bufs,
+    size_t *buffered)
+{
+    struct connection_buffer_list done = TAILQ_HEAD_INITIALIZER(done);
+    struct connection_buffer *buf = TAILQ_FIRST(write_bufs);
+    unsigned int oldsize;
+    bool ret;
+    debug_decl(coalesce_write_bufs, SUDO_DEBUG_UTIL);
+
+    if (buf == NULL || TAILQ_NEXT(buf, entries) == NULL)
+	debug_return_bool(true);
+
+    oldsize = buf->size;
+    ret = coalesce_bufs(write_bufs, &done, TLS_RECORD_SIZE);
+    buffer_charge(buffered, oldsize, buf->size);
+    while ((buf = TAILQ_FIRST(&done)) != NULL) {
+	TAILQ_REMOVE(&done, buf, entries);
+	release_buf(buf, buffered);
+    }
+
+    debug_return_bool(ret);
+}
+
+/*
+ * Returns true if the connection, or a relay connection one of its
+ * streams is being relayed over, has output queued.
+ */
+static bool
+connection_output_pending(struct connection_closure *closure)
+{
+    struct connection_closure *stream;
+    debug_decl(connection_output_pending, SUDO_DEBUG_UTIL);
+
+    if (!TAILQ_EMPTY(&closure->write_bufs))
+	debug_return_bool(true);
+    if (closure->relay_closure != NULL &&
+	    !TAILQ_EMPTY(&closure->relay_closure->write_bufs))
+	debug_return_bool(true);
+    TAILQ_FOREACH(stream, &closure->streams, stream_entries) {
+	if (stream->relay_closure != NULL &&
+		!TAILQ_EMPTY(&stream->relay_closure->write_bufs))
+	    debug_return_bool(true);
     }
+    debug_return_bool(false);
+}
 
-    if (len > buf->size) {
-	const unsigned int new_size = sudo_pow2_roundup(len);
-	if (new_size < len) {
-	    /* overflow */
-	    errno = ENOMEM;
-	    goto oom;
+/*
+ * Returns true if the connection, or a relay connection one of its
+ * streams is being relayed over, is using more than its buffer memory
+ * budget divided by divisor.
+ */
+static bool
+connection_over_limit(struct connection_closure *closure,
+    unsigned int divisor)
+{
+    struct connection_closure *stream;
+    debug_decl(connection_over_limit, SUDO_DEBUG_UTIL);
+
+    if (buffer_over_limit(closure->buffered, divisor))
+	debug_return_bool(true);
+    if (closure->relay_closure != NULL &&
+	    buffer_over_limit(closure->relay_closure->buffered, divisor))
+	debug_return_bool(true);
+    TAILQ_FOREACH(stream, &closure->streams, stream_entries) {
+	if (stream->relay_closure != NULL &&
+		buffer_over_limit(stream->relay_closure->buffered, divisor))
+	    debug_return_bool(true);
+    }
+    debug_return_bool(false);
+}
+
+/*
+ * Stop reading from a connection that is over its buffer memory budget
+ * until its queued output drains.  A connection with no output queued
+ * is not paused since there would be nothing to resume it.
+ */
+static void
+connection_pause(struct connection_closure *closure)
+{
+    struct connection_buffer *buf = &closure->read_buf;
+    debug_decl(connection_pause, SUDO_DEBUG_UTIL);
+
+    /* Can't stop reading if SSL_write() is waiting on the read event. */
+    if (closure->read_paused || closure->write_instead_of_read)
+	debug_return;
+    if (!sudo_ev_pending(closure->read_ev, SUDO_EV_READ, NULL))
+	debug_return;
+    if (!connection_output_pending(closure) ||
+	    !connection_over_limit(closure, 1))
+	debug_return;
+
+    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	"%s: pausing reads, %zu bytes buffered, %zu total", closure->ipaddr,
+	closure->buffered, buffered_total);
+    sudo_ev_del(closure->evbase, closure->read_ev);
+    closure->read_paused = true;
+    TAILQ_INSERT_TAIL(&paused_connections, closure, paused_entries);
+    num_paused++;
+
+    /* Give back memory we don't need while paused. */
+    bufpool_flush();
+    if (buf->size > READ_BUF_SIZE && buf->len - buf->off <= READ_BUF_SIZE) {
+	struct connection_buffer newbuf;
+	if (bufpool_get_data(&newbuf, READ_BUF_SIZE)) {
+	    const size_t len = buf->len - buf->off;
+	    memcpy(newbuf.data, buf->data + buf->off, len);
+	    buffer_charge(&closure->buffered, buf->size, newbuf.size);
+	    bufpool_put_data(buf);
+	    buf->data = newbuf.data;
+	    buf->size = newbuf.size;
+	    buf->len = len;
 	}
-	free(buf->data);
-	if ((buf->data = malloc(new_size)) == NULL)
-	    goto oom;
-	buf->size = new_size;
     }
+    metrics_buffers(buffered_total, num_paused);
 
-    debug_return_ptr(buf);
-oom:
-    if (buf != NULL) {
-	free(buf->data);
-	free(buf);
+    debug_return;
+}
+
+/*
+ * Resume reading from paused connections whose queued output has
+ * drained or that are now under half their buffer memory budget.
+ */
+void
+connection_resume_paused(void)
+{
+    struct connection_closure *closure, *next;
+    debug_decl(connection_resume_paused, SUDO_DEBUG_UTIL);
+
+    if (TAILQ_EMPTY(&paused_connections))
+	debug_return;
+
+    TAILQ_FOREACH_SAFE(closure, &paused_connections, paused_entries, next) {
+	if (connection_output_pending(closure) &&
+		connection_over_limit(closure, 2))
+	    continue;
+
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	    "%s: resuming reads, %zu bytes buffered, %zu total",
+	    closure->ipaddr, closure->buffered, buffered_total);
+	TAILQ_REMOVE(&paused_connections, closure, paused_entries);
+	closure->read_paused = false;
+	num_paused--;
+	/* Reads may have been stopped for good while we were paused. */
+	if (closure->state < EXITED && !closure->error) {
+	    if (sudo_ev_add(closure->evbase, closure->read_ev, NULL, false) == -1)
+		sudo_warnx("%s", U_("unable to add event to queue"));
+	}
     }
-    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
-    debug_return_ptr(NULL);
+    metrics_buffers(buffered_total, num_paused);
+
+    debug_return;
 }
 
 static bool
 fmt_server_message(struct connection_closure *closure, ServerMessage *msg)
 {
+    struct connection_closure *conn = closure->parent ? closure->parent : closure;
     struct connection_buffer *buf = NULL;
     uint32_t msg_len;
     bool ret = false;
     size_t len;
     debug_decl(fmt_server_message, SUDO_DEBUG_UTIL);
 
+    /* Messages for a multiplexed stream are written to its parent. */
+    msg->stream_id = closure->stream_id;
     len = server_message__get_packed_size(msg);
     if (len > MESSAGE_SIZE_MAX) {
 	sudo_warnx(U_("server message too large: %zu"), len);
@@ -346,7 +687,7 @@ fmt_server_message(struct connection_closure *closure, ServerMessage *msg)
     sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
 	"size + server message %zu bytes", len);
 
-    if ((buf = get_free_buf(len, closure)) == NULL) {
+    if ((buf = get_free_buf(len, &conn->buffered)) == NULL) {
 	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
 	    "unable to allocate connection_buffer");
         goto done;
@@ -354,7 +695,8 @@ fmt_server_message(struct connection_closure *closure, ServerMessage *msg)
     memcpy(buf->data, &msg_len, sizeof(msg_len));
     server_message__pack(msg, buf->data + sizeof(msg_len));
     buf->len = len;
-    TAILQ_INSERT_TAIL(&closure->write_bufs, buf, entries);
+    TAILQ_INSERT_TAIL(&conn->write_bufs, buf, entries);
+    metrics_server_message(msg->type_case, len);
 
     ret = true;
 
@@ -372,6 +714,14 @@ fmt_hello_message(struct connection_closure *closure)
     /* TODO: implement redirect and servers array.  */
     hello.server_id = (char *)server_id;
     hello.subcommands = true;
+    /* Streams are not supported when relaying a connection as-is. */
+    hello.multiplex = closure->relay_closure == NULL;
+    /* Batches are split up if the relay host does not support them. */
+    hello.iobuf_batch = true;
+#ifdef HAVE_ZLIB_H
+    /* Compressed messages are decompressed before being relayed. */
+    hello.compression = true;
+#endif
     msg.u.hello = &hello;
     msg.type_case = SERVER_MESSAGE__TYPE_HELLO;
 
@@ -417,7 +767,8 @@ schedule_error_message(const char *errstr, struct connection_closure *closure)
 	"send error to client: %s", errstr ? errstr : "none");
 
     /* Prevent further reads from the client, just write the error. */
-    sudo_ev_del(closure->evbase, closure->read_ev);
+    if (closure->read_ev != NULL)
+	sudo_ev_del(closure->evbase, closure->read_ev);
 
     if (errstr == NULL || closure->error || closure->write_ev == NULL)
 	goto done;
@@ -434,6 +785,9 @@ schedule_error_message(const char *errstr, struct connection_closure *closure)
 
 done:
     closure->error = true;
+    /* The parent closes the stream once the error has been written. */
+    if (closure->parent != NULL)
+	closure->parent->reap_streams = true;
     debug_return_bool(ret);
 }
 
@@ -559,7 +913,8 @@ handle_exit(ExitMessage *msg, uint8_t *buf, size_t len,
 	    closure->state = FINISHED;
 	}
     }
-    sudo_ev_del(closure->evbase, closure->read_ev);
+    if (closure->read_ev != NULL)
+	sudo_ev_del(closure->evbase, closure->read_ev);
 
     debug_return_bool(ret);
 }
@@ -626,21 +981,36 @@ handle_alert(AlertMessage *msg, uint8_t *buf, size_t len,
     debug_return_bool(closure->cms->alert(msg, buf, len, closure));
 }
 
-/* Enable a commit event if not relaying and it is not already pending. */
+/*
+ * Add the connection to the next group commit if not relaying and
+ * it is not already pending.
+ */
 static bool
 enable_commit(struct connection_closure *closure)
 {
     debug_decl(enable_commit, SUDO_DEBUG_UTIL);
 
-    if (closure->relay_closure == NULL) {
-	if (!ISSET(closure->commit_ev->flags, SUDO_EVQ_INSERTED)) {
-	    struct timespec tv = { ACK_FREQUENCY, 0 };
-	    if (sudo_ev_add(closure->evbase, closure->commit_ev, &tv, false) == -1) {
-		sudo_warnx("%s", U_("unable to add event to queue"));
-		debug_return_bool(false);
-	    }
+    if (closure->relay_closure != NULL || closure->commit_pending)
+	debug_return_bool(true);
+
+    if (group_commit_ev == NULL) {
+	group_commit_ev = sudo_ev_alloc(-1, SUDO_EV_TIMEOUT,
+	    group_commit_cb, NULL);
+	if (group_commit_ev == NULL) {
+	    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	    debug_return_bool(false);
 	}
     }
+    if (!ISSET(group_commit_ev->flags, SUDO_EVQ_INSERTED)) {
+	struct timespec tv = { logsrvd_conf_server_commit_interval(), 0 };
+	if (sudo_ev_add(closure->evbase, group_commit_ev, &tv, false) == -1) {
+	    sudo_warnx("%s", U_("unable to add event to queue"));
+	    debug_return_bool(false);
+	}
+    }
+    TAILQ_INSERT_TAIL(&commit_pending, closure, commit_entries);
+    closure->commit_pending = true;
+
     debug_return_bool(true);
 }
 
@@ -680,6 +1050,48 @@ handle_iobuf(int iofd, IoBuffer *iobuf, uint8_t *buf, size_t len,
     debug_return_bool(true);
 }
 
+static bool
+handle_iobuf_batch(IoBufferBatch *msg, uint8_t *buf, size_t len,
+    struct connection_closure *closure)
+{
+    const char *source = closure->journal_path ? closure->journal_path :
+	closure->ipaddr;
+    size_t n;
+    debug_decl(handle_iobuf_batch, SUDO_DEBUG_UTIL);
+
+    if (closure->state != RUNNING) {
+	sudo_warnx(U_("unexpected state %d for %s"), closure->state, source);
+	closure->errstr = _("state machine error");
+	debug_return_bool(false);
+    }
+    if (!closure->log_io) {
+	sudo_warnx(U_("%s: unexpected IoBuffer"), source);
+	closure->errstr = _("protocol error");
+	debug_return_bool(false);
+    }
+
+    /* Check that message is valid. */
+    for (n = 0; n < msg->n_records; n++) {
+	IoRecord *record = msg->records[n];
+	if (record->delay == NULL || record->iofd < IOFD_STDIN ||
+		record->iofd > IOFD_TTYOUT) {
+	    sudo_warnx(U_("%s: %s"), source, U_("invalid IoBufferBatch"));
+	    closure->errstr = _("invalid IoBufferBatch");
+	    debug_return_bool(false);
+	}
+    }
+    sudo_debug_printf(SUDO_DEBUG_INFO,
+	"%s: received IoBufferBatch with %zu records from %s",
+	source, msg->n_records, __func__);
+
+    if (!closure->cms->iobuf_batch(msg, buf, len, closure))
+	debug_return_bool(false);
+    if (!enable_commit(closure))
+	debug_return_bool(false);
+
+    debug_return_bool(true);
+}
+
 static bool
 handle_winsize(ChangeWindowSize *msg, uint8_t *buf, size_t len,
     struct connection_closure *closure)
@@ -768,28 +1180,25 @@ handle_client_hello(ClientHello *msg, uint8_t *buf, size_t len,
 
     sudo_debug_printf(SUDO_DEBUG_INFO, "%s: received ClientHello",
 	__func__);
-    sudo_debug_printf(SUDO_DEBUG_INFO, "%s: client ID %s",
-	__func__, msg->client_id ? msg->client_id : "unknown");
+    sudo_debug_printf(SUDO_DEBUG_INFO, "%s: client ID %s%s%s",
+	__func__, msg->client_id ? msg->client_id : "unknown",
+	msg->iobuf_batch ? " (iobuf_batch)" : "",
+	msg->compression ? " (compression)" : "");
 
     debug_return_bool(true);
 }
 
+/*
+ * Dispatch a ClientMessage to the handler for its type.
+ */
 static bool
-handle_client_message(uint8_t *buf, size_t len,
+dispatch_client_message(ClientMessage *msg, uint8_t *buf, size_t len,
     struct connection_closure *closure)
 {
     const char *source = closure->journal_path ? closure->journal_path :
         closure->ipaddr;
-    ClientMessage *msg;
     bool ret = false;
-    debug_decl(handle_client_message, SUDO_DEBUG_UTIL);
-
-    /* TODO: can we extract type_case without unpacking for relay case? */
-    msg = client_message__unpack(NULL, len, buf);
-    if (msg == NULL) {
-	sudo_warnx(U_("unable to unpack %s size %zu"), "ClientMessage", len);
-	debug_return_bool(false);
-    }
+    debug_decl(dispatch_client_message, SUDO_DEBUG_UTIL);
 
     switch (msg->type_case) {
     case CLIENT_MESSAGE__TYPE_ACCEPT_MSG:
@@ -822,6 +1231,9 @@ handle_client_message(uint8_t *buf, size_t len,
     case CLIENT_MESSAGE__TYPE_STDERR_BUF:
 	ret = handle_iobuf(IOFD_STDERR, msg->u.stderr_buf, buf, len, closure);
 	break;
+    case CLIENT_MESSAGE__TYPE_IOBUF_BATCH:
+	ret = handle_iobuf_batch(msg->u.iobuf_batch, buf, len, closure);
+	break;
     case CLIENT_MESSAGE__TYPE_WINSIZE_EVENT:
 	ret = handle_winsize(msg->u.winsize_event, buf, len, closure);
 	break;
@@ -837,7 +1249,308 @@ handle_client_message(uint8_t *buf, size_t len,
 	closure->errstr = _("unrecognized ClientMessage type");
 	break;
     }
-    client_message__free_unpacked(msg, NULL);
+
+    /* Commit lag is measured from the first record not yet committed. */
+    if (ret && closure->log_io && !sudo_timespecisset(&closure->commit_lag_start)) {
+	switch (msg->type_case) {
+	case CLIENT_MESSAGE__TYPE_EXIT_MSG:
+	case CLIENT_MESSAGE__TYPE_TTYIN_BUF:
+	case CLIENT_MESSAGE__TYPE_TTYOUT_BUF:
+	case CLIENT_MESSAGE__TYPE_STDIN_BUF:
+	case CLIENT_MESSAGE__TYPE_STDOUT_BUF:
+	case CLIENT_MESSAGE__TYPE_STDERR_BUF:
+	case CLIENT_MESSAGE__TYPE_IOBUF_BATCH:
+	case CLIENT_MESSAGE__TYPE_WINSIZE_EVENT:
+	case CLIENT_MESSAGE__TYPE_SUSPEND_EVENT:
+	    sudo_gettime_mono(&closure->commit_lag_start);
+	    break;
+	default:
+	    break;
+	}
+    }
+
+    debug_return_bool(ret);
+}
+
+/*
+ * Find the stream with the specified ID, allocating a new one if
+ * the message starts a session.  Returns NULL if the stream does
+ * not exist and cannot be created, setting errstr on error.
+ */
+static struct connection_closure *
+stream_lookup(ClientMessage *msg, struct connection_closure *closure)
+{
+    struct connection_closure *stream;
+    debug_decl(stream_lookup, SUDO_DEBUG_UTIL);
+
+    TAILQ_FOREACH(stream, &closure->streams, stream_entries) {
+	if (stream->stream_id == msg->stream_id)
+	    debug_return_ptr(stream);
+    }
+
+    switch (msg->type_case) {
+    case CLIENT_MESSAGE__TYPE_ACCEPT_MSG:
+    case CLIENT_MESSAGE__TYPE_REJECT_MSG:
+    case CLIENT_MESSAGE__TYPE_RESTART_MSG:
+	break;
+    default:
+	/* Stream was closed, the client will get (or got) an error. */
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	    "%s: ignoring message type %d for unknown stream %u",
+	    closure->ipaddr, msg->type_case, msg->stream_id);
+	debug_return_ptr(NULL);
+    }
+
+    if (closure->nstreams >= STREAMS_MAX) {
+	sudo_warnx(U_("%s: too many streams"), closure->ipaddr);
+	closure->errstr = _("too many streams");
+	debug_return_ptr(NULL);
+    }
+    stream = stream_closure_alloc(msg->stream_id, closure);
+    if (stream == NULL)
+	closure->errstr = _("unable to allocate memory");
+    debug_return_ptr(stream);
+}
+
+/*
+ * Finish handling a message for a multiplexed stream.  An error is
+ * reported to the client on the stream instead of the connection.
+ */
+static void
+stream_message_done(bool ok, struct connection_closure *stream)
+{
+    debug_decl(stream_message_done, SUDO_DEBUG_UTIL);
+
+    if (!ok) {
+	sudo_warnx(U_("%s: %s"), stream->ipaddr, U_("invalid ClientMessage"));
+	if (stream->errstr == NULL)
+	    stream->errstr = _("invalid ClientMessage");
+	if (!schedule_error_message(stream->errstr, stream))
+	    connection_close(stream);
+    } else if (stream->error || stream->state == FINISHED) {
+	connection_close(stream);
+    }
+
+    debug_return;
+}
+
+/*
+ * Handle a ClientMessage for a stream multiplexed over the connection.
+ * An error on the stream does not affect the connection's other streams.
+ * Returns false if the connection itself is in error.
+ */
+static bool
+handle_stream_message(ClientMessage *msg, uint8_t *buf, size_t len,
+    struct connection_closure *closure)
+{
+    struct connection_closure *stream;
+    debug_decl(handle_stream_message, SUDO_DEBUG_UTIL);
+
+    /* Connections relayed as-is do not support streams. */
+    if (closure->relay_closure != NULL ||
+	    msg->type_case == CLIENT_MESSAGE__TYPE_HELLO_MSG) {
+	sudo_warnx(U_("unexpected stream ID %u from %s"), msg->stream_id,
+	    closure->ipaddr);
+	closure->errstr = _("state machine error");
+	debug_return_bool(false);
+    }
+
+    stream = stream_lookup(msg, closure);
+    if (stream == NULL)
+	debug_return_bool(closure->errstr == NULL);
+
+    if (msg->type_case == CLIENT_MESSAGE__TYPE_CLOSE_STREAM_MSG) {
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	    "%s: stream %u closed by client: %s", closure->ipaddr,
+	    stream->stream_id, msg->u.close_stream_msg->reason);
+	connection_close(stream);
+	debug_return_bool(true);
+    }
+
+    stream_message_done(dispatch_client_message(msg, buf, len, stream),
+	stream);
+
+    debug_return_bool(true);
+}
+
+/*
+ * Decompress a compressed ClientMessage and handle the wire format
+ * messages it contains.  A message split across compressed messages
+ * is handled once the rest of it arrives.
+ */
+static bool
+handle_compressed(ProtobufCBinaryData *data, struct connection_closure *closure)
+{
+#ifdef HAVE_ZLIB_H
+    struct connection_buffer *buf;
+    size_t oldsize, msg_len;
+    uint8_t *msg;
+    bool ret = false;
+    int n;
+    debug_decl(handle_compressed, SUDO_DEBUG_UTIL);
+
+    if (closure->inflate == NULL) {
+	if ((closure->inflate = msg_inflate_alloc()) == NULL) {
+	    closure->errstr = _("unable to allocate memory");
+	    debug_return_bool(false);
+	}
+    }
+    buf = &closure->inflate->buf;
+
+    /*
+     * The compressed data is stored in the message arena, which is reset
+     * after each message is handled so it must be decompressed first.
+     */
+    oldsize = buf->size;
+    ret = msg_inflate(closure->inflate, data->data, data->len);
+    buffer_charge(&closure->buffered, oldsize, buf->size);
+    if (!ret) {
+	closure->errstr = _("invalid compressed message");
+	debug_return_bool(false);
+    }
+
+    closure->inflating = true;
+    while ((n = msg_inflate_next(closure->inflate, &msg, &msg_len)) == 1) {
+	if (!handle_client_message(msg, msg_len, closure)) {
+	    ret = false;
+	    break;
+	}
+    }
+    if (n == -1) {
+	sudo_warnx(U_("client message too large: %zu"), msg_len);
+	closure->errstr = _("client message too large");
+	ret = false;
+    }
+    closure->inflating = false;
+
+    debug_return_bool(ret);
+#else
+    debug_decl(handle_compressed, SUDO_DEBUG_UTIL);
+
+    sudo_warnx(U_("%s: compressed messages are not supported"),
+	closure->ipaddr);
+    closure->errstr = _("compressed messages are not supported");
+    debug_return_bool(false);
+#endif /* HAVE_ZLIB_H */
+}
+
+/*
+ * Relay an IoBuffer or IoBufferBatch for a connection, or one of its
+ * streams, being relayed without unpacking it.  The message is sent
+ * to the relay host as-is so only the fields used to track the session
+ * are decoded.  Returns -1 if the message must be unpacked and handled
+ * normally, else true on success and false on error.
+ */
+static int
+handle_client_message_raw(uint8_t *buf, size_t len,
+    struct connection_closure *closure)
+{
+    struct connection_closure *target = closure;
+    struct relay_peek peek;
+    struct timespec start;
+    bool ret;
+    debug_decl(handle_client_message_raw, SUDO_DEBUG_UTIL);
+
+    sudo_gettime_mono(&start);
+    if (!relay_peek_message(buf, len, &peek))
+	debug_return_int(-1);
+
+    /* Errors for unknown or misplaced streams are reported by unpacking. */
+    if (peek.stream_id != 0 && closure->sock != -1) {
+	if (closure->relay_closure != NULL)
+	    debug_return_int(-1);
+	TAILQ_FOREACH(target, &closure->streams, stream_entries) {
+	    if (target->stream_id == peek.stream_id)
+		break;
+	}
+	if (target == NULL)
+	    debug_return_int(-1);
+    }
+
+    /* The checks done by handle_iobuf() and handle_iobuf_batch(). */
+    if (target->cms != &cms_relay || target->relay_closure == NULL ||
+	    target->state != RUNNING || !target->log_io)
+	debug_return_int(-1);
+    if (peek.type_case == CLIENT_MESSAGE__TYPE_IOBUF_BATCH &&
+	    !target->relay_closure->iobuf_batch) {
+	/* Records are sent as separate IoBuffers. */
+	debug_return_int(-1);
+    }
+    metrics_observe(METRICS_DECODE_TIME, &start);
+    if (closure->sock != -1)
+	metrics_client_message(peek.type_case, len + sizeof(uint32_t));
+
+    ret = relay_iobuf_raw(&peek, buf, len, target);
+    if (ret && !sudo_timespecisset(&target->commit_lag_start))
+	sudo_gettime_mono(&target->commit_lag_start);
+    if (target != closure) {
+	stream_message_done(ret, target);
+	ret = true;
+    }
+
+    debug_return_int(ret);
+}
+
+static bool
+handle_client_message(uint8_t *buf, size_t len,
+    struct connection_closure *closure)
+{
+    const char *source = closure->journal_path ? closure->journal_path :
+        closure->ipaddr;
+    struct timespec start;
+    ClientMessage *msg;
+    bool ret;
+    debug_decl(handle_client_message, SUDO_DEBUG_UTIL);
+
+    /* I/O records being relayed are forwarded without unpacking them. */
+    if (closure->cms == &cms_relay || closure->nstreams != 0) {
+	const int rc = handle_client_message_raw(buf, len, closure);
+	if (rc != -1)
+	    debug_return_bool(rc);
+    }
+
+    if (client_msg_arena.block_size == 0)
+	protobuf_c_arena_init(&client_msg_arena, 0, NULL);
+
+    sudo_gettime_mono(&start);
+    msg = client_message__unpack(&client_msg_arena.base, len, buf);
+    if (msg == NULL) {
+	sudo_warnx(U_("unable to unpack %s size %zu"), "ClientMessage", len);
+	protobuf_c_arena_reset(&client_msg_arena);
+	debug_return_bool(false);
+    }
+    metrics_observe(METRICS_DECODE_TIME, &start);
+
+    /* Only count messages received over the network, not replayed ones. */
+    if (closure->sock != -1)
+	metrics_client_message(msg->type_case, len + sizeof(uint32_t));
+
+    /*
+     * Journaled messages may include the ID of the stream they were
+     * received on, it is only meaningful on a network connection.
+     */
+    if (msg->type_case == CLIENT_MESSAGE__TYPE_COMPRESSED) {
+	/* Compression applies to the connection, not to a stream. */
+	if (msg->stream_id != 0 || closure->inflating || closure->sock == -1) {
+	    sudo_warnx(U_("unexpected type_case value %d in %s from %s"),
+		msg->type_case, "ClientMessage", source);
+	    closure->errstr = _("unrecognized ClientMessage type");
+	    ret = false;
+	} else {
+	    ret = handle_compressed(&msg->u.compressed, closure);
+	}
+    } else if (msg->stream_id != 0 && closure->sock != -1) {
+	ret = handle_stream_message(msg, buf, len, closure);
+    } else if (msg->type_case == CLIENT_MESSAGE__TYPE_CLOSE_STREAM_MSG) {
+	sudo_warnx(U_("unexpected type_case value %d in %s from %s"),
+	    msg->type_case, "ClientMessage", source);
+	closure->errstr = _("unrecognized ClientMessage type");
+	ret = false;
+    } else {
+	ret = dispatch_client_message(msg, buf, len, closure);
+    }
+    /* The handlers do not retain pointers into msg. */
+    protobuf_c_arena_reset(&client_msg_arena);
 
     debug_return_bool(ret);
 }
@@ -859,7 +1572,7 @@ shutdown_cb(int unused, int what, void *v)
 static void
 server_shutdown(struct sudo_event_base *base)
 {
-    struct connection_closure *closure, *next;
+    struct connection_closure *closure, *next, *stream, *snext;
     struct sudo_event *ev;
     struct timespec tv = { 0, 0 };
     debug_decl(server_shutdown, SUDO_DEBUG_UTIL);
@@ -872,6 +1585,17 @@ server_shutdown(struct sudo_event_base *base)
     TAILQ_FOREACH_SAFE(closure, &connections, entries, next) {
 	closure->state = SHUTDOWN;
 	sudo_ev_del(base, closure->read_ev);
+	TAILQ_FOREACH_SAFE(stream, &closure->streams, stream_entries, snext) {
+	    stream->state = SHUTDOWN;
+	    if (stream->log_io) {
+		/* Schedule final commit point for the stream. */
+		if (sudo_ev_add(base, stream->commit_ev, &tv, false) == -1) {
+		    sudo_warnx("%s", U_("unable to add event to queue"));
+		}
+	    } else {
+		connection_close(stream);
+	    }
+	}
 	if (closure->relay_closure != NULL) {
 	    /* Connection being relayed, check for pending I/O. */
 	    relay_shutdown(closure);
@@ -880,7 +1604,7 @@ server_shutdown(struct sudo_event_base *base)
 	    if (sudo_ev_add(base, closure->commit_ev, &tv, false) == -1) {
 		sudo_warnx("%s", U_("unable to add event to queue"));
 	    }
-	} else {
+	} else if (TAILQ_EMPTY(&closure->streams)) {
 	    /* No commit point, close connection immediately. */
 	    connection_close(closure);
 	}
@@ -907,10 +1631,21 @@ static void
 server_msg_cb(int fd, int what, void *v)
 {
     struct connection_closure *closure = v;
+    struct connection_closure *stream, *next;
     struct connection_buffer *buf;
+    bool released = false;
     ssize_t nwritten;
     debug_decl(server_msg_cb, SUDO_DEBUG_UTIL);
 
+    /* Close streams with errors, their error message is queued. */
+    if (closure->reap_streams) {
+	closure->reap_streams = false;
+	TAILQ_FOREACH_SAFE(stream, &closure->streams, stream_entries, next) {
+	    if (stream->error)
+		connection_close(stream);
+	}
+    }
+
     /* For TLS we may need to write as part of SSL_read(). */
     if (closure->read_instead_of_write) {
 	closure->read_instead_of_write = false;
@@ -938,6 +1673,10 @@ server_msg_cb(int fd, int what, void *v)
 
 #if defined(HAVE_OPENSSL)
     if (closure->ssl != NULL) {
+	/* Send as many queued messages as possible in one TLS record. */
+	if (!coalesce_write_bufs(&closure->write_bufs, &closure->buffered))
+	    goto finished;
+	buf = TAILQ_FIRST(&closure->write_bufs);
         nwritten = SSL_write(closure->ssl, buf->data + buf->off,
 	    buf->len - buf->off);
         if (nwritten <= 0) {
@@ -969,7 +1708,8 @@ server_msg_cb(int fd, int what, void *v)
     } else
 #endif
     {
-	nwritten = write(fd, buf->data + buf->off, buf->len - buf->off);
+	/* Send all queued messages with a single system call. */
+	nwritten = writev_bufs(fd, &closure->write_bufs);
     }
 
     if (nwritten == -1) {
@@ -978,21 +1718,29 @@ server_msg_cb(int fd, int what, void *v)
 	sudo_warn("%s: write", closure->ipaddr);
 	goto finished;
     }
-    buf->off += nwritten;
 
-    if (buf->off == buf->len) {
-	/* sent entire message, move buf to free list */
+    /* Move the buffers that were sent in their entirety to the free list. */
+    while ((buf = TAILQ_FIRST(&closure->write_bufs)) != NULL) {
+	if ((size_t)nwritten < buf->len - buf->off) {
+	    buf->off += nwritten;
+	    break;
+	}
+	nwritten -= buf->len - buf->off;
 	sudo_debug_printf(SUDO_DEBUG_INFO,
 	    "%s: finished sending %u bytes to client", __func__, buf->len);
-	buf->off = 0;
-	buf->len = 0;
 	TAILQ_REMOVE(&closure->write_bufs, buf, entries);
-	TAILQ_INSERT_TAIL(&closure->free_bufs, buf, entries);
+	release_buf(buf, &closure->buffered);
+	released = true;
+    }
+
+    if (released) {
+	connection_resume_paused();
 	if (TAILQ_EMPTY(&closure->write_bufs)) {
 	    /* Write queue empty, check state. */
 	    sudo_ev_del(closure->evbase, closure->write_ev);
-	    if (closure->error || closure->state == FINISHED ||
-		    closure->state == SHUTDOWN)
+	    if (closure->error || closure->state == FINISHED)
+		goto finished;
+	    if (closure->state == SHUTDOWN && TAILQ_EMPTY(&closure->streams))
 		goto finished;
 	}
     }
@@ -1030,8 +1778,10 @@ client_msg_cb(int fd, int what, void *v)
     }
 
 #if defined(HAVE_OPENSSL)
+again:
     if (closure->ssl != NULL) {
-       nread = SSL_read(closure->ssl, buf->data + buf->len, buf->size);
+       nread = SSL_read(closure->ssl, buf->data + buf->len,
+	   buf->size - buf->len);
         if (nread <= 0) {
 	    const char *errstr;
             int err = SSL_get_error(closure->ssl, nread);
@@ -1094,6 +1844,10 @@ client_msg_cb(int fd, int what, void *v)
 	sudo_warn("%s: read", closure->ipaddr);
 	goto close_connection;
     case 0:
+	if (journal_tail_wait(closure)) {
+	    /* Caught up with a journal still being written, wait for more. */
+	    debug_return;
+	}
         if (closure->state != FINISHED) {
             sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
                 "unexpected EOF");
@@ -1117,10 +1871,18 @@ client_msg_cb(int fd, int what, void *v)
 
 	if (msg_len + sizeof(msg_len) > buf->len - buf->off) {
 	    /* Incomplete message, we'll read the rest next time. */
-	    if (!expand_buf(buf, msg_len + sizeof(msg_len))) {
+	    const size_t oldsize = buf->size;
+	    if (!bufpool_expand_data(buf, msg_len + sizeof(msg_len))) {
 		closure->errstr = _("unable to allocate memory");
 		goto send_error;
 	    }
+	    buffer_charge(&closure->buffered, oldsize, buf->size);
+#if defined(HAVE_OPENSSL)
+	    /* The rest of the TLS record may already be buffered by OpenSSL. */
+	    if (closure->ssl != NULL && SSL_pending(closure->ssl) > 0)
+		goto again;
+#endif
+	    connection_pause(closure);
 	    debug_return;
 	}
 
@@ -1141,6 +1903,20 @@ client_msg_cb(int fd, int what, void *v)
     if (closure->state == FINISHED)
 	goto close_connection;
 
+#if defined(HAVE_OPENSSL)
+    /*
+     * SSL_read() only returns as much of a TLS record as fits in the buffer.
+     * Data buffered by OpenSSL is no longer in the socket and will not
+     * trigger another read event, so consume it now.
+     */
+    if (closure->ssl != NULL && SSL_pending(closure->ssl) > 0 &&
+	    sudo_ev_pending(closure->read_ev, SUDO_EV_READ, NULL))
+	goto again;
+#endif
+
+    /* Stop reading if the client is sending faster than we can keep up. */
+    connection_pause(closure);
+
     debug_return;
 
 send_error:
@@ -1182,34 +1958,151 @@ schedule_commit_point(TimeSpec *commit_point,
 	    sudo_warnx("%s", U_("unable to add event to queue"));
 	    goto bad;
 	}
+	if (sudo_timespecisset(&closure->commit_lag_start)) {
+	    metrics_observe(METRICS_COMMIT_LAG, &closure->commit_lag_start);
+	    sudo_timespecclear(&closure->commit_lag_start);
+	}
+    } else if (sudo_timespecisset(&closure->commit_lag_start)) {
+	/* Relaying a journal, the client's commit point came from it. */
+	metrics_observe(METRICS_RELAY_LAG, &closure->commit_lag_start);
+	sudo_timespecclear(&closure->commit_lag_start);
+    }
+
+    if (closure->state == EXITED) {
+	/*
+	 * A relay host may send a periodic commit point after we have
+	 * passed on the ExitMessage; only the final one finishes us.
+	 */
+	struct timespec ts;
+
+	ts.tv_sec = (time_t)commit_point->tv_sec;
+	ts.tv_nsec = (long)commit_point->tv_nsec;
+	if (sudo_timespeccmp(&ts, &closure->elapsed_time, >=))
+	    closure->state = FINISHED;
     }
-
-    if (closure->state == EXITED)
-	closure->state = FINISHED;
     debug_return_bool(true);
 bad:
     debug_return_bool(false);
 }
 
 /*
- * Time-based event that fires periodically to report to the client
- * what has been committed to disk.
+ * Write out the connection's I/O log or journal so that it can be
+ * included in a commit point, syncing it to disk if commit_sync is set.
+ */
+static bool
+commit_prepare(struct connection_closure *closure)
+{
+    const bool sync = logsrvd_conf_server_commit_sync();
+    struct timespec start;
+    bool ret;
+    debug_decl(commit_prepare, SUDO_DEBUG_UTIL);
+
+    sudo_gettime_mono(&start);
+    if (closure->journal != NULL) {
+	/* Store-first connections write to a journal, not an I/O log. */
+	ret = journal_flush(closure, sync);
+    } else {
+	/* Write out buffered records so they are part of the commit point. */
+	ret = iolog_wbuf_flush(closure);
+
+	/* Flush the I/O logs and record the commit point for restarts. */
+	if (ret)
+	    ret = iolog_checkpoint_all(closure);
+
+	if (ret && sync)
+	    ret = iolog_sync_all(closure);
+    }
+    if (ret)
+	metrics_observe(METRICS_IOLOG_WRITE_TIME, &start);
+
+    debug_return_bool(ret);
+}
+
+/*
+ * Send a commit point to the client based on the elapsed time.
+ */
+static void
+send_commit_point(struct connection_closure *closure)
+{
+    TimeSpec commit_point = TIME_SPEC__INIT;
+    debug_decl(send_commit_point, SUDO_DEBUG_UTIL);
+
+    commit_point.tv_sec = closure->elapsed_time.tv_sec;
+    commit_point.tv_nsec = closure->elapsed_time.tv_nsec;
+    if (!schedule_commit_point(&commit_point, closure)) {
+	connection_close(closure);
+    } else if (closure->parent != NULL) {
+	/* A stream is done once its final commit point is queued. */
+	if (closure->state == FINISHED || closure->state == SHUTDOWN)
+	    connection_close(closure);
+    }
+
+    debug_return;
+}
+
+/*
+ * Time-based event that fires when the command has exited or the
+ * server is shutting down to report to the client what has been
+ * committed to disk.
  */
 static void
 server_commit_cb(int unused, int what, void *v)
 {
     struct connection_closure *closure = v;
-    TimeSpec commit_point = TIME_SPEC__INIT;
     debug_decl(server_commit_cb, SUDO_DEBUG_UTIL);
 
-    /* Flush I/O logs before sending commit point if needed. */
-    if (!iolog_get_flush())
-	iolog_flush_all(closure);
+    /* This commit point supersedes any pending group commit. */
+    if (closure->commit_pending) {
+	TAILQ_REMOVE(&commit_pending, closure, commit_entries);
+	closure->commit_pending = false;
+    }
+
+    /* The final commit point must include all records received. */
+    if (closure->state != RUNNING) {
+	if (!iolog_drain(closure)) {
+	    connection_close(closure);
+	    debug_return;
+	}
+    }
 
-    commit_point.tv_sec = closure->elapsed_time.tv_sec;
-    commit_point.tv_nsec = closure->elapsed_time.tv_nsec;
-    if (!schedule_commit_point(&commit_point, closure))
+    if (!commit_prepare(closure)) {
 	connection_close(closure);
+	debug_return;
+    }
+    send_commit_point(closure);
+
+    debug_return;
+}
+
+/*
+ * Time-based event that fires periodically to report to clients
+ * what has been committed to disk.  The I/O logs of all pending
+ * connections are written out (and synced) before any of the
+ * commit points are sent.
+ */
+static void
+group_commit_cb(int unused, int what, void *v)
+{
+    struct connection_list batch = TAILQ_HEAD_INITIALIZER(batch);
+    struct connection_closure *closure, *next;
+    debug_decl(group_commit_cb, SUDO_DEBUG_UTIL);
+
+    TAILQ_CONCAT(&batch, &commit_pending, commit_entries);
+    TAILQ_FOREACH(closure, &batch, commit_entries) {
+	closure->commit_pending = false;
+    }
+
+    TAILQ_FOREACH_SAFE(closure, &batch, commit_entries, next) {
+	if (!commit_prepare(closure)) {
+	    TAILQ_REMOVE(&batch, closure, commit_entries);
+	    connection_close(closure);
+	}
+    }
+
+    TAILQ_FOREACH_SAFE(closure, &batch, commit_entries, next) {
+	TAILQ_REMOVE(&batch, closure, commit_entries);
+	send_commit_point(closure);
+    }
 
     debug_return;
 }
@@ -1225,13 +2118,6 @@ start_protocol(struct connection_closure *closure)
     const struct timespec *timeout = logsrvd_conf_server_timeout();
     debug_decl(start_protocol, SUDO_DEBUG_UTIL);
 
-    if (closure->relay_closure != NULL && closure->relay_closure->relays != NULL) {
-	/* No longer need the stashed relays list. */
-	address_list_delref(closure->relay_closure->relays);
-	closure->relay_closure->relays = NULL;
-	closure->relay_closure->relay_addr = NULL;
-    }
-
     /* When replaying a journal there is no write event. */
     if (closure->write_ev != NULL) {
 	if (!fmt_hello_message(closure))
@@ -1239,6 +2125,10 @@ start_protocol(struct connection_closure *closure)
 
 	if (sudo_ev_add(closure->evbase, closure->write_ev, timeout, false) == -1)
 	    debug_return_bool(false);
+    } else if (closure->journal != NULL) {
+	/* Pick up where an interrupted relay of the journal left off. */
+	if (!journal_relay_resume(closure))
+	    debug_return_bool(false);
     }
 
     /* No read timeout, client messages may happen at arbitrary times. */
@@ -1291,6 +2181,35 @@ verify_peer_identity(int preverify_ok, X509_STORE_CTX *ctx)
     }
 }
 
+/*
+ * The verify callback is not called when a session is resumed.
+ * Check that the certificate stored in the session still matches
+ * the client's address.
+ */
+static bool
+verify_resumed_peer(struct connection_closure *closure)
+{
+    HostnameValidationResult result;
+    X509 *peer_cert;
+    debug_decl(verify_resumed_peer, SUDO_DEBUG_UTIL);
+
+    peer_cert = SSL_get_peer_certificate(closure->ssl);
+    if (peer_cert == NULL) {
+	sudo_warnx(U_("%s: resumed TLS session has no peer certificate"),
+	    closure->ipaddr);
+	debug_return_bool(false);
+    }
+    result = validate_hostname(peer_cert, closure->ipaddr, closure->ipaddr, 1);
+    X509_free(peer_cert);
+    if (result != MatchFound) {
+	sudo_warnx(U_("%s: resumed TLS session does not match peer"),
+	    closure->ipaddr);
+	debug_return_bool(false);
+    }
+
+    debug_return_bool(true);
+}
+
 /*
  * Set the TLS verify callback to verify_peer_identity().
  */
@@ -1385,9 +2304,23 @@ tls_handshake_cb(int fd, int what, void *v)
     }
 
     sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
-        "TLS version: %s, negotiated cipher suite: %s",
+        "TLS version: %s, negotiated cipher suite: %s%s",
         SSL_get_version(closure->ssl),
-        SSL_get_cipher(closure->ssl));
+        SSL_get_cipher(closure->ssl),
+	SSL_session_reused(closure->ssl) ? " (resumed)" : "");
+    if (SSL_session_reused(closure->ssl) &&
+	    logsrvd_conf_server_tls_check_peer()) {
+	if (!verify_resumed_peer(closure))
+	    goto bad;
+    }
+    metrics_observe(METRICS_TLS_HANDSHAKE_TIME, &closure->start_time);
+    metrics_tls_handshake(SSL_session_reused(closure->ssl));
+    if (logsrvd_conf_server_tls_ktls()) {
+	bool ktls_send, ktls_recv;
+
+	tls_ktls_status(closure->ssl, &ktls_send, &ktls_recv);
+	metrics_tls_ktls(ktls_send, ktls_recv);
+    }
 
     /* Start the actual protocol now that the TLS handshake is complete. */
     if (!TAILQ_EMPTY(logsrvd_conf_relay_address()) && !closure->store_first) {
@@ -1405,6 +2338,48 @@ bad:
 }
 #endif /* HAVE_OPENSSL */
 
+/*
+ * Check the credentials of a client connected to a Unix domain socket.
+ * Only root and the user sudo_logsrvd runs as may connect.
+ * Returns true if the client is allowed, else false.
+ */
+static bool
+check_peer_credentials(int sock)
+{
+    uid_t uid;
+    debug_decl(check_peer_credentials, SUDO_DEBUG_UTIL);
+
+#if defined(HAVE_GETPEEREID)
+    gid_t gid;
+
+    if (getpeereid(sock, &uid, &gid) == -1) {
+	sudo_warn("getpeereid");
+	debug_return_bool(false);
+    }
+#elif defined(SO_PEERCRED)
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+
+    if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1) {
+	sudo_warn("SO_PEERCRED");
+	debug_return_bool(false);
+    }
+    uid = cred.uid;
+#else
+    sudo_warnx("%s", U_("unable to determine the credentials of a local client"));
+    debug_return_bool(false);
+#endif
+
+    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	"local connection from uid %u", (unsigned int)uid);
+    if (uid != 0 && uid != geteuid()) {
+	sudo_warnx(U_("rejecting local connection from uid %u"),
+	    (unsigned int)uid);
+	debug_return_bool(false);
+    }
+    debug_return_bool(true);
+}
+
 /*
  * New connection.
  * Allocate a connection closure and optionally perform TLS handshake.
@@ -1428,6 +2403,11 @@ new_connection(int sock, bool tls, const union sockaddr_union *sa_un,
         inet_ntop(AF_INET6, &sa_un->sin6.sin6_addr, closure->ipaddr,
             sizeof(closure->ipaddr));
 #endif /* HAVE_STRUCT_IN6_ADDR */
+    } else if (sa_un->sa.sa_family == AF_UNIX) {
+	/* Local clients are authenticated by their credentials, not TLS. */
+	if (!check_peer_credentials(sock))
+	    goto bad;
+	(void)strlcpy(closure->ipaddr, "local", sizeof(closure->ipaddr));
     } else {
 	errno = EAFNOSUPPORT;
         sudo_warn("%s", U_("unable to get remote IP addr"));
@@ -1456,6 +2436,10 @@ new_connection(int sock, bool tls, const union sockaddr_union *sa_un,
             goto bad;
         }
 
+	/* Kernel TLS is used after the handshake if supported. */
+	if (logsrvd_conf_server_tls_ktls())
+	    tls_enable_ktls(closure->ssl);
+
         /* attach the closure object to the ssl connection object to make it
         available during hostname matching
         */
@@ -1491,7 +2475,7 @@ bad:
     debug_return_bool(false);
 }
 
-static int
+int
 create_listener(struct server_address *addr)
 {
     int flags, on, sock;
@@ -1503,6 +2487,25 @@ create_listener(struct server_address *addr)
 	goto bad;
     }
     on = 1;
+    if (addr->sa_un.sa.sa_family == AF_UNIX) {
+	const char *path = addr->sa_un.sunix.sun_path;
+	struct stat sb;
+
+	/* Remove a stale socket left behind by a previous instance. */
+	family = "unix";
+	if (lstat(path, &sb) == 0 && S_ISSOCK(sb.st_mode))
+	    unlink(path);
+	if (bind(sock, &addr->sa_un.sa, addr->sa_size) == -1) {
+	    sudo_warn("%s (%s)", addr->sa_str, family);
+	    goto bad;
+	}
+	/* Clients are also checked by uid when they connect. */
+	if (chmod(path, S_IRUSR|S_IWUSR) == -1) {
+	    sudo_warn("%s", path);
+	    goto bad;
+	}
+	goto bound;
+    }
 #ifdef HAVE_STRUCT_IN6_ADDR
     if (addr->sa_un.sa.sa_family == AF_INET6) {
 	family = "inet6";
@@ -1515,11 +2518,19 @@ create_listener(struct server_address *addr)
 #endif
     if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1)
 	sudo_warn("SO_REUSEADDR");
+#ifdef SO_REUSEPORT
+    /* Each worker has its own listener, the kernel balances between them. */
+    if (num_workers > 1) {
+	if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1)
+	    sudo_warn("SO_REUSEPORT");
+    }
+#endif
     if (bind(sock, &addr->sa_un.sa, addr->sa_size) == -1) {
 	/* TODO: only warn once for IPv4 and IPv6 or disambiguate */
 	sudo_warn("%s (%s)", addr->sa_str, family);
 	goto bad;
     }
+bound:
     if (listen(sock, SOMAXCONN) == -1) {
 	sudo_warn("listen");
 	goto bad;
@@ -1552,7 +2563,10 @@ listener_cb(int fd, int what, void *v)
     memset(&sa_un, 0, sizeof(sa_un));
     sock = accept(fd, &sa_un.sa, &salen);
     if (sock != -1) {
-	if (logsrvd_conf_server_tcp_keepalive()) {
+	if (l->path != NULL) {
+	    /* Unnamed Unix domain peers may not have an address family. */
+	    sa_un.sa.sa_family = AF_UNIX;
+	} else if (logsrvd_conf_server_tcp_keepalive()) {
 	    int keepalive = 1;
 	    if (setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &keepalive,
 		    sizeof(keepalive)) == -1) {
@@ -1590,6 +2604,11 @@ register_listener(struct server_address *addr, struct sudo_event_base *evbase)
 	sudo_fatalx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
     l->sock = sock;
     l->tls = addr->tls;
+    l->path = NULL;
+    if (addr->sa_un.sa.sa_family == AF_UNIX) {
+	if ((l->path = strdup(addr->sa_un.sunix.sun_path)) == NULL)
+	    sudo_fatalx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+    }
     l->ev = sudo_ev_alloc(sock, SUDO_EV_READ|SUDO_EV_PERSIST, listener_cb, l);
     if (l->ev == NULL)
 	sudo_fatalx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
@@ -1601,28 +2620,50 @@ register_listener(struct server_address *addr, struct sudo_event_base *evbase)
 }
 
 /*
- * Register listeners and set the TLS verify callback.
+ * Close and free all listeners.
  */
-static bool
-server_setup(struct sudo_event_base *base)
+static void
+server_free_listeners(void)
 {
-    struct server_address *addr;
     struct listener *l;
-    int nlisteners = 0;
-    bool ret;
-    debug_decl(server_setup, SUDO_DEBUG_UTIL);
+    debug_decl(server_free_listeners, SUDO_DEBUG_UTIL);
 
-    /* Free old listeners (if any) and register new ones. */
     while ((l = TAILQ_FIRST(&listeners)) != NULL) {
 	TAILQ_REMOVE(&listeners, l, entries);
 	sudo_ev_free(l->ev);
 	close(l->sock);
+	if (l->path != NULL) {
+	    unlink(l->path);
+	    free(l->path);
+	}
 	free(l);
     }
+
+    debug_return;
+}
+
+/*
+ * Register listeners and set the TLS verify callback.
+ */
+static bool
+server_setup(struct sudo_event_base *base)
+{
+    struct server_address *addr;
+    int nlisteners = 0, nskipped = 0;
+    bool ret;
+    debug_decl(server_setup, SUDO_DEBUG_UTIL);
+
+    /* Free old listeners (if any) and register new ones. */
+    server_free_listeners();
     TAILQ_FOREACH(addr, logsrvd_conf_server_listen_address(), entries) {
+	/* A Unix domain socket can't be shared via SO_REUSEPORT. */
+	if (addr->sa_un.sa.sa_family == AF_UNIX && worker_idx != 0) {
+	    nskipped++;
+	    continue;
+	}
 	nlisteners += register_listener(addr, base);
     }
-    ret = nlisteners > 0;
+    ret = nlisteners + nskipped > 0;
 
 #if defined(HAVE_OPENSSL)
     if (ret)
@@ -1646,6 +2687,10 @@ server_reload(struct sudo_event_base *evbase)
 	if (!server_setup(evbase))
 	    sudo_fatalx("%s", U_("unable to setup listen socket"));
 
+	/* With workers, the metrics listener belongs to the supervisor. */
+	if (num_workers == 1)
+	    metrics_setup(evbase);
+
 	/* Re-read sudo.conf and re-initialize debugging. */
 	sudo_debug_deregister(logsrvd_debug_instance);
 	logsrvd_debug_instance = SUDO_DEBUG_INSTANCE_INITIALIZER;
@@ -1658,6 +2703,33 @@ server_reload(struct sudo_event_base *evbase)
     debug_return;
 }
 
+/*
+ * Format the IP address of a server address for display.
+ */
+const char *
+server_address_ntop(struct server_address *addr, char *buf, size_t bufsize)
+{
+    union sockaddr_union *sa_un = &addr->sa_un;
+
+    switch (sa_un->sa.sa_family) {
+    case AF_INET:
+	inet_ntop(AF_INET, &sa_un->sin.sin_addr, buf, bufsize);
+	break;
+#ifdef HAVE_STRUCT_IN6_ADDR
+    case AF_INET6:
+	inet_ntop(AF_INET6, &sa_un->sin6.sin6_addr, buf, bufsize);
+	break;
+#endif /* HAVE_STRUCT_IN6_ADDR */
+    case AF_UNIX:
+	(void)strlcpy(buf, sa_un->sunix.sun_path, bufsize);
+	break;
+    default:
+	(void)strlcpy(buf, "[unknown]", bufsize);
+	break;
+    }
+    return buf;
+}
+
 /*
  * Dump server information to the debug file.
  * Includes information about listeners and client connections.
@@ -1677,24 +2749,39 @@ server_dump_stats(void)
     sudo_debug_printf(SUDO_DEBUG_INFO, "listen addresses:");
     n = 0;
     TAILQ_FOREACH(addr, logsrvd_conf_server_listen_address(), entries) {
-	union sockaddr_union *sa_un = &addr->sa_un;
 	char ipaddr[INET6_ADDRSTRLEN];
 
-	switch (sa_un->sa.sa_family) {
-	case AF_INET:
-	    inet_ntop(AF_INET, &sa_un->sin.sin_addr, ipaddr, sizeof(ipaddr));
+	sudo_debug_printf(SUDO_DEBUG_INFO, "  %d: %s [%s]", ++n,
+	    addr->sa_str, server_address_ntop(addr, ipaddr, sizeof(ipaddr)));
+    }
+
+    if (!TAILQ_EMPTY(logsrvd_conf_relay_address())) {
+	const char *balance = "failover";
+
+	switch (logsrvd_conf_relay_balance()) {
+	case RELAY_BALANCE_FAILOVER:
 	    break;
-#ifdef HAVE_STRUCT_IN6_ADDR
-	case AF_INET6:
-	    inet_ntop(AF_INET6, &sa_un->sin6.sin6_addr, ipaddr, sizeof(ipaddr));
+	case RELAY_BALANCE_ROUND_ROBIN:
+	    balance = "round-robin";
 	    break;
-#endif /* HAVE_STRUCT_IN6_ADDR */
-	default:
-	    (void)strlcpy(ipaddr, "[unknown]", sizeof(ipaddr));
+	case RELAY_BALANCE_LEAST_CONN:
+	    balance = "least-connections";
+	    break;
+	case RELAY_BALANCE_HASH:
+	    balance = "hash";
 	    break;
 	}
-	sudo_debug_printf(SUDO_DEBUG_INFO, "  %d: %s [%s]", ++n,
-	    addr->sa_str, ipaddr);
+	sudo_debug_printf(SUDO_DEBUG_INFO, "relay addresses (balance %s):",
+	    balance);
+	n = 0;
+	TAILQ_FOREACH(addr, logsrvd_conf_relay_address(), entries) {
+	    char ipaddr[INET6_ADDRSTRLEN];
+
+	    sudo_debug_printf(SUDO_DEBUG_INFO, "  %d: %s [%s], %u session%s",
+		++n, addr->sa_str,
+		server_address_ntop(addr, ipaddr, sizeof(ipaddr)),
+		addr->nsessions, addr->nsessions == 1 ? "" : "s");
+	}
     }
 
     if (!TAILQ_EMPTY(&connections)) {
@@ -1721,6 +2808,17 @@ server_dump_stats(void)
 		    relay_closure->relay_name.ipaddr);
 		sudo_debug_printf(SUDO_DEBUG_INFO, "      relay sock: %d",
 		    relay_closure->sock);
+		if (relay_closure->shared) {
+		    sudo_debug_printf(SUDO_DEBUG_INFO,
+			"      relay stream: %u of %u",
+			closure->relay_stream_id, relay_closure->nstreams);
+		}
+		sudo_debug_printf(SUDO_DEBUG_INFO,
+		    "      relay buffers: %zu bytes", relay_closure->buffered);
+	    }
+	    if (closure->nstreams != 0) {
+		sudo_debug_printf(SUDO_DEBUG_INFO, "      streams: %u",
+		    closure->nstreams);
 	    }
 	    sudo_debug_printf(SUDO_DEBUG_INFO, "      state: %d", closure->state);
 	    if (closure->errstr != NULL) {
@@ -1731,6 +2829,17 @@ server_dump_stats(void)
 		closure->log_io ? "true" : "false");
 	    sudo_debug_printf(SUDO_DEBUG_INFO, "      store first: %s",
 		closure->store_first ? "true" : "false");
+	    if (closure->iolog_queued != 0) {
+		sudo_debug_printf(SUDO_DEBUG_INFO,
+		    "      queued I/O log data: %zu bytes", closure->iolog_queued);
+	    }
+	    if (closure->iolog_buffered != 0) {
+		sudo_debug_printf(SUDO_DEBUG_INFO,
+		    "      buffered I/O log data: %zu bytes",
+		    closure->iolog_buffered);
+	    }
+	    sudo_debug_printf(SUDO_DEBUG_INFO, "      buffers: %zu bytes%s",
+		closure->buffered, closure->read_paused ? " (reads paused)" : "");
 	    if (sudo_timespecisset(&closure->elapsed_time)) {
 		sudo_debug_printf(SUDO_DEBUG_INFO,
 		    "      elapsed time: [%lld, %ld]",
@@ -1738,7 +2847,10 @@ server_dump_stats(void)
 		    (long)closure->elapsed_time.tv_nsec);
 	    }
 	}
-	sudo_debug_printf(SUDO_DEBUG_INFO, "%d client connection(s)\n", n);
+	sudo_debug_printf(SUDO_DEBUG_INFO, "%d client connection(s)", n);
+	sudo_debug_printf(SUDO_DEBUG_INFO,
+	    "%zu bytes buffered, %u connection(s) paused\n", buffered_total,
+	    num_paused);
     }
     logsrvd_queue_dump();
 
@@ -1786,6 +2898,263 @@ register_signal(int signo, struct sudo_event_base *base)
     debug_return;
 }
 
+/*
+ * Worker process main loop, does not return.
+ * The worker discards the supervisor's event base and sets up its
+ * own listeners, signal handlers and outgoing relay queue.
+ */
+static void
+worker_main(unsigned int idx, struct sudo_event_base *parent_base,
+    sigset_t *omask)
+{
+    struct sudo_event_base *evbase;
+    unsigned int i;
+    debug_decl(worker_main, SUDO_DEBUG_UTIL);
+
+    sudo_ev_base_free(parent_base);
+    for (i = 0; i < num_supervisor_signal_events; i++)
+	sudo_ev_free(supervisor_signal_events[i]);
+    num_supervisor_signal_events = 0;
+    sudo_ev_free(worker_restart_ev);
+    worker_restart_ev = NULL;
+    free(worker_pids);
+    worker_pids = NULL;
+    metrics_free_listeners();
+    metrics_select(idx);
+    worker_idx = idx;
+
+    if ((evbase = sudo_ev_base_alloc()) == NULL)
+	sudo_fatalx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+    if (!server_setup(evbase))
+	sudo_fatalx("%s", U_("unable to setup listen socket"));
+
+    register_signal(SIGHUP, evbase);
+    register_signal(SIGINT, evbase);
+    register_signal(SIGTERM, evbase);
+    register_signal(SIGUSR1, evbase);
+    sigprocmask(SIG_SETMASK, omask, NULL);
+
+    sudo_debug_printf(SUDO_DEBUG_INFO, "worker %u running", idx);
+    if (!bufpool_setup(evbase))
+	sudo_fatalx("%s", U_("unable to setup buffer pool"));
+    logsrvd_queue_scan(evbase);
+    sudo_ev_dispatch(evbase);
+    logsrvd_conf_cleanup();
+
+    exit(EXIT_SUCCESS);
+}
+
+/*
+ * Fork worker number idx.  Signals are blocked until the child
+ * has replaced the supervisor's signal handlers with its own.
+ */
+static bool
+start_worker(unsigned int idx, struct sudo_event_base *evbase)
+{
+    sigset_t mask, omask;
+    pid_t pid;
+    debug_decl(start_worker, SUDO_DEBUG_UTIL);
+
+    sigfillset(&mask);
+    sigprocmask(SIG_BLOCK, &mask, &omask);
+    switch (pid = sudo_debug_fork()) {
+    case -1:
+	sudo_warn("fork");
+	sigprocmask(SIG_SETMASK, &omask, NULL);
+	debug_return_bool(false);
+    case 0:
+	/* child */
+	worker_main(idx, evbase, &omask);
+	/* NOTREACHED */
+    default:
+	break;
+    }
+    sigprocmask(SIG_SETMASK, &omask, NULL);
+
+    worker_pids[idx] = pid;
+    sudo_debug_printf(SUDO_DEBUG_INFO, "started worker %u, pid %d",
+	idx, (int)pid);
+
+    debug_return_bool(true);
+}
+
+/*
+ * Restart any workers that have exited.
+ */
+static void
+worker_restart_cb(int unused, int what, void *v)
+{
+    struct sudo_event_base *evbase = v;
+    struct timespec tv = { WORKER_RESTART_DELAY, 0 };
+    unsigned int i;
+    debug_decl(worker_restart_cb, SUDO_DEBUG_UTIL);
+
+    for (i = 0; i < num_workers; i++) {
+	if (worker_pids[i] != -1)
+	    continue;
+	if (!start_worker(i, evbase)) {
+	    /* Try again later. */
+	    if (sudo_ev_add(evbase, worker_restart_ev, &tv, false) == -1)
+		sudo_warnx("%s", U_("unable to add event to queue"));
+	    break;
+	}
+    }
+
+    debug_return;
+}
+
+/*
+ * Send the specified signal to all running workers.
+ */
+static void
+signal_workers(int signo)
+{
+    unsigned int i;
+    debug_decl(signal_workers, SUDO_DEBUG_UTIL);
+
+    for (i = 0; i < num_workers; i++) {
+	if (worker_pids[i] != -1)
+	    kill(worker_pids[i], signo);
+    }
+
+    debug_return;
+}
+
+/*
+ * Reap exited workers.  Unless we are shutting down, workers that
+ * exit are restarted after a short delay.
+ */
+static void
+reap_workers(struct sudo_event_base *evbase)
+{
+    struct timespec tv = { WORKER_RESTART_DELAY, 0 };
+    unsigned int i, nrunning = 0;
+    int status;
+    pid_t pid;
+    debug_decl(reap_workers, SUDO_DEBUG_UTIL);
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+	for (i = 0; i < num_workers; i++) {
+	    if (worker_pids[i] == pid) {
+		worker_pids[i] = -1;
+		metrics_reset_gauges(i);
+		break;
+	    }
+	}
+	if (i == num_workers || workers_shutdown)
+	    continue;
+	if (WIFSIGNALED(status)) {
+	    sudo_warnx(U_("worker %d killed by signal %d"), (int)pid,
+		WTERMSIG(status));
+	} else {
+	    sudo_warnx(U_("worker %d exited with status %d"), (int)pid,
+		WEXITSTATUS(status));
+	}
+	if (sudo_ev_add(evbase, worker_restart_ev, &tv, false) == -1)
+	    sudo_warnx("%s", U_("unable to add event to queue"));
+    }
+
+    for (i = 0; i < num_workers; i++) {
+	if (worker_pids[i] != -1)
+	    nrunning++;
+    }
+    if (workers_shutdown && nrunning == 0)
+	sudo_ev_loopbreak(evbase);
+
+    debug_return;
+}
+
+static void
+supervisor_signal_cb(int signo, int what, void *v)
+{
+    struct sudo_event_base *evbase = v;
+    unsigned int i;
+    debug_decl(supervisor_signal_cb, SUDO_DEBUG_UTIL);
+
+    switch (signo) {
+	case SIGCHLD:
+	    reap_workers(evbase);
+	    break;
+	case SIGHUP:
+	    /* Workers reload their own configuration. */
+	    signal_workers(signo);
+	    break;
+	case SIGINT:
+	case SIGTERM:
+	    workers_shutdown = true;
+	    sudo_ev_del(evbase, worker_restart_ev);
+	    signal_workers(signo);
+	    reap_workers(evbase);
+	    break;
+	case SIGUSR1:
+	    sudo_debug_printf(SUDO_DEBUG_INFO, "%s", server_id);
+	    for (i = 0; i < num_workers; i++) {
+		sudo_debug_printf(SUDO_DEBUG_INFO, "  worker %u: pid %d",
+		    i, (int)worker_pids[i]);
+	    }
+	    signal_workers(signo);
+	    break;
+	default:
+	    sudo_warnx(U_("unexpected signal %d"), signo);
+	    break;
+    }
+
+    debug_return;
+}
+
+static void
+register_supervisor_signal(int signo, struct sudo_event_base *base)
+{
+    struct sudo_event *ev;
+    debug_decl(register_supervisor_signal, SUDO_DEBUG_UTIL);
+
+    if (num_supervisor_signal_events == nitems(supervisor_signal_events))
+	sudo_fatalx("%s: too many signal events", __func__);
+    ev = sudo_ev_alloc(signo, SUDO_EV_SIGNAL, supervisor_signal_cb, base);
+    if (ev == NULL)
+	sudo_fatalx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+    if (sudo_ev_add(base, ev, NULL, false) == -1)
+	sudo_fatal("%s", U_("unable to add event to queue"));
+    supervisor_signal_events[num_supervisor_signal_events++] = ev;
+
+    debug_return;
+}
+
+/*
+ * Start the worker processes and supervise them until shutdown.
+ * Each worker has its own event base, listeners and connections;
+ * the kernel distributes incoming connections via SO_REUSEPORT.
+ */
+static void
+supervise_workers(struct sudo_event_base *evbase)
+{
+    unsigned int i;
+    debug_decl(supervise_workers, SUDO_DEBUG_UTIL);
+
+    worker_pids = reallocarray(NULL, num_workers, sizeof(pid_t));
+    if (worker_pids == NULL)
+	sudo_fatalx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+    for (i = 0; i < num_workers; i++)
+	worker_pids[i] = -1;
+
+    worker_restart_ev = sudo_ev_alloc(-1, SUDO_EV_TIMEOUT, worker_restart_cb,
+	evbase);
+    if (worker_restart_ev == NULL)
+	sudo_fatalx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+
+    for (i = 0; i < num_workers; i++) {
+	if (!start_worker(i, evbase))
+	    sudo_fatalx("%s", U_("unable to start worker process"));
+    }
+
+    sudo_ev_dispatch(evbase);
+
+    free(worker_pids);
+    worker_pids = NULL;
+
+    debug_return;
+}
+
 static void
 logsrvd_cleanup(void)
 {
@@ -2002,17 +3371,48 @@ main(int argc, char *argv[])
     if (!server_setup(evbase))
 	sudo_fatalx("%s", U_("unable to setup listen socket"));
 
-    register_signal(SIGHUP, evbase);
-    register_signal(SIGINT, evbase);
-    register_signal(SIGTERM, evbase);
-    register_signal(SIGUSR1, evbase);
+    num_workers = logsrvd_conf_server_workers();
+#ifndef SO_REUSEPORT
+    if (num_workers > 1) {
+	sudo_warnx(U_("%s not supported on this system, ignoring"),
+	    "workers");
+	num_workers = 1;
+    }
+#endif
+    /* Each worker process gets its own metrics slot. */
+    if (!metrics_init(num_workers))
+	sudo_fatalx("%s", U_("unable to initialize metrics"));
+    if (!metrics_setup(evbase))
+	sudo_fatalx("%s", U_("unable to setup metrics listen socket"));
+
+    if (num_workers > 1) {
+	/* The listeners were only opened to check the config. */
+	server_free_listeners();
+
+	register_supervisor_signal(SIGCHLD, evbase);
+	register_supervisor_signal(SIGHUP, evbase);
+	register_supervisor_signal(SIGINT, evbase);
+	register_supervisor_signal(SIGTERM, evbase);
+	register_supervisor_signal(SIGUSR1, evbase);
+    } else {
+	register_signal(SIGHUP, evbase);
+	register_signal(SIGINT, evbase);
+	register_signal(SIGTERM, evbase);
+	register_signal(SIGUSR1, evbase);
+    }
 
     /* Point of no return. */
     daemonize(nofork);
     signal(SIGPIPE, SIG_IGN);
 
-    logsrvd_queue_scan(evbase);
-    sudo_ev_dispatch(evbase);
+    if (num_workers > 1) {
+	supervise_workers(evbase);
+    } else {
+	if (!bufpool_setup(evbase))
+	    sudo_fatalx("%s", U_("unable to setup buffer pool"));
+	logsrvd_queue_scan(evbase);
+	sudo_ev_dispatch(evbase);
+    }
     if (!nofork && logsrvd_conf_pid_file() != NULL)
 	unlink(logsrvd_conf_pid_file());
     logsrvd_conf_cleanup();
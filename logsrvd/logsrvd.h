@@ -40,15 +40,60 @@
 /* Default timeout value for server socket */
 #define DEFAULT_SOCKET_TIMEOUT_SEC 30
 
-/* How often to send an ACK to the client (commit point) in seconds */
+/* Default lifetime of a resumable TLS session in seconds */
+#define DEFAULT_TLS_SESSION_TIMEOUT	7200
+
+/* Default interval between commit points (ACKs) to the client in seconds */
 #define ACK_FREQUENCY	10
 
 /* Shutdown timeout (in seconds) in case client connections time out. */
 #define SHUTDOWN_TIMEO	10
 
+/* Delay (in seconds) before restarting a worker process that exited. */
+#define WORKER_RESTART_DELAY	1
+
 /* Template for mkstemp(3) when creating temporary files. */
 #define RELAY_TEMPLATE	"relay.XXXXXXXX"
 
+/* Suffix of the restart index stored alongside an incoming journal. */
+#define JOURNAL_INDEX_SUFFIX	".idx"
+
+/* Suffix of the upstream relay state stored alongside a journal. */
+#define JOURNAL_RELAY_SUFFIX	".relay"
+
+/* Minimum amount of journal data (in bytes) between index entries. */
+#define JOURNAL_INDEX_INTERVAL	(64 * 1024)
+
+/* Max queued I/O log data per connection before writing synchronously. */
+#define IOLOG_QUEUE_MAX		(1024 * 1024)
+
+/* Max queued I/O log data written per connection each writer pass. */
+#define IOLOG_WRITE_SLICE	(64 * 1024)
+
+/* Buffered I/O log data per connection before it is written out. */
+#define IOLOG_WBUF_SIZE		(64 * 1024)
+
+/* Max time (in seconds) I/O log data may stay buffered. */
+#define IOLOG_WBUF_TIMEOUT	1
+
+/* Restart index stored in the I/O log directory, one entry per commit. */
+#define IOLOG_INDEX_FILE	"timing.idx"
+
+/* Max multiplexed streams per client connection. */
+#define STREAMS_MAX		1024
+
+/* Time (in seconds) an unused shared relay connection is kept open. */
+#define RELAY_IDLE_TIMEO	60
+
+/* Initial size of a client connection's read buffer. */
+#define READ_BUF_SIZE		(64 * 1024)
+
+/* Default buffer memory limit per connection (in bytes). */
+#define DEFAULT_CONNECTION_MEMORY	(16 * 1024 * 1024)
+
+/* Default limit on free buffers kept for reuse (in bytes). */
+#define DEFAULT_POOL_MEMORY	(8 * 1024 * 1024)
+
 /*
  * Connection status.
  * In the RUNNING state we expect I/O log buffers.
@@ -62,39 +107,128 @@ enum connection_status {
     FINISHED
 };
 
+/*
+ * How a relay host is chosen for a new relay connection.
+ */
+enum relay_balance {
+    RELAY_BALANCE_FAILOVER,
+    RELAY_BALANCE_ROUND_ROBIN,
+    RELAY_BALANCE_LEAST_CONN,
+    RELAY_BALANCE_HASH
+};
+
+/*
+ * Latency histograms exported by the metrics listener.
+ */
+enum metrics_histogram_id {
+    METRICS_DECODE_TIME,
+    METRICS_IOLOG_WRITE_TIME,
+    METRICS_COMMIT_LAG,
+    METRICS_TLS_HANDSHAKE_TIME,
+    METRICS_RELAY_LAG,
+    METRICS_NHISTOGRAMS
+};
+
+TAILQ_HEAD(connection_list, connection_closure);
+
+/*
+ * Fields of an I/O record ClientMessage that are decoded when it
+ * is relayed as-is instead of unpacking the whole message.
+ */
+struct relay_peek {
+    int type_case;		/* ClientMessage__TypeCase */
+    uint32_t stream_id;
+    TimeSpec delay;		/* total delay of the record(s) */
+};
+
 /*
  * Per-connection relay state.
+ * A relay connection may be shared by multiple streams (connections
+ * being relayed) when the relay host supports multiplexing.
  */
 struct relay_closure {
+    TAILQ_ENTRY(relay_closure) entries;
+    struct connection_list streams;
+    struct sudo_event_base *evbase;
     struct server_address_list *relays;
+    struct server_address *relay_first;
     struct server_address *relay_addr;
     struct sudo_event *read_ev;
     struct sudo_event *write_ev;
     struct sudo_event *connect_ev;
+    struct sudo_event *idle_ev;
     struct connection_buffer read_buf;
     struct connection_buffer_list write_bufs;
+    struct msg_deflate *deflate;
     struct peer_info relay_name;
 #if defined(HAVE_OPENSSL)
     struct tls_client_closure tls_client;
 #endif
+    const char *errstr;
+    size_t buffered;
+    unsigned int nstreams;
+    uint32_t next_stream_id;
     int sock;
+    bool shared;
+    bool ready;
+    bool multiplex;
+    bool iobuf_batch;
     bool read_instead_of_write;
     bool write_instead_of_read;
     bool temporary_write_event;
 };
 
+/*
+ * I/O log record (timing line and optional data) that has been
+ * received but not yet written to the I/O log.
+ */
+struct iolog_record {
+    TAILQ_ENTRY(iolog_record) entries;
+    struct timespec delay;
+    char *timing;
+    uint8_t *data;
+    size_t timing_len;
+    size_t data_len;
+    int iofd;
+};
+TAILQ_HEAD(iolog_record_list, iolog_record);
+
+/*
+ * Write-combining buffer for an I/O log file.
+ * Also tracks the file offset at the last commit point.
+ */
+struct iolog_wbuf {
+    uint8_t *data;
+    size_t len;
+    size_t size;
+    off_t checkpoint;
+    bool dirty;
+};
+
 /*
  * Per-connection state.
  */
 struct connection_closure {
     TAILQ_ENTRY(connection_closure) entries;
+    TAILQ_ENTRY(connection_closure) iolog_entries;
+    TAILQ_ENTRY(connection_closure) iolog_wbuf_entries;
+    TAILQ_ENTRY(connection_closure) commit_entries;
+    TAILQ_ENTRY(connection_closure) stream_entries;
+    TAILQ_ENTRY(connection_closure) relay_entries;
+    TAILQ_ENTRY(connection_closure) paused_entries;
+    struct connection_list streams;
+    struct connection_closure *parent;
+    struct iolog_record_list iolog_records;
     struct client_message_switch *cms;
     struct relay_closure *relay_closure;
     struct eventlog *evlog;
     struct timespec elapsed_time;
+    struct timespec iolog_wbuf_time;
+    struct timespec start_time;
+    struct timespec commit_lag_start;
     struct connection_buffer read_buf;
     struct connection_buffer_list write_bufs;
-    struct connection_buffer_list free_bufs;
+    struct msg_inflate *inflate;
     struct sudo_event_base *evbase;
     struct sudo_event *commit_ev;
     struct sudo_event *read_ev;
@@ -104,16 +238,40 @@ struct connection_closure {
     SSL *ssl;
 #endif
     const char *errstr;
+    struct connection_closure *journal_tail;
+    struct connection_closure *journal_writer;
     FILE *journal;
+    FILE *journal_index;
     char *journal_path;
+    off_t journal_offset;
+    off_t journal_index_offset;
+    char *relay_log_id;
+    struct timespec relay_commit;
+    off_t queue_inflight;
     struct iolog_file iolog_files[IOFD_MAX];
+    struct iolog_wbuf iolog_wbufs[IOFD_MAX];
+    size_t iolog_queued;
+    size_t iolog_buffered;
+    size_t buffered;
     int iolog_dir_fd;
+    int iolog_index_fd;
     int sock;
+    unsigned int nstreams;
+    uint32_t stream_id;
+    uint32_t relay_stream_id;
     enum connection_status state;
     bool error;
+    bool iolog_pending;
+    bool iolog_wbuf_pending;
+    bool commit_pending;
     bool tls;
     bool log_io;
     bool store_first;
+    bool reap_streams;
+    bool read_paused;
+    bool tail_waiting;
+    bool journal_relayed;
+    bool inflating;
     bool read_instead_of_write;
     bool write_instead_of_read;
     bool temporary_write_event;
@@ -142,6 +300,8 @@ struct client_message_switch {
 	struct connection_closure *closure);
     bool (*winsize)(ChangeWindowSize *msg, uint8_t *buf, size_t len,
 	struct connection_closure *closure);
+    bool (*iobuf_batch)(IoBufferBatch *msg, uint8_t *buf, size_t len,
+	struct connection_closure *closure);
 };
 
 union sockaddr_union {
@@ -150,6 +310,7 @@ union sockaddr_union {
 #ifdef HAVE_STRUCT_IN6_ADDR
     struct sockaddr_in6 sin6;
 #endif
+    struct sockaddr_un sunix;
 };
 
 /*
@@ -161,6 +322,8 @@ struct server_address {
     char *sa_str;
     union sockaddr_union sa_un;
     socklen_t sa_size;
+    unsigned int nsessions;	/* relayed sessions using this address */
+    time_t down_until;		/* skip relay until this (monotonic) time */
     bool tls;
 };
 TAILQ_HEAD(server_address_list, server_address);
@@ -171,6 +334,7 @@ TAILQ_HEAD(server_address_list, server_address);
 struct listener {
     TAILQ_ENTRY(listener) entries;
     struct sudo_event *ev;
+    char *path;			/* Unix domain socket path, if any */
     int sock;
     bool tls;
 };
@@ -191,7 +355,15 @@ bool iolog_init(AcceptMessage *msg, struct connection_closure *closure);
 bool iolog_create(int iofd, struct connection_closure *closure);
 void iolog_close_all(struct connection_closure *closure);
 bool iolog_flush_all(struct connection_closure *closure);
+bool iolog_sync_all(struct connection_closure *closure);
+bool iolog_checkpoint_all(struct connection_closure *closure);
+bool iolog_queue_record(int iofd, TimeSpec *delay, const char *timing, size_t timing_len, const uint8_t *data, size_t data_len, struct connection_closure *closure);
+bool iolog_drain(struct connection_closure *closure);
+bool iolog_wbuf_flush(struct connection_closure *closure);
+void iolog_discard(struct connection_closure *closure);
 bool iolog_rewrite(const struct timespec *target, struct connection_closure *closure);
+bool iolog_resume(const struct timespec *target, struct connection_closure *closure);
+bool iolog_truncate_all(struct connection_closure *closure);
 void update_elapsed_time(TimeSpec *delta, struct timespec *elapsed);
 
 /* logsrvd.c */
@@ -201,8 +373,24 @@ void connection_close(struct connection_closure *closure);
 bool schedule_commit_point(TimeSpec *commit_point, struct connection_closure *closure);
 bool fmt_log_id_message(const char *id, struct connection_closure *closure);
 bool schedule_error_message(const char *errstr, struct connection_closure *closure);
-struct connection_buffer *get_free_buf(size_t, struct connection_closure *closure);
+struct connection_buffer *get_free_buf(size_t len, size_t *buffered);
+void release_buf(struct connection_buffer *buf, size_t *buffered);
+void free_buf_list(struct connection_buffer_list *bufs, size_t *buffered);
+bool coalesce_write_bufs(struct connection_buffer_list *write_bufs, size_t *buffered);
+void buffer_charge(size_t *buffered, size_t oldsize, size_t newsize);
+void connection_resume_paused(void);
 struct connection_closure *connection_closure_alloc(int fd, bool tls, bool relay_only, struct sudo_event_base *base);
+const char *server_address_ntop(struct server_address *addr, char *buf, size_t bufsize);
+int create_listener(struct server_address *addr);
+
+/* logsrvd_bufpool.c */
+bool bufpool_setup(struct sudo_event_base *evbase);
+struct connection_buffer *bufpool_get(size_t len);
+void bufpool_put(struct connection_buffer *buf);
+bool bufpool_get_data(struct connection_buffer *buf, size_t len);
+void bufpool_put_data(struct connection_buffer *buf);
+bool bufpool_expand_data(struct connection_buffer *buf, size_t needed);
+void bufpool_flush(void);
 
 /* logsrvd_conf.c */
 bool logsrvd_conf_read(const char *path);
@@ -211,20 +399,36 @@ const char *logsrvd_conf_iolog_file(void);
 bool logsrvd_conf_iolog_log_passwords(void);
 void *logsrvd_conf_iolog_passprompt_regex(void);
 struct server_address_list *logsrvd_conf_server_listen_address(void);
+struct server_address_list *logsrvd_conf_server_metrics_address(void);
 struct server_address_list *logsrvd_conf_relay_address(void);
 const char *logsrvd_conf_relay_dir(void);
 bool logsrvd_conf_relay_store_first(void);
+bool logsrvd_conf_relay_store_first_tail(void);
 bool logsrvd_conf_relay_tcp_keepalive(void);
 bool logsrvd_conf_server_tcp_keepalive(void);
+unsigned int logsrvd_conf_server_workers(void);
+size_t logsrvd_conf_server_max_connection_memory(void);
+size_t logsrvd_conf_server_max_memory(void);
+size_t logsrvd_conf_server_max_pool_memory(void);
+time_t logsrvd_conf_server_commit_interval(void);
+bool logsrvd_conf_server_commit_sync(void);
 const char *logsrvd_conf_pid_file(void);
 struct timespec *logsrvd_conf_server_timeout(void);
 struct timespec *logsrvd_conf_relay_connect_timeout(void);
 struct timespec *logsrvd_conf_relay_timeout(void);
 time_t logsrvd_conf_relay_retry_interval(void);
+unsigned int logsrvd_conf_relay_concurrency(void);
+size_t logsrvd_conf_relay_max_inflight(void);
+bool logsrvd_conf_relay_multiplex(void);
+bool logsrvd_conf_relay_compress(void);
+unsigned int logsrvd_conf_relay_max_streams(void);
+enum relay_balance logsrvd_conf_relay_balance(void);
 #if defined(HAVE_OPENSSL)
 bool logsrvd_conf_server_tls_check_peer(void);
+bool logsrvd_conf_server_tls_ktls(void);
 SSL_CTX *logsrvd_server_tls_ctx(void);
 bool logsrvd_conf_relay_tls_check_peer(void);
+bool logsrvd_conf_relay_tls_ktls(void);
 SSL_CTX *logsrvd_relay_tls_ctx(void);
 #endif
 bool logsrvd_conf_log_exit(void);
@@ -238,6 +442,14 @@ void logsrvd_warn_stderr(bool enabled);
 
 /* logsrvd_journal.c */
 extern struct client_message_switch cms_journal;
+bool journal_flush(struct connection_closure *closure, bool sync);
+char *journal_submithost(struct connection_closure *closure);
+void journal_tail_handoff(struct connection_closure *closure);
+void journal_tail_detach(struct connection_closure *closure);
+bool journal_tail_wait(struct connection_closure *closure);
+void journal_relay_update(const char *log_id, TimeSpec *commit_point, struct connection_closure *closure);
+void journal_relay_remove(struct connection_closure *closure);
+bool journal_relay_resume(struct connection_closure *closure);
 
 /* logsrvd_local.c */
 extern struct client_message_switch cms_local;
@@ -248,19 +460,43 @@ bool store_exit_local(ExitMessage *msg, uint8_t *buf, size_t len, struct connect
 bool store_restart_local(RestartMessage *msg, uint8_t *buf, size_t len, struct connection_closure *closure);
 bool store_alert_local(AlertMessage *msg, uint8_t *buf, size_t len, struct connection_closure *closure);
 bool store_iobuf_local(int iofd, IoBuffer *iobuf, uint8_t *buf, size_t len, struct connection_closure *closure);
+bool store_iobuf_batch_local(IoBufferBatch *msg, uint8_t *buf, size_t len, struct connection_closure *closure);
 bool store_winsize_local(ChangeWindowSize *msg, uint8_t *buf, size_t len, struct connection_closure *closure);
 bool store_suspend_local(CommandSuspend *msg, uint8_t *buf, size_t len, struct connection_closure *closure);
 
+/* logsrvd_metrics.c */
+bool metrics_init(unsigned int nslots);
+bool metrics_setup(struct sudo_event_base *evbase);
+void metrics_free_listeners(void);
+void metrics_select(unsigned int slot);
+void metrics_reset_gauges(unsigned int slot);
+void metrics_connection_open(bool tls);
+void metrics_connection_close(void);
+void metrics_tls_handshake(bool resumed);
+void metrics_tls_ktls(bool ktls_send, bool ktls_recv);
+void metrics_client_message(int type, size_t len);
+void metrics_server_message(int type, size_t len);
+void metrics_relay_queue(unsigned int active, size_t inflight);
+void metrics_buffers(size_t buffered, unsigned int paused);
+void metrics_buffer_pool(uint64_t hits, uint64_t misses, size_t pooled);
+void metrics_observe(enum metrics_histogram_id id, const struct timespec *start);
+
+/* logsrvd_peek.c */
+bool relay_peek_message(const uint8_t *buf, size_t len, struct relay_peek *peek);
+
 /* logsrvd_queue.c */
 bool logsrvd_queue_enable(time_t timeout, struct sudo_event_base *evbase);
 bool logsrvd_queue_insert(struct connection_closure *closure);
 bool logsrvd_queue_scan(struct sudo_event_base *evbase);
 void logsrvd_queue_dump(void);
+void logsrvd_queue_release(struct connection_closure *closure);
 
 /* logsrvd_relay.c */
 extern struct client_message_switch cms_relay;
-void relay_closure_free(struct relay_closure *relay_closure);
+void relay_detach(struct connection_closure *closure);
 bool connect_relay(struct connection_closure *closure);
 bool relay_shutdown(struct connection_closure *closure);
+bool relay_resume(struct connection_closure *closure);
+bool relay_iobuf_raw(struct relay_peek *peek, uint8_t *buf, size_t len, struct connection_closure *closure);
 
 #endif /* SUDO_LOGSRVD_H */
@@ -0,0 +1,388 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * This is an open source non-commercial project. Dear PVS-Studio, please check it.
+ * PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+ */
+
+#include <config.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+#include <errno.h>
+#ifdef HAVE_STDBOOL_H
+# include <stdbool.h>
+#else
+# include "compat/stdbool.h"
+#endif /* HAVE_STDBOOL_H */
+#if defined(HAVE_STDINT_H)
+# include <stdint.h>
+#elif defined(HAVE_INTTYPES_H)
+# include <inttypes.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sudo_compat.h"
+#include "sudo_conf.h"
+#include "sudo_debug.h"
+#include "sudo_event.h"
+#include "sudo_eventlog.h"
+#include "sudo_fatal.h"
+#include "sudo_gettext.h"
+#include "sudo_iolog.h"
+#include "sudo_queue.h"
+#include "sudo_util.h"
+
+#include "logsrvd.h"
+
+/*
+ * Pooled buffers are kept in power of two size classes from
+ * 2^BUFPOOL_MIN_SHIFT to 2^BUFPOOL_MAX_SHIFT bytes.  The largest
+ * class holds a read buffer for a maximum size message.
+ */
+#define BUFPOOL_MIN_SHIFT	8
+#define BUFPOOL_MAX_SHIFT	22
+#define BUFPOOL_NCLASSES	(BUFPOOL_MAX_SHIFT - BUFPOOL_MIN_SHIFT + 1)
+
+/* Interval (in seconds) at which unused pooled buffers are freed. */
+#define BUFPOOL_TRIM_INTERVAL	10
+
+/*
+ * Free buffers of a single size, most recently released first.
+ * The low water mark is the fewest buffers that were in the class
+ * since the last trim, that many were not needed and can be freed.
+ */
+struct bufpool_class {
+    struct connection_buffer_list bufs;
+    unsigned int count;
+    unsigned int lowat;
+};
+
+static struct bufpool_class bufpool[BUFPOOL_NCLASSES];
+
+/* Buffer headers whose data was lent out as a read buffer. */
+static struct connection_buffer_list bufpool_spares =
+    TAILQ_HEAD_INITIALIZER(bufpool_spares);
+
+static struct sudo_event_base *bufpool_evbase;
+static struct sudo_event *bufpool_trim_ev;
+static size_t bufpool_bytes;
+static uint64_t bufpool_hits;
+static uint64_t bufpool_misses;
+
+/*
+ * Returns the index of the smallest size class that holds len bytes,
+ * or -1 if len is larger than the largest class.
+ */
+static int
+bufpool_class(size_t len)
+{
+    unsigned int shift;
+
+    for (shift = BUFPOOL_MIN_SHIFT; shift <= BUFPOOL_MAX_SHIFT; shift++) {
+	if (len <= ((size_t)1 << shift))
+	    return (int)(shift - BUFPOOL_MIN_SHIFT);
+    }
+    return -1;
+}
+
+static void
+bufpool_free(struct connection_buffer *buf)
+{
+    free(buf->data);
+    free(buf);
+}
+
+/*
+ * Free the pooled buffers that were not needed since the last trim.
+ */
+static void
+bufpool_trim_cb(int unused, int what, void *v)
+{
+    struct connection_buffer *buf;
+    unsigned int i, n, trimmed = 0;
+    debug_decl(bufpool_trim_cb, SUDO_DEBUG_UTIL);
+
+    for (i = 0; i < BUFPOOL_NCLASSES; i++) {
+	struct bufpool_class *pc = &bufpool[i];
+
+	for (n = pc->lowat; n > 0; n--) {
+	    if ((buf = TAILQ_LAST(&pc->bufs, connection_buffer_list)) == NULL)
+		break;
+	    TAILQ_REMOVE(&pc->bufs, buf, entries);
+	    pc->count--;
+	    bufpool_bytes -= buf->size;
+	    bufpool_free(buf);
+	    trimmed++;
+	}
+	pc->lowat = pc->count;
+    }
+    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	"trimmed %u pooled buffers, %zu bytes remain pooled", trimmed,
+	bufpool_bytes);
+    metrics_buffer_pool(bufpool_hits, bufpool_misses, bufpool_bytes);
+
+    if (bufpool_bytes != 0) {
+	struct timespec tv = { BUFPOOL_TRIM_INTERVAL, 0 };
+	if (sudo_ev_add(bufpool_evbase, bufpool_trim_ev, &tv, false) == -1)
+	    sudo_warnx("%s", U_("unable to add event to queue"));
+    }
+
+    debug_return;
+}
+
+/*
+ * Set up the buffer pool for the event base of this process.
+ * Until this is called, buffers are allocated and freed directly.
+ */
+bool
+bufpool_setup(struct sudo_event_base *evbase)
+{
+    unsigned int i;
+    debug_decl(bufpool_setup, SUDO_DEBUG_UTIL);
+
+    if (bufpool_trim_ev == NULL) {
+	for (i = 0; i < BUFPOOL_NCLASSES; i++)
+	    TAILQ_INIT(&bufpool[i].bufs);
+	bufpool_trim_ev = sudo_ev_alloc(-1, SUDO_EV_TIMEOUT,
+	    bufpool_trim_cb, NULL);
+	if (bufpool_trim_ev == NULL) {
+	    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	    debug_return_bool(false);
+	}
+    }
+    bufpool_evbase = evbase;
+
+    debug_return_bool(true);
+}
+
+/*
+ * Get a buffer with room for at least len bytes, reusing a pooled
+ * buffer of the matching size class if there is one.
+ */
+struct connection_buffer *
+bufpool_get(size_t len)
+{
+    struct connection_buffer *buf;
+    size_t size;
+    int idx;
+    debug_decl(bufpool_get, SUDO_DEBUG_UTIL);
+
+    idx = bufpool_class(len);
+    if (idx != -1) {
+	struct bufpool_class *pc = &bufpool[idx];
+
+	if (bufpool_evbase != NULL &&
+		(buf = TAILQ_FIRST(&pc->bufs)) != NULL) {
+	    TAILQ_REMOVE(&pc->bufs, buf, entries);
+	    if (--pc->count < pc->lowat)
+		pc->lowat = pc->count;
+	    bufpool_bytes -= buf->size;
+	    bufpool_hits++;
+	    metrics_buffer_pool(bufpool_hits, bufpool_misses, bufpool_bytes);
+	    debug_return_ptr(buf);
+	}
+	size = (size_t)1 << (idx + BUFPOOL_MIN_SHIFT);
+    } else {
+	size = sudo_pow2_roundup(len);
+	if (size < len) {
+	    /* overflow */
+	    errno = ENOMEM;
+	    debug_return_ptr(NULL);
+	}
+    }
+
+    if ((buf = calloc(1, sizeof(*buf))) == NULL)
+	debug_return_ptr(NULL);
+    if ((buf->data = malloc(size)) == NULL) {
+	free(buf);
+	debug_return_ptr(NULL);
+    }
+    buf->size = size;
+    bufpool_misses++;
+    metrics_buffer_pool(bufpool_hits, bufpool_misses, bufpool_bytes);
+
+    debug_return_ptr(buf);
+}
+
+/*
+ * Return a buffer to the pool, or free it if it is not the size of
+ * a class or the pool is already at its maximum size.
+ */
+void
+bufpool_put(struct connection_buffer *buf)
+{
+    const size_t max_pool = logsrvd_conf_server_max_pool_memory();
+    int idx;
+    debug_decl(bufpool_put, SUDO_DEBUG_UTIL);
+
+    buf->off = 0;
+    buf->len = 0;
+    idx = bufpool_class(buf->size);
+    if (bufpool_evbase == NULL || idx == -1 ||
+	    buf->size != (size_t)1 << (idx + BUFPOOL_MIN_SHIFT) ||
+	    bufpool_bytes + buf->size > max_pool) {
+	bufpool_free(buf);
+	debug_return;
+    }
+
+    TAILQ_INSERT_HEAD(&bufpool[idx].bufs, buf, entries);
+    bufpool[idx].count++;
+    bufpool_bytes += buf->size;
+    metrics_buffer_pool(bufpool_hits, bufpool_misses, bufpool_bytes);
+
+    if (!ISSET(bufpool_trim_ev->flags, SUDO_EVQ_INSERTED)) {
+	struct timespec tv = { BUFPOOL_TRIM_INTERVAL, 0 };
+	if (sudo_ev_add(bufpool_evbase, bufpool_trim_ev, &tv, false) == -1)
+	    sudo_warnx("%s", U_("unable to add event to queue"));
+    }
+
+    debug_return;
+}
+
+/*
+ * Fill in a buffer that is embedded in a closure, such as a read
+ * buffer, with pooled data of at least len bytes.
+ */
+bool
+bufpool_get_data(struct connection_buffer *buf, size_t len)
+{
+    struct connection_buffer *pbuf;
+    debug_decl(bufpool_get_data, SUDO_DEBUG_UTIL);
+
+    if ((pbuf = bufpool_get(len)) == NULL)
+	debug_return_bool(false);
+    buf->data = pbuf->data;
+    buf->size = pbuf->size;
+    buf->len = 0;
+    buf->off = 0;
+
+    /* Keep the header to return the data to the pool with later. */
+    pbuf->data = NULL;
+    pbuf->size = 0;
+    TAILQ_INSERT_HEAD(&bufpool_spares, pbuf, entries);
+
+    debug_return_bool(true);
+}
+
+/*
+ * Return the data of a buffer embedded in a closure to the pool.
+ */
+void
+bufpool_put_data(struct connection_buffer *buf)
+{
+    struct connection_buffer *pbuf;
+    debug_decl(bufpool_put_data, SUDO_DEBUG_UTIL);
+
+    if (buf->data == NULL)
+	debug_return;
+
+    if ((pbuf = TAILQ_FIRST(&bufpool_spares)) != NULL) {
+	TAILQ_REMOVE(&bufpool_spares, pbuf, entries);
+    } else {
+	pbuf = calloc(1, sizeof(*pbuf));
+    }
+    if (pbuf != NULL) {
+	pbuf->data = buf->data;
+	pbuf->size = buf->size;
+	bufpool_put(pbuf);
+    } else {
+	free(buf->data);
+    }
+    buf->data = NULL;
+    buf->size = 0;
+    buf->len = 0;
+    buf->off = 0;
+
+    debug_return;
+}
+
+/*
+ * Like expand_buf() but the new data comes from the pool and the old
+ * data is returned to it.  The unconsumed data is moved to the start
+ * of the buffer.
+ */
+bool
+bufpool_expand_data(struct connection_buffer *buf, size_t needed)
+{
+    struct connection_buffer newbuf;
+    debug_decl(bufpool_expand_data, SUDO_DEBUG_UTIL);
+
+    if (buf->size < needed) {
+	/* Expand buffer. */
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	    "expanding buffer from %u to at least %zu", buf->size, needed);
+	if (!bufpool_get_data(&newbuf, needed)) {
+	    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	    debug_return_bool(false);
+	}
+	if (buf->len != buf->off)
+	    memcpy(newbuf.data, buf->data + buf->off, buf->len - buf->off);
+	newbuf.len = buf->len - buf->off;
+	bufpool_put_data(buf);
+	buf->data = newbuf.data;
+	buf->size = newbuf.size;
+	buf->len = newbuf.len;
+    } else {
+	/* Just reset existing buffer. */
+	if (buf->len != buf->off) {
+	    memmove(buf->data, buf->data + buf->off,
+		buf->len - buf->off);
+	}
+	buf->len -= buf->off;
+	buf->off = 0;
+    }
+
+    debug_return_bool(true);
+}
+
+/*
+ * Free all pooled buffers.
+ */
+void
+bufpool_flush(void)
+{
+    struct connection_buffer *buf;
+    unsigned int i;
+    debug_decl(bufpool_flush, SUDO_DEBUG_UTIL);
+
+    if (bufpool_evbase == NULL)
+	debug_return;
+
+    for (i = 0; i < BUFPOOL_NCLASSES; i++) {
+	while ((buf = TAILQ_FIRST(&bufpool[i].bufs)) != NULL) {
+	    TAILQ_REMOVE(&bufpool[i].bufs, buf, entries);
+	    bufpool_free(buf);
+	}
+	bufpool[i].count = 0;
+	bufpool[i].lowat = 0;
+    }
+    bufpool_bytes = 0;
+    metrics_buffer_pool(bufpool_hits, bufpool_misses, bufpool_bytes);
+    sudo_ev_del(bufpool_evbase, bufpool_trim_ev);
+
+    debug_return;
+}
@@ -26,6 +26,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 
 #include <errno.h>
@@ -111,8 +112,15 @@ struct address_list_container {
 static struct logsrvd_config {
     struct logsrvd_config_server {
         struct address_list_container addresses;
+        struct address_list_container metrics_addresses;
         struct timespec timeout;
         bool tcp_keepalive;
+	bool commit_sync;
+	unsigned int workers;
+	time_t commit_interval;
+	size_t max_connection_memory;
+	size_t max_memory;
+	size_t max_pool_memory;
 	enum server_log_type log_type;
 	FILE *log_stream;
 	char *log_file;
@@ -124,8 +132,11 @@ static struct logsrvd_config {
 	char *tls_dhparams_path;
 	char *tls_ciphers_v12;
 	char *tls_ciphers_v13;
+	char *tls_ticket_key_path;
+	time_t tls_session_timeout;
 	int tls_check_peer;
 	int tls_verify;
+	int tls_ktls;
 	SSL_CTX *ssl_ctx;
 #endif
     } server;
@@ -134,9 +145,16 @@ static struct logsrvd_config {
         struct timespec connect_timeout;
         struct timespec timeout;
 	time_t retry_interval;
+	size_t max_inflight;
+	unsigned int concurrency;
+	unsigned int max_streams;
+	enum relay_balance balance;
 	char *relay_dir;
         bool tcp_keepalive;
 	bool store_first;
+	bool store_first_tail;
+	bool multiplex;
+	bool compress;
 #if defined(HAVE_OPENSSL)
 	char *tls_key_path;
 	char *tls_cert_path;
@@ -146,6 +164,7 @@ static struct logsrvd_config {
 	char *tls_ciphers_v13;
 	int tls_check_peer;
 	int tls_verify;
+	int tls_ktls;
 	SSL_CTX *ssl_ctx;
 #endif
     } relay;
@@ -241,12 +260,54 @@ logsrvd_conf_server_listen_address(void)
     return &logsrvd_config->server.addresses.addrs;
 }
 
+struct server_address_list *
+logsrvd_conf_server_metrics_address(void)
+{
+    return &logsrvd_config->server.metrics_addresses.addrs;
+}
+
 bool
 logsrvd_conf_server_tcp_keepalive(void)
 {
     return logsrvd_config->server.tcp_keepalive;
 }
 
+unsigned int
+logsrvd_conf_server_workers(void)
+{
+    return logsrvd_config->server.workers;
+}
+
+time_t
+logsrvd_conf_server_commit_interval(void)
+{
+    return logsrvd_config->server.commit_interval;
+}
+
+bool
+logsrvd_conf_server_commit_sync(void)
+{
+    return logsrvd_config->server.commit_sync;
+}
+
+size_t
+logsrvd_conf_server_max_connection_memory(void)
+{
+    return logsrvd_config->server.max_connection_memory;
+}
+
+size_t
+logsrvd_conf_server_max_memory(void)
+{
+    return logsrvd_config->server.max_memory;
+}
+
+size_t
+logsrvd_conf_server_max_pool_memory(void)
+{
+    return logsrvd_config->server.max_pool_memory;
+}
+
 const char *
 logsrvd_conf_pid_file(void)
 {
@@ -275,6 +336,12 @@ logsrvd_conf_server_tls_check_peer(void)
 {
     return logsrvd_config->server.tls_check_peer;
 }
+
+bool
+logsrvd_conf_server_tls_ktls(void)
+{
+    return logsrvd_config->server.tls_ktls;
+}
 #endif
 
 /* relay getters */
@@ -296,6 +363,12 @@ logsrvd_conf_relay_store_first(void)
     return logsrvd_config->relay.store_first;
 }
 
+bool
+logsrvd_conf_relay_store_first_tail(void)
+{
+    return logsrvd_config->relay.store_first_tail;
+}
+
 bool
 logsrvd_conf_relay_tcp_keepalive(void)
 {
@@ -328,6 +401,42 @@ logsrvd_conf_relay_retry_interval(void)
     return logsrvd_config->relay.retry_interval;
 }
 
+unsigned int
+logsrvd_conf_relay_concurrency(void)
+{
+    return logsrvd_config->relay.concurrency;
+}
+
+size_t
+logsrvd_conf_relay_max_inflight(void)
+{
+    return logsrvd_config->relay.max_inflight;
+}
+
+bool
+logsrvd_conf_relay_multiplex(void)
+{
+    return logsrvd_config->relay.multiplex;
+}
+
+bool
+logsrvd_conf_relay_compress(void)
+{
+    return logsrvd_config->relay.compress;
+}
+
+unsigned int
+logsrvd_conf_relay_max_streams(void)
+{
+    return logsrvd_config->relay.max_streams;
+}
+
+enum relay_balance
+logsrvd_conf_relay_balance(void)
+{
+    return logsrvd_config->relay.balance;
+}
+
 #if defined(HAVE_OPENSSL)
 SSL_CTX *
 logsrvd_relay_tls_ctx(void)
@@ -344,6 +453,12 @@ logsrvd_conf_relay_tls_check_peer(void)
 	return logsrvd_config->relay.tls_check_peer;
     return logsrvd_config->server.tls_check_peer;
 }
+
+bool
+logsrvd_conf_relay_tls_ktls(void)
+{
+    return TLS_RELAY_INT(logsrvd_config, tls_ktls);
+}
 #endif
 
 /* I/O log callbacks */
@@ -561,6 +676,8 @@ append_address(struct server_address_list *addresses, const char *str,
 
 	memcpy(&addr->sa_un, res->ai_addr, res->ai_addrlen);
 	addr->sa_size = res->ai_addrlen;
+	addr->nsessions = 0;
+	addr->down_until = 0;
 	addr->tls = tls;
 	TAILQ_INSERT_TAIL(addresses, addr, entries);
     }
@@ -575,12 +692,71 @@ done:
     debug_return_bool(ret);
 }
 
+/*
+ * Add a Unix domain socket to the list of addresses.
+ * Clients that connect to it are authenticated by their peer
+ * credentials so TLS is not supported.
+ */
+static bool
+append_unix_address(struct server_address_list *addresses, const char *path)
+{
+    struct server_address *addr;
+    size_t len = strlen(path);
+    debug_decl(append_unix_address, SUDO_DEBUG_UTIL);
+
+    if (len >= sizeof(addr->sa_un.sunix.sun_path)) {
+	errno = ENAMETOOLONG;
+	sudo_warn("%s", path);
+	debug_return_bool(false);
+    }
+
+    if ((addr = calloc(1, sizeof(*addr))) == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	debug_return_bool(false);
+    }
+    if ((addr->sa_str = sudo_rcstr_dup(path)) == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	free(addr);
+	debug_return_bool(false);
+    }
+    addr->sa_un.sunix.sun_family = AF_UNIX;
+    memcpy(addr->sa_un.sunix.sun_path, path, len + 1);
+    addr->sa_size = offsetof(struct sockaddr_un, sun_path) + len + 1;
+    addr->tls = false;
+    TAILQ_INSERT_TAIL(addresses, addr, entries);
+
+    debug_return_bool(true);
+}
+
 static bool
 cb_server_listen_address(struct logsrvd_config *config, const char *str, size_t offset)
 {
+    /* A fully-qualified path is a Unix domain socket. */
+    if (str[0] == '/')
+	return append_unix_address(&config->server.addresses.addrs, str);
     return append_address(&config->server.addresses.addrs, str, true);
 }
 
+static bool
+cb_server_metrics_address(struct logsrvd_config *config, const char *str, size_t offset)
+{
+    struct server_address_list *addrs = &config->server.metrics_addresses.addrs;
+    struct server_address *addr;
+    debug_decl(cb_server_metrics_address, SUDO_DEBUG_UTIL);
+
+    if (!append_address(addrs, str, true))
+	debug_return_bool(false);
+
+    /* The metrics listener only speaks plain HTTP. */
+    TAILQ_FOREACH(addr, addrs, entries) {
+	if (addr->tls) {
+	    sudo_warnx("%s", U_("TLS not supported"));
+	    debug_return_bool(false);
+	}
+    }
+    debug_return_bool(true);
+}
+
 static bool
 cb_server_timeout(struct logsrvd_config *config, const char *str, size_t offset)
 {
@@ -610,6 +786,94 @@ cb_server_keepalive(struct logsrvd_config *config, const char *str, size_t offse
     debug_return_bool(true);
 }
 
+static bool
+cb_server_workers(struct logsrvd_config *config, const char *str, size_t offset)
+{
+    unsigned int workers;
+    const char *errstr;
+    debug_decl(cb_server_workers, SUDO_DEBUG_UTIL);
+
+    workers = sudo_strtonum(str, 1, 1024, &errstr);
+    if (errstr != NULL)
+	debug_return_bool(false);
+
+    config->server.workers = workers;
+    debug_return_bool(true);
+}
+
+static bool
+cb_server_commit_interval(struct logsrvd_config *config, const char *str, size_t offset)
+{
+    time_t interval;
+    const char *errstr;
+    debug_decl(cb_server_commit_interval, SUDO_DEBUG_UTIL);
+
+    interval = sudo_strtonum(str, 1, TIME_T_MAX, &errstr);
+    if (errstr != NULL)
+	debug_return_bool(false);
+
+    config->server.commit_interval = interval;
+    debug_return_bool(true);
+}
+
+static bool
+cb_server_commit_sync(struct logsrvd_config *config, const char *str, size_t offset)
+{
+    int val;
+    debug_decl(cb_server_commit_sync, SUDO_DEBUG_UTIL);
+
+    if ((val = sudo_strtobool(str)) == -1)
+	debug_return_bool(false);
+
+    config->server.commit_sync = val;
+    debug_return_bool(true);
+}
+
+static bool
+cb_server_max_connection_memory(struct logsrvd_config *config, const char *str, size_t offset)
+{
+    long long max_memory;
+    const char *errstr;
+    debug_decl(cb_server_max_connection_memory, SUDO_DEBUG_UTIL);
+
+    max_memory = sudo_strtonum(str, 0, SSIZE_MAX, &errstr);
+    if (errstr != NULL)
+	debug_return_bool(false);
+
+    config->server.max_connection_memory = (size_t)max_memory;
+    debug_return_bool(true);
+}
+
+static bool
+cb_server_max_memory(struct logsrvd_config *config, const char *str, size_t offset)
+{
+    long long max_memory;
+    const char *errstr;
+    debug_decl(cb_server_max_memory, SUDO_DEBUG_UTIL);
+
+    max_memory = sudo_strtonum(str, 0, SSIZE_MAX, &errstr);
+    if (errstr != NULL)
+	debug_return_bool(false);
+
+    config->server.max_memory = (size_t)max_memory;
+    debug_return_bool(true);
+}
+
+static bool
+cb_server_max_pool_memory(struct logsrvd_config *config, const char *str, size_t offset)
+{
+    long long max_memory;
+    const char *errstr;
+    debug_decl(cb_server_max_pool_memory, SUDO_DEBUG_UTIL);
+
+    max_memory = sudo_strtonum(str, 0, SSIZE_MAX, &errstr);
+    if (errstr != NULL)
+	debug_return_bool(false);
+
+    config->server.max_pool_memory = (size_t)max_memory;
+    debug_return_bool(true);
+}
+
 static bool
 cb_server_pid_file(struct logsrvd_config *config, const char *str, size_t offset)
 {
@@ -778,6 +1042,55 @@ cb_tls_checkpeer(struct logsrvd_config *config, const char *str, size_t offset)
     *p = val;
     debug_return_bool(true);
 }
+
+static bool
+cb_tls_ktls(struct logsrvd_config *config, const char *str, size_t offset)
+{
+    int *p = (int *)((char *)config + offset);
+    int val;
+    debug_decl(cb_tls_ktls, SUDO_DEBUG_UTIL);
+
+    if ((val = sudo_strtobool(str)) == -1)
+	debug_return_bool(false);
+
+#ifndef SSL_OP_ENABLE_KTLS
+    if (val) {
+	sudo_warnx("%s",
+	    U_("kernel TLS is not supported by the TLS library, ignoring tls_ktls"));
+    }
+#endif
+    *p = val;
+    debug_return_bool(true);
+}
+
+static bool
+cb_server_tls_session_timeout(struct logsrvd_config *config, const char *str, size_t offset)
+{
+    time_t timeout;
+    const char *errstr;
+    debug_decl(cb_server_tls_session_timeout, SUDO_DEBUG_UTIL);
+
+    timeout = sudo_strtonum(str, 0, LONG_MAX, &errstr);
+    if (errstr != NULL)
+	debug_return_bool(false);
+
+    config->server.tls_session_timeout = timeout;
+
+    debug_return_bool(true);
+}
+
+static bool
+cb_server_tls_ticket_key(struct logsrvd_config *config, const char *path, size_t offset)
+{
+    debug_decl(cb_server_tls_ticket_key, SUDO_DEBUG_UTIL);
+
+    free(config->server.tls_ticket_key_path);
+    if ((config->server.tls_ticket_key_path = strdup(path)) == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+        debug_return_bool(false);
+    }
+    debug_return_bool(true);
+}
 #endif
 
 /* relay callbacks */
@@ -852,6 +1165,99 @@ cb_retry_interval(struct logsrvd_config *config, const char *str, size_t offset)
     debug_return_bool(true);
 }
 
+static bool
+cb_relay_concurrency(struct logsrvd_config *config, const char *str, size_t offset)
+{
+    unsigned int concurrency;
+    const char *errstr;
+    debug_decl(cb_relay_concurrency, SUDO_DEBUG_UTIL);
+
+    concurrency = sudo_strtonum(str, 1, 1024, &errstr);
+    if (errstr != NULL)
+	debug_return_bool(false);
+
+    config->relay.concurrency = concurrency;
+
+    debug_return_bool(true);
+}
+
+static bool
+cb_relay_max_inflight(struct logsrvd_config *config, const char *str, size_t offset)
+{
+    long long max_inflight;
+    const char *errstr;
+    debug_decl(cb_relay_max_inflight, SUDO_DEBUG_UTIL);
+
+    max_inflight = sudo_strtonum(str, 0, SSIZE_MAX, &errstr);
+    if (errstr != NULL)
+	debug_return_bool(false);
+
+    config->relay.max_inflight = (size_t)max_inflight;
+
+    debug_return_bool(true);
+}
+
+static bool
+cb_relay_multiplex(struct logsrvd_config *config, const char *str, size_t offset)
+{
+    int val;
+    debug_decl(cb_relay_multiplex, SUDO_DEBUG_UTIL);
+
+    if ((val = sudo_strtobool(str)) == -1)
+	debug_return_bool(false);
+
+    config->relay.multiplex = val;
+    debug_return_bool(true);
+}
+
+static bool
+cb_relay_compress(struct logsrvd_config *config, const char *str, size_t offset)
+{
+    int val;
+    debug_decl(cb_relay_compress, SUDO_DEBUG_UTIL);
+
+    if ((val = sudo_strtobool(str)) == -1)
+	debug_return_bool(false);
+
+    config->relay.compress = val;
+    debug_return_bool(true);
+}
+
+static bool
+cb_relay_max_streams(struct logsrvd_config *config, const char *str, size_t offset)
+{
+    unsigned int max_streams;
+    const char *errstr;
+    debug_decl(cb_relay_max_streams, SUDO_DEBUG_UTIL);
+
+    max_streams = sudo_strtonum(str, 1, STREAMS_MAX, &errstr);
+    if (errstr != NULL)
+	debug_return_bool(false);
+
+    config->relay.max_streams = max_streams;
+
+    debug_return_bool(true);
+}
+
+static bool
+cb_relay_balance(struct logsrvd_config *config, const char *str, size_t offset)
+{
+    debug_decl(cb_relay_balance, SUDO_DEBUG_UTIL);
+
+    if (strcmp(str, "failover") == 0)
+	config->relay.balance = RELAY_BALANCE_FAILOVER;
+    else if (strcmp(str, "round-robin") == 0)
+	config->relay.balance = RELAY_BALANCE_ROUND_ROBIN;
+    else if (strcmp(str, "least-connections") == 0)
+	config->relay.balance = RELAY_BALANCE_LEAST_CONN;
+    else if (strcmp(str, "hash") == 0)
+	config->relay.balance = RELAY_BALANCE_HASH;
+    else
+	debug_return_bool(false);
+
+    debug_return_bool(true);
+}
+
 static bool
 cb_relay_store_first(struct logsrvd_config *config, const char *str, size_t offset)
 {
@@ -865,6 +1271,19 @@ cb_relay_store_first(struct logsrvd_config *config, const char *str, size_t offs
     debug_return_bool(true);
 }
 
+static bool
+cb_relay_store_first_tail(struct logsrvd_config *config, const char *str, size_t offset)
+{
+    int val;
+    debug_decl(cb_relay_store_first_tail, SUDO_DEBUG_UTIL);
+
+    if ((val = sudo_strtobool(str)) == -1)
+	debug_return_bool(false);
+
+    config->relay.store_first_tail = val;
+    debug_return_bool(true);
+}
+
 static bool
 cb_relay_keepalive(struct logsrvd_config *config, const char *str, size_t offset)
 {
@@ -1086,9 +1505,16 @@ address_list_delref(struct server_address_list *al)
 
 static struct logsrvd_config_entry server_conf_entries[] = {
     { "listen_address", cb_server_listen_address },
+    { "metrics_address", cb_server_metrics_address },
     { "timeout", cb_server_timeout },
     { "tcp_keepalive", cb_server_keepalive },
     { "pid_file", cb_server_pid_file },
+    { "workers", cb_server_workers },
+    { "commit_interval", cb_server_commit_interval },
+    { "commit_sync", cb_server_commit_sync },
+    { "max_connection_memory", cb_server_max_connection_memory },
+    { "max_memory", cb_server_max_memory },
+    { "max_pool_memory", cb_server_max_pool_memory },
     { "server_log", cb_server_log },
 #if defined(HAVE_OPENSSL)
     { "tls_key", cb_tls_key, offsetof(struct logsrvd_config, server.tls_key_path) },
@@ -1099,6 +1525,9 @@ static struct logsrvd_config_entry server_conf_entries[] = {
     { "tls_ciphers_v13", cb_tls_ciphers13, offsetof(struct logsrvd_config, server.tls_ciphers_v13) },
     { "tls_checkpeer", cb_tls_checkpeer, offsetof(struct logsrvd_config, server.tls_check_peer) },
     { "tls_verify", cb_tls_verify, offsetof(struct logsrvd_config, server.tls_verify) },
+    { "tls_ktls", cb_tls_ktls, offsetof(struct logsrvd_config, server.tls_ktls) },
+    { "tls_session_timeout", cb_server_tls_session_timeout },
+    { "tls_ticket_key", cb_server_tls_ticket_key },
 #endif
     { NULL }
 };
@@ -1109,7 +1538,14 @@ static struct logsrvd_config_entry relay_conf_entries[] = {
     { "connect_timeout", cb_relay_connect_timeout },
     { "relay_dir", cb_relay_dir },
     { "retry_interval", cb_retry_interval },
+    { "relay_concurrency", cb_relay_concurrency },
+    { "relay_max_inflight", cb_relay_max_inflight },
+    { "relay_multiplex", cb_relay_multiplex },
+    { "relay_compress", cb_relay_compress },
+    { "relay_max_streams", cb_relay_max_streams },
+    { "relay_balance", cb_relay_balance },
     { "store_first", cb_relay_store_first },
+    { "store_first_tail", cb_relay_store_first_tail },
     { "tcp_keepalive", cb_relay_keepalive },
 #if defined(HAVE_OPENSSL)
     { "tls_key", cb_tls_key, offsetof(struct logsrvd_config, relay.tls_key_path) },
@@ -1120,6 +1556,7 @@ static struct logsrvd_config_entry relay_conf_entries[] = {
     { "tls_ciphers_v13", cb_tls_ciphers13, offsetof(struct logsrvd_config, relay.tls_ciphers_v13) },
     { "tls_checkpeer", cb_tls_checkpeer, offsetof(struct logsrvd_config, relay.tls_check_peer) },
     { "tls_verify", cb_tls_verify, offsetof(struct logsrvd_config, relay.tls_verify) },
+    { "tls_ktls", cb_tls_ktls, offsetof(struct logsrvd_config, relay.tls_ktls) },
 #endif
     { NULL }
 };
@@ -1537,6 +1974,7 @@ logsrvd_conf_free(struct logsrvd_config *config)
 
     /* struct logsrvd_config_server */
     address_list_delref(&config->server.addresses.addrs);
+    address_list_delref(&config->server.metrics_addresses.addrs);
     free(config->server.pid_file);
     free(config->server.log_file);
     if (config->server.log_stream != NULL)
@@ -1548,6 +1986,7 @@ logsrvd_conf_free(struct logsrvd_config *config)
     free(config->server.tls_dhparams_path);
     free(config->server.tls_ciphers_v12);
     free(config->server.tls_ciphers_v13);
+    free(config->server.tls_ticket_key_path);
 
     if (config->server.ssl_ctx != NULL)
 	SSL_CTX_free(config->server.ssl_ctx);
@@ -1603,18 +2042,28 @@ logsrvd_conf_alloc(void)
     config->relay.connect_timeout.tv_sec = DEFAULT_SOCKET_TIMEOUT_SEC;
     config->relay.tcp_keepalive = true;
     config->relay.retry_interval = 30;
+    config->relay.concurrency = 1;
+    config->relay.max_streams = 32;
+    config->relay.balance = RELAY_BALANCE_FAILOVER;
     if (!cb_relay_dir(config, _PATH_SUDO_RELAY_DIR, 0))
 	goto bad;
 #if defined(HAVE_OPENSSL)
     config->relay.tls_verify = -1;
     config->relay.tls_check_peer = -1;
+    config->relay.tls_ktls = -1;
 #endif
 
     /* Server defaults */
     TAILQ_INIT(&config->server.addresses.addrs);
     config->server.addresses.refcnt = 1;
+    TAILQ_INIT(&config->server.metrics_addresses.addrs);
+    config->server.metrics_addresses.refcnt = 1;
     config->server.timeout.tv_sec = DEFAULT_SOCKET_TIMEOUT_SEC;
     config->server.tcp_keepalive = true;
+    config->server.workers = 1;
+    config->server.commit_interval = ACK_FREQUENCY;
+    config->server.max_connection_memory = DEFAULT_CONNECTION_MEMORY;
+    config->server.max_pool_memory = DEFAULT_POOL_MEMORY;
     config->server.log_type = SERVER_LOG_SYSLOG;
     config->server.pid_file = strdup(_PATH_SUDO_LOGSRVD_PID);
     if (config->server.pid_file == NULL) {
@@ -1648,6 +2097,8 @@ logsrvd_conf_alloc(void)
     }
     config->server.tls_verify = true;
     config->server.tls_check_peer = false;
+    config->server.tls_ktls = false;
+    config->server.tls_session_timeout = DEFAULT_TLS_SESSION_TIMEOUT;
 #endif
 
     /* I/O log defaults */
@@ -1763,6 +2214,12 @@ logsrvd_conf_apply(struct logsrvd_config *config)
 	    sudo_warnx("%s", U_("unable to initialize server TLS context"));
 	    debug_return_bool(false);
 	}
+	if (!init_tls_session_resumption(config->server.ssl_ctx,
+		"sudo_logsrvd", (long)config->server.tls_session_timeout,
+		config->server.tls_ticket_key_path)) {
+	    sudo_warnx("%s", U_("unable to initialize server TLS context"));
+	    debug_return_bool(false);
+	}
 	break;
     }
 
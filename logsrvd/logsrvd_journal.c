@@ -26,6 +26,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
@@ -89,6 +90,231 @@ journal_fdopen(int fd, const char *journal_path,
     debug_return_bool(true);
 }
 
+/*
+ * The restart index is a sidecar file stored next to an incoming journal.
+ * It consists of a header followed by an array of entries, each of which
+ * records the journal offset and elapsed time after a message.  Entries
+ * are added at most every JOURNAL_INDEX_INTERVAL bytes, which lets
+ * journal_restart() skip directly to the vicinity of the resume point.
+ * The index is advisory; if it is missing or stale a linear scan is used.
+ */
+#define JOURNAL_INDEX_MAGIC	0x4a494458	/* "JIDX" */
+#define JOURNAL_INDEX_VERSION	1
+
+struct journal_index_header {
+    uint32_t magic;
+    uint32_t version;
+};
+
+struct journal_index_entry {
+    int64_t offset;
+    int64_t tv_sec;
+    int64_t tv_nsec;
+};
+
+/*
+ * Fill in pathbuf with the path of the file stored alongside
+ * journal_path with the specified suffix.
+ */
+static bool
+journal_sidecar_path(const char *journal_path, const char *suffix,
+    char *pathbuf, size_t pathlen)
+{
+    int len;
+    debug_decl(journal_sidecar_path, SUDO_DEBUG_UTIL);
+
+    len = snprintf(pathbuf, pathlen, "%s%s", journal_path, suffix);
+    if (len < 0 || (size_t)len >= pathlen) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "path too long: %s%s", journal_path, suffix);
+	debug_return_bool(false);
+    }
+    debug_return_bool(true);
+}
+
+/*
+ * Fill in pathbuf with the path of the restart index for journal_path.
+ */
+static bool
+journal_index_path(const char *journal_path, char *pathbuf, size_t pathlen)
+{
+    return journal_sidecar_path(journal_path, JOURNAL_INDEX_SUFFIX, pathbuf,
+	pathlen);
+}
+
+/*
+ * Close the restart index, removing it if unlink_index is set.
+ */
+static void
+journal_index_close(struct connection_closure *closure, bool unlink_index)
+{
+    char index_path[PATH_MAX];
+    debug_decl(journal_index_close, SUDO_DEBUG_UTIL);
+
+    if (closure->journal_index != NULL) {
+	fclose(closure->journal_index);
+	closure->journal_index = NULL;
+    }
+    if (unlink_index && closure->journal_path != NULL) {
+	if (journal_index_path(closure->journal_path, index_path,
+		sizeof(index_path)))
+	    unlink(index_path);
+    }
+
+    debug_return;
+}
+
+/*
+ * Start appending to the restart index open on fd, keeping the
+ * first nentries entries.  A negative nentries means the existing
+ * contents are unusable and the index is re-initialized.
+ */
+static void
+journal_index_fdopen(int fd, long nentries, off_t last_offset,
+    struct connection_closure *closure)
+{
+    struct journal_index_header hdr = {
+	JOURNAL_INDEX_MAGIC, JOURNAL_INDEX_VERSION
+    };
+    off_t size;
+    debug_decl(journal_index_fdopen, SUDO_DEBUG_UTIL);
+
+    if (nentries <= 0) {
+	if (pwrite(fd, &hdr, sizeof(hdr), 0) != ssizeof(hdr))
+	    goto bad;
+	nentries = 0;
+	last_offset = 0;
+    }
+    size = (off_t)sizeof(hdr) +
+	(off_t)nentries * (off_t)sizeof(struct journal_index_entry);
+    if (ftruncate(fd, size) == -1 || lseek(fd, size, SEEK_SET) == -1)
+	goto bad;
+    if ((closure->journal_index = fdopen(fd, "w")) == NULL)
+	goto bad;
+    closure->journal_index_offset = last_offset;
+
+    debug_return;
+bad:
+    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	"unable to initialize journal index for %s", closure->journal_path);
+    close(fd);
+    journal_index_close(closure, true);
+    debug_return;
+}
+
+/*
+ * Create the restart index for a new journal.
+ * Failure is not fatal, we just won't have an index.
+ */
+static void
+journal_index_create(struct connection_closure *closure)
+{
+    char index_path[PATH_MAX];
+    int fd;
+    debug_decl(journal_index_create, SUDO_DEBUG_UTIL);
+
+    if (!journal_index_path(closure->journal_path, index_path,
+	    sizeof(index_path)))
+	debug_return;
+    fd = open(index_path, O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
+    if (fd == -1) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "unable to create journal index %s", index_path);
+	debug_return;
+    }
+    journal_index_fdopen(fd, -1, 0, closure);
+
+    debug_return;
+}
+
+/*
+ * Add an entry to the restart index for the current journal position
+ * if enough data has been written since the last one.
+ */
+static void
+journal_index_add(struct connection_closure *closure)
+{
+    struct journal_index_entry entry;
+    debug_decl(journal_index_add, SUDO_DEBUG_UTIL);
+
+    if (closure->journal_index == NULL)
+	debug_return;
+    if (closure->journal_offset - closure->journal_index_offset <
+	    JOURNAL_INDEX_INTERVAL)
+	debug_return;
+
+    entry.offset = closure->journal_offset;
+    entry.tv_sec = closure->elapsed_time.tv_sec;
+    entry.tv_nsec = closure->elapsed_time.tv_nsec;
+    if (fwrite(&entry, sizeof(entry), 1, closure->journal_index) != 1) {
+	/* Better no index than an incomplete one. */
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "unable to write journal index for %s", closure->journal_path);
+	journal_index_close(closure, true);
+	debug_return;
+    }
+    closure->journal_index_offset = closure->journal_offset;
+
+    debug_return;
+}
+
+/*
+ * Binary search the restart index open on fd for the last entry
+ * before target and store it in entry.
+ * Returns the number of entries up to and including the one found,
+ * 0 if there is no such entry or -1 if the index is invalid or stale.
+ */
+static long
+journal_index_search(int fd, const struct timespec *target,
+    off_t journal_size, struct journal_index_entry *entry)
+{
+    struct journal_index_header hdr;
+    struct timespec ts;
+    long lo, hi, mid;
+    struct stat sb;
+    debug_decl(journal_index_search, SUDO_DEBUG_UTIL);
+
+    if (fstat(fd, &sb) == -1 || sb.st_size < ssizeof(hdr))
+	debug_return_long(-1);
+    if (pread(fd, &hdr, sizeof(hdr), 0) != ssizeof(hdr))
+	debug_return_long(-1);
+    if (hdr.magic != JOURNAL_INDEX_MAGIC ||
+	    hdr.version != JOURNAL_INDEX_VERSION)
+	debug_return_long(-1);
+
+    /* Ignore a partial entry at the end. */
+    lo = 0;
+    hi = (long)((sb.st_size - (off_t)sizeof(hdr)) / (off_t)sizeof(*entry));
+    while (lo < hi) {
+	mid = lo + (hi - lo) / 2;
+	if (pread(fd, entry, sizeof(*entry), (off_t)sizeof(hdr) +
+			(off_t)mid * (off_t)sizeof(*entry)) != ssizeof(*entry))
+	    debug_return_long(-1);
+	ts.tv_sec = (time_t)entry->tv_sec;
+	ts.tv_nsec = (long)entry->tv_nsec;
+	if (sudo_timespeccmp(&ts, target, <))
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    if (lo == 0)
+	debug_return_long(0);
+
+    if (pread(fd, entry, sizeof(*entry), (off_t)sizeof(hdr) +
+	    (off_t)(lo - 1) * (off_t)sizeof(*entry)) != ssizeof(*entry))
+	debug_return_long(-1);
+    if (entry->offset < 0 || entry->offset > journal_size ||
+	    entry->tv_sec < 0 || entry->tv_nsec < 0 ||
+	    entry->tv_nsec >= 1000000000) {
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+	    "stale journal index entry: offset %lld, size %lld",
+	    (long long)entry->offset, (long long)journal_size);
+	debug_return_long(-1);
+    }
+
+    debug_return_long(lo);
+}
+
 static int
 journal_mkstemp(const char *parent_dir, char *pathbuf, int pathlen)
 {
@@ -164,6 +390,8 @@ journal_create(struct connection_closure *closure)
 	closure->errstr = _("unable to open journal file");
 	debug_return_bool(false);
     }
+    closure->journal_offset = 0;
+    journal_index_create(closure);
 
     debug_return_bool(true);
 }
@@ -176,7 +404,8 @@ journal_create(struct connection_closure *closure)
 static bool
 journal_finish(struct connection_closure *closure)
 {
-    char outgoing_path[PATH_MAX];
+    char outgoing_path[PATH_MAX], outgoing_relay_path[PATH_MAX];
+    char relay_path[PATH_MAX];
     size_t len;
     int fd;
     debug_decl(journal_finish, SUDO_DEBUG_UTIL);
@@ -187,6 +416,9 @@ journal_finish(struct connection_closure *closure)
     }
     rewind(closure->journal);
 
+    /* The restart index is only needed for incoming journals. */
+    journal_index_close(closure, true);
+
     /* Move journal to the outgoing directory. */
     fd = journal_mkstemp("outgoing", outgoing_path, sizeof(outgoing_path));
     if (fd == -1) {
@@ -203,6 +435,17 @@ journal_finish(struct connection_closure *closure)
     }
     sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
 	"renamed %s -> %s", closure->journal_path, outgoing_path);
+
+    /* Upstream relay state, if any, moves along with the journal. */
+    if (journal_sidecar_path(closure->journal_path, JOURNAL_RELAY_SUFFIX,
+	    relay_path, sizeof(relay_path)) &&
+	    journal_sidecar_path(outgoing_path, JOURNAL_RELAY_SUFFIX,
+	    outgoing_relay_path, sizeof(outgoing_relay_path))) {
+	if (rename(relay_path, outgoing_relay_path) == -1 && errno != ENOENT) {
+	    sudo_warn(U_("unable to rename %s to %s"), relay_path,
+		outgoing_relay_path);
+	}
+    }
     len = strlen(outgoing_path);
     if (strlen(closure->journal_path) == len) {
 	/* This should always be true. */
@@ -295,6 +538,8 @@ journal_seek(struct timespec *target, struct connection_closure *closure)
 	    }
 	}
 
+	closure->journal_offset += (off_t)(sizeof(msg_len) + msg_len);
+
 	client_message__free_unpacked(msg, NULL);
 	msg = client_message__unpack(NULL, msg_len, buf);
 	if (msg == NULL) {
@@ -359,6 +604,21 @@ journal_seek(struct timespec *target, struct connection_closure *closure)
 		"read stderr_buf (%d), delay [%lld, %ld]", msg->type_case,
 		(long long)delay->tv_sec, (long)delay->tv_nsec);
 	    break;
+	case CLIENT_MESSAGE__TYPE_IOBUF_BATCH: {
+	    IoBufferBatch *batch = msg->u.iobuf_batch;
+	    size_t n;
+
+	    sudo_debug_printf(SUDO_DEBUG_DEBUG|SUDO_DEBUG_LINENO,
+		"read IoBufferBatch (%d), %zu records", msg->type_case,
+		batch->n_records);
+	    for (n = 0; n < batch->n_records; n++) {
+		if (batch->records[n]->delay != NULL) {
+		    update_elapsed_time(batch->records[n]->delay,
+			&closure->elapsed_time);
+		}
+	    }
+	    break;
+	}
 	case CLIENT_MESSAGE__TYPE_WINSIZE_EVENT:
 	    delay = msg->u.winsize_event->delay;
 	    sudo_debug_printf(SUDO_DEBUG_DEBUG|SUDO_DEBUG_LINENO,
@@ -400,6 +660,77 @@ journal_seek(struct timespec *target, struct connection_closure *closure)
     debug_return_bool(ret);
 }
 
+/*
+ * Find the submitting host in the first message of an outgoing journal.
+ * The journal position is left unchanged.
+ * Returns the host name, which the caller must free, or NULL if not found.
+ */
+char *
+journal_submithost(struct connection_closure *closure)
+{
+    ClientMessage *msg = NULL;
+    InfoMessage **info_msgs = NULL;
+    size_t n, n_info_msgs = 0;
+    uint8_t *buf = NULL;
+    uint32_t msg_len;
+    char *ret = NULL;
+    off_t offset;
+    debug_decl(journal_submithost, SUDO_DEBUG_UTIL);
+
+    offset = ftello(closure->journal);
+    if (offset == -1)
+	debug_return_str(NULL);
+
+    /* Read message size (uint32_t in network byte order). */
+    if (fread(&msg_len, sizeof(msg_len), 1, closure->journal) != 1)
+	goto done;
+    msg_len = ntohl(msg_len);
+    if (msg_len == 0 || msg_len > MESSAGE_SIZE_MAX)
+	goto done;
+    if ((buf = malloc(msg_len)) == NULL)
+	goto done;
+    if (fread(buf, msg_len, 1, closure->journal) != 1)
+	goto done;
+    msg = client_message__unpack(NULL, msg_len, buf);
+    if (msg == NULL)
+	goto done;
+
+    switch (msg->type_case) {
+    case CLIENT_MESSAGE__TYPE_ACCEPT_MSG:
+	info_msgs = msg->u.accept_msg->info_msgs;
+	n_info_msgs = msg->u.accept_msg->n_info_msgs;
+	break;
+    case CLIENT_MESSAGE__TYPE_REJECT_MSG:
+	info_msgs = msg->u.reject_msg->info_msgs;
+	n_info_msgs = msg->u.reject_msg->n_info_msgs;
+	break;
+    case CLIENT_MESSAGE__TYPE_ALERT_MSG:
+	info_msgs = msg->u.alert_msg->info_msgs;
+	n_info_msgs = msg->u.alert_msg->n_info_msgs;
+	break;
+    default:
+	break;
+    }
+    for (n = 0; n < n_info_msgs; n++) {
+	InfoMessage *info = info_msgs[n];
+
+	if (info->value_case == INFO_MESSAGE__VALUE_STRVAL &&
+		strcmp(info->key, "submithost") == 0) {
+	    ret = strdup(info->u.strval);
+	    break;
+	}
+    }
+
+done:
+    if (fseeko(closure->journal, offset, SEEK_SET) == -1) {
+	sudo_warn(U_("%s: %s"), closure->journal_path,
+	    U_("error reading journal file"));
+    }
+    client_message__free_unpacked(msg, NULL);
+    free(buf);
+    debug_return_str(ret);
+}
+
 /*
  * Restart an existing journal.
  * Seeks to the resume_point in RestartMessage before continuing.
@@ -409,9 +740,13 @@ static bool
 journal_restart(RestartMessage *msg, uint8_t *buf, size_t buflen,
     struct connection_closure *closure)
 {
+    struct journal_index_entry entry = { 0, 0, 0 };
     struct timespec target;
-    int fd, len;
-    char *cp, journal_path[PATH_MAX];
+    long nentries = -1;
+    struct stat sb;
+    int fd, ifd = -1, len;
+    bool seeked;
+    char *cp, journal_path[PATH_MAX], index_path[PATH_MAX];
     debug_decl(journal_restart, SUDO_DEBUG_UTIL);
 
     /* Strip off leading hostname from log_id. */
@@ -441,15 +776,488 @@ journal_restart(RestartMessage *msg, uint8_t *buf, size_t buflen,
 	debug_return_bool(false);
     }
 
-    /* Seek forward to resume point. */
     target.tv_sec = msg->resume_point->tv_sec;
     target.tv_nsec = msg->resume_point->tv_nsec;
-    if (!journal_seek(&target, closure)) {
+    closure->journal_offset = 0;
+
+    /* Use the restart index (if any) to skip ahead in the journal. */
+    if (journal_index_path(journal_path, index_path, sizeof(index_path))) {
+	ifd = open(index_path, O_RDWR|O_CREAT, S_IRUSR|S_IWUSR);
+	if (ifd != -1 && fstat(fd, &sb) == 0)
+	    nentries = journal_index_search(ifd, &target, sb.st_size, &entry);
+    }
+    if (nentries > 0) {
+	if (fseeko(closure->journal, (off_t)entry.offset, SEEK_SET) == 0) {
+	    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+		"%s: resuming scan at offset %lld, [%lld, %ld]", journal_path,
+		(long long)entry.offset, (long long)entry.tv_sec,
+		(long)entry.tv_nsec);
+	    closure->journal_offset = (off_t)entry.offset;
+	    closure->elapsed_time.tv_sec = (time_t)entry.tv_sec;
+	    closure->elapsed_time.tv_nsec = (long)entry.tv_nsec;
+	} else {
+	    nentries = -1;
+	}
+    }
+
+    /* Seek forward to resume point. */
+    seeked = journal_seek(&target, closure);
+    if (!seeked && nentries > 0) {
+	/* Stale index, fall back to a linear scan. */
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+	    "%s: journal index is stale, rescanning", journal_path);
+	rewind(closure->journal);
+	closure->journal_offset = 0;
+	sudo_timespecclear(&closure->elapsed_time);
+	closure->errstr = NULL;
+	nentries = -1;
+	seeked = journal_seek(&target, closure);
+    }
+    if (!seeked) {
 	sudo_warn(U_("unable to seek to [%lld, %ld] in journal file %s"),
 	    (long long)target.tv_sec, target.tv_nsec, journal_path);
+	if (ifd != -1)
+	    close(ifd);
 	debug_return_bool(false);
     }
 
+    /*
+     * Discard anything past the resume point, the client will resend it.
+     * This also repositions the stream for writing.
+     */
+    if (fseeko(closure->journal, closure->journal_offset, SEEK_SET) == -1 ||
+	    ftruncate(fd, closure->journal_offset) == -1) {
+	sudo_warn(U_("unable to write to %s"), journal_path);
+	closure->errstr = _("unable to write journal file");
+	if (ifd != -1)
+	    close(ifd);
+	debug_return_bool(false);
+    }
+    if (ifd != -1)
+	journal_index_fdopen(ifd, nentries, (off_t)entry.offset, closure);
+
+    debug_return_bool(true);
+}
+
+/*
+ * Resume reading a journal tail that has caught up with the writer.
+ */
+static void
+journal_tail_wake(struct connection_closure *tail)
+{
+    debug_decl(journal_tail_wake, SUDO_DEBUG_UTIL);
+
+    if (!tail->tail_waiting || tail->state == SHUTDOWN)
+	debug_return;
+
+    tail->tail_waiting = false;
+    if (sudo_ev_add(tail->evbase, tail->read_ev, NULL, false) == -1) {
+	sudo_warnx("%s", U_("unable to add event to queue"));
+	connection_close(tail);
+    }
+
+    debug_return;
+}
+
+/*
+ * With store_first_tail, start relaying a new journal while the
+ * session is still being written to it.  The tail is a relay-only
+ * connection that reads the journal through its own descriptor and
+ * only sees data written out by journal_flush().
+ * Failure is not fatal, the journal is relayed once it is complete.
+ */
+static void
+journal_tail_start(struct connection_closure *closure)
+{
+    struct connection_closure *tail;
+    FILE *fp;
+    int fd;
+    debug_decl(journal_tail_start, SUDO_DEBUG_UTIL);
+
+    /* The relay host may be chosen based on the AcceptMessage. */
+    if (fflush(closure->journal) != 0)
+	debug_return;
+
+    if ((fd = open(closure->journal_path, O_RDWR)) == -1) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "unable to open journal file %s", closure->journal_path);
+	debug_return;
+    }
+    if ((fp = fdopen(fd, "r")) == NULL) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "unable to fdopen journal file %s", closure->journal_path);
+	close(fd);
+	debug_return;
+    }
+    tail = connection_closure_alloc(fd, false, true, closure->evbase);
+    if (tail == NULL) {
+	fclose(fp);
+	debug_return;
+    }
+    tail->journal = fp;
+    tail->journal_writer = closure;
+    closure->journal_tail = tail;
+
+    tail->journal_path = strdup(closure->journal_path);
+    if (tail->journal_path == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	connection_close(tail);
+	debug_return;
+    }
+    if (!connect_relay(tail)) {
+	sudo_warnx("%s", U_("unable to connect to relay"));
+	connection_close(tail);
+	debug_return;
+    }
+    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	"relaying %s while it is written", closure->journal_path);
+
+    debug_return;
+}
+
+/*
+ * Hand a finished journal off to the tail that is relaying it.
+ * The tail takes over the outgoing journal and the lock on it
+ * and reads the rest of the journal.
+ */
+void
+journal_tail_handoff(struct connection_closure *closure)
+{
+    struct connection_closure *tail = closure->journal_tail;
+    debug_decl(journal_tail_handoff, SUDO_DEBUG_UTIL);
+
+    closure->journal_tail = NULL;
+    tail->journal_writer = NULL;
+    free(tail->journal_path);
+    tail->journal_path = closure->journal_path;
+    closure->journal_path = NULL;
+
+    /* Closing any descriptor for the journal releases the lock. */
+    fclose(closure->journal);
+    closure->journal = NULL;
+    if (!sudo_lock_file(fileno(tail->journal), SUDO_TLOCK)) {
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "unable to lock %s", tail->journal_path);
+    }
+    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	"finishing relay of %s", tail->journal_path);
+    journal_tail_wake(tail);
+
+    debug_return;
+}
+
+/*
+ * Separate a journal writer and its tail when either one is freed
+ * before the journal is handed off.  If the tail goes away, the writer
+ * relays the journal once it is complete, restarting the upstream
+ * session if the tail got far enough, see journal_relay_update().
+ * If the writer goes away, the journal is incomplete and the tail is
+ * closed; the journal remains in the incoming directory so the client
+ * can restart it.
+ */
+void
+journal_tail_detach(struct connection_closure *closure)
+{
+    struct connection_closure *writer = closure->journal_writer;
+    struct connection_closure *tail = closure->journal_tail;
+    debug_decl(journal_tail_detach, SUDO_DEBUG_UTIL);
+
+    if (writer != NULL) {
+	writer->journal_tail = NULL;
+	closure->journal_writer = NULL;
+	free(closure->journal_path);
+	closure->journal_path = NULL;
+	if (closure->state == FINISHED) {
+	    /* The relay host has the whole journal, don't relay it again. */
+	    writer->journal_relayed = true;
+	}
+
+	/* Closing any descriptor for the journal releases the lock. */
+	sudo_ev_del(closure->evbase, closure->read_ev);
+	fclose(closure->journal);
+	closure->journal = NULL;
+	if (writer->journal != NULL &&
+		!sudo_lock_file(fileno(writer->journal), SUDO_TLOCK)) {
+	    sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+		"unable to lock %s", writer->journal_path);
+	}
+    } else if (tail != NULL) {
+	closure->journal_tail = NULL;
+	tail->journal_writer = NULL;
+	free(tail->journal_path);
+	tail->journal_path = NULL;
+	connection_close(tail);
+    }
+
+    debug_return;
+}
+
+/*
+ * Called when a relay-only connection reaches the end of its journal.
+ * A tail that has caught up with the writer stops reading until
+ * journal_flush() wakes it up.
+ * Returns true if the tail is waiting for more data, else false.
+ */
+bool
+journal_tail_wait(struct connection_closure *closure)
+{
+    debug_decl(journal_tail_wait, SUDO_DEBUG_UTIL);
+
+    if (closure->journal_writer == NULL)
+	debug_return_bool(false);
+
+    sudo_ev_del(closure->evbase, closure->read_ev);
+    closure->tail_waiting = true;
+    debug_return_bool(true);
+}
+
+/*
+ * Fill in pathbuf with the path of the upstream relay state for the
+ * journal being relayed by closure.  A tail follows its writer, which
+ * moves the journal to the outgoing directory when it is complete.
+ */
+static bool
+journal_relay_path(struct connection_closure *closure, char *pathbuf,
+    size_t pathlen)
+{
+    const char *journal_path = closure->journal_path;
+
+    if (closure->journal_writer != NULL)
+	journal_path = closure->journal_writer->journal_path;
+    if (journal_path == NULL)
+	return false;
+    return journal_sidecar_path(journal_path, JOURNAL_RELAY_SUFFIX, pathbuf,
+	pathlen);
+}
+
+/*
+ * Store the log ID the relay host assigned to a journal we are relaying
+ * and the last commit point it sent, in a file next to the journal.
+ * If the relay connection is lost, the next relay of the journal
+ * restarts the session from the commit point, see journal_relay_resume().
+ * The log ID is only present in the first update.
+ */
+void
+journal_relay_update(const char *log_id, TimeSpec *commit_point,
+    struct connection_closure *closure)
+{
+    char relay_path[PATH_MAX], tmp_path[PATH_MAX];
+    FILE *fp;
+    int fd, len;
+    debug_decl(journal_relay_update, SUDO_DEBUG_UTIL);
+
+    if (log_id != NULL) {
+	char *copy = strdup(log_id);
+	if (copy == NULL) {
+	    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	    debug_return;
+	}
+	free(closure->relay_log_id);
+	closure->relay_log_id = copy;
+	sudo_timespecclear(&closure->relay_commit);
+    } else {
+	/* Only sessions with a log ID can be restarted. */
+	if (closure->relay_log_id == NULL)
+	    debug_return;
+	closure->relay_commit.tv_sec = (time_t)commit_point->tv_sec;
+	closure->relay_commit.tv_nsec = (long)commit_point->tv_nsec;
+    }
+
+    if (!journal_relay_path(closure, relay_path, sizeof(relay_path)))
+	debug_return;
+    len = snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", relay_path);
+    if (len < 0 || (size_t)len >= sizeof(tmp_path)) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "path too long: %s.tmp", relay_path);
+	debug_return;
+    }
+
+    /* Replace the old state atomically. */
+    fd = open(tmp_path, O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
+    if (fd == -1 || (fp = fdopen(fd, "w")) == NULL) {
+	sudo_warn(U_("unable to open %s"), tmp_path);
+	if (fd != -1)
+	    close(fd);
+	debug_return;
+    }
+    fprintf(fp, "%lld %ld %s\n", (long long)closure->relay_commit.tv_sec,
+	closure->relay_commit.tv_nsec, closure->relay_log_id);
+    if (fclose(fp) != 0 || rename(tmp_path, relay_path) == -1) {
+	sudo_warn(U_("unable to write to %s"), relay_path);
+	unlink(tmp_path);
+	debug_return;
+    }
+    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	"%s: relay log ID %s, commit point [%lld, %ld]", relay_path,
+	closure->relay_log_id, (long long)closure->relay_commit.tv_sec,
+	closure->relay_commit.tv_nsec);
+
+    debug_return;
+}
+
+/*
+ * Remove the upstream relay state for the journal being relayed,
+ * if any.  The journal will be relayed from the start next time.
+ */
+void
+journal_relay_remove(struct connection_closure *closure)
+{
+    char relay_path[PATH_MAX];
+    debug_decl(journal_relay_remove, SUDO_DEBUG_UTIL);
+
+    if (journal_relay_path(closure, relay_path, sizeof(relay_path))) {
+	if (unlink(relay_path) == 0) {
+	    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+		"removed %s", relay_path);
+	}
+    }
+
+    debug_return;
+}
+
+/*
+ * Read the upstream relay state stored by journal_relay_update().
+ * Returns true if there is a valid state, else false.
+ */
+static bool
+journal_relay_load(struct connection_closure *closure)
+{
+    char line[PATH_MAX + 64], relay_path[PATH_MAX];
+    const char *errstr;
+    char *cp, *ep;
+    struct timespec commit;
+    FILE *fp;
+    debug_decl(journal_relay_load, SUDO_DEBUG_UTIL);
+
+    if (!journal_relay_path(closure, relay_path, sizeof(relay_path)))
+	debug_return_bool(false);
+    if ((fp = fopen(relay_path, "r")) == NULL)
+	debug_return_bool(false);
+    cp = fgets(line, sizeof(line), fp);
+    fclose(fp);
+    if (cp == NULL)
+	goto bad;
+    line[strcspn(line, "\n")] = '\0';
+
+    /* Format is "tv_sec tv_nsec log_id". */
+    if ((ep = strchr(cp, ' ')) == NULL)
+	goto bad;
+    *ep++ = '\0';
+    commit.tv_sec = (time_t)sudo_strtonum(cp, 0, TIME_T_MAX, &errstr);
+    if (errstr != NULL)
+	goto bad;
+    cp = ep;
+    if ((ep = strchr(cp, ' ')) == NULL)
+	goto bad;
+    *ep++ = '\0';
+    commit.tv_nsec = (long)sudo_strtonum(cp, 0, 999999999, &errstr);
+    if (errstr != NULL || *ep == '\0')
+	goto bad;
+
+    free(closure->relay_log_id);
+    if ((closure->relay_log_id = strdup(ep)) == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	debug_return_bool(false);
+    }
+    closure->relay_commit = commit;
+    debug_return_bool(true);
+
+bad:
+    sudo_warnx(U_("%s: invalid relay state, ignoring"), relay_path);
+    debug_return_bool(false);
+}
+
+/*
+ * Called before a journal is relayed.  If an earlier relay of the
+ * journal was interrupted, skip what the relay host has committed
+ * and restart its session instead of starting a new one, which
+ * would leave a partial copy of the session on the relay host.
+ * If the journal cannot be resumed, it is relayed from the start.
+ * Returns true on success, false on error.
+ */
+bool
+journal_relay_resume(struct connection_closure *closure)
+{
+    int fd = fileno(closure->journal);
+    debug_decl(journal_relay_resume, SUDO_DEBUG_UTIL);
+
+    if (!journal_relay_load(closure))
+	debug_return_bool(true);
+
+    /* The rest of the journal is read from fd, not the stdio stream. */
+    rewind(closure->journal);
+    closure->journal_offset = 0;
+    sudo_timespecclear(&closure->elapsed_time);
+    if (journal_seek(&closure->relay_commit, closure)) {
+	if (lseek(fd, closure->journal_offset, SEEK_SET) == -1) {
+	    sudo_warn(U_("unable to seek to [%lld, %ld] in journal file %s"),
+		(long long)closure->relay_commit.tv_sec,
+		closure->relay_commit.tv_nsec, closure->journal_path);
+	    closure->errstr = _("error reading journal file");
+	    debug_return_bool(false);
+	}
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	    "%s: resuming relay of %s at offset %lld", closure->journal_path,
+	    closure->relay_log_id, (long long)closure->journal_offset);
+	debug_return_bool(relay_resume(closure));
+    }
+
+    /* Relay the whole journal as a new session. */
+    sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+	"%s: unable to resume relay of %s, starting over",
+	closure->journal_path, closure->relay_log_id);
+    journal_relay_remove(closure);
+    free(closure->relay_log_id);
+    closure->relay_log_id = NULL;
+    sudo_timespecclear(&closure->relay_commit);
+    sudo_timespecclear(&closure->elapsed_time);
+    closure->journal_offset = 0;
+    closure->errstr = NULL;
+    rewind(closure->journal);
+    if (lseek(fd, 0, SEEK_SET) == -1) {
+	sudo_warn("%s", closure->journal_path);
+	closure->errstr = _("error reading journal file");
+	debug_return_bool(false);
+    }
+
+    debug_return_bool(true);
+}
+
+/*
+ * Flush buffered journal data and, if sync is set, commit the
+ * journal to stable storage.
+ */
+bool
+journal_flush(struct connection_closure *closure, bool sync)
+{
+    debug_decl(journal_flush, SUDO_DEBUG_UTIL);
+
+    if (fflush(closure->journal) != 0) {
+	closure->errstr = _("unable to write journal file");
+	debug_return_bool(false);
+    }
+    if (closure->journal_index != NULL && fflush(closure->journal_index) != 0) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "unable to write journal index for %s", closure->journal_path);
+	journal_index_close(closure, true);
+    }
+    if (sync) {
+#ifdef HAVE_FDATASYNC
+	if (fdatasync(fileno(closure->journal)) == -1) {
+#else
+	if (fsync(fileno(closure->journal)) == -1) {
+#endif
+	    sudo_warn(U_("unable to write to %s"),
+		closure->journal_path);
+	    closure->errstr = _("unable to write journal file");
+	    debug_return_bool(false);
+	}
+    }
+
+    /* Let the tail (if any) relay what has been written out. */
+    if (closure->journal_tail != NULL)
+	journal_tail_wake(closure->journal_tail);
+
     debug_return_bool(true);
 }
 
@@ -470,6 +1278,7 @@ journal_write(uint8_t *buf, size_t len, struct connection_closure *closure)
 	closure->errstr = _("unable to write journal file");
 	debug_return_bool(false);
     }
+    closure->journal_offset += (off_t)(sizeof(msg_len) + len);
     debug_return_bool(true);
 }
 
@@ -502,6 +1311,10 @@ journal_accept(AcceptMessage *msg, uint8_t *buf, size_t len,
 	    sudo_warnx("%s", U_("unable to add event to queue"));
 	    debug_return_bool(false);
 	}
+
+	/* Relay the session while it is still running. */
+	if (logsrvd_conf_relay_store_first_tail())
+	    journal_tail_start(closure);
     }
 
     debug_return_bool(true);
@@ -577,6 +1390,26 @@ journal_iobuf(int iofd, IoBuffer *iobuf, uint8_t *buf, size_t len,
     if (!journal_write(buf, len, closure))
 	debug_return_bool(false);
     update_elapsed_time(iobuf->delay, &closure->elapsed_time);
+    journal_index_add(closure);
+
+    debug_return_bool(true);
+}
+
+/*
+ * Store an IoBufferBatch from the client in the journal as-is.
+ */
+static bool
+journal_iobuf_batch(IoBufferBatch *msg, uint8_t *buf, size_t len,
+    struct connection_closure *closure)
+{
+    size_t n;
+    debug_decl(journal_iobuf_batch, SUDO_DEBUG_UTIL);
+
+    if (!journal_write(buf, len, closure))
+	debug_return_bool(false);
+    for (n = 0; n < msg->n_records; n++)
+	update_elapsed_time(msg->records[n]->delay, &closure->elapsed_time);
+    journal_index_add(closure);
 
     debug_return_bool(true);
 }
@@ -591,8 +1424,11 @@ journal_suspend(CommandSuspend *msg, uint8_t *buf, size_t len,
     debug_decl(journal_suspend, SUDO_DEBUG_UTIL);
 
     update_elapsed_time(msg->delay, &closure->elapsed_time);
+    if (!journal_write(buf, len, closure))
+	debug_return_bool(false);
+    journal_index_add(closure);
 
-    debug_return_bool(journal_write(buf, len, closure));
+    debug_return_bool(true);
 }
 
 /*
@@ -605,8 +1441,11 @@ journal_winsize(ChangeWindowSize *msg, uint8_t *buf, size_t len,
     debug_decl(journal_winsize, SUDO_DEBUG_UTIL);
 
     update_elapsed_time(msg->delay, &closure->elapsed_time);
+    if (!journal_write(buf, len, closure))
+	debug_return_bool(false);
+    journal_index_add(closure);
 
-    debug_return_bool(journal_write(buf, len, closure));
+    debug_return_bool(true);
 }
 
 struct client_message_switch cms_journal = {
@@ -617,5 +1456,6 @@ struct client_message_switch cms_journal = {
     journal_alert,
     journal_iobuf,
     journal_suspend,
-    journal_winsize
+    journal_winsize,
+    journal_iobuf_batch
 };
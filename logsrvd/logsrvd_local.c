@@ -26,6 +26,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/uio.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
@@ -403,6 +404,10 @@ store_exit_local(ExitMessage *msg, uint8_t *buf, size_t len,
     int flags = 0;
     debug_decl(store_exit_local, SUDO_DEBUG_UTIL);
 
+    /* Write any queued I/O log records before logging the exit status. */
+    if (!iolog_drain(closure))
+	debug_return_bool(false);
+
     if (msg->run_time != NULL) {
 	evlog->run_time.tv_sec = msg->run_time->tv_sec;
 	evlog->run_time.tv_nsec = msg->run_time->tv_nsec;
@@ -443,6 +448,13 @@ store_exit_local(ExitMessage *msg, uint8_t *buf, size_t len,
 	    sudo_warn("chmod 0%o %s/%s", (unsigned int)mode, "timing",
 		logsrvd_conf_iolog_dir());
 	}
+
+	/* A complete log cannot be restarted, remove the restart index. */
+	if (closure->iolog_index_fd != -1) {
+	    close(closure->iolog_index_fd);
+	    closure->iolog_index_fd = -1;
+	}
+	(void)unlinkat(closure->iolog_dir_fd, IOLOG_INDEX_FILE, 0);
     }
 
     debug_return_bool(true);
@@ -494,6 +506,10 @@ store_restart_local(RestartMessage *msg, uint8_t *buf, size_t len,
 	goto bad;
     }
 
+    /* Use the restart index to resume without reading the logs. */
+    if (iolog_resume(&target, closure))
+	debug_return_bool(true);
+
     /* Open existing I/O log files. */
     if (!iolog_open_all(closure->iolog_dir_fd, closure->evlog->iolog_path,
 	    closure->iolog_files, "r+"))
@@ -510,11 +526,9 @@ store_restart_local(RestartMessage *msg, uint8_t *buf, size_t len,
 	    closure->iolog_files, &closure->elapsed_time, &target))
 	goto bad;
 
-    /* Must seek or flush before switching from read -> write. */
-    if (iolog_seek(&closure->iolog_files[IOFD_TIMING], 0, SEEK_CUR) == -1) {
-	sudo_warn("%s/timing", closure->evlog->iolog_path);
+    /* Discard anything past the resume point. */
+    if (!iolog_truncate_all(closure))
 	goto bad;
-    }
 
     /* Ready to log I/O buffers. */
     debug_return_bool(true);
@@ -563,10 +577,7 @@ bool
 store_iobuf_local(int iofd, IoBuffer *iobuf, uint8_t *buf, size_t buflen,
     struct connection_closure *closure)
 {
-    const struct eventlog *evlog = closure->evlog;
-    struct ProtobufCBinaryData data = iobuf->data;
-    char tbuf[1024], *newbuf = NULL;
-    const char *errstr;
+    char tbuf[1024];
     int len;
     debug_decl(store_iobuf_local, SUDO_DEBUG_UTIL);
 
@@ -580,36 +591,16 @@ store_iobuf_local(int iofd, IoBuffer *iobuf, uint8_t *buf, size_t buflen,
     /* FIXME - assumes IOFD_* matches IO_EVENT_* */
     len = snprintf(tbuf, sizeof(tbuf), "%d %lld.%09d %zu\n",
 	iofd, (long long)iobuf->delay->tv_sec, (int)iobuf->delay->tv_nsec,
-	data.len);
+	iobuf->data.len);
     if (len < 0 || len >= ssizeof(tbuf)) {
 	sudo_warnx(U_("unable to format timing buffer, length %d"), len);
 	goto bad;
     }
 
-    if (!logsrvd_conf_iolog_log_passwords()) {
-	if (!iolog_pwfilt_run(logsrvd_conf_iolog_passprompt_regex(), iofd,
-		(char *)data.data, data.len, &newbuf))
-	    goto bad;
-	if (newbuf != NULL)
-	    data.data = (uint8_t *)newbuf;
-    }
-
-    /* Write to specified I/O log file. */
-    if (!iolog_write(&closure->iolog_files[iofd], data.data, data.len, &errstr)) {
-	sudo_warnx(U_("%s/%s: %s"), evlog->iolog_path, iolog_fd_to_name(iofd),
-	    errstr);
-	goto bad;
-    }
-
-    /* Write timing data. */
-    if (!iolog_write(&closure->iolog_files[IOFD_TIMING], tbuf,
-	    len, &errstr)) {
-	sudo_warnx(U_("%s/%s: %s"), evlog->iolog_path,
-	    iolog_fd_to_name(IOFD_TIMING), errstr);
+    /* Queue I/O log data and timing for the I/O log writer. */
+    if (!iolog_queue_record(iofd, iobuf->delay, tbuf, len, iobuf->data.data,
+	    iobuf->data.len, closure))
 	goto bad;
-    }
-
-    update_elapsed_time(iobuf->delay, &closure->elapsed_time);
 
     /* Random drop is a debugging tool to test client restart. */
     if (random_drop > 0.0) {
@@ -622,20 +613,40 @@ store_iobuf_local(int iofd, IoBuffer *iobuf, uint8_t *buf, size_t buflen,
 	}
     }
 
-    free(newbuf);
     debug_return_bool(true);
 bad:
-    free(newbuf);
     if (closure->errstr == NULL)
 	closure->errstr = _("error writing IoBuffer");
     debug_return_bool(false);
 }
 
+/*
+ * Store each record of an IoBufferBatch as if it were its own IoBuffer.
+ */
+bool
+store_iobuf_batch_local(IoBufferBatch *msg, uint8_t *buf, size_t buflen,
+    struct connection_closure *closure)
+{
+    size_t n;
+    debug_decl(store_iobuf_batch_local, SUDO_DEBUG_UTIL);
+
+    for (n = 0; n < msg->n_records; n++) {
+	IoRecord *record = msg->records[n];
+	IoBuffer iobuf = IO_BUFFER__INIT;
+
+	iobuf.delay = record->delay;
+	iobuf.data = record->data;
+	if (!store_iobuf_local(record->iofd, &iobuf, NULL, 0, closure))
+	    debug_return_bool(false);
+    }
+
+    debug_return_bool(true);
+}
+
 bool
 store_winsize_local(ChangeWindowSize *msg, uint8_t *buf, size_t buflen,
     struct connection_closure *closure)
 {
-    const char *errstr;
     char tbuf[1024];
     int len;
     debug_decl(store_winsize_local, SUDO_DEBUG_UTIL);
@@ -649,15 +660,10 @@ store_winsize_local(ChangeWindowSize *msg, uint8_t *buf, size_t buflen,
 	goto bad;
     }
 
-    /* Write timing data. */
-    if (!iolog_write(&closure->iolog_files[IOFD_TIMING], tbuf,
-	    len, &errstr)) {
-	sudo_warnx(U_("%s/%s: %s"), closure->evlog->iolog_path,
-	    iolog_fd_to_name(IOFD_TIMING), errstr);
+    /* Queue timing data for the I/O log writer. */
+    if (!iolog_queue_record(IOFD_TIMING, msg->delay, tbuf, len, NULL, 0,
+	    closure))
 	goto bad;
-    }
-
-    update_elapsed_time(msg->delay, &closure->elapsed_time);
 
     debug_return_bool(true);
 bad:
@@ -670,7 +676,6 @@ bool
 store_suspend_local(CommandSuspend *msg, uint8_t *buf, size_t buflen,
     struct connection_closure *closure)
 {
-    const char *errstr;
     char tbuf[1024];
     int len;
     debug_decl(store_suspend_local, SUDO_DEBUG_UTIL);
@@ -684,15 +689,10 @@ store_suspend_local(CommandSuspend *msg, uint8_t *buf, size_t buflen,
 	goto bad;
     }
 
-    /* Write timing data. */
-    if (!iolog_write(&closure->iolog_files[IOFD_TIMING], tbuf,
-	    len, &errstr)) {
-	sudo_warnx(U_("%s/%s: %s"), closure->evlog->iolog_path,
-	    iolog_fd_to_name(IOFD_TIMING), errstr);
+    /* Queue timing data for the I/O log writer. */
+    if (!iolog_queue_record(IOFD_TIMING, msg->delay, tbuf, len, NULL, 0,
+	    closure))
 	goto bad;
-    }
-
-    update_elapsed_time(msg->delay, &closure->elapsed_time);
 
     debug_return_bool(true);
 bad:
@@ -709,5 +709,6 @@ struct client_message_switch cms_local = {
     store_alert_local,
     store_iobuf_local,
     store_suspend_local,
-    store_winsize_local
+    store_winsize_local,
+    store_iobuf_batch_local
 };
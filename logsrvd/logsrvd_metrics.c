@@ -0,0 +1,943 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * This is an open source non-commercial project. Dear PVS-Studio, please check it.
+ * PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+ */
+
+#include <config.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#ifdef HAVE_STDBOOL_H
+# include <stdbool.h>
+#else
+# include "compat/stdbool.h"
+#endif /* HAVE_STDBOOL_H */
+#if defined(HAVE_STDINT_H)
+# include <stdint.h>
+#elif defined(HAVE_INTTYPES_H)
+# include <inttypes.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sudo_compat.h"
+#include "sudo_conf.h"
+#include "sudo_debug.h"
+#include "sudo_event.h"
+#include "sudo_eventlog.h"
+#include "sudo_fatal.h"
+#include "sudo_gettext.h"
+#include "sudo_iolog.h"
+#include "sudo_queue.h"
+#include "sudo_util.h"
+
+#include "logsrvd.h"
+
+#if !defined(MAP_ANON) && defined(MAP_ANONYMOUS)
+# define MAP_ANON MAP_ANONYMOUS
+#endif
+
+#if defined(HAVE_STRUCT_DIRENT_D_NAMLEN) && HAVE_STRUCT_DIRENT_D_NAMLEN
+# define NAMLEN(dirent) (dirent)->d_namlen
+#else
+# define NAMLEN(dirent) strlen((dirent)->d_name)
+#endif
+
+/*
+ * Histogram bucket upper bounds, in microseconds.
+ * Observations larger than the last bound go in the +Inf bucket.
+ */
+static const unsigned int histogram_bounds[] = {
+    50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+    100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000
+};
+#define HISTOGRAM_NBUCKETS	(nitems(histogram_bounds) + 1)
+
+struct metrics_histogram {
+    uint64_t buckets[HISTOGRAM_NBUCKETS];
+    uint64_t count;
+    uint64_t sum_ns;
+};
+
+static const struct histogram_info {
+    const char *name;
+    const char *help;
+} histogram_info[METRICS_NHISTOGRAMS] = {
+    { "sudo_logsrvd_decode_seconds",
+	"Time spent unpacking a client message." },
+    { "sudo_logsrvd_iolog_write_seconds",
+	"Time spent writing out an I/O log or journal for a commit point." },
+    { "sudo_logsrvd_commit_lag_seconds",
+	"Time from the first unacknowledged record to its commit point." },
+    { "sudo_logsrvd_tls_handshake_seconds",
+	"Time from accepting a TLS connection to handshake completion." },
+    { "sudo_logsrvd_relay_lag_seconds",
+	"Time from reading a stored journal record to its relay commit point." }
+};
+
+/* Indexed by ClientMessage type_case, 0 is used for unknown types. */
+static const char *client_message_types[] = {
+    "unknown",
+    "accept_msg",
+    "reject_msg",
+    "exit_msg",
+    "restart_msg",
+    "alert_msg",
+    "ttyin_buf",
+    "ttyout_buf",
+    "stdin_buf",
+    "stdout_buf",
+    "stderr_buf",
+    "winsize_event",
+    "suspend_event",
+    "hello_msg",
+    "close_stream_msg",
+    NULL,		/* 15 is stream_id, not a message type */
+    "iobuf_batch",
+    "compressed"
+};
+
+/* Indexed by ServerMessage type_case, 0 is used for unknown types. */
+static const char *server_message_types[] = {
+    "unknown",
+    "hello",
+    "commit_point",
+    "log_id",
+    "error",
+    "abort"
+};
+
+/*
+ * Metrics for a single server process.
+ * When there are multiple workers, each one updates its own slot
+ * in a shared mapping that the supervisor sums when scraped.
+ */
+struct logsrvd_metrics {
+    uint64_t connections_accepted[2];	/* indexed by tls */
+    uint64_t connections_active;
+    uint64_t tls_handshakes[2];		/* indexed by resumed */
+    uint64_t tls_ktls[2];		/* send, receive */
+    uint64_t client_messages[nitems(client_message_types)];
+    uint64_t client_bytes[nitems(client_message_types)];
+    uint64_t server_messages[nitems(server_message_types)];
+    uint64_t server_bytes[nitems(server_message_types)];
+    uint64_t relay_journals_active;
+    uint64_t relay_inflight_bytes;
+    uint64_t buffer_bytes;
+    uint64_t connections_paused;
+    uint64_t buffer_pool_hits;
+    uint64_t buffer_pool_misses;
+    uint64_t buffer_pool_bytes;
+    struct metrics_histogram histograms[METRICS_NHISTOGRAMS];
+};
+
+/*
+ * A client of the metrics listener.
+ * We read a single HTTP request, write the response and close.
+ */
+struct metrics_client {
+    TAILQ_ENTRY(metrics_client) entries;
+    struct sudo_event_base *evbase;
+    struct sudo_event *ev;
+    char *resp;
+    size_t resp_len;
+    size_t resp_off;
+    size_t req_len;
+    int sock;
+    char req[1024];
+};
+TAILQ_HEAD(metrics_client_list, metrics_client);
+
+/* Growable buffer for the response body. */
+struct metrics_buf {
+    char *data;
+    size_t len;
+    size_t size;
+    bool error;
+};
+
+static struct logsrvd_metrics *metrics_slots;
+static struct logsrvd_metrics *metrics;
+static unsigned int metrics_nslots;
+static struct listener_list metrics_listeners =
+    TAILQ_HEAD_INITIALIZER(metrics_listeners);
+static struct metrics_client_list metrics_clients =
+    TAILQ_HEAD_INITIALIZER(metrics_clients);
+
+static void metrics_client_cb(int fd, int what, void *v);
+static bool metrics_printf(struct metrics_buf *buf, const char * restrict fmt, ...) sudo_printflike(2, 3);
+
+/*
+ * Allocate metrics storage for nslots server processes.
+ * The storage is shared so worker processes forked after this
+ * call update counters that are visible to the supervisor.
+ */
+bool
+metrics_init(unsigned int nslots)
+{
+    size_t size = nslots * sizeof(struct logsrvd_metrics);
+    void *ptr;
+    debug_decl(metrics_init, SUDO_DEBUG_UTIL);
+
+    ptr = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANON, -1, 0);
+    if (ptr == MAP_FAILED) {
+	sudo_warn("%s", U_("unable to allocate memory"));
+	debug_return_bool(false);
+    }
+    metrics_slots = ptr;
+    metrics_nslots = nslots;
+    metrics = &metrics_slots[0];
+
+    debug_return_bool(true);
+}
+
+/*
+ * Select the slot updated by this process.
+ * Called by a worker process after it is forked.
+ */
+void
+metrics_select(unsigned int slot)
+{
+    debug_decl(metrics_select, SUDO_DEBUG_UTIL);
+
+    if (metrics_slots != NULL && slot < metrics_nslots)
+	metrics = &metrics_slots[slot];
+
+    debug_return;
+}
+
+/*
+ * Clear the gauges of a slot whose process has exited.
+ * Counters are left as-is so they never go backwards.
+ */
+void
+metrics_reset_gauges(unsigned int slot)
+{
+    debug_decl(metrics_reset_gauges, SUDO_DEBUG_UTIL);
+
+    if (metrics_slots != NULL && slot < metrics_nslots) {
+	metrics_slots[slot].connections_active = 0;
+	metrics_slots[slot].relay_journals_active = 0;
+	metrics_slots[slot].relay_inflight_bytes = 0;
+	metrics_slots[slot].buffer_bytes = 0;
+	metrics_slots[slot].connections_paused = 0;
+	metrics_slots[slot].buffer_pool_bytes = 0;
+    }
+
+    debug_return;
+}
+
+void
+metrics_connection_open(bool tls)
+{
+    if (metrics != NULL) {
+	metrics->connections_accepted[tls]++;
+	metrics->connections_active++;
+    }
+}
+
+void
+metrics_connection_close(void)
+{
+    if (metrics != NULL)
+	metrics->connections_active--;
+}
+
+void
+metrics_tls_handshake(bool resumed)
+{
+    if (metrics != NULL)
+	metrics->tls_handshakes[resumed]++;
+}
+
+void
+metrics_tls_ktls(bool ktls_send, bool ktls_recv)
+{
+    if (metrics != NULL) {
+	if (ktls_send)
+	    metrics->tls_ktls[0]++;
+	if (ktls_recv)
+	    metrics->tls_ktls[1]++;
+    }
+}
+
+void
+metrics_client_message(int type, size_t len)
+{
+    if (metrics != NULL) {
+	if (type < 0 || (size_t)type >= nitems(client_message_types))
+	    type = 0;
+	metrics->client_messages[type]++;
+	metrics->client_bytes[type] += len;
+    }
+}
+
+void
+metrics_server_message(int type, size_t len)
+{
+    if (metrics != NULL) {
+	if (type < 0 || (size_t)type >= nitems(server_message_types))
+	    type = 0;
+	metrics->server_messages[type]++;
+	metrics->server_bytes[type] += len;
+    }
+}
+
+void
+metrics_relay_queue(unsigned int active, size_t inflight)
+{
+    if (metrics != NULL) {
+	metrics->relay_journals_active = active;
+	metrics->relay_inflight_bytes = inflight;
+    }
+}
+
+void
+metrics_buffers(size_t buffered, unsigned int paused)
+{
+    if (metrics != NULL) {
+	metrics->buffer_bytes = buffered;
+	metrics->connections_paused = paused;
+    }
+}
+
+void
+metrics_buffer_pool(uint64_t hits, uint64_t misses, size_t pooled)
+{
+    if (metrics != NULL) {
+	metrics->buffer_pool_hits = hits;
+	metrics->buffer_pool_misses = misses;
+	metrics->buffer_pool_bytes = pooled;
+    }
+}
+
+/*
+ * Add the time elapsed since start (monotonic) to the specified histogram.
+ */
+void
+metrics_observe(enum metrics_histogram_id id, const struct timespec *start)
+{
+    struct metrics_histogram *h;
+    struct timespec now;
+    uint64_t usec;
+    size_t i;
+
+    if (metrics == NULL || sudo_gettime_mono(&now) == -1)
+	return;
+    sudo_timespecsub(&now, start, &now);
+    if (now.tv_sec < 0)
+	return;
+
+    h = &metrics->histograms[id];
+    usec = ((uint64_t)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+    for (i = 0; i < nitems(histogram_bounds); i++) {
+	if (usec <= histogram_bounds[i])
+	    break;
+    }
+    h->buckets[i]++;
+    h->count++;
+    h->sum_ns += ((uint64_t)now.tv_sec * 1000000000) + now.tv_nsec;
+}
+
+
+static bool
+metrics_printf(struct metrics_buf *buf, const char * restrict fmt, ...)
+{
+    va_list ap;
+    int len;
+
+    if (buf->error)
+	return false;
+    for (;;) {
+	size_t avail = buf->size - buf->len;
+	size_t newsize;
+	char *newdata;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf->data ? buf->data + buf->len : NULL, avail, fmt, ap);
+	va_end(ap);
+	if (len < 0) {
+	    buf->error = true;
+	    return false;
+	}
+	if ((size_t)len < avail)
+	    break;
+
+	/* Grow the buffer and try again. */
+	newsize = buf->size + (size_t)len + 4096;
+	if ((newdata = realloc(buf->data, newsize)) == NULL) {
+	    buf->error = true;
+	    return false;
+	}
+	buf->data = newdata;
+	buf->size = newsize;
+    }
+    buf->len += (size_t)len;
+    return true;
+}
+
+/*
+ * Sum the metrics of all server processes into total.
+ */
+static void
+metrics_sum(struct logsrvd_metrics *total)
+{
+    unsigned int slot;
+    size_t i, j;
+    debug_decl(metrics_sum, SUDO_DEBUG_UTIL);
+
+    memset(total, 0, sizeof(*total));
+    for (slot = 0; slot < metrics_nslots; slot++) {
+	const struct logsrvd_metrics *m = &metrics_slots[slot];
+
+	for (i = 0; i < nitems(m->connections_accepted); i++)
+	    total->connections_accepted[i] += m->connections_accepted[i];
+	total->connections_active += m->connections_active;
+	for (i = 0; i < nitems(m->tls_handshakes); i++)
+	    total->tls_handshakes[i] += m->tls_handshakes[i];
+	for (i = 0; i < nitems(m->tls_ktls); i++)
+	    total->tls_ktls[i] += m->tls_ktls[i];
+	for (i = 0; i < nitems(client_message_types); i++) {
+	    total->client_messages[i] += m->client_messages[i];
+	    total->client_bytes[i] += m->client_bytes[i];
+	}
+	for (i = 0; i < nitems(server_message_types); i++) {
+	    total->server_messages[i] += m->server_messages[i];
+	    total->server_bytes[i] += m->server_bytes[i];
+	}
+	total->relay_journals_active += m->relay_journals_active;
+	total->relay_inflight_bytes += m->relay_inflight_bytes;
+	total->buffer_bytes += m->buffer_bytes;
+	total->connections_paused += m->connections_paused;
+	total->buffer_pool_hits += m->buffer_pool_hits;
+	total->buffer_pool_misses += m->buffer_pool_misses;
+	total->buffer_pool_bytes += m->buffer_pool_bytes;
+	for (i = 0; i < METRICS_NHISTOGRAMS; i++) {
+	    const struct metrics_histogram *h = &m->histograms[i];
+
+	    for (j = 0; j < HISTOGRAM_NBUCKETS; j++)
+		total->histograms[i].buckets[j] += h->buckets[j];
+	    total->histograms[i].count += h->count;
+	    total->histograms[i].sum_ns += h->sum_ns;
+	}
+    }
+
+    debug_return;
+}
+
+/*
+ * Count the journals waiting to be relayed and their total size.
+ */
+static void
+metrics_journal_backlog(unsigned long long *count, unsigned long long *bytes)
+{
+    char path[PATH_MAX];
+    struct dirent *dent;
+    size_t prefix_len;
+    int dirlen;
+    DIR *dirp;
+    debug_decl(metrics_journal_backlog, SUDO_DEBUG_UTIL);
+
+    *count = 0;
+    *bytes = 0;
+
+    if (TAILQ_EMPTY(logsrvd_conf_relay_address()))
+	debug_return;
+
+    dirlen = snprintf(path, sizeof(path), "%s/outgoing/",
+	logsrvd_conf_relay_dir());
+    if (dirlen < 0 || dirlen >= ssizeof(path))
+	debug_return;
+    if ((dirp = opendir(path)) == NULL)
+	debug_return;
+
+    prefix_len = strcspn(RELAY_TEMPLATE, "X");
+    while ((dent = readdir(dirp)) != NULL) {
+	struct stat sb;
+
+	/* Skip anything that is not a relay temp file. */
+	if (NAMLEN(dent) != sizeof(RELAY_TEMPLATE) - 1)
+	    continue;
+	if (strncmp(dent->d_name, RELAY_TEMPLATE, prefix_len) != 0)
+	    continue;
+
+	path[dirlen] = '\0';
+	if (strlcat(path, dent->d_name, sizeof(path)) >= sizeof(path))
+	    continue;
+	if (stat(path, &sb) == -1)
+	    continue;
+	(*count)++;
+	*bytes += (unsigned long long)sb.st_size;
+    }
+    closedir(dirp);
+
+    debug_return;
+}
+
+static void
+metrics_format_histogram(struct metrics_buf *buf, const char *name,
+    const char *help, const struct metrics_histogram *h)
+{
+    unsigned long long cumulative = 0;
+    size_t i;
+    debug_decl(metrics_format_histogram, SUDO_DEBUG_UTIL);
+
+    metrics_printf(buf, "# HELP %s %s\n# TYPE %s histogram\n", name, help,
+	name);
+    for (i = 0; i < nitems(histogram_bounds); i++) {
+	cumulative += h->buckets[i];
+	metrics_printf(buf, "%s_bucket{le=\"%u.%06u\"} %llu\n", name,
+	    histogram_bounds[i] / 1000000, histogram_bounds[i] % 1000000,
+	    cumulative);
+    }
+    cumulative += h->buckets[i];
+    metrics_printf(buf, "%s_bucket{le=\"+Inf\"} %llu\n", name, cumulative);
+    metrics_printf(buf, "%s_sum %llu.%09llu\n", name,
+	(unsigned long long)(h->sum_ns / 1000000000),
+	(unsigned long long)(h->sum_ns % 1000000000));
+    metrics_printf(buf, "%s_count %llu\n", name, (unsigned long long)h->count);
+
+    debug_return;
+}
+
+/*
+ * Format the metrics of all server processes in the Prometheus
+ * text exposition format.
+ */
+static bool
+metrics_format(struct metrics_buf *buf)
+{
+    struct logsrvd_metrics total;
+    unsigned long long backlog, backlog_bytes;
+    size_t i;
+    debug_decl(metrics_format, SUDO_DEBUG_UTIL);
+
+    metrics_sum(&total);
+    metrics_journal_backlog(&backlog, &backlog_bytes);
+
+    metrics_printf(buf, "# HELP sudo_logsrvd_connections_accepted_total "
+	"Client connections accepted.\n"
+	"# TYPE sudo_logsrvd_connections_accepted_total counter\n");
+    metrics_printf(buf,
+	"sudo_logsrvd_connections_accepted_total{tls=\"false\"} %llu\n",
+	(unsigned long long)total.connections_accepted[false]);
+    metrics_printf(buf,
+	"sudo_logsrvd_connections_accepted_total{tls=\"true\"} %llu\n",
+	(unsigned long long)total.connections_accepted[true]);
+    metrics_printf(buf, "# HELP sudo_logsrvd_connections_active "
+	"Client connections currently open.\n"
+	"# TYPE sudo_logsrvd_connections_active gauge\n"
+	"sudo_logsrvd_connections_active %llu\n",
+	(unsigned long long)total.connections_active);
+
+    metrics_printf(buf, "# HELP sudo_logsrvd_tls_handshakes_total "
+	"TLS handshakes completed, by whether a session was resumed.\n"
+	"# TYPE sudo_logsrvd_tls_handshakes_total counter\n");
+    metrics_printf(buf,
+	"sudo_logsrvd_tls_handshakes_total{resumed=\"false\"} %llu\n",
+	(unsigned long long)total.tls_handshakes[false]);
+    metrics_printf(buf,
+	"sudo_logsrvd_tls_handshakes_total{resumed=\"true\"} %llu\n",
+	(unsigned long long)total.tls_handshakes[true]);
+
+    metrics_printf(buf, "# HELP sudo_logsrvd_tls_ktls_total "
+	"TLS connections using kernel TLS offload, by direction.\n"
+	"# TYPE sudo_logsrvd_tls_ktls_total counter\n");
+    metrics_printf(buf,
+	"sudo_logsrvd_tls_ktls_total{direction=\"send\"} %llu\n",
+	(unsigned long long)total.tls_ktls[0]);
+    metrics_printf(buf,
+	"sudo_logsrvd_tls_ktls_total{direction=\"receive\"} %llu\n",
+	(unsigned long long)total.tls_ktls[1]);
+
+    metrics_printf(buf, "# HELP sudo_logsrvd_client_messages_total "
+	"Client messages received, by type.\n"
+	"# TYPE sudo_logsrvd_client_messages_total counter\n");
+    for (i = 0; i < nitems(client_message_types); i++) {
+	if (client_message_types[i] == NULL)
+	    continue;
+	metrics_printf(buf,
+	    "sudo_logsrvd_client_messages_total{type=\"%s\"} %llu\n",
+	    client_message_types[i],
+	    (unsigned long long)total.client_messages[i]);
+    }
+    metrics_printf(buf, "# HELP sudo_logsrvd_client_bytes_total "
+	"Bytes of client messages received, by type.  The contents of "
+	"compressed messages are also counted uncompressed.\n"
+	"# TYPE sudo_logsrvd_client_bytes_total counter\n");
+    for (i = 0; i < nitems(client_message_types); i++) {
+	if (client_message_types[i] == NULL)
+	    continue;
+	metrics_printf(buf,
+	    "sudo_logsrvd_client_bytes_total{type=\"%s\"} %llu\n",
+	    client_message_types[i],
+	    (unsigned long long)total.client_bytes[i]);
+    }
+    metrics_printf(buf, "# HELP sudo_logsrvd_server_messages_total "
+	"Server messages sent, by type.\n"
+	"# TYPE sudo_logsrvd_server_messages_total counter\n");
+    for (i = 0; i < nitems(server_message_types); i++) {
+	metrics_printf(buf,
+	    "sudo_logsrvd_server_messages_total{type=\"%s\"} %llu\n",
+	    server_message_types[i],
+	    (unsigned long long)total.server_messages[i]);
+    }
+    metrics_printf(buf, "# HELP sudo_logsrvd_server_bytes_total "
+	"Bytes of server messages sent, by type.\n"
+	"# TYPE sudo_logsrvd_server_bytes_total counter\n");
+    for (i = 0; i < nitems(server_message_types); i++) {
+	metrics_printf(buf,
+	    "sudo_logsrvd_server_bytes_total{type=\"%s\"} %llu\n",
+	    server_message_types[i],
+	    (unsigned long long)total.server_bytes[i]);
+    }
+
+    metrics_printf(buf, "# HELP sudo_logsrvd_relay_journals_active "
+	"Stored journals currently being relayed.\n"
+	"# TYPE sudo_logsrvd_relay_journals_active gauge\n"
+	"sudo_logsrvd_relay_journals_active %llu\n",
+	(unsigned long long)total.relay_journals_active);
+    metrics_printf(buf, "# HELP sudo_logsrvd_relay_inflight_bytes "
+	"Combined size of the stored journals currently being relayed.\n"
+	"# TYPE sudo_logsrvd_relay_inflight_bytes gauge\n"
+	"sudo_logsrvd_relay_inflight_bytes %llu\n",
+	(unsigned long long)total.relay_inflight_bytes);
+    metrics_printf(buf, "# HELP sudo_logsrvd_journal_backlog "
+	"Stored journals waiting to be relayed, including those in flight.\n"
+	"# TYPE sudo_logsrvd_journal_backlog gauge\n"
+	"sudo_logsrvd_journal_backlog %llu\n", backlog);
+    metrics_printf(buf, "# HELP sudo_logsrvd_journal_backlog_bytes "
+	"Combined size of the stored journals waiting to be relayed.\n"
+	"# TYPE sudo_logsrvd_journal_backlog_bytes gauge\n"
+	"sudo_logsrvd_journal_backlog_bytes %llu\n", backlog_bytes);
+    metrics_printf(buf, "# HELP sudo_logsrvd_buffer_bytes "
+	"Memory used by client and relay connection buffers.\n"
+	"# TYPE sudo_logsrvd_buffer_bytes gauge\n"
+	"sudo_logsrvd_buffer_bytes %llu\n",
+	(unsigned long long)total.buffer_bytes);
+    metrics_printf(buf, "# HELP sudo_logsrvd_connections_paused "
+	"Connections not being read from until their buffers drain.\n"
+	"# TYPE sudo_logsrvd_connections_paused gauge\n"
+	"sudo_logsrvd_connections_paused %llu\n",
+	(unsigned long long)total.connections_paused);
+    metrics_printf(buf, "# HELP sudo_logsrvd_buffer_pool_requests_total "
+	"Connection buffers requested, by whether a pooled buffer was reused.\n"
+	"# TYPE sudo_logsrvd_buffer_pool_requests_total counter\n");
+    metrics_printf(buf,
+	"sudo_logsrvd_buffer_pool_requests_total{result=\"hit\"} %llu\n",
+	(unsigned long long)total.buffer_pool_hits);
+    metrics_printf(buf,
+	"sudo_logsrvd_buffer_pool_requests_total{result=\"miss\"} %llu\n",
+	(unsigned long long)total.buffer_pool_misses);
+    metrics_printf(buf, "# HELP sudo_logsrvd_buffer_pool_bytes "
+	"Memory held by free buffers in the buffer pool.\n"
+	"# TYPE sudo_logsrvd_buffer_pool_bytes gauge\n"
+	"sudo_logsrvd_buffer_pool_bytes %llu\n",
+	(unsigned long long)total.buffer_pool_bytes);
+
+    for (i = 0; i < METRICS_NHISTOGRAMS; i++) {
+	metrics_format_histogram(buf, histogram_info[i].name,
+	    histogram_info[i].help, &total.histograms[i]);
+    }
+
+    debug_return_bool(!buf->error);
+}
+
+static void
+metrics_client_free(struct metrics_client *client)
+{
+    debug_decl(metrics_client_free, SUDO_DEBUG_UTIL);
+
+    TAILQ_REMOVE(&metrics_clients, client, entries);
+    sudo_ev_free(client->ev);
+    close(client->sock);
+    free(client->resp);
+    free(client);
+
+    debug_return;
+}
+
+/*
+ * Build the HTTP response to the request in client->req.
+ * Only GET and HEAD of /metrics are supported.
+ */
+static bool
+metrics_respond(struct metrics_client *client)
+{
+    struct metrics_buf body = { NULL, 0, 0, false };
+    struct metrics_buf resp = { NULL, 0, 0, false };
+    const char *status = "200 OK";
+    const char *path;
+    bool head = false;
+    size_t pathlen;
+    debug_decl(metrics_respond, SUDO_DEBUG_UTIL);
+
+    if (strncmp(client->req, "GET ", 4) == 0) {
+	path = client->req + 4;
+    } else if (strncmp(client->req, "HEAD ", 5) == 0) {
+	path = client->req + 5;
+	head = true;
+    } else {
+	status = "405 Method Not Allowed";
+	path = NULL;
+    }
+    if (path != NULL) {
+	pathlen = strcspn(path, "? \r\n");
+	if (pathlen != sizeof("/metrics") - 1 ||
+		strncmp(path, "/metrics", pathlen) != 0) {
+	    status = "404 Not Found";
+	}
+    }
+
+    if (strcmp(status, "200 OK") == 0) {
+	if (!metrics_format(&body)) {
+	    free(body.data);
+	    debug_return_bool(false);
+	}
+    } else {
+	metrics_printf(&body, "%s\n", status);
+    }
+
+    metrics_printf(&resp, "HTTP/1.0 %s\r\n"
+	"Content-Type: text/plain; version=0.0.4\r\n"
+	"Content-Length: %zu\r\n"
+	"Connection: close\r\n\r\n", status, body.len);
+    if (!head && body.len != 0)
+	metrics_printf(&resp, "%.*s", (int)body.len, body.data);
+    free(body.data);
+    if (resp.error) {
+	free(resp.data);
+	debug_return_bool(false);
+    }
+
+    client->resp = resp.data;
+    client->resp_len = resp.len;
+    client->resp_off = 0;
+
+    debug_return_bool(true);
+}
+
+/*
+ * Read the HTTP request and write the response.
+ */
+static void
+metrics_client_cb(int fd, int what, void *v)
+{
+    struct metrics_client *client = v;
+    ssize_t nread, nwritten;
+    debug_decl(metrics_client_cb, SUDO_DEBUG_UTIL);
+
+    if (what == SUDO_EV_TIMEOUT) {
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	    "metrics client timed out");
+	goto done;
+    }
+
+    if (client->resp == NULL) {
+	nread = read(fd, client->req + client->req_len,
+	    sizeof(client->req) - 1 - client->req_len);
+	switch (nread) {
+	case -1:
+	    if (errno == EAGAIN || errno == EINTR)
+		debug_return;
+	    goto done;
+	case 0:
+	    goto done;
+	default:
+	    break;
+	}
+	client->req_len += (size_t)nread;
+	client->req[client->req_len] = '\0';
+
+	/* Wait until we have the entire request header. */
+	if (strstr(client->req, "\r\n\r\n") == NULL &&
+		strstr(client->req, "\n\n") == NULL) {
+	    if (client->req_len < sizeof(client->req) - 1)
+		debug_return;
+	}
+	if (!metrics_respond(client))
+	    goto done;
+
+	/* Switch to writing the response. */
+	sudo_ev_del(client->evbase, client->ev);
+	if (sudo_ev_set(client->ev, fd, SUDO_EV_WRITE|SUDO_EV_PERSIST,
+		metrics_client_cb, client) == -1)
+	    goto done;
+	if (sudo_ev_add(client->evbase, client->ev, logsrvd_conf_server_timeout(),
+		false) == -1) {
+	    sudo_warnx("%s", U_("unable to add event to queue"));
+	    goto done;
+	}
+	debug_return;
+    }
+
+    nwritten = write(fd, client->resp + client->resp_off,
+	client->resp_len - client->resp_off);
+    if (nwritten == -1) {
+	if (errno == EAGAIN || errno == EINTR)
+	    debug_return;
+	goto done;
+    }
+    client->resp_off += (size_t)nwritten;
+    if (client->resp_off < client->resp_len)
+	debug_return;
+
+done:
+    metrics_client_free(client);
+    debug_return;
+}
+
+static void
+metrics_listener_cb(int fd, int what, void *v)
+{
+    struct listener *l = v;
+    struct sudo_event_base *evbase = sudo_ev_get_base(l->ev);
+    struct metrics_client *client;
+    int flags, sock;
+    debug_decl(metrics_listener_cb, SUDO_DEBUG_UTIL);
+
+    sock = accept(fd, NULL, NULL);
+    if (sock == -1) {
+	if (errno != EAGAIN && errno != EINTR)
+	    sudo_warn("accept");
+	debug_return;
+    }
+    flags = fcntl(sock, F_GETFL, 0);
+    if (flags == -1 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) == -1) {
+	sudo_warn("fcntl(O_NONBLOCK)");
+	close(sock);
+	debug_return;
+    }
+
+    if ((client = calloc(1, sizeof(*client))) == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	close(sock);
+	debug_return;
+    }
+    client->evbase = evbase;
+    client->sock = sock;
+    TAILQ_INSERT_TAIL(&metrics_clients, client, entries);
+
+    client->ev = sudo_ev_alloc(sock, SUDO_EV_READ|SUDO_EV_PERSIST,
+	metrics_client_cb, client);
+    if (client->ev == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	metrics_client_free(client);
+	debug_return;
+    }
+    if (sudo_ev_add(evbase, client->ev, logsrvd_conf_server_timeout(),
+	    false) == -1) {
+	sudo_warnx("%s", U_("unable to add event to queue"));
+	metrics_client_free(client);
+	debug_return;
+    }
+
+    debug_return;
+}
+
+/*
+ * Close and free the metrics listeners and any clients.
+ * A worker process calls this to close the listeners it inherited.
+ */
+void
+metrics_free_listeners(void)
+{
+    struct metrics_client *client;
+    struct listener *l;
+    debug_decl(metrics_free_listeners, SUDO_DEBUG_UTIL);
+
+    while ((client = TAILQ_FIRST(&metrics_clients)) != NULL)
+	metrics_client_free(client);
+    while ((l = TAILQ_FIRST(&metrics_listeners)) != NULL) {
+	TAILQ_REMOVE(&metrics_listeners, l, entries);
+	sudo_ev_free(l->ev);
+	close(l->sock);
+	free(l);
+    }
+
+    debug_return;
+}
+
+/*
+ * Register listeners for the metrics_address setting, if any.
+ */
+bool
+metrics_setup(struct sudo_event_base *evbase)
+{
+    struct server_address *addr;
+    struct listener *l;
+    bool ret = true;
+    int sock;
+    debug_decl(metrics_setup, SUDO_DEBUG_UTIL);
+
+    metrics_free_listeners();
+    TAILQ_FOREACH(addr, logsrvd_conf_server_metrics_address(), entries) {
+	sock = create_listener(addr);
+	if (sock == -1) {
+	    ret = false;
+	    continue;
+	}
+	if ((l = malloc(sizeof(*l))) == NULL) {
+	    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	    close(sock);
+	    ret = false;
+	    break;
+	}
+	l->sock = sock;
+	l->tls = false;
+	l->path = NULL;
+	l->ev = sudo_ev_alloc(sock, SUDO_EV_READ|SUDO_EV_PERSIST,
+	    metrics_listener_cb, l);
+	if (l->ev == NULL) {
+	    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	    close(sock);
+	    free(l);
+	    ret = false;
+	    break;
+	}
+	if (sudo_ev_add(evbase, l->ev, NULL, false) == -1) {
+	    sudo_warnx("%s", U_("unable to add event to queue"));
+	    sudo_ev_free(l->ev);
+	    close(sock);
+	    free(l);
+	    ret = false;
+	    break;
+	}
+	TAILQ_INSERT_TAIL(&metrics_listeners, l, entries);
+    }
+
+    debug_return_bool(ret);
+}
@@ -0,0 +1,273 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * This is an open source non-commercial project. Dear PVS-Studio, please check it.
+ * PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+ */
+
+#include <config.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+#ifdef HAVE_STDBOOL_H
+# include <stdbool.h>
+#else
+# include "compat/stdbool.h"
+#endif /* HAVE_STDBOOL_H */
+#if defined(HAVE_STDINT_H)
+# include <stdint.h>
+#elif defined(HAVE_INTTYPES_H)
+# include <inttypes.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sudo_compat.h"
+#include "sudo_conf.h"
+#include "sudo_debug.h"
+#include "sudo_event.h"
+#include "sudo_eventlog.h"
+#include "sudo_iolog.h"
+#include "sudo_queue.h"
+#include "sudo_util.h"
+
+#include "logsrvd.h"
+
+/*
+ * Decode the varint at *cpp, advancing *cpp past it.
+ * Returns false if the varint is truncated or too long.
+ */
+static bool
+unpack_varint(const uint8_t **cpp, const uint8_t *end, uint64_t *valp)
+{
+    const uint8_t *cp = *cpp;
+    uint64_t val = 0;
+    unsigned int shift;
+
+    for (shift = 0; shift < 64 && cp < end; shift += 7) {
+	val |= (uint64_t)(*cp & 0x7f) << shift;
+	if ((*cp++ & 0x80) == 0) {
+	    *cpp = cp;
+	    *valp = val;
+	    return true;
+	}
+    }
+    return false;
+}
+
+/*
+ * Decode the field at *cpp, advancing *cpp past it.
+ * A varint value is stored in valp, the contents of a length-delimited
+ * field in datap and lenp.  Fixed-size values are skipped.
+ * Returns the field number, or 0 if the field is malformed.
+ */
+static uint32_t
+unpack_field(const uint8_t **cpp, const uint8_t *end, unsigned int *wtypep,
+    uint64_t *valp, const uint8_t **datap, size_t *lenp)
+{
+    uint64_t key, len;
+
+    if (!unpack_varint(cpp, end, &key) || (key >> 3) == 0 ||
+	    (key >> 3) > UINT32_MAX)
+	return 0;
+    *wtypep = key & 7;
+    switch (*wtypep) {
+    case 0:
+	if (!unpack_varint(cpp, end, valp))
+	    return 0;
+	break;
+    case 1:
+    case 5:
+	len = *wtypep == 1 ? 8 : 4;
+	if ((size_t)(end - *cpp) < len)
+	    return 0;
+	*cpp += len;
+	break;
+    case 2:
+	if (!unpack_varint(cpp, end, &len) || (size_t)(end - *cpp) < len)
+	    return 0;
+	*datap = *cpp;
+	*lenp = (size_t)len;
+	*cpp += len;
+	break;
+    default:
+	return 0;
+    }
+    return (uint32_t)(key >> 3);
+}
+
+/*
+ * Decode a TimeSpec that is the delay of an I/O record and add it to
+ * the delay in peek.  Returns false if the TimeSpec is malformed or
+ * its nanoseconds are out of range.
+ */
+static bool
+peek_delay(const uint8_t *cp, size_t len, struct relay_peek *peek)
+{
+    const uint8_t *data, *end = cp + len;
+    unsigned int wtype;
+    int64_t tv_sec = 0;
+    int32_t tv_nsec = 0;
+    uint64_t val;
+    size_t dlen;
+
+    while (cp < end) {
+	switch (unpack_field(&cp, end, &wtype, &val, &data, &dlen)) {
+	case 0:
+	    return false;
+	case 1:
+	    if (wtype != 0)
+		return false;
+	    tv_sec = (int64_t)val;
+	    break;
+	case 2:
+	    if (wtype != 0)
+		return false;
+	    tv_nsec = (int32_t)val;
+	    break;
+	default:
+	    /* Unknown fields are ignored when unpacking too. */
+	    break;
+	}
+    }
+    if (tv_nsec < 0 || tv_nsec >= 1000000000)
+	return false;
+
+    peek->delay.tv_sec += tv_sec;
+    peek->delay.tv_nsec += tv_nsec;
+    if (peek->delay.tv_nsec >= 1000000000) {
+	peek->delay.tv_sec++;
+	peek->delay.tv_nsec -= 1000000000;
+    }
+    return true;
+}
+
+/*
+ * Decode an IoBuffer or, if record is set, an IoRecord from an
+ * IoBufferBatch and add its delay to peek.
+ * Returns false if the delay is missing or a field is malformed.
+ */
+static bool
+peek_iobuf(const uint8_t *cp, size_t len, bool record,
+    struct relay_peek *peek)
+{
+    const uint8_t *data, *delay = NULL, *end = cp + len;
+    const uint32_t delay_field = record ? 2 : 1;
+    const uint32_t data_field = record ? 3 : 2;
+    size_t dlen, delay_len = 0;
+    unsigned int wtype;
+    int32_t iofd = 0;
+    uint32_t field;
+    uint64_t val;
+
+    while (cp < end) {
+	field = unpack_field(&cp, end, &wtype, &val, &data, &dlen);
+	if (field == 0)
+	    return false;
+	if (field == delay_field) {
+	    /* Repeated sub-messages are merged, leave that to unpack. */
+	    if (wtype != 2 || delay != NULL)
+		return false;
+	    delay = data;
+	    delay_len = dlen;
+	} else if (field == data_field) {
+	    if (wtype != 2)
+		return false;
+	} else if (record && field == 1) {
+	    if (wtype != 0)
+		return false;
+	    iofd = (int32_t)val;
+	}
+    }
+    if (delay == NULL || iofd < IOFD_STDIN || iofd > IOFD_TTYOUT)
+	return false;
+    return peek_delay(delay, delay_len, peek);
+}
+
+/*
+ * Decode the fields of a wire format ClientMessage that are needed to
+ * relay it as-is: the message type, the stream ID and, for I/O records,
+ * the total delay.  Returns false if the message is not an IoBuffer or
+ * IoBufferBatch or if it is malformed; such a message must be unpacked.
+ */
+bool
+relay_peek_message(const uint8_t *buf, size_t len, struct relay_peek *peek)
+{
+    const uint8_t *cp = buf, *end = buf + len;
+    const uint8_t *data, *body = NULL;
+    size_t dlen, body_len = 0;
+    unsigned int wtype;
+    uint32_t field;
+    uint64_t val;
+    debug_decl(relay_peek_message, SUDO_DEBUG_UTIL);
+
+    memset(peek, 0, sizeof(*peek));
+    while (cp < end) {
+	field = unpack_field(&cp, end, &wtype, &val, &data, &dlen);
+	switch (field) {
+	case 0:
+	    debug_return_bool(false);
+	case 15:
+	    /* stream_id */
+	    if (wtype != 0)
+		debug_return_bool(false);
+	    peek->stream_id = (uint32_t)val;
+	    break;
+	default:
+	    if (field > CLIENT_MESSAGE__TYPE_COMPRESSED)
+		break;
+	    /* Member of the type oneof, there must be only one. */
+	    if (wtype != 2 || peek->type_case != 0)
+		debug_return_bool(false);
+	    peek->type_case = (int)field;
+	    body = data;
+	    body_len = dlen;
+	    break;
+	}
+    }
+
+    switch (peek->type_case) {
+    case CLIENT_MESSAGE__TYPE_TTYIN_BUF:
+    case CLIENT_MESSAGE__TYPE_TTYOUT_BUF:
+    case CLIENT_MESSAGE__TYPE_STDIN_BUF:
+    case CLIENT_MESSAGE__TYPE_STDOUT_BUF:
+    case CLIENT_MESSAGE__TYPE_STDERR_BUF:
+	debug_return_bool(peek_iobuf(body, body_len, false, peek));
+    case CLIENT_MESSAGE__TYPE_IOBUF_BATCH:
+	cp = body;
+	end = body + body_len;
+	while (cp < end) {
+	    field = unpack_field(&cp, end, &wtype, &val, &data, &dlen);
+	    if (field == 0)
+		debug_return_bool(false);
+	    if (field != 1)
+		continue;
+	    if (wtype != 2 || !peek_iobuf(data, dlen, true, peek))
+		debug_return_bool(false);
+	}
+	debug_return_bool(true);
+    default:
+	debug_return_bool(false);
+    }
+}
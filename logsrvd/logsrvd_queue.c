@@ -26,6 +26,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
@@ -74,13 +75,20 @@ static struct outgoing_journal_queue outgoing_journal_queue =
 
 static struct sudo_event *outgoing_queue_event;
 
+/* Number of journals currently being relayed and their total size. */
+static unsigned int outgoing_active;
+static size_t outgoing_inflight;
+
 /*
  * Callback that runs when the outgoing queue retry timer fires.
- * Tries to relay the first entry in the outgoing queue.
+ * Relays entries in the outgoing queue, in order, until the
+ * relay_concurrency or relay_max_inflight limit is reached.
  */
 static void
 outgoing_queue_cb(int unused, int what, void *v)
 {
+    const unsigned int concurrency = logsrvd_conf_relay_concurrency();
+    const size_t max_inflight = logsrvd_conf_relay_max_inflight();
     struct connection_closure *closure;
     struct outgoing_journal *oj, *next;
     struct sudo_event_base *evbase = v;
@@ -91,11 +99,19 @@ outgoing_queue_cb(int unused, int what, void *v)
     if (TAILQ_EMPTY(logsrvd_conf_relay_address()))
 	debug_return;
 
-    /* Process first journal. */
+    /* Process journals until we run out of relay slots. */
     TAILQ_FOREACH_SAFE(oj, &outgoing_journal_queue, entries, next) {
+	struct stat sb;
 	FILE *fp;
 	int fd;
 
+	if (outgoing_active >= concurrency) {
+	    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+		"%u journals in flight, deferring %s", outgoing_active,
+		oj->journal_path);
+	    break;
+	}
+
 	fd = open(oj->journal_path, O_RDWR);
 	if (fd == -1) {
 	    if (errno == ENOENT) {
@@ -106,10 +122,42 @@ outgoing_queue_cb(int unused, int what, void *v)
 	    continue;
 	}
 	if (!sudo_lock_file(fd, SUDO_TLOCK)) {
-	    sudo_warn(U_("unable to lock %s"), oj->journal_path);
+	    if (errno == EAGAIN || errno == EACCES) {
+		/* Being relayed by another worker, retry later. */
+		sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+		    "%s locked by another process", oj->journal_path);
+	    } else {
+		sudo_warn(U_("unable to lock %s"), oj->journal_path);
+	    }
+	    close(fd);
+	    continue;
+	}
+	if (fstat(fd, &sb) == -1) {
+	    sudo_warn(U_("unable to stat %s"), oj->journal_path);
 	    close(fd);
 	    continue;
 	}
+	if (sb.st_nlink == 0) {
+	    /* Another worker finished relaying it after we opened it. */
+	    TAILQ_REMOVE(&outgoing_journal_queue, oj, entries);
+	    free(oj->journal_path);
+	    free(oj);
+	    close(fd);
+	    continue;
+	}
+	/*
+	 * Stay under the in-flight limit, keeping the queue in order.
+	 * A journal larger than the limit is relayed on its own.
+	 */
+	if (max_inflight != 0 && outgoing_active != 0 &&
+		(outgoing_inflight >= max_inflight ||
+		(size_t)sb.st_size > max_inflight - outgoing_inflight)) {
+	    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+		"%zu bytes in flight, deferring %s", outgoing_inflight,
+		oj->journal_path);
+	    close(fd);
+	    break;
+	}
 	fp = fdopen(fd, "r");
 	if (fp == NULL) {
 	    sudo_warn(U_("unable to open %s"), oj->journal_path);
@@ -130,13 +178,48 @@ outgoing_queue_cb(int unused, int what, void *v)
 	TAILQ_REMOVE(&outgoing_journal_queue, oj, entries);
 	free(oj);
 
+	/* Account for the journal until the closure is freed. */
+	closure->queue_inflight = sb.st_size > 0 ? sb.st_size : 1;
+	outgoing_inflight += (size_t)closure->queue_inflight;
+	outgoing_active++;
+	metrics_relay_queue(outgoing_active, outgoing_inflight);
+
 	success = connect_relay(closure);
 	if (!success) {
 	    sudo_warnx("%s", U_("unable to connect to relay"));
 	    connection_close(closure);
+	    break;
 	}
-	break;
     }
+
+    debug_return;
+}
+
+/*
+ * Release the relay slot held by closure, if any.
+ * Called when a connection closure is freed.  If the queue is not
+ * already scheduled to run, retry after the usual interval so the
+ * free slot does not go unused when a relay fails.
+ */
+void
+logsrvd_queue_release(struct connection_closure *closure)
+{
+    debug_decl(logsrvd_queue_release, SUDO_DEBUG_UTIL);
+
+    if (closure->queue_inflight != 0) {
+	outgoing_inflight -= (size_t)closure->queue_inflight;
+	outgoing_active--;
+	closure->queue_inflight = 0;
+	metrics_relay_queue(outgoing_active, outgoing_inflight);
+
+	if (outgoing_queue_event == NULL ||
+		!sudo_ev_pending(outgoing_queue_event, SUDO_EV_TIMEOUT, NULL)) {
+	    logsrvd_queue_enable(logsrvd_conf_relay_retry_interval(),
+		closure->evbase);
+	}
+    }
+
+    debug_return;
 }
 
 /*
@@ -26,6 +26,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
@@ -62,58 +63,272 @@
 #include "sudo_util.h"
 
 #include "logsrvd.h"
+#include "protobuf-c/protobuf-c-arena.h"
 
 static void relay_client_msg_cb(int fd, int what, void *v);
 static void relay_server_msg_cb(int fd, int what, void *v);
+static void relay_idle_cb(int unused, int what, void *v);
 static void connect_cb(int sock, int what, void *v);
-static bool start_relay(int sock, struct connection_closure *closure);
+static bool start_relay(int sock, struct relay_closure *relay_closure);
+static bool relay_start(struct connection_closure *closure, bool multiplex);
+
+/* Server messages are unpacked one at a time using a reusable arena. */
+static ProtobufCArena server_msg_arena;
 
 /*
- * Free a struct relay_closure container and its contents.
+ * Relay connections that may be shared by multiple streams.
+ * New streams are attached to the first connection to the selected
+ * relay host with room.
  */
-void
-relay_closure_free(struct relay_closure *relay_closure)
+static TAILQ_HEAD(relay_closure_list, relay_closure) relay_pool =
+    TAILQ_HEAD_INITIALIZER(relay_pool);
+
+/* Number of relay host selections made, for round-robin balancing. */
+static unsigned int relay_rr_count;
+
+/*
+ * 32-bit FNV-1a hash of a NUL-terminated string, continuing from hash.
+ */
+static uint32_t
+relay_hash_str(const char *str, uint32_t hash)
 {
-    struct connection_buffer *buf;
-    debug_decl(relay_closure_free, SUDO_DEBUG_UTIL);
+    while (*str != '\0') {
+	hash ^= (unsigned char)*str++;
+	hash *= 16777619U;
+    }
+    return hash;
+}
+
+/*
+ * Returns true if the relay host failed recently and should be
+ * skipped when choosing a host for a new connection.
+ */
+static bool
+relay_is_down(struct server_address *relay, time_t now)
+{
+    return relay->down_until > now;
+}
+
+/*
+ * Record whether we were able to connect to a relay host.
+ * A host we could not connect to is avoided for retry_interval seconds.
+ */
+static void
+relay_set_down(struct server_address *relay, bool down)
+{
+    struct timespec now;
+    debug_decl(relay_set_down, SUDO_DEBUG_UTIL);
+
+    if (!down) {
+	relay->down_until = 0;
+    } else if (sudo_gettime_mono(&now) == 0) {
+	relay->down_until = now.tv_sec + logsrvd_conf_relay_retry_interval();
+    }
+
+    debug_return;
+}
+
+/*
+ * Choose the relay host to try first for a new relay connection,
+ * based on the configured balancing policy.  Hosts we recently
+ * failed to connect to are skipped unless they all have.  If the
+ * chosen host is not reachable, the others are tried in order.
+ * The key is used for hash balancing and may be NULL.
+ * Returns NULL if there are no relay hosts.
+ */
+static struct server_address *
+relay_select(struct server_address_list *relays, const char *key)
+{
+    struct server_address *relay, *best = NULL;
+    unsigned int n, nrelays = 0;
+    uint32_t hash, best_hash = 0;
+    struct timespec ts;
+    time_t now = 0;
+    debug_decl(relay_select, SUDO_DEBUG_UTIL);
+
+    /* Count the relay hosts that are usable. */
+    if (sudo_gettime_mono(&ts) == 0)
+	now = ts.tv_sec;
+    TAILQ_FOREACH(relay, relays, entries) {
+	if (!relay_is_down(relay, now))
+	    nrelays++;
+    }
+    if (nrelays == 0) {
+	/* Everything is down, try them all. */
+	now = TIME_T_MAX;
+	TAILQ_FOREACH(relay, relays, entries)
+	    nrelays++;
+	if (nrelays == 0)
+	    debug_return_ptr(NULL);
+    }
+
+    switch (logsrvd_conf_relay_balance()) {
+    case RELAY_BALANCE_FAILOVER:
+	break;
+    case RELAY_BALANCE_LEAST_CONN:
+	/* Fewest relayed sessions wins, ties go to the earlier host. */
+	TAILQ_FOREACH(relay, relays, entries) {
+	    if (relay_is_down(relay, now))
+		continue;
+	    if (best == NULL || relay->nsessions < best->nsessions)
+		best = relay;
+	}
+	break;
+    case RELAY_BALANCE_HASH:
+	if (key != NULL) {
+	    /*
+	     * Rendezvous hashing: each host is scored by hashing it
+	     * together with the key and the highest score wins.
+	     * Only keys mapped to a host that is unavailable will move.
+	     */
+	    const uint32_t key_hash = relay_hash_str(key, 2166136261U);
+
+	    TAILQ_FOREACH(relay, relays, entries) {
+		char ipaddr[INET6_ADDRSTRLEN];
+
+		if (relay_is_down(relay, now))
+		    continue;
+		hash = relay_hash_str(relay->sa_str, key_hash);
+		hash = relay_hash_str(
+		    server_address_ntop(relay, ipaddr, sizeof(ipaddr)), hash);
+
+		/* Final avalanche step so that every bit of the key counts. */
+		hash ^= hash >> 16;
+		hash *= 0x85ebca6bU;
+		hash ^= hash >> 13;
+		hash *= 0xc2b2ae35U;
+		hash ^= hash >> 16;
+		if (best == NULL || hash > best_hash) {
+		    best = relay;
+		    best_hash = hash;
+		}
+	    }
+	    break;
+	}
+	FALLTHROUGH;
+    case RELAY_BALANCE_ROUND_ROBIN:
+	/* Skip to the next usable host after the one we used last time. */
+	n = relay_rr_count++ % nrelays;
+	TAILQ_FOREACH(relay, relays, entries) {
+	    if (relay_is_down(relay, now))
+		continue;
+	    if (n-- == 0) {
+		best = relay;
+		break;
+	    }
+	}
+	break;
+    }
+    if (best == NULL) {
+	/* Failover, use the first usable host. */
+	TAILQ_FOREACH(best, relays, entries) {
+	    if (!relay_is_down(best, now))
+		break;
+	}
+    }
+
+    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	"selected relay %s%s%s", best->sa_str, key ? " for " : "",
+	key ? key : "");
+    debug_return_ptr(best);
+}
+
+/*
+ * Set the relay host a relay connection is using, moving its
+ * streams' session count from the old host to the new one.
+ */
+static void
+relay_set_addr(struct relay_closure *relay_closure,
+    struct server_address *relay)
+{
+    debug_decl(relay_set_addr, SUDO_DEBUG_UTIL);
+
+    if (relay_closure->relay_addr != NULL)
+	relay_closure->relay_addr->nsessions -= relay_closure->nstreams;
+    relay_closure->relay_addr = relay;
+    if (relay != NULL)
+	relay->nsessions += relay_closure->nstreams;
+
+    debug_return;
+}
+
+/*
+ * Close the connection to the relay host, if open.
+ * The relay closure itself is not freed.
+ */
+static void
+relay_disconnect(struct relay_closure *relay_closure)
+{
+    debug_decl(relay_disconnect, SUDO_DEBUG_UTIL);
 
 #if defined(HAVE_OPENSSL)
     if (relay_closure->tls_client.ssl != NULL) {
 	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
-	    "closing down TLS connection to %s",
+	    "closing down TLS connection to %s",
 	    relay_closure->relay_name.name);
 	if (SSL_shutdown(relay_closure->tls_client.ssl) == 0)
 	    SSL_shutdown(relay_closure->tls_client.ssl);
 	SSL_free(relay_closure->tls_client.ssl);
+	relay_closure->tls_client.ssl = NULL;
     }
 #endif
+    if (relay_closure->read_ev != NULL)
+	sudo_ev_del(relay_closure->evbase, relay_closure->read_ev);
+    if (relay_closure->write_ev != NULL)
+	sudo_ev_del(relay_closure->evbase, relay_closure->write_ev);
+    if (relay_closure->connect_ev != NULL)
+	sudo_ev_del(relay_closure->evbase, relay_closure->connect_ev);
+    if (relay_closure->sock != -1) {
+	shutdown(relay_closure->sock, SHUT_RDWR);
+	close(relay_closure->sock);
+	relay_closure->sock = -1;
+    }
+
+    debug_return;
+}
+
+/*
+ * Free a struct relay_closure container and its contents.
+ * Any streams must already have been detached.
+ */
+static void
+relay_closure_free(struct relay_closure *relay_closure)
+{
+    debug_decl(relay_closure_free, SUDO_DEBUG_UTIL);
+
+    if (relay_closure->shared)
+	TAILQ_REMOVE(&relay_pool, relay_closure, entries);
+    relay_disconnect(relay_closure);
     if (relay_closure->relays != NULL)
 	address_list_delref(relay_closure->relays);
     sudo_rcstr_delref(relay_closure->relay_name.name);
     sudo_ev_free(relay_closure->read_ev);
     sudo_ev_free(relay_closure->write_ev);
     sudo_ev_free(relay_closure->connect_ev);
-    free(relay_closure->read_buf.data);
-    while ((buf = TAILQ_FIRST(&relay_closure->write_bufs)) != NULL) {
-	TAILQ_REMOVE(&relay_closure->write_bufs, buf, entries);
-	free(buf->data);
-	free(buf);
-    }
-    if (relay_closure->sock != -1) {
-	shutdown(relay_closure->sock, SHUT_RDWR);
-	close(relay_closure->sock);
-    }
+    sudo_ev_free(relay_closure->idle_ev);
+    buffer_charge(&relay_closure->buffered, relay_closure->read_buf.size, 0);
+    bufpool_put_data(&relay_closure->read_buf);
+    free_buf_list(&relay_closure->write_bufs, &relay_closure->buffered);
+#ifdef HAVE_ZLIB_H
+    msg_deflate_free(relay_closure->deflate);
+#endif
     free(relay_closure);
 
+    /* The memory we freed may let paused connections resume. */
+    connection_resume_paused();
+
     debug_return;
 }
 
 /*
  * Allocate a relay closure.
+ * A shared relay closure is added to the pool of connections that
+ * new streams may be attached to.
  * Note that allocation of the events is deferred until we know the socket.
  */
 static struct relay_closure *
-relay_closure_alloc(void)
+relay_closure_alloc(struct sudo_event_base *evbase, bool shared,
+    struct server_address *first)
 {
     struct relay_closure *relay_closure;
     debug_decl(relay_closure_alloc, SUDO_DEBUG_UTIL);
@@ -123,14 +338,25 @@ relay_closure_alloc(void)
 
     /* We take a reference to relays so it doesn't change while connecting. */
     relay_closure->sock = -1;
+    relay_closure->evbase = evbase;
     relay_closure->relays = logsrvd_conf_relay_address();
     address_list_addref(relay_closure->relays);
+    relay_closure->relay_first = first;
+    TAILQ_INIT(&relay_closure->streams);
     TAILQ_INIT(&relay_closure->write_bufs);
 
-    relay_closure->read_buf.size = 8 * 1024;
-    relay_closure->read_buf.data = malloc(relay_closure->read_buf.size);
-    if (relay_closure->read_buf.data == NULL)
+    if (!bufpool_get_data(&relay_closure->read_buf, 8 * 1024))
 	goto bad;
+    buffer_charge(&relay_closure->buffered, 0, relay_closure->read_buf.size);
+
+    if (shared) {
+	relay_closure->idle_ev = sudo_ev_alloc(-1, SUDO_EV_TIMEOUT,
+	    relay_idle_cb, relay_closure);
+	if (relay_closure->idle_ev == NULL)
+	    goto bad;
+	TAILQ_INSERT_TAIL(&relay_pool, relay_closure, entries);
+	relay_closure->shared = true;
+    }
 
     debug_return_ptr(relay_closure);
 bad:
@@ -138,6 +364,64 @@ bad:
     debug_return_ptr(NULL);
 }
 
+/*
+ * Encode the ClientMessage stream_id field (number 15, varint) in buf,
+ * which must have room for at least 6 bytes.
+ * Returns the length of the encoded field.
+ */
+static size_t
+pack_stream_id(uint32_t stream_id, uint8_t *buf)
+{
+    size_t len = 0;
+
+    buf[len++] = (15 << 3) | 0;
+    while (stream_id > 0x7f) {
+	buf[len++] = (uint8_t)(stream_id | 0x80);
+	stream_id >>= 7;
+    }
+    buf[len++] = (uint8_t)stream_id;
+
+    return len;
+}
+
+#ifdef HAVE_ZLIB_H
+/*
+ * Replace the wire format message in buf with a compressed ClientMessage.
+ * Returns true on success, false on failure.
+ */
+static bool
+relay_compress_buf(struct connection_buffer *buf,
+    struct relay_closure *relay_closure)
+{
+    ClientMessage zmsg = CLIENT_MESSAGE__INIT;
+    const unsigned int oldsize = buf->size;
+    uint32_t msg_len;
+    size_t len;
+    debug_decl(relay_compress_buf, SUDO_DEBUG_UTIL);
+
+    if (!msg_deflate_wire(relay_closure->deflate, buf->data, buf->len, &zmsg))
+	debug_return_bool(false);
+    len = client_message__get_packed_size(&zmsg);
+    if (len > MESSAGE_SIZE_MAX) {
+	sudo_warnx(U_("client message too large: %zu"), len);
+	debug_return_bool(false);
+    }
+
+    /* The compressed message may be slightly larger than the original. */
+    buf->len = buf->off = 0;
+    if (!bufpool_expand_data(buf, len + sizeof(msg_len)))
+	debug_return_bool(false);
+    buffer_charge(&relay_closure->buffered, oldsize, buf->size);
+
+    msg_len = htonl((uint32_t)len);
+    memcpy(buf->data, &msg_len, sizeof(msg_len));
+    client_message__pack(&zmsg, buf->data + sizeof(msg_len));
+    buf->len = len + sizeof(msg_len);
+
+    debug_return_bool(true);
+}
+#endif /* HAVE_ZLIB_H */
+
 /*
  * Allocate a new buffer, copy buf to it and insert on the write queue.
  * On success the relay write event is enabled.
@@ -148,27 +432,50 @@ relay_enqueue_write(uint8_t *msgbuf, size_t len,
     struct connection_closure *closure)
 {
     struct relay_closure *relay_closure = closure->relay_closure;
-    struct connection_buffer *buf;
+    struct connection_buffer *buf = NULL;
+    uint8_t idbuf[6];
+    size_t idlen = 0;
     uint32_t msg_len;
     bool ret = false;
     debug_decl(relay_enqueue_write, SUDO_DEBUG_UTIL);
 
+    /*
+     * Tag the message with its stream by appending the stream_id field,
+     * the last instance of a field wins when the message is unpacked.
+     * Journaled messages may include the stream they were received on.
+     */
+    if (closure->relay_stream_id != 0 || closure->journal != NULL)
+	idlen = pack_stream_id(closure->relay_stream_id, idbuf);
+    if (len + idlen > MESSAGE_SIZE_MAX) {
+	sudo_warnx(U_("client message too large: %zu"), len + idlen);
+	goto done;
+    }
+
     /* Wire message size is used for length encoding, precedes message. */
-    msg_len = htonl((uint32_t)len);
+    msg_len = htonl((uint32_t)(len + idlen));
 
     sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
-	"size + client message %zu bytes", len);
+	"size + client message %zu bytes", len + idlen);
 
-    if ((buf = get_free_buf(sizeof(msg_len) + len, closure)) == NULL) {
+    buf = get_free_buf(sizeof(msg_len) + len + idlen,
+	&relay_closure->buffered);
+    if (buf == NULL) {
 	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
 	    "unable to allocate connection_buffer");
 	goto done;
     }
     memcpy(buf->data, &msg_len, sizeof(msg_len));
     memcpy(buf->data + sizeof(msg_len), msgbuf, len);
-    buf->len = sizeof(msg_len) + len;
+    memcpy(buf->data + sizeof(msg_len) + len, idbuf, idlen);
+    buf->len = sizeof(msg_len) + len + idlen;
+#ifdef HAVE_ZLIB_H
+    if (relay_closure->deflate != NULL) {
+	if (!relay_compress_buf(buf, relay_closure))
+	    goto done;
+    }
+#endif
 
-    if (sudo_ev_add(closure->evbase, relay_closure->write_ev, NULL, false) == -1) {
+    if (sudo_ev_add(relay_closure->evbase, relay_closure->write_ev, NULL, false) == -1) {
 	sudo_warnx("%s", U_("unable to add event to queue"));
 	goto done;
     }
@@ -179,10 +486,8 @@ relay_enqueue_write(uint8_t *msgbuf, size_t len,
     ret = true;
 
 done:
-    if (buf != NULL) {
-	free(buf->data);
-	free(buf);
-    }
+    if (buf != NULL)
+	release_buf(buf, &relay_closure->buffered);
     debug_return_bool(ret);
 }
 
@@ -191,15 +496,25 @@ done:
  * Returns true on success, false on failure.
  */
 static bool
-fmt_client_message(struct connection_closure *closure, ClientMessage *msg)
+fmt_client_message(struct relay_closure *relay_closure, ClientMessage *msg)
 {
-    struct relay_closure *relay_closure = closure->relay_closure;
+#ifdef HAVE_ZLIB_H
+    ClientMessage zmsg = CLIENT_MESSAGE__INIT;
+#endif
     struct connection_buffer *buf = NULL;
     uint32_t msg_len;
     bool ret = false;
     size_t len;
     debug_decl(fmt_client_message, SUDO_DEBUG_UTIL);
 
+#ifdef HAVE_ZLIB_H
+    if (relay_closure->deflate != NULL) {
+	if (!msg_deflate(relay_closure->deflate, msg, &zmsg))
+	    goto done;
+	msg = &zmsg;
+    }
+#endif
+
     len = client_message__get_packed_size(msg);
     if (len > MESSAGE_SIZE_MAX) {
 	sudo_warnx(U_("client message too large: %zu"), len);
@@ -213,7 +528,7 @@ fmt_client_message(struct connection_closure *closure, ClientMessage *msg)
     sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
 	"size + client message %zu bytes", len);
 
-    if ((buf = get_free_buf(len, closure)) == NULL) {
+    if ((buf = get_free_buf(len, &relay_closure->buffered)) == NULL) {
 	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
 	    "unable to allocate connection_buffer");
         goto done;
@@ -230,9 +545,8 @@ done:
 }
 
 static bool
-fmt_client_hello(struct connection_closure *closure)
+fmt_client_hello(struct relay_closure *relay_closure)
 {
-    struct relay_closure *relay_closure = closure->relay_closure;
     ClientMessage client_msg = CLIENT_MESSAGE__INIT;
     ClientHello hello_msg = CLIENT_HELLO__INIT;
     bool ret;
@@ -240,16 +554,20 @@ fmt_client_hello(struct connection_closure *closure)
 
     sudo_debug_printf(SUDO_DEBUG_INFO, "%s: sending ClientHello", __func__);
     hello_msg.client_id = (char *)"Sudo Logsrvd " PACKAGE_VERSION;
+    hello_msg.iobuf_batch = true;
+#ifdef HAVE_ZLIB_H
+    hello_msg.compression = logsrvd_conf_relay_compress();
+#endif
 
     client_msg.u.hello_msg = &hello_msg;
     client_msg.type_case = CLIENT_MESSAGE__TYPE_HELLO_MSG;
-    ret = fmt_client_message(closure, &client_msg);
+    ret = fmt_client_message(relay_closure, &client_msg);
     if (ret) {
-	if (sudo_ev_add(closure->evbase, relay_closure->read_ev, NULL, false) == -1) {
+	if (sudo_ev_add(relay_closure->evbase, relay_closure->read_ev, NULL, false) == -1) {
 	    sudo_warnx("%s", U_("unable to add event to queue"));
 	    ret = false;
 	}
-	if (sudo_ev_add(closure->evbase, relay_closure->write_ev, NULL, false) == -1) {
+	if (sudo_ev_add(relay_closure->evbase, relay_closure->write_ev, NULL, false) == -1) {
 	    sudo_warnx("%s", U_("unable to add event to queue"));
 	    ret = false;
 	}
@@ -258,6 +576,177 @@ fmt_client_hello(struct connection_closure *closure)
     debug_return_bool(ret);
 }
 
+/*
+ * Tell the relay host to discard a stream that did not finish.
+ */
+static void
+fmt_close_stream(uint32_t stream_id, const char *reason,
+    struct relay_closure *relay_closure)
+{
+    ClientMessage client_msg = CLIENT_MESSAGE__INIT;
+    CloseStream close_msg = CLOSE_STREAM__INIT;
+    debug_decl(fmt_close_stream, SUDO_DEBUG_UTIL);
+
+    if (relay_closure->sock == -1 || relay_closure->write_ev == NULL)
+	debug_return;
+
+    sudo_debug_printf(SUDO_DEBUG_INFO, "%s: closing stream %u", __func__,
+	stream_id);
+    close_msg.reason = (char *)(reason ? reason : "");
+
+    client_msg.stream_id = stream_id;
+    client_msg.u.close_stream_msg = &close_msg;
+    client_msg.type_case = CLIENT_MESSAGE__TYPE_CLOSE_STREAM_MSG;
+    if (fmt_client_message(relay_closure, &client_msg)) {
+	if (sudo_ev_add(relay_closure->evbase, relay_closure->write_ev, NULL, false) == -1) {
+	    sudo_warnx("%s", U_("unable to add event to queue"));
+	}
+    }
+
+    debug_return;
+}
+
+/*
+ * Detach a connection closure from its relay connection.
+ * A dedicated relay connection is closed along with its stream,
+ * a shared one is kept open for a while in case it can be reused.
+ */
+void
+relay_detach(struct connection_closure *closure)
+{
+    struct relay_closure *relay_closure = closure->relay_closure;
+    debug_decl(relay_detach, SUDO_DEBUG_UTIL);
+
+    if (relay_closure == NULL)
+	debug_return;
+
+    TAILQ_REMOVE(&relay_closure->streams, closure, relay_entries);
+    relay_closure->nstreams--;
+    if (relay_closure->relay_addr != NULL)
+	relay_closure->relay_addr->nsessions--;
+    closure->relay_closure = NULL;
+
+    if (!relay_closure->shared) {
+	relay_closure_free(relay_closure);
+	debug_return;
+    }
+
+    if (closure->relay_stream_id != 0 && closure->state != FINISHED) {
+	fmt_close_stream(closure->relay_stream_id, closure->errstr,
+	    relay_closure);
+    }
+    closure->relay_stream_id = 0;
+
+    if (relay_closure->nstreams == 0) {
+	if (relay_closure->sock == -1) {
+	    relay_closure_free(relay_closure);
+	} else {
+	    struct timespec tv = { RELAY_IDLE_TIMEO, 0 };
+
+	    if (sudo_ev_add(relay_closure->evbase, relay_closure->idle_ev,
+		    &tv, false) == -1) {
+		sudo_warnx("%s", U_("unable to add event to queue"));
+		relay_closure_free(relay_closure);
+	    }
+	}
+    }
+
+    debug_return;
+}
+
+/*
+ * Close a shared relay connection that has not been used recently.
+ */
+static void
+relay_idle_cb(int unused, int what, void *v)
+{
+    struct relay_closure *relay_closure = v;
+    debug_decl(relay_idle_cb, SUDO_DEBUG_UTIL);
+
+    if (relay_closure->nstreams == 0) {
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	    "closing idle connection to relay %s (%s)",
+	    relay_closure->relay_name.name, relay_closure->relay_name.ipaddr);
+	relay_closure_free(relay_closure);
+    }
+
+    debug_return;
+}
+
+/*
+ * Send the client an error message for a stream, or close it if
+ * that is not possible.
+ */
+static void
+relay_stream_error(struct connection_closure *closure)
+{
+    debug_decl(relay_stream_error, SUDO_DEBUG_UTIL);
+
+    if (!schedule_error_message(closure->errstr, closure))
+	connection_close(closure);
+
+    debug_return;
+}
+
+/*
+ * The connection to the relay host failed, fail all streams using it.
+ * The relay closure is freed when the last stream is detached,
+ * it must not be used after this function returns.
+ */
+static void
+relay_fail(struct relay_closure *relay_closure, const char *errstr)
+{
+    struct connection_closure *closure, *next;
+    debug_decl(relay_fail, SUDO_DEBUG_UTIL);
+
+    relay_disconnect(relay_closure);
+    if (TAILQ_EMPTY(&relay_closure->streams)) {
+	relay_closure_free(relay_closure);
+	debug_return;
+    }
+
+    TAILQ_FOREACH_SAFE(closure, &relay_closure->streams, relay_entries, next) {
+	closure->errstr = errstr;
+	relay_stream_error(closure);
+    }
+
+    debug_return;
+}
+
+/*
+ * The relay host closed the connection.  Streams that are not finished
+ * are sent an error, finished journals are done.
+ * The relay closure is freed when the last stream is detached,
+ * it must not be used after this function returns.
+ */
+static void
+relay_eof(struct relay_closure *relay_closure)
+{
+    struct connection_closure *closure, *next;
+    debug_decl(relay_eof, SUDO_DEBUG_UTIL);
+
+    relay_disconnect(relay_closure);
+    if (TAILQ_EMPTY(&relay_closure->streams)) {
+	relay_closure_free(relay_closure);
+	debug_return;
+    }
+
+    TAILQ_FOREACH_SAFE(closure, &relay_closure->streams, relay_entries, next) {
+	if (closure->state != FINISHED) {
+	    sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+		"premature EOF from %s (%s) [state %d]",
+		relay_closure->relay_name.name,
+		relay_closure->relay_name.ipaddr, closure->state);
+	    closure->errstr = _("relay server closed connection");
+	    relay_stream_error(closure);
+	} else if (closure->sock == -1) {
+	    connection_close(closure);
+	}
+    }
+
+    debug_return;
+}
+
 #if defined(HAVE_OPENSSL)
 /* Wrapper for start_relay() called via tls_connect_cb() */
 static bool
@@ -270,24 +759,26 @@ tls_client_start_fn(struct tls_client_closure *tls_client)
 
 /* Perform TLS connection to the relay host. */
 static bool
-connect_relay_tls(struct connection_closure *closure)
+connect_relay_tls(struct relay_closure *relay_closure)
 {
-    struct tls_client_closure *tls_client = &closure->relay_closure->tls_client;
+    struct tls_client_closure *tls_client = &relay_closure->tls_client;
     SSL_CTX *ssl_ctx = logsrvd_relay_tls_ctx();
     debug_decl(connect_relay_tls, SUDO_DEBUG_UTIL);
 
     /* Populate struct tls_client_closure. */
-    tls_client->parent_closure = closure;
-    tls_client->evbase = closure->evbase;
-    tls_client->tls_connect_ev = sudo_ev_alloc(closure->relay_closure->sock,
+    tls_client->parent_closure = relay_closure;
+    tls_client->evbase = relay_closure->evbase;
+    tls_client->tls_connect_ev = sudo_ev_alloc(relay_closure->sock,
 	SUDO_EV_WRITE, tls_connect_cb, tls_client);
     if (tls_client->tls_connect_ev == NULL)
         goto bad;
-    tls_client->peer_name = &closure->relay_closure->relay_name;
+    tls_client->peer_name = &relay_closure->relay_name;
     tls_client->connect_timeout = *logsrvd_conf_relay_connect_timeout();
     tls_client->start_fn = tls_client_start_fn;
-    if (!tls_ctx_client_setup(ssl_ctx, closure->relay_closure->sock, tls_client))
+    if (!tls_ctx_client_setup(ssl_ctx, relay_closure->sock, tls_client))
         goto bad;
+    if (logsrvd_conf_relay_tls_ktls())
+	tls_enable_ktls(tls_client->ssl);
 
     debug_return_bool(true);
 bad:
@@ -301,25 +792,31 @@ bad:
  * If there is no next relay, errno is set to ENOENT.
  */
 static int
-connect_relay_next(struct connection_closure *closure)
+connect_relay_next(struct relay_closure *relay_closure)
 {
-    struct relay_closure *relay_closure = closure->relay_closure;
     struct server_address *relay;
     int ret, sock = -1;
     char *addr;
     debug_decl(connect_relay_next, SUDO_DEBUG_UTIL);
 
-    /* Get next relay or return ENOENT none are left. */
+    /*
+     * Get next relay or return ENOENT none are left.
+     * We start with the selected relay and wrap around to the first.
+     */
     if (relay_closure->relay_addr != NULL) {
 	relay = TAILQ_NEXT(relay_closure->relay_addr, entries);
+	if (relay == NULL)
+	    relay = TAILQ_FIRST(relay_closure->relays);
+	if (relay == relay_closure->relay_first)
+	    relay = NULL;
     } else {
-	relay = TAILQ_FIRST(relay_closure->relays);
+	relay = relay_closure->relay_first;
     }
     if (relay == NULL) {
 	errno = ENOENT;
 	goto bad;
     }
-    relay_closure->relay_addr = relay;
+    relay_set_addr(relay_closure, relay);
 
     sock = socket(relay->sa_un.sa.sa_family, SOCK_STREAM, 0);
     if (sock == -1) {
@@ -340,8 +837,10 @@ connect_relay_next(struct connection_closure *closure)
     }
 
     ret = connect(sock, &relay->sa_un.sa, relay->sa_size);
-    if (ret == -1 && errno != EINPROGRESS)
+    if (ret == -1 && errno != EINPROGRESS) {
+	relay_set_down(relay, true);
 	goto bad;
+    }
 
     switch (relay->sa_un.sa.sa_family) {
     case AF_INET:
@@ -360,9 +859,11 @@ connect_relay_next(struct connection_closure *closure)
     inet_ntop(relay->sa_un.sa.sa_family, addr,
 	relay_closure->relay_name.ipaddr,
 	sizeof(relay_closure->relay_name.ipaddr));
+    sudo_rcstr_delref(relay_closure->relay_name.name);
     relay_closure->relay_name.name = sudo_rcstr_addref(relay->sa_host);
 
     if (ret == 0) {
+	relay_set_down(relay, false);
 	if (relay_closure->sock != -1) {
 	    shutdown(relay_closure->sock, SHUT_RDWR);
 	    close(relay_closure->sock);
@@ -371,22 +872,22 @@ connect_relay_next(struct connection_closure *closure)
 #if defined(HAVE_OPENSSL)
 	/* Relay connection succeeded, start TLS handshake. */
 	if (relay_closure->relay_addr->tls) {
-	    if (!connect_relay_tls(closure))
+	    if (!connect_relay_tls(relay_closure))
 		goto bad;
 	} else
 #endif
 	{
 	    /* Connection succeeded without blocking. */
-	    if (!start_relay(sock, closure))
+	    if (!start_relay(sock, relay_closure))
 		goto bad;
 	}
     } else {
 	/* Connection will be completed in connect_cb(). */
 	relay_closure->connect_ev = sudo_ev_alloc(sock, SUDO_EV_WRITE,
-	    connect_cb, closure);
+	    connect_cb, relay_closure);
 	if (relay_closure->connect_ev == NULL)
 	    goto bad;
-	if (sudo_ev_add(closure->evbase, relay_closure->connect_ev,
+	if (sudo_ev_add(relay_closure->evbase, relay_closure->connect_ev,
 		logsrvd_conf_relay_connect_timeout(), false) == -1) {
 	    sudo_warnx("%s", U_("unable to add event to queue"));
 	    goto bad;
@@ -396,7 +897,9 @@ connect_relay_next(struct connection_closure *closure)
 	    close(relay_closure->sock);
 	}
 	relay_closure->sock = sock;
-	closure->state = CONNECTING;
+
+	/* Closing the old socket may have overwritten errno. */
+	errno = EINPROGRESS;
     }
     debug_return_int(ret);
 
@@ -416,8 +919,8 @@ bad:
 static void
 connect_cb(int sock, int what, void *v)
 {
-    struct connection_closure *closure = v;
-    struct relay_closure *relay_closure = closure->relay_closure;
+    struct relay_closure *relay_closure = v;
+    struct connection_closure *closure;
     int errnum, optval, ret;
     socklen_t optlen = sizeof(optval);
     debug_decl(connect_cb, SUDO_DEBUG_UTIL);
@@ -429,24 +932,26 @@ connect_cb(int sock, int what, void *v)
 	errnum = ret == 0 ? optval : errno;
     }
     if (errnum == 0) {
-	closure->state = INITIAL;
+	/* No longer need the connect event. */
+	sudo_ev_free(relay_closure->connect_ev);
+	relay_closure->connect_ev = NULL;
+	relay_set_down(relay_closure->relay_addr, false);
+	TAILQ_FOREACH(closure, &relay_closure->streams, relay_entries) {
+	    closure->state = INITIAL;
+	}
 #if defined(HAVE_OPENSSL)
 	/* Relay connection succeeded, start TLS handshake. */
 	if (relay_closure->relay_addr->tls) {
-	    if (!connect_relay_tls(closure)) {
-		closure->errstr = _("TLS handshake with relay host failed");
-		if (!schedule_error_message(closure->errstr, closure))
-		    connection_close(closure);
+	    if (!connect_relay_tls(relay_closure)) {
+		relay_fail(relay_closure,
+		    _("TLS handshake with relay host failed"));
 	    }
 	} else
 #endif
 	{
-	    /* Relay connection succeeded, start talking to the client.  */
-	    if (!start_relay(sock, closure)) {
-		closure->errstr = _("unable to allocate memory");
-		if (!schedule_error_message(closure->errstr, closure))
-		    connection_close(closure);
-	    }
+	    /* Relay connection succeeded, start talking to the relay.  */
+	    if (!start_relay(sock, relay_closure))
+		relay_fail(relay_closure, _("unable to allocate memory"));
 	}
     } else {
 	/* Connection failed, try next relay (if any). */
@@ -455,42 +960,150 @@ connect_cb(int sock, int what, void *v)
 	    "unable to connect to relay %s (%s): %s",
 	    relay_closure->relay_name.name, relay_closure->relay_name.ipaddr,
 	    strerror(errnum));
-	while ((res = connect_relay_next(closure)) == -1) {
+	sudo_ev_free(relay_closure->connect_ev);
+	relay_closure->connect_ev = NULL;
+	relay_set_down(relay_closure->relay_addr, true);
+	while ((res = connect_relay_next(relay_closure)) == -1) {
 	    if (errno == ENOENT || errno == EINPROGRESS) {
 		/* Out of relays or connecting asynchronously. */
 		break;
 	    }
 	}
-	if (res == -1 && errno != EINPROGRESS) {
-	    closure->errstr = _("unable to connect to relay host");
-	    if (!schedule_error_message(closure->errstr, closure))
-		connection_close(closure);
-	}
+	if (res == -1 && errno != EINPROGRESS)
+	    relay_fail(relay_closure, _("unable to connect to relay host"));
     }
 
     debug_return;
 }
 
-/* Connect to the first available relay host. */
-bool
-connect_relay(struct connection_closure *closure)
+/*
+ * Open a new connection to the first available relay host,
+ * starting with first.
+ * Returns the relay closure on success or NULL on error.
+ */
+static struct relay_closure *
+relay_connect(struct sudo_event_base *evbase, bool shared,
+    struct server_address *first)
 {
     struct relay_closure *relay_closure;
     int res;
-    debug_decl(connect_relay, SUDO_DEBUG_UTIL);
+    debug_decl(relay_connect, SUDO_DEBUG_UTIL);
 
-    relay_closure = closure->relay_closure = relay_closure_alloc();
+    relay_closure = relay_closure_alloc(evbase, shared, first);
     if (relay_closure == NULL)
-	debug_return_bool(false);
+	debug_return_ptr(NULL);
 
-    while ((res = connect_relay_next(closure)) == -1) {
+    while ((res = connect_relay_next(relay_closure)) == -1) {
 	if (errno == ENOENT || errno == EINPROGRESS) {
 	    /* Out of relays or connecting asynchronously. */
 	    break;
 	}
     }
 
-    if (res == -1 && errno != EINPROGRESS)
+    if (res == -1 && errno != EINPROGRESS) {
+	relay_closure_free(relay_closure);
+	debug_return_ptr(NULL);
+    }
+
+    debug_return_ptr(relay_closure);
+}
+
+/*
+ * Find a shared relay connection opened for the first relay host
+ * with room for another stream.
+ * Returns NULL if there is none.
+ */
+static struct relay_closure *
+relay_pool_lookup(struct server_address *first)
+{
+    struct server_address_list *relays = logsrvd_conf_relay_address();
+    const unsigned int max_streams = logsrvd_conf_relay_max_streams();
+    struct relay_closure *relay_closure;
+    debug_decl(relay_pool_lookup, SUDO_DEBUG_UTIL);
+
+    TAILQ_FOREACH(relay_closure, &relay_pool, entries) {
+	/* The relay hosts may have changed on configuration reload. */
+	if (relay_closure->relays != relays || relay_closure->sock == -1)
+	    continue;
+	if (relay_closure->relay_first != first)
+	    continue;
+	if (relay_closure->nstreams >= max_streams)
+	    continue;
+	if (relay_closure->ready && !relay_closure->multiplex)
+	    continue;
+	if (relay_closure->next_stream_id > UINT32_MAX - STREAMS_MAX)
+	    continue;
+	debug_return_ptr(relay_closure);
+    }
+
+    debug_return_ptr(NULL);
+}
+
+/*
+ * Attach closure to a relay connection, sharing an existing one
+ * if multiplex is set.  Relaying starts once the relay host has
+ * said hello.
+ */
+static bool
+relay_start(struct connection_closure *closure, bool multiplex)
+{
+    struct relay_closure *relay_closure = NULL;
+    struct server_address *first;
+    char *submithost = NULL;
+    const char *key = NULL;
+    debug_decl(relay_start, SUDO_DEBUG_UTIL);
+
+    /*
+     * For hash balancing, journals are keyed on the submitting host.
+     * A live session is keyed on the client address, which is the
+     * submitting host unless the client is itself a relay.
+     */
+    if (logsrvd_conf_relay_balance() == RELAY_BALANCE_HASH) {
+	if (closure->journal != NULL)
+	    key = submithost = journal_submithost(closure);
+	else if (closure->ipaddr[0] != '\0')
+	    key = closure->ipaddr;
+    }
+    first = relay_select(logsrvd_conf_relay_address(), key);
+    free(submithost);
+
+    if (multiplex)
+	relay_closure = relay_pool_lookup(first);
+    if (relay_closure == NULL) {
+	relay_closure = relay_connect(closure->evbase, multiplex, first);
+	if (relay_closure == NULL)
+	    debug_return_bool(false);
+    }
+
+    closure->relay_closure = relay_closure;
+    TAILQ_INSERT_TAIL(&relay_closure->streams, closure, relay_entries);
+    relay_closure->nstreams++;
+    if (relay_closure->relay_addr != NULL)
+	relay_closure->relay_addr->nsessions++;
+    if (relay_closure->idle_ev != NULL)
+	sudo_ev_del(relay_closure->evbase, relay_closure->idle_ev);
+
+    if (relay_closure->connect_ev != NULL) {
+	/* Connection will be completed in connect_cb(). */
+	closure->state = CONNECTING;
+    } else if (relay_closure->ready) {
+	/* Relay server already said hello, start talking to client. */
+	if (relay_closure->multiplex)
+	    closure->relay_stream_id = ++relay_closure->next_stream_id;
+	if (!start_protocol(closure))
+	    debug_return_bool(false);
+    }
+
+    debug_return_bool(true);
+}
+
+/* Connect to the first available relay host. */
+bool
+connect_relay(struct connection_closure *closure)
+{
+    debug_decl(connect_relay, SUDO_DEBUG_UTIL);
+
+    if (!relay_start(closure, logsrvd_conf_relay_multiplex()))
 	debug_return_bool(false);
 
     /* Switch to relay client message handlers. */
@@ -498,20 +1111,41 @@ connect_relay(struct connection_closure *closure)
     debug_return_bool(true);
 }
 
+/*
+ * Find the stream a ServerMessage from the relay is for.
+ * Returns NULL if the stream is no longer attached.
+ */
+static struct connection_closure *
+relay_stream_lookup(uint32_t stream_id, struct relay_closure *relay_closure)
+{
+    struct connection_closure *closure;
+    debug_decl(relay_stream_lookup, SUDO_DEBUG_UTIL);
+
+    if (!relay_closure->multiplex)
+	debug_return_ptr(TAILQ_FIRST(&relay_closure->streams));
+
+    TAILQ_FOREACH(closure, &relay_closure->streams, relay_entries) {
+	if (closure->relay_stream_id == stream_id && stream_id != 0)
+	    break;
+    }
+    debug_return_ptr(closure);
+}
+
 /*
  * Respond to a ServerHello message from the relay.
  * Returns true on success, false on error.
  */
 static bool
-handle_server_hello(ServerHello *msg, struct connection_closure *closure)
+handle_server_hello(ServerHello *msg, struct relay_closure *relay_closure)
 {
-    struct relay_closure *relay_closure = closure->relay_closure;
+    struct connection_closure *closure, *next;
     debug_decl(handle_server_hello, SUDO_DEBUG_UTIL);
 
-    if (closure->state != INITIAL) {
-	sudo_warnx(U_("unexpected state %d for %s"), closure->state,
+    if (relay_closure->ready) {
+	sudo_warnx(U_("unexpected type_case value %d in %s from %s"),
+	    SERVER_MESSAGE__TYPE_HELLO, "ServerMessage",
 	    relay_closure->relay_name.ipaddr);
-	closure->errstr = _("state machine error");
+	relay_closure->errstr = _("state machine error");
 	debug_return_bool(false);
     }
 
@@ -519,16 +1153,61 @@ handle_server_hello(ServerHello *msg, struct connection_closure *closure)
     if (msg->server_id == NULL || msg->server_id[0] == '\0') {
 	sudo_warnx(U_("%s: invalid ServerHello, missing server_id"),
 	    relay_closure->relay_name.ipaddr);
-	closure->errstr = _("invalid ServerHello");
+	relay_closure->errstr = _("invalid ServerHello");
 	debug_return_bool(false);
     }
 
     sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
-	"relay server %s (%s) ID %s", relay_closure->relay_name.name,
-	relay_closure->relay_name.ipaddr, msg->server_id);
+	"relay server %s (%s) ID %s%s%s%s", relay_closure->relay_name.name,
+	relay_closure->relay_name.ipaddr, msg->server_id,
+	msg->multiplex ? " (multiplex)" : "",
+	msg->iobuf_batch ? " (iobuf_batch)" : "",
+	msg->compression ? " (compression)" : "");
 
     /* TODO: handle redirect */
 
+    relay_closure->ready = true;
+    if (relay_closure->shared && !msg->multiplex &&
+	    (closure = TAILQ_FIRST(&relay_closure->streams)) != NULL) {
+	/*
+	 * The relay server does not support multiplexing.  The first
+	 * stream gets the connection to itself, the others need their own.
+	 */
+	while ((next = TAILQ_NEXT(closure, relay_entries)) != NULL) {
+	    relay_detach(next);
+	    if (!relay_start(next, false)) {
+		next->errstr = _("unable to connect to relay host");
+		relay_stream_error(next);
+	    }
+	}
+	TAILQ_REMOVE(&relay_pool, relay_closure, entries);
+	relay_closure->shared = false;
+    }
+    relay_closure->multiplex = relay_closure->shared && msg->multiplex;
+    relay_closure->iobuf_batch = msg->iobuf_batch;
+#ifdef HAVE_ZLIB_H
+    /* Messages sent after the ClientHello may be compressed. */
+    if (msg->compression && logsrvd_conf_relay_compress()) {
+	if ((relay_closure->deflate = msg_deflate_alloc()) == NULL) {
+	    relay_closure->errstr = _("unable to allocate memory");
+	    debug_return_bool(false);
+	}
+    }
+#endif
+
+    /* Relay server said hello, start talking to the client(s). */
+    TAILQ_FOREACH_SAFE(closure, &relay_closure->streams, relay_entries, next) {
+	if (relay_closure->multiplex)
+	    closure->relay_stream_id = ++relay_closure->next_stream_id;
+	if (!start_protocol(closure)) {
+	    if (!relay_closure->shared) {
+		relay_closure->errstr = closure->errstr;
+		debug_return_bool(false);
+	    }
+	    relay_stream_error(closure);
+	}
+    }
+
     debug_return_bool(true);
 }
 
@@ -548,6 +1227,10 @@ handle_commit_point(TimeSpec *commit_point, struct connection_closure *closure)
 	debug_return_bool(false);
     }
 
+    /* Remember how far the relay host got with a journal. */
+    if (closure->write_ev == NULL && closure->journal != NULL)
+	journal_relay_update(NULL, commit_point, closure);
+
     /* Pass commit point from relay to client. */
     debug_return_bool(schedule_commit_point(commit_point, closure));
 }
@@ -570,8 +1253,12 @@ handle_log_id(char *id, struct connection_closure *closure)
 	closure->relay_closure->relay_name.ipaddr);
 
     /* No client connection when replaying a journaled entry. */
-    if (closure->write_ev == NULL)
+    if (closure->write_ev == NULL) {
+	/* Needed to restart the session if the relay connection fails. */
+	if (closure->journal != NULL)
+	    journal_relay_update(id, NULL, closure);
 	debug_return_bool(true);
+    }
 
     /* Generate a new log ID that includes the relay host. */
     len = asprintf(&new_id, "%s/%s", id,
@@ -606,9 +1293,19 @@ handle_server_error(char *errmsg, struct connection_closure *closure)
 	relay_closure->relay_name.name, relay_closure->relay_name.ipaddr,
 	errmsg);
 
-    /* Server will drop connection after the error message. */
-    sudo_ev_del(closure->evbase, closure->relay_closure->read_ev);
-    sudo_ev_del(closure->evbase, closure->relay_closure->write_ev);
+    if (closure->write_ev == NULL && closure->journal != NULL) {
+	/* The relay host gave up on the session, don't restart it. */
+	journal_relay_remove(closure);
+    }
+
+    if (relay_closure->multiplex) {
+	/* Server has closed the stream, no need to close it again. */
+	closure->relay_stream_id = 0;
+    } else {
+	/* Server will drop connection after the error message. */
+	sudo_ev_del(relay_closure->evbase, relay_closure->read_ev);
+	sudo_ev_del(relay_closure->evbase, relay_closure->write_ev);
+    }
 
     if (!schedule_error_message(errmsg, closure))
 	debug_return_bool(false);
@@ -639,29 +1336,48 @@ handle_server_abort(char *errmsg, struct connection_closure *closure)
 
 /*
  * Respond to a ServerMessage from the relay.
- * Returns true on success, false on error.
+ * Messages other than ServerHello are passed to the stream they are for.
+ * Returns true on success, false if the relay connection is in error.
  */
 static bool
-handle_server_message(uint8_t *buf, size_t len, struct connection_closure *closure)
+handle_server_message(uint8_t *buf, size_t len,
+    struct relay_closure *relay_closure)
 {
+    struct connection_closure *closure;
     ServerMessage *msg;
     bool ret = false;
     debug_decl(handle_server_message, SUDO_DEBUG_UTIL);
 
+    if (server_msg_arena.block_size == 0)
+	protobuf_c_arena_init(&server_msg_arena, 0, NULL);
+
+    relay_closure->errstr = NULL;
+
     sudo_debug_printf(SUDO_DEBUG_INFO, "%s: unpacking ServerMessage", __func__);
-    msg = server_message__unpack(NULL, len, buf);
+    msg = server_message__unpack(&server_msg_arena.base, len, buf);
     if (msg == NULL) {
 	sudo_warnx(U_("unable to unpack %s size %zu"), "ServerMessage", len);
+	protobuf_c_arena_reset(&server_msg_arena);
 	debug_return_bool(false);
     }
 
+    if (msg->type_case == SERVER_MESSAGE__TYPE_HELLO) {
+	ret = handle_server_hello(msg->u.hello, relay_closure);
+	goto done;
+    }
+
+    closure = relay_stream_lookup(msg->stream_id, relay_closure);
+    if (closure == NULL) {
+	/* Stream already detached, e.g. after the client disconnected. */
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+	    "ignoring message type %d for stream %u from relay %s (%s)",
+	    msg->type_case, msg->stream_id, relay_closure->relay_name.name,
+	    relay_closure->relay_name.ipaddr);
+	ret = true;
+	goto done;
+    }
+
     switch (msg->type_case) {
-    case SERVER_MESSAGE__TYPE_HELLO:
-	if ((ret = handle_server_hello(msg->u.hello, closure))) {
-	    /* Relay server said hello, start talking to client. */
-	    ret = start_protocol(closure);
-	}
-	break;
     case SERVER_MESSAGE__TYPE_COMMIT_POINT:
 	ret = handle_commit_point(msg->u.commit_point, closure);
 	break;
@@ -677,12 +1393,25 @@ handle_server_message(uint8_t *buf, size_t len, struct connection_closure *closu
     default:
 	sudo_warnx(U_("unexpected type_case value %d in %s from %s"),
 	    msg->type_case, "ServerMessage",
-	    closure->relay_closure->relay_name.ipaddr);
+	    relay_closure->relay_name.ipaddr);
 	closure->errstr = _("unrecognized ServerMessage type");
 	break;
     }
 
-    server_message__free_unpacked(msg, NULL);
+    if (!relay_closure->shared) {
+	/* A dedicated relay connection fails along with its stream. */
+	if (!ret)
+	    relay_closure->errstr = closure->errstr;
+    } else if (!ret) {
+	relay_stream_error(closure);
+	ret = true;
+    } else if (closure->state == FINISHED && closure->write_ev == NULL) {
+	/* Journal relayed, the server will not close the connection. */
+	connection_close(closure);
+    }
+
+done:
+    protobuf_c_arena_reset(&server_msg_arena);
     debug_return_bool(ret);
 }
 
@@ -692,8 +1421,7 @@ handle_server_message(uint8_t *buf, size_t len, struct connection_closure *closu
 static void
 relay_server_msg_cb(int fd, int what, void *v)
 {
-    struct connection_closure *closure = v;
-    struct relay_closure *relay_closure = closure->relay_closure;
+    struct relay_closure *relay_closure = v;
     struct connection_buffer *buf = &relay_closure->read_buf;
     ssize_t nread;
     uint32_t msg_len;
@@ -709,11 +1437,12 @@ relay_server_msg_cb(int fd, int what, void *v)
     if (what == SUDO_EV_TIMEOUT) {
 	sudo_warnx(U_("timed out reading from relay %s (%s)"),
 	    relay_closure->relay_name.name, relay_closure->relay_name.ipaddr);
-	closure->errstr = _("timeout reading from relay");
+	relay_closure->errstr = _("timeout reading from relay");
         goto send_error;
     }
 
 #if defined(HAVE_OPENSSL)
+again:
     if (relay_closure->tls_client.ssl != NULL) {
 	SSL *ssl = relay_closure->tls_client.ssl;
 	sudo_debug_printf(SUDO_DEBUG_INFO,
@@ -740,9 +1469,9 @@ relay_server_msg_cb(int fd, int what, void *v)
 			"SSL_read returns SSL_ERROR_WANT_WRITE");
 		    if (!sudo_ev_pending(relay_closure->write_ev, SUDO_EV_WRITE, NULL)) {
 			/* Enable a temporary write event. */
-			if (sudo_ev_add(closure->evbase, relay_closure->write_ev, NULL, false) == -1) {
+			if (sudo_ev_add(relay_closure->evbase, relay_closure->write_ev, NULL, false) == -1) {
 			    sudo_warnx("%s", U_("unable to add event to queue"));
-			    closure->errstr = _("unable to allocate memory");
+			    relay_closure->errstr = _("unable to allocate memory");
 			    goto send_error;
 			}
 			relay_closure->temporary_write_event = true;
@@ -759,15 +1488,15 @@ relay_server_msg_cb(int fd, int what, void *v)
                      */
                     err = ERR_get_error();
 #if !defined(HAVE_WOLFSSL)
-                    if (closure->state == INITIAL &&
+                    if (!relay_closure->ready &&
                         ERR_GET_REASON(err) == SSL_R_TLSV1_ALERT_INTERNAL_ERROR) {
                         errstr = _("relay host name does not match certificate");
-			closure->errstr = errstr;
+			relay_closure->errstr = errstr;
                     } else
 #endif
 		    {
                         errstr = ERR_reason_error_string(err);
-			closure->errstr = _("error reading from relay");
+			relay_closure->errstr = _("error reading from relay");
                     }
 		    sudo_warnx("%s: SSL_read: %s",
 			relay_closure->relay_name.ipaddr,
@@ -781,14 +1510,14 @@ relay_server_msg_cb(int fd, int what, void *v)
 			break;
 		    }
 		    sudo_warn("%s: SSL_read", relay_closure->relay_name.ipaddr);
-		    closure->errstr = _("error reading from relay");
+		    relay_closure->errstr = _("error reading from relay");
                     goto send_error;
                 default:
                     errstr = ERR_reason_error_string(ERR_get_error());
 		    sudo_warnx("%s: SSL_read: %s",
 			relay_closure->relay_name.ipaddr,
 			errstr ? errstr : strerror(errno));
-		    closure->errstr = _("error reading from relay");
+		    relay_closure->errstr = _("error reading from relay");
                     goto send_error;
             }
         }
@@ -809,26 +1538,11 @@ relay_server_msg_cb(int fd, int what, void *v)
 	if (errno == EAGAIN || errno == EINTR)
 	    debug_return;
 	sudo_warn("%s: read", relay_closure->relay_name.ipaddr);
-	closure->errstr = _("unable to read from relay");
+	relay_closure->errstr = _("unable to read from relay");
 	goto send_error;
     case 0:
 	/* EOF from relay server, close the socket. */
-	shutdown(relay_closure->sock, SHUT_RDWR);
-	close(relay_closure->sock);
-	relay_closure->sock = -1;
-	sudo_ev_del(closure->evbase, relay_closure->read_ev);
-	sudo_ev_del(closure->evbase, relay_closure->write_ev);
-
-	if (closure->state != FINISHED) {
-	    sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
-		"premature EOF from %s (%s) [state %d]",
-		relay_closure->relay_name.name,
-		relay_closure->relay_name.ipaddr, closure->state);
-	    closure->errstr = _("relay server closed connection");
-	    goto send_error;
-	}
-	if (closure->sock == -1)
-	    connection_close(closure);
+	relay_eof(relay_closure);
 	debug_return;
     default:
 	break;
@@ -842,16 +1556,24 @@ relay_server_msg_cb(int fd, int what, void *v)
 
 	if (msg_len > MESSAGE_SIZE_MAX) {
 	    sudo_warnx(U_("server message too large: %zu"), (size_t)msg_len);
-	    closure->errstr = _("server message too large");
+	    relay_closure->errstr = _("server message too large");
 	    goto send_error;
 	}
 
 	if (msg_len + sizeof(msg_len) > buf->len - buf->off) {
 	    /* Incomplete message, we'll read the rest next time. */
-	    if (!expand_buf(buf, msg_len + sizeof(msg_len))) {
-		closure->errstr = _("unable to allocate memory");
+	    const size_t oldsize = buf->size;
+	    if (!bufpool_expand_data(buf, msg_len + sizeof(msg_len))) {
+		relay_closure->errstr = _("unable to allocate memory");
 		goto send_error;
 	    }
+	    buffer_charge(&relay_closure->buffered, oldsize, buf->size);
+#if defined(HAVE_OPENSSL)
+	    /* The rest of the TLS record may already be buffered by OpenSSL. */
+	    if (relay_closure->tls_client.ssl != NULL &&
+		    SSL_pending(relay_closure->tls_client.ssl) > 0)
+		goto again;
+#endif
 	    debug_return;
 	}
 
@@ -859,25 +1581,27 @@ relay_server_msg_cb(int fd, int what, void *v)
 	sudo_debug_printf(SUDO_DEBUG_INFO,
 	    "%s: parsing ServerMessage, size %u", __func__, msg_len);
 	buf->off += sizeof(msg_len);
-	if (!handle_server_message(buf->data + buf->off, msg_len, closure))
+	if (!handle_server_message(buf->data + buf->off, msg_len, relay_closure))
 	    goto send_error;
 	buf->off += msg_len;
     }
     buf->len -= buf->off;
     buf->off = 0;
+#if defined(HAVE_OPENSSL)
+    /* Buffered TLS data will not trigger another read event. */
+    if (relay_closure->tls_client.ssl != NULL &&
+	    SSL_pending(relay_closure->tls_client.ssl) > 0 &&
+	    sudo_ev_pending(relay_closure->read_ev, SUDO_EV_READ, NULL))
+	goto again;
+#endif
     debug_return;
 
 send_error:
     /*
-     * Try to send client an error message before closing connection.
+     * Try to send the client(s) an error message before closing.
      * If we are already in an error state, just give up.
      */
-    if (!schedule_error_message(closure->errstr, closure))
-	goto close_connection;
-    debug_return;
-
-close_connection:
-    connection_close(closure);
+    relay_fail(relay_closure, relay_closure->errstr);
     debug_return;
 }
 
@@ -887,9 +1611,9 @@ close_connection:
 static void
 relay_client_msg_cb(int fd, int what, void *v)
 {
-    struct connection_closure *closure = v;
-    struct relay_closure *relay_closure = closure->relay_closure;
+    struct relay_closure *relay_closure = v;
     struct connection_buffer *buf;
+    bool released = false;
     ssize_t nwritten;
     debug_decl(relay_client_msg_cb, SUDO_DEBUG_UTIL);
 
@@ -899,7 +1623,7 @@ relay_client_msg_cb(int fd, int what, void *v)
         /* Delete write event if it was only due to SSL_read(). */
         if (relay_closure->temporary_write_event) {
             relay_closure->temporary_write_event = false;
-            sudo_ev_del(closure->evbase, relay_closure->write_ev);
+            sudo_ev_del(relay_closure->evbase, relay_closure->write_ev);
         }
         relay_server_msg_cb(fd, what, v);
         debug_return;
@@ -908,14 +1632,15 @@ relay_client_msg_cb(int fd, int what, void *v)
     if (what == SUDO_EV_TIMEOUT) {
 	sudo_warnx(U_("timed out writing to relay %s (%s)"),
 	    relay_closure->relay_name.name, relay_closure->relay_name.ipaddr);
-	closure->errstr = _("timeout writing to relay");
+	relay_closure->errstr = _("timeout writing to relay");
         goto send_error;
     }
 
     if ((buf = TAILQ_FIRST(&relay_closure->write_bufs)) == NULL) {
 	sudo_warnx(U_("missing write buffer for client %s"),
 	    relay_closure->relay_name.ipaddr);
-        goto close_connection;
+	relay_closure->errstr = NULL;
+        goto send_error;
     }
 
     sudo_debug_printf(SUDO_DEBUG_INFO, "%s: sending %u bytes to server %s (%s)",
@@ -925,6 +1650,14 @@ relay_client_msg_cb(int fd, int what, void *v)
 #if defined(HAVE_OPENSSL)
     if (relay_closure->tls_client.ssl != NULL) {
 	SSL *ssl = relay_closure->tls_client.ssl;
+
+	/* Send as many queued messages as possible in one TLS record. */
+	if (!coalesce_write_bufs(&relay_closure->write_bufs,
+		&relay_closure->buffered)) {
+	    relay_closure->errstr = _("unable to allocate memory");
+	    goto send_error;
+	}
+	buf = TAILQ_FIRST(&relay_closure->write_bufs);
         nwritten = SSL_write(ssl, buf->data + buf->off, buf->len - buf->off);
         if (nwritten <= 0) {
 	    const char *errstr;
@@ -932,19 +1665,7 @@ relay_client_msg_cb(int fd, int what, void *v)
             switch (SSL_get_error(ssl, nwritten)) {
 		case SSL_ERROR_ZERO_RETURN:
 		    /* ssl connection shutdown cleanly */
-		    shutdown(relay_closure->sock, SHUT_RDWR);
-		    close(relay_closure->sock);
-		    relay_closure->sock = -1;
-		    sudo_ev_del(closure->evbase, relay_closure->read_ev);
-		    sudo_ev_del(closure->evbase, relay_closure->write_ev);
-
-		    if (closure->state != FINISHED) {
-			sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
-			    "premature EOF from %s (state %d)",
-			    relay_closure->relay_name.ipaddr, closure->state);
-			closure->errstr = _("relay server closed connection");
-			goto send_error;
-		    }
+		    relay_eof(relay_closure);
 		    debug_return;
                 case SSL_ERROR_WANT_READ:
                     /* ssl wants to read, read event always active */
@@ -961,63 +1682,65 @@ relay_client_msg_cb(int fd, int what, void *v)
                 case SSL_ERROR_SYSCALL:
 		    sudo_warn("%s: SSL_write",
 			relay_closure->relay_name.ipaddr);
-		    closure->errstr = _("error writing to relay");
+		    relay_closure->errstr = _("error writing to relay");
 		    goto send_error;
                 default:
 		    errstr = ERR_reason_error_string(ERR_get_error());
 		    sudo_warnx("%s: SSL_write: %s",
 			relay_closure->relay_name.ipaddr,
 			errstr ? errstr : strerror(errno));
-		    closure->errstr = _("error writing to relay");
+		    relay_closure->errstr = _("error writing to relay");
 		    goto send_error;
             }
         }
     } else
 #endif
     {
-	nwritten = write(fd, buf->data + buf->off, buf->len - buf->off);
+	/* Send all queued messages with a single system call. */
+	nwritten = writev_bufs(fd, &relay_closure->write_bufs);
 	if (nwritten == -1) {
 	    if (errno == EAGAIN || errno == EINTR)
 		debug_return;
 	    sudo_warn("%s: write", relay_closure->relay_name.ipaddr);
-	    closure->errstr = _("error writing to relay");
+	    relay_closure->errstr = _("error writing to relay");
 	    goto send_error;
 	}
     }
-    buf->off += nwritten;
 
-    if (buf->off == buf->len) {
-	/* sent entire message, move buf to free list */
+    /* Move the buffers that were sent in their entirety to the free list. */
+    while ((buf = TAILQ_FIRST(&relay_closure->write_bufs)) != NULL) {
+	if ((size_t)nwritten < buf->len - buf->off) {
+	    buf->off += nwritten;
+	    break;
+	}
+	nwritten -= buf->len - buf->off;
 	sudo_debug_printf(SUDO_DEBUG_INFO,
 	    "%s: finished sending %u bytes to server", __func__, buf->len);
-	buf->off = 0;
-	buf->len = 0;
 	TAILQ_REMOVE(&relay_closure->write_bufs, buf, entries);
-	TAILQ_INSERT_TAIL(&closure->free_bufs, buf, entries);
+	release_buf(buf, &relay_closure->buffered);
+	released = true;
+    }
+
+    if (released) {
 	if (TAILQ_EMPTY(&relay_closure->write_bufs))
-	    sudo_ev_del(closure->evbase, relay_closure->write_ev);
+	    sudo_ev_del(relay_closure->evbase, relay_closure->write_ev);
+	connection_resume_paused();
     }
     debug_return;
 
 send_error:
     /*
-     * Try to send client an error message before closing connection.
+     * Try to send the client(s) an error message before closing.
      * If we are already in an error state, just give up.
      */
-    if (!schedule_error_message(closure->errstr, closure))
-	goto close_connection;
-    debug_return;
-
-close_connection:
-    connection_close(closure);
+    relay_fail(relay_closure, relay_closure->errstr);
     debug_return;
 }
 
 /* Begin the conversation with the relay host. */
 static bool
-start_relay(int sock, struct connection_closure *closure)
+start_relay(int sock, struct relay_closure *relay_closure)
 {
-    struct relay_closure *relay_closure = closure->relay_closure;
     debug_decl(start_relay, SUDO_DEBUG_UTIL);
 
     /* No longer need the connect event. */
@@ -1026,14 +1749,14 @@ start_relay(int sock, struct connection_closure *closure)
 
     /* Allocate relay read/write events now that we know the socket. */
     relay_closure->read_ev = sudo_ev_alloc(sock, SUDO_EV_READ|SUDO_EV_PERSIST,
-	relay_server_msg_cb, closure);
+	relay_server_msg_cb, relay_closure);
     relay_closure->write_ev = sudo_ev_alloc(sock, SUDO_EV_WRITE|SUDO_EV_PERSIST,
-	relay_client_msg_cb, closure);
+	relay_client_msg_cb, relay_closure);
     if (relay_closure->read_ev == NULL || relay_closure->write_ev == NULL)
 	debug_return_bool(false);
 
     /* Start communication with the relay server by saying hello. */
-    debug_return_bool(fmt_client_hello(closure));
+    debug_return_bool(fmt_client_hello(relay_closure));
 }
 
 /*
@@ -1125,9 +1848,14 @@ relay_restart(RestartMessage *msg, uint8_t *buf, size_t len,
 	    restart_msg.log_id = cp + 1;
     }
 
+    /* Elapsed time resumes from the restart point. */
+    closure->elapsed_time.tv_sec = (time_t)msg->resume_point->tv_sec;
+    closure->elapsed_time.tv_nsec = (long)msg->resume_point->tv_nsec;
+
+    client_msg.stream_id = closure->relay_stream_id;
     client_msg.u.restart_msg = &restart_msg;
     client_msg.type_case = CLIENT_MESSAGE__TYPE_RESTART_MSG;
-    ret = fmt_client_message(closure, &client_msg);
+    ret = fmt_client_message(relay_closure, &client_msg);
     if (ret) {
 	if (sudo_ev_add(evbase, relay_closure->write_ev, NULL, false) == -1) {
 	    sudo_warnx("%s", U_("unable to add event to queue"));
@@ -1138,6 +1866,49 @@ relay_restart(RestartMessage *msg, uint8_t *buf, size_t len,
     debug_return_bool(ret);
 }
 
+/*
+ * Restart the relay host's session for a journal that was partially
+ * relayed before, see journal_relay_resume().  The journal has
+ * already been positioned after the last commit point.
+ */
+bool
+relay_resume(struct connection_closure *closure)
+{
+    struct relay_closure *relay_closure = closure->relay_closure;
+    ClientMessage client_msg = CLIENT_MESSAGE__INIT;
+    RestartMessage restart_msg = RESTART_MESSAGE__INIT;
+    TimeSpec ts = TIME_SPEC__INIT;
+    debug_decl(relay_resume, SUDO_DEBUG_UTIL);
+
+    sudo_debug_printf(SUDO_DEBUG_INFO,
+	"%s: restarting %s at [%lld, %ld] on %s (%s)", __func__,
+	closure->relay_log_id, (long long)closure->relay_commit.tv_sec,
+	closure->relay_commit.tv_nsec, relay_closure->relay_name.name,
+	relay_closure->relay_name.ipaddr);
+
+    ts.tv_sec = (int64_t)closure->relay_commit.tv_sec;
+    ts.tv_nsec = (int32_t)closure->relay_commit.tv_nsec;
+    restart_msg.log_id = closure->relay_log_id;
+    restart_msg.resume_point = &ts;
+
+    client_msg.stream_id = closure->relay_stream_id;
+    client_msg.u.restart_msg = &restart_msg;
+    client_msg.type_case = CLIENT_MESSAGE__TYPE_RESTART_MSG;
+    if (!fmt_client_message(relay_closure, &client_msg))
+	debug_return_bool(false);
+    if (sudo_ev_add(closure->evbase, relay_closure->write_ev, NULL,
+	    false) == -1) {
+	sudo_warnx("%s", U_("unable to add event to queue"));
+	debug_return_bool(false);
+    }
+
+    /* Only I/O logs are restartable. */
+    closure->log_io = true;
+    closure->state = RUNNING;
+
+    debug_return_bool(true);
+}
+
 /*
  * Relay an AlertMessage from the client to the relay server.
  */
@@ -1177,6 +1948,9 @@ relay_suspend(CommandSuspend *msg, uint8_t *buf, size_t len,
 	"%s: relaying CommandSuspend from %s to %s (%s)", __func__, source,
 	relay_closure->relay_name.name, relay_closure->relay_name.ipaddr);
 
+    /* Track elapsed time so we can recognize the final commit point. */
+    update_elapsed_time(msg->delay, &closure->elapsed_time);
+
     ret = relay_enqueue_write(buf, len, closure);
 
     debug_return_bool(ret);
@@ -1199,6 +1973,9 @@ relay_winsize(ChangeWindowSize *msg, uint8_t *buf, size_t len,
 	"%s: relaying ChangeWindowSize from %s to %s (%s)", __func__, source,
 	relay_closure->relay_name.name, relay_closure->relay_name.ipaddr);
 
+    /* Track elapsed time so we can recognize the final commit point. */
+    update_elapsed_time(msg->delay, &closure->elapsed_time);
+
     ret = relay_enqueue_write(buf, len, closure);
 
     debug_return_bool(ret);
@@ -1221,11 +1998,107 @@ relay_iobuf(int iofd, IoBuffer *iobuf, uint8_t *buf, size_t len,
 	"%s: relaying IoBuffer from %s to %s (%s)", __func__, source,
 	relay_closure->relay_name.name, relay_closure->relay_name.ipaddr);
 
+    /* Track elapsed time so we can recognize the final commit point. */
+    update_elapsed_time(iobuf->delay, &closure->elapsed_time);
+
     ret = relay_enqueue_write(buf, len, closure);
 
     debug_return_bool(ret);
 }
 
+/*
+ * Relay an IoBuffer or IoBufferBatch from the client to the relay
+ * server without unpacking it, see relay_peek_message().
+ */
+bool
+relay_iobuf_raw(struct relay_peek *peek, uint8_t *buf, size_t len,
+    struct connection_closure *closure)
+{
+    struct relay_closure *relay_closure = closure->relay_closure;
+    const char *source = closure->journal_path ? closure->journal_path :
+	closure->ipaddr;
+    debug_decl(relay_iobuf_raw, SUDO_DEBUG_UTIL);
+
+    sudo_debug_printf(SUDO_DEBUG_INFO,
+	"%s: relaying %s from %s to %s (%s) as-is", __func__,
+	peek->type_case == CLIENT_MESSAGE__TYPE_IOBUF_BATCH ?
+	"IoBufferBatch" : "IoBuffer", source,
+	relay_closure->relay_name.name, relay_closure->relay_name.ipaddr);
+
+    /* Track elapsed time so we can recognize the final commit point. */
+    update_elapsed_time(&peek->delay, &closure->elapsed_time);
+
+    debug_return_bool(relay_enqueue_write(buf, len, closure));
+}
+
+/*
+ * Relay an IoBufferBatch from the client to the relay server.
+ * If the relay server does not support batches, each record is
+ * sent as a separate IoBuffer.
+ */
+static bool
+relay_iobuf_batch(IoBufferBatch *msg, uint8_t *buf, size_t len,
+    struct connection_closure *closure)
+{
+    struct relay_closure *relay_closure = closure->relay_closure;
+    const char *source = closure->journal_path ? closure->journal_path :
+	closure->ipaddr;
+    size_t n;
+    bool ret = true;
+    debug_decl(relay_iobuf_batch, SUDO_DEBUG_UTIL);
+
+    sudo_debug_printf(SUDO_DEBUG_INFO,
+	"%s: relaying IoBufferBatch from %s to %s (%s)%s", __func__, source,
+	relay_closure->relay_name.name, relay_closure->relay_name.ipaddr,
+	relay_closure->iobuf_batch ? "" : " as IoBuffers");
+
+    /* Track elapsed time so we can recognize the final commit point. */
+    for (n = 0; n < msg->n_records; n++)
+	update_elapsed_time(msg->records[n]->delay, &closure->elapsed_time);
+
+    if (relay_closure->iobuf_batch)
+	debug_return_bool(relay_enqueue_write(buf, len, closure));
+
+    for (n = 0; n < msg->n_records && ret; n++) {
+	ClientMessage client_msg = CLIENT_MESSAGE__INIT;
+	IoRecord *record = msg->records[n];
+	IoBuffer iobuf = IO_BUFFER__INIT;
+
+	iobuf.delay = record->delay;
+	iobuf.data = record->data;
+
+	/* It doesn't matter which IoBuffer we set. */
+	client_msg.stream_id = closure->relay_stream_id;
+	client_msg.u.ttyout_buf = &iobuf;
+	switch (record->iofd) {
+	case IOFD_STDIN:
+	    client_msg.type_case = CLIENT_MESSAGE__TYPE_STDIN_BUF;
+	    break;
+	case IOFD_STDOUT:
+	    client_msg.type_case = CLIENT_MESSAGE__TYPE_STDOUT_BUF;
+	    break;
+	case IOFD_STDERR:
+	    client_msg.type_case = CLIENT_MESSAGE__TYPE_STDERR_BUF;
+	    break;
+	case IOFD_TTYIN:
+	    client_msg.type_case = CLIENT_MESSAGE__TYPE_TTYIN_BUF;
+	    break;
+	default:
+	    client_msg.type_case = CLIENT_MESSAGE__TYPE_TTYOUT_BUF;
+	    break;
+	}
+	ret = fmt_client_message(relay_closure, &client_msg);
+    }
+    if (ret) {
+	if (sudo_ev_add(relay_closure->evbase, relay_closure->write_ev, NULL, false) == -1) {
+	    sudo_warnx("%s", U_("unable to add event to queue"));
+	    ret = false;
+	}
+    }
+
+    debug_return_bool(ret);
+}
+
 /*
  * Shutdown relay connection when server is exiting.
  */
@@ -1236,9 +2109,13 @@ relay_shutdown(struct connection_closure *closure)
     debug_decl(relay_shutdown, SUDO_DEBUG_UTIL);
 
     /* Close connection unless relay events are pending. */
-    if (!sudo_ev_pending(relay_closure->read_ev, SUDO_EV_READ, NULL) &&
-	    !sudo_ev_pending(relay_closure->write_ev, SUDO_EV_WRITE, NULL) &&
-	    TAILQ_EMPTY(&relay_closure->write_bufs)) {
+    if (relay_closure->read_ev != NULL &&
+	    sudo_ev_pending(relay_closure->read_ev, SUDO_EV_READ, NULL))
+	debug_return_bool(true);
+    if (relay_closure->write_ev != NULL &&
+	    sudo_ev_pending(relay_closure->write_ev, SUDO_EV_WRITE, NULL))
+	debug_return_bool(true);
+    if (TAILQ_EMPTY(&relay_closure->write_bufs)) {
 	connection_close(closure);
     }
 
@@ -1253,5 +2130,6 @@ struct client_message_switch cms_relay = {
     relay_alert,
     relay_iobuf,
     relay_suspend,
-    relay_winsize
+    relay_winsize,
+    relay_iobuf_batch
 };
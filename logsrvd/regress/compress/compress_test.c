@@ -0,0 +1,334 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifdef HAVE_STDBOOL_H
+# include <stdbool.h>
+#else
+# include "compat/stdbool.h"
+#endif /* HAVE_STDBOOL_H */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SUDO_ERROR_WRAP 0
+
+#include "sudo_compat.h"
+#include "sudo_fatal.h"
+#include "sudo_queue.h"
+#include "sudo_util.h"
+#include "log_server.pb-c.h"
+#include "logsrv_util.h"
+
+sudo_dso_public int main(int argc, char *argv[]);
+
+#ifdef HAVE_ZLIB_H
+static int errors = 0, ntests = 0;
+static bool verbose;
+
+/*
+ * Build a wire format message: a 32-bit size in network byte order
+ * followed by size bytes of data that does not compress too well.
+ */
+static uint8_t *
+make_frame(size_t size, unsigned int seed)
+{
+    uint8_t *frame;
+    uint32_t msg_len = htonl((uint32_t)size);
+    size_t i;
+
+    if ((frame = malloc(size + sizeof(msg_len))) == NULL)
+	sudo_fatalx("%s: %s", __func__, "unable to allocate memory");
+    memcpy(frame, &msg_len, sizeof(msg_len));
+    for (i = 0; i < size; i++) {
+	seed = seed * 1103515245 + 12345;
+	frame[sizeof(msg_len) + i] = (uint8_t)(seed >> 16);
+    }
+    return frame;
+}
+
+/*
+ * Compress len bytes of wire format data as one compressed message
+ * and pass it to the decompressor.
+ */
+static bool
+send_compressed(struct msg_deflate *zout, struct msg_inflate *zin,
+    const uint8_t *data, size_t len)
+{
+    ClientMessage zmsg = CLIENT_MESSAGE__INIT;
+
+    if (!msg_deflate_wire(zout, data, len, &zmsg))
+	return false;
+    return msg_inflate(zin, zmsg.u.compressed.data, zmsg.u.compressed.len);
+}
+
+/*
+ * Check that the next decompressed message matches frame.
+ */
+static void
+expect_frame(const char *name, struct msg_inflate *zin, const uint8_t *frame,
+    size_t size)
+{
+    uint8_t *msg = NULL;
+    size_t msg_len = 0;
+    int n;
+
+    ntests++;
+    n = msg_inflate_next(zin, &msg, &msg_len);
+    if (n != 1) {
+	sudo_warnx("%s: expected a %zu byte message, got %d (size %zu)",
+	    name, size, n, msg_len);
+	errors++;
+    } else if (msg_len != size ||
+	    memcmp(msg, frame + sizeof(uint32_t), size) != 0) {
+	sudo_warnx("%s: message does not match (size %zu, expected %zu)",
+	    name, msg_len, size);
+	errors++;
+    } else if (verbose) {
+	printf("%s: %zu byte message OK\n", name, size);
+    }
+}
+
+/*
+ * Check that no complete message is pending.
+ */
+static void
+expect_none(const char *name, struct msg_inflate *zin)
+{
+    uint8_t *msg;
+    size_t msg_len;
+    int n;
+
+    ntests++;
+    n = msg_inflate_next(zin, &msg, &msg_len);
+    if (n != 0) {
+	sudo_warnx("%s: expected no message, got %d (size %zu)",
+	    name, n, msg_len);
+	errors++;
+    }
+}
+
+static void
+expect_bool(const char *name, bool result, bool expected)
+{
+    ntests++;
+    if (result != expected) {
+	sudo_warnx("%s: expected %s, got %s", name,
+	    expected ? "success" : "failure", result ? "success" : "failure");
+	errors++;
+    } else if (verbose) {
+	printf("%s: %s as expected\n", name, result ? "success" : "failure");
+    }
+}
+
+/*
+ * Whole messages of various sizes, each in its own compressed message,
+ * all in a single stream.
+ */
+static void
+test_roundtrip(void)
+{
+    const size_t sizes[] = { 0, 1, 100, 64 * 1024, 300000 };
+    struct msg_deflate *zout = msg_deflate_alloc();
+    struct msg_inflate *zin = msg_inflate_alloc();
+    size_t i;
+
+    if (zout == NULL || zin == NULL)
+	sudo_fatalx("unable to allocate zlib streams");
+
+    for (i = 0; i < nitems(sizes); i++) {
+	uint8_t *frame = make_frame(sizes[i], (unsigned int)i);
+
+	expect_bool("roundtrip", send_compressed(zout, zin, frame,
+	    sizes[i] + sizeof(uint32_t)), true);
+	expect_frame("roundtrip", zin, frame, sizes[i]);
+	expect_none("roundtrip", zin);
+	free(frame);
+    }
+
+    msg_deflate_free(zout);
+    msg_inflate_free(zin);
+}
+
+/*
+ * A message split across several compressed messages is only returned
+ * once the last piece arrives, along with the message that follows it.
+ */
+static void
+test_split(void)
+{
+    struct msg_deflate *zout = msg_deflate_alloc();
+    struct msg_inflate *zin = msg_inflate_alloc();
+    const size_t size = 200000, chunk = 50000, small = 10;
+    uint8_t *frame, *next, *tail;
+    size_t off, len;
+
+    if (zout == NULL || zin == NULL)
+	sudo_fatalx("unable to allocate zlib streams");
+    frame = make_frame(size, 100);
+    next = make_frame(small, 101);
+
+    /* The first piece holds the size and a single byte of data. */
+    off = sizeof(uint32_t) + 1;
+    expect_bool("split", send_compressed(zout, zin, frame, off), true);
+    expect_none("split", zin);
+    while (size + sizeof(uint32_t) - off > chunk) {
+	expect_bool("split", send_compressed(zout, zin, frame + off, chunk),
+	    true);
+	expect_none("split", zin);
+	off += chunk;
+    }
+
+    /* The last piece also contains the next message. */
+    len = size + sizeof(uint32_t) - off;
+    if ((tail = malloc(len + small + sizeof(uint32_t))) == NULL)
+	sudo_fatalx("%s: %s", __func__, "unable to allocate memory");
+    memcpy(tail, frame + off, len);
+    memcpy(tail + len, next, small + sizeof(uint32_t));
+    expect_bool("split", send_compressed(zout, zin, tail,
+	len + small + sizeof(uint32_t)), true);
+    expect_frame("split", zin, frame, size);
+    expect_frame("split", zin, next, small);
+    expect_none("split", zin);
+
+    free(tail);
+    free(next);
+    free(frame);
+    msg_deflate_free(zout);
+    msg_inflate_free(zin);
+}
+
+/*
+ * The size limit excludes the 32-bit size on both the compressing
+ * and decompressing side.
+ */
+static void
+test_size_limit(void)
+{
+    struct msg_deflate *zout = msg_deflate_alloc();
+    struct msg_inflate *zin = msg_inflate_alloc();
+    ClientMessage zmsg = CLIENT_MESSAGE__INIT;
+    uint8_t *frame, *msg;
+    size_t half, msg_len = 0;
+    int n;
+
+    if (zout == NULL || zin == NULL)
+	sudo_fatalx("unable to allocate zlib streams");
+
+    /* A message of the maximum size is accepted. */
+    frame = make_frame(MESSAGE_SIZE_MAX, 200);
+    expect_bool("max size", send_compressed(zout, zin, frame,
+	MESSAGE_SIZE_MAX + sizeof(uint32_t)), true);
+    expect_frame("max size", zin, frame, MESSAGE_SIZE_MAX);
+    expect_none("max size", zin);
+    free(frame);
+
+    /* One byte more cannot be compressed as a single message. */
+    frame = make_frame(MESSAGE_SIZE_MAX + 1, 201);
+    expect_bool("max size + 1", msg_deflate_wire(zout, frame,
+	MESSAGE_SIZE_MAX + 1 + sizeof(uint32_t), &zmsg),
+	false);
+
+    /* Sent in two pieces, it is rejected when decompressed. */
+    half = (MESSAGE_SIZE_MAX + 1 + sizeof(uint32_t)) / 2;
+    expect_bool("max size + 1 split", send_compressed(zout, zin, frame,
+	half), true);
+    ntests++;
+    n = msg_inflate_next(zin, &msg, &msg_len);
+    if (n != -1 || msg_len != MESSAGE_SIZE_MAX + 1) {
+	sudo_warnx("max size + 1 split: expected -1 (size %zu), "
+	    "got %d (size %zu)", (size_t)MESSAGE_SIZE_MAX + 1, n, msg_len);
+	errors++;
+    }
+    free(frame);
+
+    msg_deflate_free(zout);
+    msg_inflate_free(zin);
+}
+
+/*
+ * Pending decompressed data is bounded when messages are not consumed.
+ */
+static void
+test_inflate_limit(void)
+{
+    struct msg_deflate *zout = msg_deflate_alloc();
+    struct msg_inflate *zin = msg_inflate_alloc();
+    uint8_t *frame, *small;
+
+    if (zout == NULL || zin == NULL)
+	sudo_fatalx("unable to allocate zlib streams");
+    frame = make_frame(MESSAGE_SIZE_MAX, 300);
+    small = make_frame(200, 301);
+
+    /* Just under two messages of the maximum size may be pending. */
+    expect_bool("inflate limit", send_compressed(zout, zin, frame,
+	MESSAGE_SIZE_MAX + sizeof(uint32_t)), true);
+    expect_bool("inflate limit", send_compressed(zout, zin, frame,
+	MESSAGE_SIZE_MAX - 100 + sizeof(uint32_t)), true);
+    expect_bool("inflate limit", send_compressed(zout, zin, small,
+	200 + sizeof(uint32_t)), false);
+
+    free(small);
+    free(frame);
+    msg_deflate_free(zout);
+    msg_inflate_free(zin);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int ch;
+
+    initprogname(argc > 0 ? argv[0] : "compress_test");
+
+    while ((ch = getopt(argc, argv, "v")) != -1) {
+	switch (ch) {
+	case 'v':
+	    verbose = true;
+	    break;
+	default:
+	    fprintf(stderr, "usage: %s [-v]\n", getprogname());
+	    return EXIT_FAILURE;
+	}
+    }
+
+    test_roundtrip();
+    test_split();
+    test_size_limit();
+    test_inflate_limit();
+
+    if (ntests != 0) {
+	printf("%s: %d tests run, %d errors, %d%% success rate\n",
+	    getprogname(), ntests, errors, (ntests - errors) * 100 / ntests);
+    }
+    return errors;
+}
+#else
+int
+main(int argc, char *argv[])
+{
+    return EXIT_SUCCESS;
+}
+#endif /* HAVE_ZLIB_H */
@@ -0,0 +1,483 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define SUDO_ERROR_WRAP 0
+
+#include "iolog_writer.c"
+
+sudo_dso_public int main(int argc, char *argv[]);
+
+/* Number of commit points in the test log and records between them. */
+#define NCHECKPOINTS	8
+#define NRECORDS	16
+
+/* The ttyin file is created at this commit point and written after it. */
+#define TTYIN_CHECKPOINT	3
+
+/* Data appended after resuming. */
+#define APPENDED	"appended after restart\n"
+
+static char tdir[] = "iolog_resume.XXXXXXXX";
+static int errors = 0, ntests = 0;
+static bool verbose;
+
+/*
+ * Expected contents of each I/O log file and its length
+ * (uncompressed) at each commit point.
+ */
+static struct expected_file {
+    char *data;
+    size_t len;
+    size_t size;
+    size_t checkpoint_len[NCHECKPOINTS];
+} expected[IOFD_MAX];
+static struct timespec checkpoint_time[NCHECKPOINTS];
+
+/*
+ * Stubs for the parts of sudo_logsrvd the I/O log code depends on.
+ */
+const char *
+logsrvd_conf_iolog_dir(void)
+{
+    return tdir;
+}
+
+const char *
+logsrvd_conf_iolog_file(void)
+{
+    return "%{seq}";
+}
+
+bool
+logsrvd_conf_iolog_log_passwords(void)
+{
+    return true;
+}
+
+void *
+logsrvd_conf_iolog_passprompt_regex(void)
+{
+    return NULL;
+}
+
+bool
+schedule_error_message(const char *errstr, struct connection_closure *closure)
+{
+    return true;
+}
+
+void
+connection_close(struct connection_closure *closure)
+{
+    return;
+}
+
+/*
+ * Append len bytes of data to the expected contents of iofd.
+ */
+static void
+expected_append(int iofd, const char *data, size_t len)
+{
+    struct expected_file *ef = &expected[iofd];
+
+    if (ef->len + len > ef->size) {
+	ef->size = sudo_pow2_roundup((unsigned int)(ef->len + len));
+	if ((ef->data = realloc(ef->data, ef->size)) == NULL)
+	    sudo_fatalx("%s: %s", __func__, "unable to allocate memory");
+    }
+    memcpy(ef->data + ef->len, data, len);
+    ef->len += len;
+}
+
+/*
+ * Write data to the I/O log file for iofd as sudo_logsrvd would.
+ */
+static void
+write_iolog(struct connection_closure *closure, int iofd, const char *data,
+    size_t len)
+{
+    const char *errstr;
+
+    if (iolog_write(&closure->iolog_files[iofd], data, len, &errstr) == -1)
+	sudo_fatalx("%s/%s: %s", closure->evlog->iolog_path,
+	    iolog_fd_to_name(iofd), errstr);
+    closure->iolog_wbufs[iofd].dirty = true;
+    expected_append(iofd, data, len);
+}
+
+/*
+ * Write a record to iofd and the matching timing file entry.
+ */
+static void
+write_record(struct connection_closure *closure, int iofd, int n)
+{
+    char buf[64];
+    int len;
+
+    len = snprintf(buf, sizeof(buf), "%s record %d\n",
+	iolog_fd_to_name(iofd), n);
+    write_iolog(closure, iofd, buf, (size_t)len);
+    len = snprintf(buf, sizeof(buf), "%d 0.001000 %d\n", iofd, len);
+    write_iolog(closure, IOFD_TIMING, buf, (size_t)len);
+    closure->elapsed_time.tv_nsec += 1000000;
+    if (closure->elapsed_time.tv_nsec >= 1000000000) {
+	closure->elapsed_time.tv_sec++;
+	closure->elapsed_time.tv_nsec -= 1000000000;
+    }
+}
+
+/*
+ * Initialize closure for the I/O log in dir, as store_restart_local() does.
+ */
+static void
+closure_init(struct connection_closure *closure, const char *dir)
+{
+    memset(closure, 0, sizeof(*closure));
+    closure->iolog_index_fd = -1;
+    if ((closure->evlog = calloc(1, sizeof(*closure->evlog))) == NULL)
+	sudo_fatalx("%s: %s", __func__, "unable to allocate memory");
+    if ((closure->evlog->iolog_path = strdup(dir)) == NULL)
+	sudo_fatalx("%s: %s", __func__, "unable to allocate memory");
+    closure->iolog_dir_fd = iolog_openat(AT_FDCWD, dir, O_RDONLY);
+    if (closure->iolog_dir_fd == -1)
+	sudo_fatal("%s", dir);
+}
+
+static void
+closure_free(struct connection_closure *closure)
+{
+    iolog_close_all(closure);
+    eventlog_free(closure->evlog);
+    memset(closure, 0, sizeof(*closure));
+}
+
+/*
+ * Write an I/O log with NCHECKPOINTS commit points, followed by
+ * records that were never committed.
+ */
+static void
+write_log(const char *dir)
+{
+    struct connection_closure closure;
+    int c, i, n = 0;
+
+    for (i = 0; i < IOFD_MAX; i++)
+	expected[i].len = 0;
+    if (mkdir(dir, S_IRWXU) == -1)
+	sudo_fatal("%s", dir);
+    closure_init(&closure, dir);
+    iolog_index_create(&closure);
+    if (!iolog_create(IOFD_TIMING, &closure) ||
+	    !iolog_create(IOFD_STDOUT, &closure))
+	sudo_fatal("%s", dir);
+
+    for (c = 0; c < NCHECKPOINTS; c++) {
+	if (c == TTYIN_CHECKPOINT) {
+	    if (!iolog_create(IOFD_TTYIN, &closure))
+		sudo_fatal("%s", dir);
+	}
+	for (i = 0; i < NRECORDS; i++) {
+	    write_record(&closure, IOFD_STDOUT, n++);
+	    if (c > TTYIN_CHECKPOINT && i % 4 == 0)
+		write_record(&closure, IOFD_TTYIN, n++);
+	}
+	if (!iolog_checkpoint_all(&closure))
+	    sudo_fatalx("%s: unable to checkpoint", dir);
+	checkpoint_time[c] = closure.elapsed_time;
+	for (i = 0; i < IOFD_MAX; i++)
+	    expected[i].checkpoint_len[c] = expected[i].len;
+    }
+    for (i = 0; i < NRECORDS; i++)
+	write_record(&closure, IOFD_STDOUT, n++);
+
+    closure_free(&closure);
+}
+
+/*
+ * Return the size of the file for iofd in dir or -1 if it doesn't exist.
+ */
+static off_t
+file_size(const char *dir, int iofd)
+{
+    char path[PATH_MAX];
+    struct stat sb;
+    int len;
+
+    len = snprintf(path, sizeof(path), "%s/%s", dir, iolog_fd_to_name(iofd));
+    if (len < 0 || len >= ssizeof(path)) {
+	errno = ENAMETOOLONG;
+	sudo_fatal("%s/%s", dir, iolog_fd_to_name(iofd));
+    }
+    if (stat(path, &sb) == -1)
+	return -1;
+    return sb.st_size;
+}
+
+/*
+ * Read back the file for iofd in dir and compare it to the expected
+ * contents up to len, followed by the data appended after resuming.
+ */
+static bool
+verify_file(const char *name, const char *dir, int iofd, size_t len)
+{
+    struct iolog_file iol = { true };
+    size_t nread = 0, explen = len + sizeof(APPENDED) - 1;
+    const char *errstr;
+    char *buf;
+    ssize_t nr;
+    bool ret = false;
+    int dfd;
+
+    if ((buf = malloc(explen + 1)) == NULL)
+	sudo_fatalx("%s: %s", __func__, "unable to allocate memory");
+    if ((dfd = iolog_openat(AT_FDCWD, dir, O_RDONLY)) == -1)
+	sudo_fatal("%s", dir);
+    if (!iolog_open(&iol, dfd, iofd, "r")) {
+	sudo_warn("%s: unable to open %s/%s", name, dir,
+	    iolog_fd_to_name(iofd));
+	goto done;
+    }
+    for (;;) {
+	nr = iolog_read(&iol, buf + nread, explen + 1 - nread, &errstr);
+	if (nr <= 0)
+	    break;
+	nread += (size_t)nr;
+	if (nread > explen)
+	    break;
+    }
+    if (nr == -1) {
+	sudo_warnx("%s: %s/%s: %s", name, dir, iolog_fd_to_name(iofd),
+	    errstr);
+    } else if (nread != explen || memcmp(buf, expected[iofd].data, len) != 0 ||
+	    memcmp(buf + len, APPENDED, sizeof(APPENDED) - 1) != 0) {
+	sudo_warnx("%s: %s/%s: contents mismatch, read %zu bytes, "
+	    "expected %zu", name, dir, iolog_fd_to_name(iofd), nread, explen);
+    } else {
+	ret = true;
+    }
+    iolog_close(&iol, &errstr);
+done:
+    close(dfd);
+    free(buf);
+    return ret;
+}
+
+/*
+ * Resume the I/O log in dir at target.  If checkpoint is not -1, the
+ * resume must succeed and leave the log as it was at that commit point,
+ * ready to be appended to.  Otherwise, it must fail without changing
+ * the log.
+ */
+static void
+resume_test(const char *name, const char *dir, struct timespec *target,
+    int checkpoint)
+{
+    struct connection_closure closure;
+    bool enabled[IOFD_MAX];
+    off_t sizes[IOFD_MAX];
+    bool ok;
+    int i;
+
+    if (verbose) {
+	printf("%s: resume %s at [%lld, %ld]\n", name, dir,
+	    (long long)target->tv_sec, target->tv_nsec);
+    }
+
+    for (i = 0; i < IOFD_MAX; i++)
+	sizes[i] = file_size(dir, i);
+    closure_init(&closure, dir);
+
+    ntests++;
+    ok = iolog_resume(target, &closure);
+    if (checkpoint == -1) {
+	if (ok) {
+	    sudo_warnx("%s: resume succeeded unexpectedly", name);
+	    errors++;
+	} else {
+	    for (i = 0; i < IOFD_MAX; i++) {
+		if (closure.iolog_files[i].enabled) {
+		    sudo_warnx("%s: %s left open after failed resume", name,
+			iolog_fd_to_name(i));
+		    errors++;
+		    break;
+		}
+		if (file_size(dir, i) != sizes[i]) {
+		    sudo_warnx("%s: %s modified by failed resume", name,
+			iolog_fd_to_name(i));
+		    errors++;
+		    break;
+		}
+	    }
+	}
+	closure_free(&closure);
+	return;
+    }
+    if (!ok) {
+	sudo_warnx("%s: unable to resume at [%lld, %ld]", name,
+	    (long long)target->tv_sec, target->tv_nsec);
+	errors++;
+	closure_free(&closure);
+	return;
+    }
+
+    /* The files must be truncated at the commit point. */
+    ntests++;
+    for (i = 0; i < IOFD_MAX; i++) {
+	const bool present = expected[i].checkpoint_len[checkpoint] != 0 ||
+	    (i == IOFD_TTYIN && checkpoint >= TTYIN_CHECKPOINT);
+
+	if (closure.iolog_files[i].enabled != present ||
+		(file_size(dir, i) == -1) == present) {
+	    sudo_warnx("%s: %s should%s exist", name, iolog_fd_to_name(i),
+		present ? "" : " not");
+	    errors++;
+	    break;
+	}
+	if (present && file_size(dir, i) != closure.iolog_wbufs[i].checkpoint) {
+	    sudo_warnx("%s: %s not truncated at the commit point", name,
+		iolog_fd_to_name(i));
+	    errors++;
+	    break;
+	}
+    }
+    ntests++;
+    if (sudo_timespeccmp(&closure.elapsed_time, target, !=)) {
+	sudo_warnx("%s: elapsed time not restored", name);
+	errors++;
+    }
+
+    /* Append to the resumed log and make sure it reads back correctly. */
+    for (i = 0; i < IOFD_MAX; i++) {
+	enabled[i] = closure.iolog_files[i].enabled;
+	if (enabled[i]) {
+	    expected[i].len = expected[i].checkpoint_len[checkpoint];
+	    write_iolog(&closure, i, APPENDED, sizeof(APPENDED) - 1);
+	}
+    }
+    closure_free(&closure);
+    for (i = 0; i < IOFD_MAX; i++) {
+	if (enabled[i]) {
+	    ntests++;
+	    if (!verify_file(name, dir, i,
+		    expected[i].checkpoint_len[checkpoint]))
+		errors++;
+	}
+    }
+}
+
+/*
+ * Exercise iolog_resume() using compressed and uncompressed I/O logs.
+ */
+int
+main(int argc, char *argv[])
+{
+    struct timespec target;
+    char dir[PATH_MAX], path[PATH_MAX], cmd[1024];
+    int ch, i, len, n = 0;
+    bool compress;
+
+    initprogname(argc > 0 ? argv[0] : "iolog_resume_test");
+
+    while ((ch = getopt(argc, argv, "v")) != -1) {
+	switch (ch) {
+	case 'v':
+	    verbose = true;
+	    break;
+	default:
+	    fprintf(stderr, "usage: %s [-v]\n", getprogname());
+	    return EXIT_FAILURE;
+	}
+    }
+    argc -= optind;
+    argv += optind;
+
+    if (mkdtemp(tdir) == NULL)
+	sudo_fatal("%s", tdir);
+
+#ifdef HAVE_ZLIB_H
+    for (i = 0; i < 2; i++) {
+	compress = i != 0;
+#else
+    for (i = 0; i < 1; i++) {
+	compress = false;
+#endif
+	iolog_set_compress(compress);
+
+	/* Resume at a commit point, discarding uncommitted records. */
+	len = snprintf(dir, sizeof(dir), "%s/%d", tdir, n++);
+	if (len < 0 || len >= ssizeof(dir))
+	    sudo_fatalx("%s/%d: %s", tdir, n, strerror(ENAMETOOLONG));
+	write_log(dir);
+	resume_test(compress ? "gzip exact" : "exact", dir,
+	    &checkpoint_time[NCHECKPOINTS - 2], NCHECKPOINTS - 2);
+
+	/* Resume before the ttyin file was written to. */
+	len = snprintf(dir, sizeof(dir), "%s/%d", tdir, n++);
+	if (len < 0 || len >= ssizeof(dir))
+	    sudo_fatalx("%s/%d: %s", tdir, n, strerror(ENAMETOOLONG));
+	write_log(dir);
+	resume_test(compress ? "gzip early" : "early", dir,
+	    &checkpoint_time[1], 1);
+
+	/* A target that is not a commit point must not change the log. */
+	len = snprintf(dir, sizeof(dir), "%s/%d", tdir, n++);
+	if (len < 0 || len >= ssizeof(dir))
+	    sudo_fatalx("%s/%d: %s", tdir, n, strerror(ENAMETOOLONG));
+	write_log(dir);
+	target = checkpoint_time[NCHECKPOINTS / 2];
+	target.tv_nsec++;
+	resume_test(compress ? "gzip no match" : "no match", dir, &target, -1);
+	target = checkpoint_time[NCHECKPOINTS - 1];
+	target.tv_sec++;
+	resume_test(compress ? "gzip beyond" : "beyond", dir, &target, -1);
+
+	/* A file shorter than the index says is stale. */
+	len = snprintf(path, sizeof(path), "%s/%s", dir,
+	    iolog_fd_to_name(IOFD_TTYIN));
+	if (len < 0 || len >= ssizeof(path))
+	    sudo_fatalx("%s/%s: %s", dir, iolog_fd_to_name(IOFD_TTYIN),
+		strerror(ENAMETOOLONG));
+	if (truncate(path, file_size(dir, IOFD_TTYIN) / 2) == -1)
+	    sudo_fatal("%s", path);
+	resume_test(compress ? "gzip stale" : "stale", dir,
+	    &checkpoint_time[NCHECKPOINTS - 1], -1);
+
+	/* A file that cannot be opened must not leave others truncated. */
+	if (unlink(path) == -1 || mkdir(path, S_IRWXU) == -1)
+	    sudo_fatal("%s", path);
+	resume_test(compress ? "gzip unopenable" : "unopenable", dir,
+	    &checkpoint_time[TTYIN_CHECKPOINT], -1);
+    }
+
+    /* Cleanup */
+    len = snprintf(cmd, sizeof(cmd), "rm -rf \"%s\"", tdir);
+    if (len < 0 || len >= ssizeof(cmd)) {
+	errno = ENAMETOOLONG;
+	sudo_fatalx("rm -rf %s", tdir);
+    }
+    ignore_result(system(cmd));
+
+    for (i = 0; i < IOFD_MAX; i++)
+	free(expected[i].data);
+
+    if (ntests != 0) {
+	printf("%s: %d tests run, %d errors, %d%% success rate\n",
+	    getprogname(), ntests, errors, (ntests - errors) * 100 / ntests);
+    }
+    return errors;
+}
@@ -0,0 +1,911 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define SUDO_ERROR_WRAP 0
+
+#include "logsrvd_journal.c"
+
+#include <sys/wait.h>
+
+sudo_dso_public int main(int argc, char *argv[]);
+
+/* Number of I/O records in the test journal and the size of each. */
+#define NRECORDS	1024
+#define RECORD_SIZE	1000
+
+static char relay_dir[] = "journal_test.XXXXXXXX";
+static int errors = 0, ntests = 0;
+static bool verbose;
+
+/* State for the journal tail tests. */
+static struct sudo_event_base *evbase;
+static int nclosures, nresumed;
+static bool relay_ok;
+
+/* Journal offset and elapsed time after each I/O record. */
+static struct journal_point {
+    off_t offset;
+    struct timespec elapsed;
+} points[NRECORDS];
+
+/*
+ * Stubs for the parts of sudo_logsrvd the journal code depends on.
+ */
+const char *
+logsrvd_conf_relay_dir(void)
+{
+    return relay_dir;
+}
+
+uid_t
+logsrvd_conf_iolog_uid(void)
+{
+    return (uid_t)-1;
+}
+
+gid_t
+logsrvd_conf_iolog_gid(void)
+{
+    return (gid_t)-1;
+}
+
+mode_t
+logsrvd_conf_iolog_mode(void)
+{
+    return S_IRUSR|S_IWUSR;
+}
+
+struct timespec *
+logsrvd_conf_server_timeout(void)
+{
+    return NULL;
+}
+
+bool
+logsrvd_conf_relay_store_first_tail(void)
+{
+    return false;
+}
+
+bool
+fmt_log_id_message(const char *id, struct connection_closure *closure)
+{
+    return true;
+}
+
+static void
+tail_read_cb(int fd, int what, void *v)
+{
+    return;
+}
+
+struct connection_closure *
+connection_closure_alloc(int fd, bool tls, bool relay_only,
+    struct sudo_event_base *base)
+{
+    struct connection_closure *closure;
+
+    if ((closure = calloc(1, sizeof(*closure))) == NULL)
+	return NULL;
+    closure->evbase = base;
+    closure->read_ev = sudo_ev_alloc(fd, SUDO_EV_READ|SUDO_EV_PERSIST,
+	tail_read_cb, closure);
+    if (closure->read_ev == NULL) {
+	free(closure);
+	return NULL;
+    }
+    nclosures++;
+    return closure;
+}
+
+bool
+connect_relay(struct connection_closure *closure)
+{
+    return relay_ok;
+}
+
+/*
+ * Free a closure the way connection_closure_free() does as far
+ * as the journal is concerned.
+ */
+void
+connection_close(struct connection_closure *closure)
+{
+    if (closure->journal_tail != NULL || closure->journal_writer != NULL)
+	journal_tail_detach(closure);
+    sudo_ev_free(closure->read_ev);
+    journal_index_close(closure, false);
+    if (closure->journal != NULL)
+	fclose(closure->journal);
+    free(closure->journal_path);
+    free(closure->relay_log_id);
+    free(closure);
+    nclosures--;
+}
+
+bool
+relay_resume(struct connection_closure *closure)
+{
+    nresumed++;
+    closure->state = RUNNING;
+    return true;
+}
+
+void
+update_elapsed_time(TimeSpec *delta, struct timespec *elapsed)
+{
+    elapsed->tv_sec += delta->tv_sec;
+    elapsed->tv_nsec += delta->tv_nsec;
+    while (elapsed->tv_nsec >= 1000000000) {
+	elapsed->tv_sec++;
+	elapsed->tv_nsec -= 1000000000;
+    }
+}
+
+/*
+ * Pack a ClientMessage into a newly-allocated buffer.
+ */
+static uint8_t *
+pack_message(ClientMessage *msg, size_t *lenp)
+{
+    uint8_t *buf;
+
+    *lenp = client_message__get_packed_size(msg);
+    if ((buf = malloc(*lenp)) == NULL)
+	sudo_fatalx("%s: %s", __func__, "unable to allocate memory");
+    client_message__pack(msg, buf);
+    return buf;
+}
+
+/*
+ * Release the journal and index held by closure.
+ */
+static void
+closure_reset(struct connection_closure *closure)
+{
+    journal_index_close(closure, false);
+    if (closure->journal != NULL)
+	fclose(closure->journal);
+    free(closure->journal_path);
+    memset(closure, 0, sizeof(*closure));
+}
+
+/*
+ * Write a journal consisting of an AcceptMessage followed by NRECORDS
+ * I/O buffers, recording the offset and elapsed time after each one.
+ * Returns the journal name relative to the incoming directory.
+ */
+static char *
+build_journal(void)
+{
+    ClientMessage client_msg = CLIENT_MESSAGE__INIT;
+    AcceptMessage accept_msg = ACCEPT_MESSAGE__INIT;
+    IoBuffer iobuf_msg = IO_BUFFER__INIT;
+    TimeSpec ts = TIME_SPEC__INIT;
+    struct connection_closure closure;
+    uint8_t data[RECORD_SIZE], *buf;
+    char *cp, *log_id;
+    size_t len;
+    int i;
+
+    memset(&closure, 0, sizeof(closure));
+    if (!journal_create(&closure))
+	sudo_fatalx("unable to create journal");
+
+    accept_msg.submit_time = &ts;
+    accept_msg.expect_iobufs = true;
+    client_msg.type_case = CLIENT_MESSAGE__TYPE_ACCEPT_MSG;
+    client_msg.u.accept_msg = &accept_msg;
+    buf = pack_message(&client_msg, &len);
+    if (!journal_write(buf, len, &closure))
+	sudo_fatalx("unable to write journal");
+    free(buf);
+
+    memset(data, 'x', sizeof(data));
+    iobuf_msg.delay = &ts;
+    iobuf_msg.data.data = data;
+    client_msg.type_case = CLIENT_MESSAGE__TYPE_TTYOUT_BUF;
+    client_msg.u.ttyout_buf = &iobuf_msg;
+    for (i = 0; i < NRECORDS; i++) {
+	/* Vary the record size and delay. */
+	ts.tv_sec = i % 3;
+	ts.tv_nsec = (i * 7919) % 1000000000;
+	iobuf_msg.data.len = RECORD_SIZE - (size_t)(i % 64);
+	buf = pack_message(&client_msg, &len);
+	if (!journal_iobuf(IOFD_TTYOUT, &iobuf_msg, buf, len, &closure))
+	    sudo_fatalx("unable to write journal");
+	free(buf);
+	points[i].offset = closure.journal_offset;
+	points[i].elapsed = closure.elapsed_time;
+    }
+    if (!journal_flush(&closure, false))
+	sudo_fatalx("unable to write journal");
+
+    cp = strrchr(closure.journal_path, '/');
+    if ((log_id = strdup(cp + 1)) == NULL)
+	sudo_fatalx("%s: %s", __func__, "unable to allocate memory");
+    closure_reset(&closure);
+
+    return log_id;
+}
+
+/*
+ * Fill in path with the journal or index path for log_id.
+ */
+static void
+journal_test_path(const char *log_id, const char *suffix, char *path,
+    size_t pathlen)
+{
+    int len;
+
+    len = snprintf(path, pathlen, "%s/incoming/%s%s", relay_dir, log_id,
+	suffix);
+    if (len < 0 || (size_t)len >= pathlen) {
+	errno = ENAMETOOLONG;
+	sudo_fatal("%s/incoming/%s%s", relay_dir, log_id, suffix);
+    }
+}
+
+/*
+ * Return the number of entries in the restart index for log_id.
+ */
+static long
+index_entries(const char *log_id)
+{
+    char path[PATH_MAX];
+    struct stat sb;
+
+    journal_test_path(log_id, JOURNAL_INDEX_SUFFIX, path, sizeof(path));
+    if (stat(path, &sb) == -1)
+	return -1;
+    return (long)((sb.st_size - (off_t)sizeof(struct journal_index_header)) /
+	(off_t)sizeof(struct journal_index_entry));
+}
+
+/*
+ * Read the n'th entry in the restart index for log_id.
+ */
+static void
+index_read(const char *log_id, long n, struct journal_index_entry *entry)
+{
+    char path[PATH_MAX];
+    int fd;
+
+    journal_test_path(log_id, JOURNAL_INDEX_SUFFIX, path, sizeof(path));
+    if ((fd = open(path, O_RDONLY)) == -1)
+	sudo_fatal("%s", path);
+    if (pread(fd, entry, sizeof(*entry),
+	    (off_t)sizeof(struct journal_index_header) +
+	    (off_t)n * (off_t)sizeof(*entry)) != ssizeof(*entry))
+	sudo_fatal("%s", path);
+    close(fd);
+}
+
+/*
+ * Overwrite the n'th entry in the restart index for log_id.
+ */
+static void
+index_write(const char *log_id, long n, struct journal_index_entry *entry)
+{
+    char path[PATH_MAX];
+    int fd;
+
+    journal_test_path(log_id, JOURNAL_INDEX_SUFFIX, path, sizeof(path));
+    if ((fd = open(path, O_WRONLY)) == -1)
+	sudo_fatal("%s", path);
+    if (pwrite(fd, entry, sizeof(*entry),
+	    (off_t)sizeof(struct journal_index_header) +
+	    (off_t)n * (off_t)sizeof(*entry)) != ssizeof(*entry))
+	sudo_fatal("%s", path);
+    close(fd);
+}
+
+/*
+ * Return the index of the I/O record whose offset is offset or -1.
+ */
+static int
+find_point(off_t offset)
+{
+    int i;
+
+    for (i = 0; i < NRECORDS; i++) {
+	if (points[i].offset == offset)
+	    return i;
+    }
+    return -1;
+}
+
+/*
+ * Restart the journal for log_id at target.  If expected is not -1,
+ * the restart must succeed and leave the journal truncated after the
+ * I/O record at index expected, with the index no longer than the
+ * journal.  Otherwise, the restart must fail and leave the journal as-is.
+ */
+static void
+restart_test(const char *name, const char *log_id, struct timespec *target,
+    int expected)
+{
+    RestartMessage restart_msg = RESTART_MESSAGE__INIT;
+    TimeSpec ts = TIME_SPEC__INIT;
+    struct connection_closure closure;
+    struct journal_index_entry entry;
+    char path[PATH_MAX];
+    struct stat sb;
+    off_t size;
+    long n;
+    bool ok;
+
+    journal_test_path(log_id, "", path, sizeof(path));
+    if (stat(path, &sb) == -1)
+	sudo_fatal("%s", path);
+    size = sb.st_size;
+
+    ts.tv_sec = target->tv_sec;
+    ts.tv_nsec = (int32_t)target->tv_nsec;
+    restart_msg.log_id = (char *)log_id;
+    restart_msg.resume_point = &ts;
+
+    if (verbose) {
+	printf("%s: restart at [%lld, %ld]\n", name,
+	    (long long)target->tv_sec, target->tv_nsec);
+    }
+
+    ntests++;
+    memset(&closure, 0, sizeof(closure));
+    ok = journal_restart(&restart_msg, NULL, 0, &closure);
+    if (expected == -1) {
+	if (ok) {
+	    sudo_warnx("%s: restart succeeded unexpectedly", name);
+	    errors++;
+	} else if (stat(path, &sb) == -1 || sb.st_size != size) {
+	    sudo_warnx("%s: journal modified by failed restart", name);
+	    errors++;
+	}
+	closure_reset(&closure);
+	return;
+    }
+    if (!ok) {
+	sudo_warnx("%s: unable to restart at [%lld, %ld]", name,
+	    (long long)target->tv_sec, target->tv_nsec);
+	errors++;
+	closure_reset(&closure);
+	return;
+    }
+
+    /* Check the resume point and the truncated journal. */
+    ntests++;
+    if (closure.journal_offset != points[expected].offset ||
+	    sudo_timespeccmp(&closure.elapsed_time, target, !=)) {
+	sudo_warnx("%s: resumed at offset %lld, expected %lld", name,
+	    (long long)closure.journal_offset,
+	    (long long)points[expected].offset);
+	errors++;
+    }
+    ntests++;
+    if (fstat(fileno(closure.journal), &sb) == -1 ||
+	    sb.st_size != points[expected].offset ||
+	    ftello(closure.journal) != points[expected].offset) {
+	sudo_warnx("%s: journal not truncated at offset %lld", name,
+	    (long long)points[expected].offset);
+	errors++;
+    }
+
+    /* Index entries past the resume point must have been discarded. */
+    ntests++;
+    if (closure.journal_index != NULL && fflush(closure.journal_index) != 0) {
+	sudo_warn("%s: unable to flush index", name);
+	errors++;
+    } else {
+	n = index_entries(log_id);
+	if (n > 0) {
+	    index_read(log_id, n - 1, &entry);
+	    if (entry.offset > points[expected].offset ||
+		    find_point((off_t)entry.offset) == -1) {
+		sudo_warnx("%s: stale index entry at offset %lld", name,
+		    (long long)entry.offset);
+		errors++;
+	    }
+	}
+    }
+    closure_reset(&closure);
+}
+
+/*
+ * Returns true if another process is unable to lock the file at path.
+ */
+static bool
+journal_locked(const char *path)
+{
+    int fd, status;
+    pid_t pid;
+
+    switch (pid = fork()) {
+    case -1:
+	sudo_fatal("fork");
+    case 0:
+	if ((fd = open(path, O_RDWR)) == -1)
+	    _exit(2);
+	_exit(sudo_lock_file(fd, SUDO_TLOCK) ? 1 : 0);
+    }
+    if (waitpid(pid, &status, 0) == -1)
+	sudo_fatal("waitpid");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) == 2)
+	sudo_fatalx("unable to check lock on %s", path);
+    return WEXITSTATUS(status) == 0;
+}
+
+/*
+ * Returns true if the upstream relay state for journal_path exists.
+ */
+static bool
+relay_state_exists(const char *journal_path)
+{
+    char path[PATH_MAX];
+    struct stat sb;
+
+    if (!journal_sidecar_path(journal_path, JOURNAL_RELAY_SUFFIX, path,
+	    sizeof(path)))
+	sudo_fatalx("path too long: %s", journal_path);
+    return stat(path, &sb) == 0;
+}
+
+static void
+check(const char *name, const char *what, bool ok)
+{
+    ntests++;
+    if (!ok) {
+	sudo_warnx("%s: %s", name, what);
+	errors++;
+    } else if (verbose) {
+	printf("%s: %s OK\n", name, what);
+    }
+}
+
+/*
+ * Create a journal with an AcceptMessage and start a tail for it.
+ */
+static struct connection_closure *
+writer_start(void)
+{
+    ClientMessage client_msg = CLIENT_MESSAGE__INIT;
+    AcceptMessage accept_msg = ACCEPT_MESSAGE__INIT;
+    TimeSpec ts = TIME_SPEC__INIT;
+    struct connection_closure *writer;
+    uint8_t *buf;
+    size_t len;
+
+    if ((writer = calloc(1, sizeof(*writer))) == NULL)
+	sudo_fatalx("%s: %s", __func__, "unable to allocate memory");
+    writer->evbase = evbase;
+    nclosures++;
+    if (!journal_create(writer))
+	sudo_fatalx("unable to create journal");
+
+    accept_msg.submit_time = &ts;
+    accept_msg.expect_iobufs = true;
+    client_msg.type_case = CLIENT_MESSAGE__TYPE_ACCEPT_MSG;
+    client_msg.u.accept_msg = &accept_msg;
+    buf = pack_message(&client_msg, &len);
+    if (!journal_write(buf, len, writer))
+	sudo_fatalx("unable to write journal");
+    free(buf);
+
+    journal_tail_start(writer);
+    return writer;
+}
+
+/*
+ * Write count I/O records, each 1us after the previous one, to the
+ * journal and flush them out, which wakes up the tail.
+ */
+static void
+writer_records(struct connection_closure *writer, int count)
+{
+    ClientMessage client_msg = CLIENT_MESSAGE__INIT;
+    IoBuffer iobuf_msg = IO_BUFFER__INIT;
+    TimeSpec ts = TIME_SPEC__INIT;
+    uint8_t data[100], *buf;
+    size_t len;
+    int i;
+
+    memset(data, 'y', sizeof(data));
+    ts.tv_nsec = 1000;
+    iobuf_msg.delay = &ts;
+    iobuf_msg.data.data = data;
+    iobuf_msg.data.len = sizeof(data);
+    client_msg.type_case = CLIENT_MESSAGE__TYPE_TTYOUT_BUF;
+    client_msg.u.ttyout_buf = &iobuf_msg;
+    for (i = 0; i < count; i++) {
+	buf = pack_message(&client_msg, &len);
+	if (!journal_iobuf(IOFD_TTYOUT, &iobuf_msg, buf, len, writer))
+	    sudo_fatalx("unable to write journal");
+	free(buf);
+    }
+    if (!journal_flush(writer, false))
+	sudo_fatalx("unable to write journal");
+}
+
+/*
+ * Read from the journal descriptor until EOF, like client_msg_cb().
+ * Returns the number of bytes read.
+ */
+static off_t
+tail_read(struct connection_closure *tail)
+{
+    char buf[4096];
+    off_t total = 0;
+    ssize_t nread;
+
+    while ((nread = read(fileno(tail->journal), buf, sizeof(buf))) > 0)
+	total += nread;
+    if (nread == -1)
+	sudo_fatal("%s", tail->journal_path);
+    return total;
+}
+
+/*
+ * A tail that loses its relay connection in the middle of a session.
+ * The writer keeps its lock and the relay of the complete journal
+ * restarts the relay host's session from the tail's last commit point.
+ */
+static void
+tail_test_detach(void)
+{
+    const char *name = "tail detach";
+    struct connection_closure *writer, *tail, *relay;
+    struct timespec commit = { 0, 5000 };
+    TimeSpec ts = TIME_SPEC__INIT;
+    off_t nread, resume_offset;
+
+    relay_ok = true;
+    writer = writer_start();
+    tail = writer->journal_tail;
+    check(name, "tail started", tail != NULL && tail->journal_writer == writer);
+    if (tail == NULL)
+	return;
+    check(name, "journal locked", journal_locked(writer->journal_path));
+
+    /* Catch up with the writer, then wait for more. */
+    nread = tail_read(tail);
+    check(name, "read AcceptMessage", nread == writer->journal_offset);
+    check(name, "caught up", journal_tail_wait(tail) && tail->tail_waiting);
+    writer_records(writer, 5);
+    check(name, "woken by flush", !tail->tail_waiting);
+    nread += tail_read(tail);
+    check(name, "read records", nread == writer->journal_offset);
+    check(name, "caught up again", journal_tail_wait(tail));
+    resume_offset = writer->journal_offset;
+
+    /* The relay host sends a log ID and commits the first five records. */
+    journal_relay_update("relayhost/upstream", NULL, tail);
+    ts.tv_sec = commit.tv_sec;
+    ts.tv_nsec = (int32_t)commit.tv_nsec;
+    journal_relay_update(NULL, &ts, tail);
+    check(name, "relay state stored", relay_state_exists(writer->journal_path));
+    writer_records(writer, 5);
+
+    /* Relay connection fails, the writer must keep its lock. */
+    connection_close(tail);
+    check(name, "tail detached", writer->journal_tail == NULL);
+    check(name, "journal still locked", journal_locked(writer->journal_path));
+
+    /* The relay state moves to the outgoing directory with the journal. */
+    writer_records(writer, 5);
+    if (!journal_finish(writer))
+	sudo_fatalx("unable to finish journal");
+    check(name, "relay state moved", relay_state_exists(writer->journal_path) &&
+	strstr(writer->journal_path, "/outgoing/") != NULL);
+
+    /* Relay the complete journal, as connection_close() does. */
+    if ((relay = calloc(1, sizeof(*relay))) == NULL)
+	sudo_fatalx("%s: %s", __func__, "unable to allocate memory");
+    nclosures++;
+    relay->journal = writer->journal;
+    writer->journal = NULL;
+    relay->journal_path = writer->journal_path;
+    writer->journal_path = NULL;
+    nread = writer->journal_offset;
+    connection_close(writer);
+
+    nresumed = 0;
+    check(name, "resume", journal_relay_resume(relay));
+    check(name, "restarted relay host session", nresumed == 1 &&
+	relay->relay_log_id != NULL &&
+	strcmp(relay->relay_log_id, "relayhost/upstream") == 0 &&
+	sudo_timespeccmp(&relay->relay_commit, &commit, ==) &&
+	sudo_timespeccmp(&relay->elapsed_time, &commit, ==));
+    check(name, "resume offset",
+	lseek(fileno(relay->journal), 0, SEEK_CUR) == resume_offset);
+    check(name, "rest of journal", tail_read(relay) == nread - resume_offset);
+
+    /* A commit point that is not in the journal starts over. */
+    ts.tv_nsec = 5500;
+    journal_relay_update(NULL, &ts, relay);
+    nresumed = 0;
+    check(name, "bad resume point", journal_relay_resume(relay) &&
+	nresumed == 0 && relay->relay_log_id == NULL &&
+	!relay_state_exists(relay->journal_path) &&
+	lseek(fileno(relay->journal), 0, SEEK_CUR) == 0);
+
+    unlink(relay->journal_path);
+    connection_close(relay);
+}
+
+/*
+ * The writer finishes the session and hands the journal to its tail.
+ */
+static void
+tail_test_handoff(void)
+{
+    const char *name = "tail handoff";
+    struct connection_closure *writer, *tail;
+    off_t nread;
+
+    relay_ok = true;
+    writer = writer_start();
+    tail = writer->journal_tail;
+    check(name, "tail started", tail != NULL);
+    if (tail == NULL)
+	return;
+    writer_records(writer, 3);
+    nread = tail_read(tail);
+    check(name, "caught up", journal_tail_wait(tail));
+
+    writer_records(writer, 3);
+    if (!journal_finish(writer))
+	sudo_fatalx("unable to finish journal");
+    journal_tail_handoff(writer);
+    check(name, "tail owns journal", tail->journal_writer == NULL &&
+	writer->journal_tail == NULL && writer->journal == NULL &&
+	tail->journal_path != NULL &&
+	strstr(tail->journal_path, "/outgoing/") != NULL);
+    check(name, "tail woken", !tail->tail_waiting);
+    check(name, "journal locked", journal_locked(tail->journal_path));
+    nread += tail_read(tail);
+    check(name, "read whole journal", nread == writer->journal_offset);
+    check(name, "EOF is final", !journal_tail_wait(tail));
+
+    connection_close(writer);
+    unlink(tail->journal_path);
+    connection_close(tail);
+}
+
+/*
+ * The client goes away while the tail is relaying the journal, or the
+ * tail finishes before the writer does.
+ */
+static void
+tail_test_writer_gone(void)
+{
+    const char *name = "writer gone";
+    struct connection_closure *writer, *tail;
+    char path[PATH_MAX];
+
+    relay_ok = true;
+    writer = writer_start();
+    tail = writer->journal_tail;
+    check(name, "tail started", tail != NULL);
+    if (tail == NULL)
+	return;
+    writer_records(writer, 3);
+    if (strlcpy(path, writer->journal_path, sizeof(path)) >= sizeof(path))
+	sudo_fatalx("path too long: %s", writer->journal_path);
+    connection_close(writer);
+    check(name, "tail closed", nclosures == 0);
+    check(name, "journal kept", access(path, F_OK) == 0);
+    check(name, "journal unlocked", !journal_locked(path));
+    unlink(path);
+
+    /* A tail that relayed everything keeps the writer from relaying it. */
+    name = "tail finished";
+    writer = writer_start();
+    tail = writer->journal_tail;
+    check(name, "tail started", tail != NULL);
+    if (tail == NULL)
+	return;
+    tail->state = FINISHED;
+    connection_close(tail);
+    check(name, "journal relayed", writer->journal_relayed);
+    check(name, "journal still locked", journal_locked(writer->journal_path));
+    unlink(writer->journal_path);
+    connection_close(writer);
+}
+
+/*
+ * If the relay connection cannot be started, the writer keeps its lock.
+ */
+static void
+tail_test_no_relay(void)
+{
+    const char *name = "no relay";
+    struct connection_closure *writer;
+
+    relay_ok = false;
+    writer = writer_start();
+    check(name, "no tail", writer->journal_tail == NULL && nclosures == 1);
+    check(name, "journal locked", journal_locked(writer->journal_path));
+    unlink(writer->journal_path);
+    connection_close(writer);
+}
+
+/*
+ * Exercise journal_restart() with and without the restart index
+ * and the journal tail.
+ */
+int
+main(int argc, char *argv[])
+{
+    struct journal_index_entry entry;
+    struct timespec target;
+    char *log_id, path[PATH_MAX], cmd[1024];
+    long n, nentries;
+    int ch, i, len;
+
+    initprogname(argc > 0 ? argv[0] : "journal_test");
+
+    while ((ch = getopt(argc, argv, "v")) != -1) {
+	switch (ch) {
+	case 'v':
+	    verbose = true;
+	    break;
+	default:
+	    fprintf(stderr, "usage: %s [-v]\n", getprogname());
+	    return EXIT_FAILURE;
+	}
+    }
+    argc -= optind;
+    argv += optind;
+
+    if (mkdtemp(relay_dir) == NULL)
+	sudo_fatal("%s", relay_dir);
+
+    /* Relay a journal while it is being written. */
+    if ((evbase = sudo_ev_base_alloc()) == NULL)
+	sudo_fatalx("unable to allocate event base");
+    tail_test_detach();
+    tail_test_handoff();
+    tail_test_writer_gone();
+    tail_test_no_relay();
+    ntests++;
+    if (nclosures != 0) {
+	sudo_warnx("%d connection closures not freed", nclosures);
+	errors++;
+    }
+    sudo_ev_base_free(evbase);
+
+    /* The journal must have several index entries to search. */
+    log_id = build_journal();
+    nentries = index_entries(log_id);
+    ntests++;
+    if (nentries < 8) {
+	sudo_warnx("expected at least 8 index entries, got %ld", nentries);
+	errors++;
+	goto done;
+    }
+
+    /* Every index entry must match a record boundary. */
+    for (n = 0; n < nentries; n++) {
+	ntests++;
+	index_read(log_id, n, &entry);
+	i = find_point((off_t)entry.offset);
+	if (i == -1 || entry.tv_sec != points[i].elapsed.tv_sec ||
+		entry.tv_nsec != points[i].elapsed.tv_nsec) {
+	    sudo_warnx("index entry %ld does not match the journal", n);
+	    errors++;
+	}
+    }
+
+    /* Resume beyond the end of the journal. */
+    target = points[NRECORDS - 1].elapsed;
+    target.tv_sec++;
+    restart_test("beyond end", log_id, &target, -1);
+
+    /* Resume at a time that doesn't match a record. */
+    target = points[NRECORDS / 2].elapsed;
+    target.tv_nsec++;
+    restart_test("no match", log_id, &target, -1);
+
+    /* Resume at the last record, keeping the whole journal. */
+    restart_test("last record", log_id, &points[NRECORDS - 1].elapsed,
+	NRECORDS - 1);
+
+    /* Resume exactly at an indexed point. */
+    index_read(log_id, nentries / 2, &entry);
+    i = find_point((off_t)entry.offset);
+    restart_test("indexed", log_id, &points[i].elapsed, i);
+
+    /* The index is kept up to the entry the search found. */
+    ntests++;
+    n = index_entries(log_id);
+    if (n != nentries / 2) {
+	sudo_warnx("expected %ld index entries after restart, got %ld",
+	    nentries / 2, n);
+	errors++;
+	goto done;
+    }
+
+    /* Resume between indexed points, the index was truncated above. */
+    nentries = n;
+    index_read(log_id, nentries / 2, &entry);
+    i = find_point((off_t)entry.offset) + 1;
+    restart_test("between", log_id, &points[i].elapsed, i);
+
+    /* Resume before the first indexed point. */
+    restart_test("before index", log_id, &points[1].elapsed, 1);
+    free(log_id);
+
+    /* A stale index entry falls back to a linear scan. */
+    log_id = build_journal();
+    nentries = index_entries(log_id);
+    index_read(log_id, nentries / 2, &entry);
+    i = find_point((off_t)entry.offset) + 1;
+    entry.offset -= 2;
+    index_write(log_id, nentries / 2, &entry);
+    restart_test("stale entry", log_id, &points[i].elapsed, i);
+    ntests++;
+    if (index_entries(log_id) != 0) {
+	sudo_warnx("stale index not re-initialized after restart");
+	errors++;
+    }
+    free(log_id);
+
+    /* An index entry past the end of the journal is also stale. */
+    log_id = build_journal();
+    nentries = index_entries(log_id);
+    index_read(log_id, nentries / 2, &entry);
+    i = find_point((off_t)entry.offset) + 1;
+    entry.offset = points[NRECORDS - 1].offset + 1;
+    index_write(log_id, nentries / 2, &entry);
+    restart_test("past end", log_id, &points[i].elapsed, i);
+    free(log_id);
+
+    /* Without an index the journal is scanned from the start. */
+    log_id = build_journal();
+    journal_test_path(log_id, JOURNAL_INDEX_SUFFIX, path, sizeof(path));
+    unlink(path);
+    restart_test("no index", log_id, &points[NRECORDS / 4].elapsed,
+	NRECORDS / 4);
+    ntests++;
+    if (index_entries(log_id) != 0) {
+	sudo_warnx("index not re-initialized after restart");
+	errors++;
+    }
+
+    /* A corrupt index header is ignored. */
+    if (truncate(path, 3) == -1)
+	sudo_fatal("%s", path);
+    restart_test("bad header", log_id, &points[NRECORDS / 8].elapsed,
+	NRECORDS / 8);
+
+done:
+    free(log_id);
+
+    /* Cleanup */
+    len = snprintf(cmd, sizeof(cmd), "rm -rf \"%s\"", relay_dir);
+    if (len < 0 || len >= ssizeof(cmd)) {
+	errno = ENAMETOOLONG;
+	sudo_fatalx("rm -rf %s", relay_dir);
+    }
+    ignore_result(system(cmd));
+
+    if (ntests != 0) {
+	printf("%s: %d tests run, %d errors, %d%% success rate\n",
+	    getprogname(), ntests, errors, (ntests - errors) * 100 / ntests);
+    }
+    return errors;
+}
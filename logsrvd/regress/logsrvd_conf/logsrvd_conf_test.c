@@ -19,6 +19,7 @@
 #include <config.h>
 
 #include <sys/socket.h>
+#include <sys/un.h>
 
 #ifdef HAVE_STDBOOL_H
 # include <stdbool.h>
@@ -0,0 +1,411 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define SUDO_ERROR_WRAP 0
+
+#include "logsrvd_relay.c"
+
+sudo_dso_public int main(int argc, char *argv[]);
+
+/* Maximum number of buffers handed out by get_free_buf() at once. */
+#define MAX_BUFS	8
+
+static struct connection_buffer *bufs_out[MAX_BUFS];
+static bool (* volatile enqueue_write)(uint8_t *, size_t,
+    struct connection_closure *) = relay_enqueue_write;
+static int errors = 0, ntests = 0;
+static bool verbose;
+
+/*
+ * Stubs for the parts of sudo_logsrvd the relay code depends on.
+ */
+void
+address_list_addref(struct server_address_list *al)
+{
+    return;
+}
+
+void
+address_list_delref(struct server_address_list *al)
+{
+    return;
+}
+
+void
+buffer_charge(size_t *buffered, size_t oldsize, size_t newsize)
+{
+    *buffered = *buffered - oldsize + newsize;
+}
+
+bool
+bufpool_get_data(struct connection_buffer *buf, size_t len)
+{
+    return false;
+}
+
+bool
+bufpool_expand_data(struct connection_buffer *buf, size_t needed)
+{
+    return false;
+}
+
+void
+bufpool_put_data(struct connection_buffer *buf)
+{
+    return;
+}
+
+bool
+coalesce_write_bufs(struct connection_buffer_list *write_bufs,
+    size_t *buffered)
+{
+    return true;
+}
+
+void
+connection_close(struct connection_closure *closure)
+{
+    return;
+}
+
+void
+connection_resume_paused(void)
+{
+    return;
+}
+
+bool
+fmt_log_id_message(const char *id, struct connection_closure *closure)
+{
+    return true;
+}
+
+/*
+ * Hand out buffers, remembering them so release_buf() can check
+ * that it is only passed buffers that were handed out.
+ */
+struct connection_buffer *
+get_free_buf(size_t len, size_t *buffered)
+{
+    struct connection_buffer *buf;
+    int i;
+
+    for (i = 0; i < MAX_BUFS; i++) {
+	if (bufs_out[i] == NULL)
+	    break;
+    }
+    if (i == MAX_BUFS)
+	sudo_fatalx("%s: too many buffers", __func__);
+    if ((buf = calloc(1, sizeof(*buf))) == NULL ||
+	    (buf->data = malloc(len)) == NULL)
+	sudo_fatalx("%s: %s", __func__, "unable to allocate memory");
+    buf->size = (unsigned int)len;
+    buffer_charge(buffered, 0, buf->size);
+    bufs_out[i] = buf;
+    return buf;
+}
+
+void
+release_buf(struct connection_buffer *buf, size_t *buffered)
+{
+    int i;
+
+    for (i = 0; i < MAX_BUFS; i++) {
+	if (bufs_out[i] == buf)
+	    break;
+    }
+    if (i == MAX_BUFS) {
+	sudo_warnx("%s: buffer %p was not allocated", __func__, buf);
+	errors++;
+	return;
+    }
+    bufs_out[i] = NULL;
+    buffer_charge(buffered, buf->size, 0);
+    free(buf->data);
+    free(buf);
+}
+
+void
+free_buf_list(struct connection_buffer_list *bufs, size_t *buffered)
+{
+    struct connection_buffer *buf;
+
+    while ((buf = TAILQ_FIRST(bufs)) != NULL) {
+	TAILQ_REMOVE(bufs, buf, entries);
+	release_buf(buf, buffered);
+    }
+}
+
+void
+journal_relay_remove(struct connection_closure *closure)
+{
+    return;
+}
+
+void
+journal_relay_update(const char *log_id, TimeSpec *commit_point,
+    struct connection_closure *closure)
+{
+    return;
+}
+
+char *
+journal_submithost(struct connection_closure *closure)
+{
+    return NULL;
+}
+
+struct server_address_list *
+logsrvd_conf_relay_address(void)
+{
+    return NULL;
+}
+
+enum relay_balance
+logsrvd_conf_relay_balance(void)
+{
+    return RELAY_BALANCE_FAILOVER;
+}
+
+bool
+logsrvd_conf_relay_compress(void)
+{
+    return false;
+}
+
+struct timespec *
+logsrvd_conf_relay_connect_timeout(void)
+{
+    return NULL;
+}
+
+unsigned int
+logsrvd_conf_relay_max_streams(void)
+{
+    return 0;
+}
+
+bool
+logsrvd_conf_relay_multiplex(void)
+{
+    return true;
+}
+
+time_t
+logsrvd_conf_relay_retry_interval(void)
+{
+    return 0;
+}
+
+bool
+logsrvd_conf_relay_tcp_keepalive(void)
+{
+    return false;
+}
+
+struct timespec *
+logsrvd_conf_relay_timeout(void)
+{
+    return NULL;
+}
+
+#if defined(HAVE_OPENSSL)
+bool
+logsrvd_conf_relay_tls_ktls(void)
+{
+    return false;
+}
+
+SSL_CTX *
+logsrvd_relay_tls_ctx(void)
+{
+    return NULL;
+}
+#endif
+
+bool
+schedule_commit_point(TimeSpec *commit_point,
+    struct connection_closure *closure)
+{
+    return true;
+}
+
+bool
+schedule_error_message(const char *errstr, struct connection_closure *closure)
+{
+    return true;
+}
+
+const char *
+server_address_ntop(struct server_address *addr, char *buf, size_t bufsize)
+{
+    return "";
+}
+
+bool
+start_protocol(struct connection_closure *closure)
+{
+    return true;
+}
+
+void
+update_elapsed_time(TimeSpec *delta, struct timespec *elapsed)
+{
+    return;
+}
+
+static void
+relay_test_cb(int fd, int what, void *v)
+{
+    return;
+}
+
+/*
+ * Fill the stack below the caller with non-zero bytes so that
+ * relay_enqueue_write() does not find zeroed locals by chance.
+ */
+static void
+poison_stack(void)
+{
+    volatile uint8_t junk[4096];
+    size_t i;
+
+    for (i = 0; i < sizeof(junk); i++)
+	junk[i] = 0xa5;
+}
+
+/*
+ * Queue a len byte message for the relay on the stream stream_id.
+ * If expected is true, the message must be queued with the stream ID
+ * appended, else it must be rejected without queuing anything.
+ */
+static void
+enqueue_test(const char *name, struct connection_closure *closure,
+    uint32_t stream_id, size_t len, bool expected)
+{
+    struct relay_closure *relay_closure = closure->relay_closure;
+    struct connection_buffer *buf;
+    uint8_t idbuf[6], *msgbuf;
+    size_t idlen = 0;
+    uint32_t msg_len;
+    bool ok;
+
+    if ((msgbuf = calloc(1, len)) == NULL)
+	sudo_fatalx("%s: %s", __func__, "unable to allocate memory");
+    closure->relay_stream_id = stream_id;
+    if (stream_id != 0 || closure->journal != NULL)
+	idlen = pack_stream_id(stream_id, idbuf);
+
+    ntests++;
+    poison_stack();
+    ok = enqueue_write(msgbuf, len, closure);
+    buf = TAILQ_FIRST(&relay_closure->write_bufs);
+    if (ok != expected) {
+	sudo_warnx("%s: %zu byte message %s unexpectedly", name, len,
+	    ok ? "queued" : "rejected");
+	errors++;
+    } else if (!expected) {
+	if (buf != NULL || relay_closure->buffered != 0) {
+	    sudo_warnx("%s: rejected message left %zu bytes buffered", name,
+		relay_closure->buffered);
+	    errors++;
+	} else if (verbose) {
+	    printf("%s: %zu byte message rejected\n", name, len);
+	}
+    } else {
+	memcpy(&msg_len, buf->data, sizeof(msg_len));
+	msg_len = ntohl(msg_len);
+	if (msg_len != len + idlen ||
+		buf->len != sizeof(msg_len) + len + idlen ||
+		memcmp(buf->data + sizeof(msg_len) + len, idbuf, idlen) != 0) {
+	    sudo_warnx("%s: queued message has size %u, expected %zu", name,
+		msg_len, len + idlen);
+	    errors++;
+	} else if (verbose) {
+	    printf("%s: %zu byte message queued as %u bytes\n", name, len,
+		msg_len);
+	}
+    }
+    free_buf_list(&relay_closure->write_bufs, &relay_closure->buffered);
+    free(msgbuf);
+}
+
+/*
+ * Exercise the message size limit in relay_enqueue_write().
+ */
+int
+main(int argc, char *argv[])
+{
+    struct connection_closure closure;
+    struct relay_closure relay_closure;
+    int ch, fds[2];
+
+    initprogname(argc > 0 ? argv[0] : "relay_test");
+
+    while ((ch = getopt(argc, argv, "v")) != -1) {
+	switch (ch) {
+	case 'v':
+	    verbose = true;
+	    break;
+	default:
+	    fprintf(stderr, "usage: %s [-v]\n", getprogname());
+	    return EXIT_FAILURE;
+	}
+    }
+
+    if (pipe(fds) == -1)
+	sudo_fatal("pipe");
+    memset(&relay_closure, 0, sizeof(relay_closure));
+    TAILQ_INIT(&relay_closure.write_bufs);
+    relay_closure.multiplex = true;
+    if ((relay_closure.evbase = sudo_ev_base_alloc()) == NULL)
+	sudo_fatalx("unable to allocate event base");
+    relay_closure.write_ev = sudo_ev_alloc(fds[1], SUDO_EV_WRITE,
+	relay_test_cb, &relay_closure);
+    if (relay_closure.write_ev == NULL)
+	sudo_fatalx("unable to allocate event");
+    memset(&closure, 0, sizeof(closure));
+    closure.relay_closure = &relay_closure;
+
+    /* A multiplexed stream ID counts towards the size limit. */
+    enqueue_test("multiplexed", &closure, 300, MESSAGE_SIZE_MAX - 1, false);
+    enqueue_test("multiplexed", &closure, 300, MESSAGE_SIZE_MAX - 3, true);
+    enqueue_test("multiplexed", &closure, 300, MESSAGE_SIZE_MAX - 2, false);
+    enqueue_test("multiplexed", &closure, 1, MESSAGE_SIZE_MAX - 2, true);
+
+    /* Without a stream ID the whole limit is available. */
+    enqueue_test("dedicated", &closure, 0, MESSAGE_SIZE_MAX, true);
+    enqueue_test("dedicated", &closure, 0, MESSAGE_SIZE_MAX + 1, false);
+
+    /* Journaled messages are always tagged with their stream. */
+    closure.journal = stdin;
+    enqueue_test("journal", &closure, 0, MESSAGE_SIZE_MAX - 1, false);
+    enqueue_test("journal", &closure, 0, MESSAGE_SIZE_MAX - 2, true);
+    closure.journal = NULL;
+
+    sudo_ev_free(relay_closure.write_ev);
+    sudo_ev_base_free(relay_closure.evbase);
+    close(fds[0]);
+    close(fds[1]);
+
+    if (ntests != 0) {
+	printf("%s: %d tests run, %d errors, %d%% success rate\n",
+	    getprogname(), ntests, errors, (ntests - errors) * 100 / ntests);
+    }
+    return errors;
+}
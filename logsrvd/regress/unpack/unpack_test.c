@@ -0,0 +1,727 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+#ifdef HAVE_STDBOOL_H
+# include <stdbool.h>
+#else
+# include "compat/stdbool.h"
+#endif /* HAVE_STDBOOL_H */
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SUDO_ERROR_WRAP 0
+
+#include "sudo_compat.h"
+#include "sudo_conf.h"
+#include "sudo_debug.h"
+#include "sudo_event.h"
+#include "sudo_eventlog.h"
+#include "sudo_fatal.h"
+#include "sudo_iolog.h"
+#include "sudo_queue.h"
+#include "sudo_util.h"
+#include "log_server.pb-c.h"
+#include "protobuf-c/protobuf-c-arena.h"
+
+#include "logsrvd.h"
+
+sudo_dso_public int main(int argc, char *argv[]);
+
+/*
+ * Packed ClientMessages built from a recorded session.
+ */
+struct packed_msg {
+    uint8_t *buf;
+    size_t len;
+};
+static struct packed_msg *corpus;
+static size_t corpus_len, corpus_size;
+
+/* Synthesized I/O buffer contents. */
+static uint8_t *iobuf_data;
+static size_t iobuf_datasize;
+
+/* I/O buffers are also sent in batches of up to this many records. */
+#define BATCH_MAX	8
+static IoRecord batch_records[BATCH_MAX], *batch_ptrs[BATCH_MAX];
+static TimeSpec batch_delays[BATCH_MAX];
+static size_t batch_len;
+
+/* Stream IDs assigned to corpus messages in turn, including multi-byte. */
+static const uint32_t stream_ids[] = { 0, 1, 127, 128, 300, 0xffffffff };
+
+/* Backing allocator that counts calls to malloc(). */
+static size_t nallocs;
+
+static void *
+counting_alloc(void *allocator_data, size_t size)
+{
+    nallocs++;
+    return malloc(size);
+}
+
+static void
+counting_free(void *allocator_data, void *data)
+{
+    free(data);
+}
+
+static ProtobufCAllocator counting_allocator = {
+    counting_alloc, counting_free, NULL
+};
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: %s [-v] [-n iterations] file ...\n",
+	getprogname());
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * Pack msg and append it to the corpus.
+ */
+static void
+add_message(ClientMessage *msg)
+{
+    struct packed_msg *pm;
+
+    if (corpus_len == corpus_size) {
+	corpus_size = corpus_size ? corpus_size * 2 : 1024;
+	corpus = reallocarray(corpus, corpus_size, sizeof(*corpus));
+	if (corpus == NULL)
+	    sudo_fatalx("%s: %s", __func__, "unable to allocate memory");
+    }
+    msg->stream_id = stream_ids[corpus_len % nitems(stream_ids)];
+    pm = &corpus[corpus_len++];
+    pm->len = client_message__get_packed_size(msg);
+    if ((pm->buf = malloc(pm->len)) == NULL)
+	sudo_fatalx("%s: %s", __func__, "unable to allocate memory");
+    client_message__pack(msg, pm->buf);
+}
+
+static void
+set_strval(InfoMessage *info, const char *key, char *value)
+{
+    info->key = (char *)key;
+    info->value_case = INFO_MESSAGE__VALUE_STRVAL;
+    info->u.strval = value ? value : (char *)"unknown";
+}
+
+/*
+ * Build a ClientHello and AcceptMessage from a JSON I/O log info file.
+ */
+static bool
+add_loginfo(const char *path)
+{
+    ClientMessage client_msg = CLIENT_MESSAGE__INIT;
+    ClientHello hello_msg = CLIENT_HELLO__INIT;
+    AcceptMessage accept_msg = ACCEPT_MESSAGE__INIT;
+    TimeSpec ts = TIME_SPEC__INIT;
+    InfoMessage info[10], *info_ptrs[10];
+    InfoMessage__StringList runargv = INFO_MESSAGE__STRING_LIST__INIT;
+    InfoMessage__StringList runenv = INFO_MESSAGE__STRING_LIST__INIT;
+    struct eventlog *evlog;
+    size_t n = 0;
+    FILE *fp;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+	sudo_warn("%s", path);
+	return false;
+    }
+    if ((evlog = calloc(1, sizeof(*evlog))) == NULL)
+	sudo_fatalx("%s: %s", __func__, "unable to allocate memory");
+    evlog->runuid = (uid_t)-1;
+    evlog->rungid = (gid_t)-1;
+    evlog->exit_value = -1;
+    if (!iolog_parse_loginfo_json(fp, path, evlog)) {
+	eventlog_free(evlog);
+	fclose(fp);
+	return false;
+    }
+    fclose(fp);
+
+    hello_msg.client_id = (char *)"unpack_test";
+    client_msg.type_case = CLIENT_MESSAGE__TYPE_HELLO_MSG;
+    client_msg.u.hello_msg = &hello_msg;
+    add_message(&client_msg);
+
+    for (n = 0; n < nitems(info); n++) {
+	info_message__init(&info[n]);
+	info_ptrs[n] = &info[n];
+    }
+    n = 0;
+    set_strval(&info[n++], "command", evlog->command);
+    set_strval(&info[n++], "runcwd", evlog->runcwd);
+    set_strval(&info[n++], "runuser", evlog->runuser);
+    set_strval(&info[n++], "submitcwd", evlog->cwd);
+    set_strval(&info[n++], "submithost", evlog->submithost);
+    set_strval(&info[n++], "submituser", evlog->submituser);
+    set_strval(&info[n++], "ttyname", evlog->ttyname);
+    if (evlog->argv != NULL) {
+	while (evlog->argv[runargv.n_strings] != NULL)
+	    runargv.n_strings++;
+	runargv.strings = evlog->argv;
+	info[n].key = (char *)"runargv";
+	info[n].value_case = INFO_MESSAGE__VALUE_STRLISTVAL;
+	info[n++].u.strlistval = &runargv;
+    }
+    if (evlog->envp != NULL) {
+	while (evlog->envp[runenv.n_strings] != NULL)
+	    runenv.n_strings++;
+	runenv.strings = evlog->envp;
+	info[n].key = (char *)"runenv";
+	info[n].value_case = INFO_MESSAGE__VALUE_STRLISTVAL;
+	info[n++].u.strlistval = &runenv;
+    }
+    info[n].key = (char *)"lines";
+    info[n].value_case = INFO_MESSAGE__VALUE_NUMVAL;
+    info[n++].u.numval = evlog->lines;
+
+    ts.tv_sec = evlog->submit_time.tv_sec;
+    ts.tv_nsec = (int32_t)evlog->submit_time.tv_nsec;
+    accept_msg.submit_time = &ts;
+    accept_msg.expect_iobufs = true;
+    accept_msg.info_msgs = info_ptrs;
+    accept_msg.n_info_msgs = n;
+    client_msg.type_case = CLIENT_MESSAGE__TYPE_ACCEPT_MSG;
+    client_msg.u.accept_msg = &accept_msg;
+    add_message(&client_msg);
+
+    eventlog_free(evlog);
+    return true;
+}
+
+/*
+ * Send the pending I/O records as an IoBufferBatch.
+ */
+static void
+flush_batch(void)
+{
+    ClientMessage client_msg = CLIENT_MESSAGE__INIT;
+    IoBufferBatch batch_msg = IO_BUFFER_BATCH__INIT;
+
+    if (batch_len == 0)
+	return;
+    batch_msg.records = batch_ptrs;
+    batch_msg.n_records = batch_len;
+    client_msg.type_case = CLIENT_MESSAGE__TYPE_IOBUF_BATCH;
+    client_msg.u.iobuf_batch = &batch_msg;
+    add_message(&client_msg);
+    batch_len = 0;
+}
+
+/*
+ * Build I/O buffer, window size and suspend messages from a timing file.
+ * The contents of the I/O buffers are synthesized.
+ */
+static bool
+add_timing(const char *path)
+{
+    ClientMessage client_msg = CLIENT_MESSAGE__INIT;
+    IoBuffer iobuf_msg = IO_BUFFER__INIT;
+    ChangeWindowSize winsize_msg = CHANGE_WINDOW_SIZE__INIT;
+    CommandSuspend suspend_msg = COMMAND_SUSPEND__INIT;
+    TimeSpec ts = TIME_SPEC__INIT;
+    struct timing_closure timing;
+    char *line = NULL;
+    size_t linesize = 0;
+    bool ret = true;
+    FILE *fp;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+	sudo_warn("%s", path);
+	return false;
+    }
+
+    memset(&timing, 0, sizeof(timing));
+    timing.decimal = ".";
+    while (getdelim(&line, &linesize, '\n', fp) != -1) {
+	line[strcspn(line, "\n")] = '\0';
+	if (!iolog_parse_timing(line, &timing)) {
+	    sudo_warnx("%s: invalid timing file line: %s", path, line);
+	    ret = false;
+	    break;
+	}
+	ts.tv_sec = timing.delay.tv_sec;
+	ts.tv_nsec = (int32_t)timing.delay.tv_nsec;
+
+	switch (timing.event) {
+	case IO_EVENT_WINSIZE:
+	    flush_batch();
+	    winsize_msg.delay = &ts;
+	    winsize_msg.rows = timing.u.winsize.lines;
+	    winsize_msg.cols = timing.u.winsize.cols;
+	    client_msg.type_case = CLIENT_MESSAGE__TYPE_WINSIZE_EVENT;
+	    client_msg.u.winsize_event = &winsize_msg;
+	    break;
+	case IO_EVENT_SUSPEND:
+	    flush_batch();
+	    suspend_msg.delay = &ts;
+	    suspend_msg.signal = (char *)"TSTP";
+	    client_msg.type_case = CLIENT_MESSAGE__TYPE_SUSPEND_EVENT;
+	    client_msg.u.suspend_event = &suspend_msg;
+	    break;
+	default:
+	    if (timing.u.nbytes > iobuf_datasize) {
+		/* Pending records point to the old buffer. */
+		flush_batch();
+		free(iobuf_data);
+		iobuf_datasize = timing.u.nbytes;
+		if ((iobuf_data = malloc(iobuf_datasize)) == NULL) {
+		    sudo_fatalx("%s: %s", __func__,
+			"unable to allocate memory");
+		}
+		memset(iobuf_data, 'x', iobuf_datasize);
+	    }
+	    iobuf_msg.delay = &ts;
+	    iobuf_msg.data.data = iobuf_data;
+	    iobuf_msg.data.len = timing.u.nbytes;
+
+	    /* Queue a copy of the record for the next batch. */
+	    io_record__init(&batch_records[batch_len]);
+	    batch_delays[batch_len] = ts;
+	    batch_records[batch_len].iofd = timing.event < IO_EVENT_WINSIZE ?
+		timing.event : IOFD_TTYOUT;
+	    batch_records[batch_len].delay = &batch_delays[batch_len];
+	    batch_records[batch_len].data = iobuf_msg.data;
+	    batch_ptrs[batch_len] = &batch_records[batch_len];
+	    if (++batch_len == BATCH_MAX)
+		flush_batch();
+	    switch (timing.event) {
+	    case IO_EVENT_STDIN:
+		client_msg.type_case = CLIENT_MESSAGE__TYPE_STDIN_BUF;
+		client_msg.u.stdin_buf = &iobuf_msg;
+		break;
+	    case IO_EVENT_STDOUT:
+		client_msg.type_case = CLIENT_MESSAGE__TYPE_STDOUT_BUF;
+		client_msg.u.stdout_buf = &iobuf_msg;
+		break;
+	    case IO_EVENT_STDERR:
+		client_msg.type_case = CLIENT_MESSAGE__TYPE_STDERR_BUF;
+		client_msg.u.stderr_buf = &iobuf_msg;
+		break;
+	    case IO_EVENT_TTYIN:
+		client_msg.type_case = CLIENT_MESSAGE__TYPE_TTYIN_BUF;
+		client_msg.u.ttyin_buf = &iobuf_msg;
+		break;
+	    default:
+		client_msg.type_case = CLIENT_MESSAGE__TYPE_TTYOUT_BUF;
+		client_msg.u.ttyout_buf = &iobuf_msg;
+		break;
+	    }
+	    break;
+	}
+	add_message(&client_msg);
+    }
+    flush_batch();
+    free(line);
+    fclose(fp);
+
+    return ret;
+}
+
+/*
+ * Unpack every message in the corpus using allocator, freeing
+ * via client_message__free_unpacked() or by resetting the arena.
+ * Returns the number of unpack failures.
+ */
+static int
+unpack_corpus(ProtobufCAllocator *allocator, ProtobufCArena *arena)
+{
+    int errors = 0;
+    size_t i;
+
+    for (i = 0; i < corpus_len; i++) {
+	ClientMessage *msg =
+	    client_message__unpack(allocator, corpus[i].len, corpus[i].buf);
+	if (msg == NULL)
+	    errors++;
+	else if (arena == NULL)
+	    client_message__free_unpacked(msg, allocator);
+	if (arena != NULL)
+	    protobuf_c_arena_reset(arena);
+    }
+    return errors;
+}
+
+/*
+ * Verify that messages unpacked using the arena repack to the original.
+ */
+static int
+verify_corpus(ProtobufCArena *arena)
+{
+    uint8_t *buf = NULL;
+    size_t bufsize = 0;
+    int errors = 0;
+    size_t i;
+
+    for (i = 0; i < corpus_len; i++) {
+	ClientMessage *msg = client_message__unpack(&arena->base,
+	    corpus[i].len, corpus[i].buf);
+	if (msg == NULL) {
+	    sudo_warnx("message %zu: unable to unpack", i);
+	    errors++;
+	    continue;
+	}
+	if (client_message__get_packed_size(msg) != corpus[i].len) {
+	    sudo_warnx("message %zu: size mismatch", i);
+	    errors++;
+	} else {
+	    if (corpus[i].len > bufsize) {
+		free(buf);
+		bufsize = corpus[i].len;
+		if ((buf = malloc(bufsize)) == NULL) {
+		    sudo_fatalx("%s: %s", __func__,
+			"unable to allocate memory");
+		}
+	    }
+	    client_message__pack(msg, buf);
+	    if (memcmp(buf, corpus[i].buf, corpus[i].len) != 0) {
+		sudo_warnx("message %zu: contents mismatch", i);
+		errors++;
+	    }
+	}
+	protobuf_c_arena_reset(arena);
+    }
+    free(buf);
+
+    return errors;
+}
+
+/*
+ * Add delay to the running total, as relay_peek_message() does.
+ */
+static void
+add_delay(TimeSpec *total, const TimeSpec *delay)
+{
+    total->tv_sec += delay->tv_sec;
+    total->tv_nsec += delay->tv_nsec;
+    if (total->tv_nsec >= 1000000000) {
+	total->tv_sec++;
+	total->tv_nsec -= 1000000000;
+    }
+}
+
+/*
+ * Check that relay_peek_message() either declines the message or
+ * agrees with client_message__unpack() on the type, stream ID and
+ * total delay.  If relayable is set, the message must be peeked.
+ * Returns the number of errors (0 or 1).
+ */
+static int
+check_peek(const uint8_t *buf, size_t len, bool relayable, const char *what,
+    size_t idx)
+{
+    TimeSpec delay = TIME_SPEC__INIT;
+    struct relay_peek peek;
+    IoBuffer *iobuf = NULL;
+    ClientMessage *msg;
+    int errors = 0;
+    size_t n;
+
+    if (!relay_peek_message(buf, len, &peek)) {
+	if (relayable) {
+	    sudo_warnx("%s message %zu: unable to peek", what, idx);
+	    return 1;
+	}
+	return 0;
+    }
+    msg = client_message__unpack(NULL, len, buf);
+    if (msg == NULL) {
+	sudo_warnx("%s message %zu: peeked but unable to unpack", what, idx);
+	return 1;
+    }
+
+    switch (msg->type_case) {
+    case CLIENT_MESSAGE__TYPE_TTYIN_BUF:
+	iobuf = msg->u.ttyin_buf;
+	break;
+    case CLIENT_MESSAGE__TYPE_TTYOUT_BUF:
+	iobuf = msg->u.ttyout_buf;
+	break;
+    case CLIENT_MESSAGE__TYPE_STDIN_BUF:
+	iobuf = msg->u.stdin_buf;
+	break;
+    case CLIENT_MESSAGE__TYPE_STDOUT_BUF:
+	iobuf = msg->u.stdout_buf;
+	break;
+    case CLIENT_MESSAGE__TYPE_STDERR_BUF:
+	iobuf = msg->u.stderr_buf;
+	break;
+    case CLIENT_MESSAGE__TYPE_IOBUF_BATCH:
+	for (n = 0; n < msg->u.iobuf_batch->n_records; n++) {
+	    IoRecord *rec = msg->u.iobuf_batch->records[n];
+	    if (rec->delay == NULL) {
+		errors = 1;
+		break;
+	    }
+	    add_delay(&delay, rec->delay);
+	}
+	break;
+    default:
+	errors = 1;
+	break;
+    }
+    if (iobuf != NULL) {
+	if (iobuf->delay == NULL)
+	    errors = 1;
+	else
+	    add_delay(&delay, iobuf->delay);
+    }
+
+    if (errors || peek.type_case != (int)msg->type_case ||
+	    peek.stream_id != msg->stream_id ||
+	    peek.delay.tv_sec != delay.tv_sec ||
+	    peek.delay.tv_nsec != delay.tv_nsec) {
+	sudo_warnx("%s message %zu: peeked type %d, stream %u, delay "
+	    "%lld.%09d; unpacked type %d, stream %u, delay %lld.%09d",
+	    what, idx, peek.type_case, peek.stream_id,
+	    (long long)peek.delay.tv_sec, peek.delay.tv_nsec,
+	    (int)msg->type_case, msg->stream_id,
+	    (long long)delay.tv_sec, delay.tv_nsec);
+	errors = 1;
+    }
+    client_message__free_unpacked(msg, NULL);
+
+    return errors;
+}
+
+/*
+ * Hand-crafted messages that single byte mutations are unlikely to produce.
+ */
+static struct peek_case {
+    const char *name;
+    bool relayable;
+    size_t len;
+    const uint8_t buf[32];
+} peek_cases[] = {
+    /* A repeated delay is merged when unpacked. */
+    { "repeated delay", false, 13, {
+	0x4a, 0x0b, 0x0a, 0x02, 0x08, 0x01, 0x0a, 0x02, 0x10, 0x05,
+	0x12, 0x01, 'x' } },
+    /* The last member of the oneof wins when unpacked. */
+    { "repeated type", false, 12, {
+	0x4a, 0x04, 0x0a, 0x02, 0x08, 0x01, 0x52, 0x04, 0x0a, 0x02,
+	0x08, 0x02 } },
+    /* The last stream ID wins. */
+    { "repeated stream_id", true, 10, {
+	0x78, 0x01, 0x4a, 0x04, 0x0a, 0x02, 0x08, 0x01, 0x78, 0x02 } },
+    /* Nanoseconds out of range. */
+    { "tv_nsec too large", false, 10, {
+	0x4a, 0x08, 0x0a, 0x06, 0x10, 0x80, 0x94, 0xeb, 0xdc, 0x03 } },
+    /* Invalid file descriptor in a batch. */
+    { "invalid iofd", false, 9, {
+	0x82, 0x01, 0x06, 0x0a, 0x04, 0x08, 0x07, 0x12, 0x00 } },
+    /* Unknown fields are ignored. */
+    { "unknown fields", true, 13, {
+	0x4a, 0x08, 0x0a, 0x04, 0x08, 0x01, 0x18, 0x09, 0x20, 0x01,
+	0x90, 0x01, 0x00 } }
+};
+
+/*
+ * Peek at every message in the corpus, as well as truncated and
+ * mutated copies of it.  I/O messages in the corpus must be peeked,
+ * the others may be declined.  Returns the number of errors.
+ */
+static int
+peek_corpus(int *ntests)
+{
+    const uint8_t mutations[] = { 0x00, 0x01, 0x7f, 0x80, 0xff };
+    uint8_t *buf = NULL;
+    size_t bufsize = 0;
+    int errors = 0;
+    size_t i, j, off, step;
+
+    for (i = 0; i < corpus_len; i++) {
+	const uint8_t *orig = corpus[i].buf;
+	const size_t len = corpus[i].len;
+	ClientMessage *msg;
+	bool relayable;
+
+	msg = client_message__unpack(NULL, len, orig);
+	if (msg == NULL)
+	    continue;	/* reported by verify_corpus() */
+	switch (msg->type_case) {
+	case CLIENT_MESSAGE__TYPE_TTYIN_BUF:
+	case CLIENT_MESSAGE__TYPE_TTYOUT_BUF:
+	case CLIENT_MESSAGE__TYPE_STDIN_BUF:
+	case CLIENT_MESSAGE__TYPE_STDOUT_BUF:
+	case CLIENT_MESSAGE__TYPE_STDERR_BUF:
+	case CLIENT_MESSAGE__TYPE_IOBUF_BATCH:
+	    relayable = true;
+	    break;
+	default:
+	    relayable = false;
+	    break;
+	}
+	client_message__free_unpacked(msg, NULL);
+
+	(*ntests)++;
+	errors += check_peek(orig, len, relayable, "corpus", i);
+
+	/* Check up to 32 truncation and mutation points per message. */
+	step = len / 32 + 1;
+	for (off = 0; off < len; off += step) {
+	    (*ntests)++;
+	    errors += check_peek(orig, off, false, "truncated", i);
+	}
+
+	if (len > bufsize) {
+	    free(buf);
+	    bufsize = len;
+	    if ((buf = malloc(bufsize)) == NULL)
+		sudo_fatalx("%s: %s", __func__, "unable to allocate memory");
+	}
+	memcpy(buf, orig, len);
+	for (off = 0; off < len; off += step) {
+	    for (j = 0; j < nitems(mutations); j++) {
+		if (orig[off] == mutations[j])
+		    continue;
+		buf[off] = mutations[j];
+		(*ntests)++;
+		errors += check_peek(buf, len, false, "mutated", i);
+	    }
+	    buf[off] = orig[off];
+	}
+    }
+    free(buf);
+
+    for (i = 0; i < nitems(peek_cases); i++) {
+	(*ntests)++;
+	errors += check_peek(peek_cases[i].buf, peek_cases[i].len,
+	    peek_cases[i].relayable, peek_cases[i].name, i);
+    }
+
+    return errors;
+}
+
+static void
+report(const char *name, size_t count, struct timespec *elapsed)
+{
+    double ns = (double)elapsed->tv_sec * 1000000000.0 + elapsed->tv_nsec;
+
+    printf("%-8s %10zu allocs %8.2f allocs/msg %10.1f ns/msg\n", name,
+	nallocs, (double)nallocs / count, ns / count);
+}
+
+/*
+ * Unpack a recorded session using the default allocator and an arena.
+ * Arguments are JSON log files and timing files.
+ * With -v, the number of allocations and the time per message is shown.
+ */
+int
+main(int argc, char *argv[])
+{
+    struct timespec start, stop, elapsed;
+    ProtobufCArena arena;
+    int ch, errors = 0, ntests = 0;
+    unsigned int iterations = 1, n;
+    const char *errstr;
+    bool verbose = false;
+    size_t i;
+
+    initprogname(argc > 0 ? argv[0] : "unpack_test");
+
+    while ((ch = getopt(argc, argv, "n:v")) != -1) {
+	switch (ch) {
+	case 'n':
+	    iterations = sudo_strtonum(optarg, 1, UINT_MAX, &errstr);
+	    if (errstr != NULL)
+		sudo_fatalx("iterations %s: %s", optarg, errstr);
+	    break;
+	case 'v':
+	    verbose = true;
+	    break;
+	default:
+	    usage();
+	}
+    }
+    argc -= optind;
+    argv += optind;
+
+    if (argc < 1)
+	usage();
+
+    for (ch = 0; ch < argc; ch++) {
+	const char *path = argv[ch];
+	size_t len = strlen(path);
+	bool ok;
+
+	if (len > 5 && strcmp(path + len - 5, ".json") == 0)
+	    ok = add_loginfo(path);
+	else
+	    ok = add_timing(path);
+	if (!ok)
+	    errors++;
+	ntests++;
+    }
+    if (corpus_len == 0)
+	sudo_fatalx("no messages to unpack");
+
+    /* Arena blocks are allocated via the counting allocator too. */
+    protobuf_c_arena_init(&arena, 0, &counting_allocator);
+    ntests += (int)corpus_len;
+    errors += verify_corpus(&arena);
+    errors += peek_corpus(&ntests);
+
+    if (verbose) {
+	printf("%zu messages, %u iteration%s\n", corpus_len, iterations,
+	    iterations == 1 ? "" : "s");
+
+	nallocs = 0;
+	sudo_gettime_mono(&start);
+	for (n = 0; n < iterations; n++)
+	    errors += unpack_corpus(&counting_allocator, NULL);
+	sudo_gettime_mono(&stop);
+	sudo_timespecsub(&stop, &start, &elapsed);
+	report("default", corpus_len * iterations, &elapsed);
+
+	/* Start with an empty arena so the block allocations are counted. */
+	protobuf_c_arena_destroy(&arena);
+	nallocs = 0;
+	sudo_gettime_mono(&start);
+	for (n = 0; n < iterations; n++)
+	    errors += unpack_corpus(&arena.base, &arena);
+	sudo_gettime_mono(&stop);
+	sudo_timespecsub(&stop, &start, &elapsed);
+	report("arena", corpus_len * iterations, &elapsed);
+    }
+    protobuf_c_arena_destroy(&arena);
+
+    for (i = 0; i < corpus_len; i++)
+	free(corpus[i].buf);
+    free(corpus);
+    free(iobuf_data);
+
+    printf("%s: %d tests run, %d errors, %d%% success rate\n",
+	getprogname(), ntests, errors, (ntests - errors) * 100 / ntests);
+
+    return errors;
+}
@@ -26,7 +26,9 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
@@ -67,10 +69,12 @@
 #include "sudo_fatal.h"
 #include "sudo_gettext.h"
 #include "sudo_iolog.h"
+#include "sudo_rand.h"
 #include "sudo_util.h"
 
 #include "sendlog.h"
 #include "hostcheck.h"
+#include "protobuf-c/protobuf-c-arena.h"
 
 #if defined(HAVE_OPENSSL)
 # define TLS_HANDSHAKE_TIMEO_SEC 10
@@ -82,8 +86,37 @@ static struct connection_list connections = TAILQ_HEAD_INITIALIZER(connections);
 static struct peer_info server_info = { "localhost" };
 static char *iolog_dir;
 static bool testrun = false;
+static bool use_compression = false;
 static int nr_of_conns = 1;
 static int finished_transmissions = 0;
+static unsigned long long bytes_sent = 0;
+static unsigned long long messages_sent = 0;
+
+/* Synthetic load test (-L option). */
+static bool load_test = false;
+static struct load_params load_params;
+static struct sudo_event *load_ev;
+static struct eventlog *load_evlog;
+static const char *load_port;
+static struct timespec load_delay;
+static unsigned int load_started, load_active;
+static unsigned int load_completed, load_failed, load_restarts;
+static unsigned int load_conn_failures;
+static unsigned long long load_records;
+
+/*
+ * Commit point latency histogram in microseconds.  Values below
+ * 2^LATENCY_SUB_BITS are exact, larger values are grouped into
+ * 2^LATENCY_SUB_BITS buckets per power of two (about 6% precision).
+ */
+#define LATENCY_SUB_BITS	4
+#define LATENCY_BUCKETS		(64 << LATENCY_SUB_BITS)
+static unsigned long long latency_hist[LATENCY_BUCKETS];
+static unsigned long long latency_count;
+static unsigned long long latency_max;
+
+/* Server messages are unpacked one at a time using a reusable arena. */
+static ProtobufCArena server_msg_arena;
 
 #if defined(HAVE_OPENSSL)
 static SSL_CTX *ssl_ctx = NULL;
@@ -91,23 +124,26 @@ static const char *ca_bundle = NULL;
 static const char *cert = NULL;
 static const char *key = NULL;
 static bool verify_server = true;
+static bool use_ktls = false;
 #endif
 
 /* Server callback may redirect to client callback for TLS. */
 static void client_msg_cb(int fd, int what, void *v);
 static void server_msg_cb(int fd, int what, void *v);
+static void load_session_done(struct client_closure *closure);
 
 static void
 usage(bool fatal)
 {
 #if defined(HAVE_OPENSSL)
-    fprintf(stderr, "usage: %s [-AnV] [-b ca_bundle] [-c cert_file] [-h host] "
-	"[-i iolog-id] [-k key_file] [-p port] "
+    fprintf(stderr, "usage: %s [-AKnVz] [-b ca_bundle] [-c cert_file] [-h host] "
+	"[-i iolog-id] [-k key_file] [-L load-spec] [-p port] "
 #else
-    fprintf(stderr, "usage: %s [-AnV] [-h host] [-i iolog-id] [-p port] "
+    fprintf(stderr, "usage: %s [-AnVz] [-h host] [-i iolog-id] [-L load-spec] "
+	"[-p port] "
 #endif
-	"[-r restart-point] [-R reject-reason] [-s stop-point] [-t number] /path/to/iolog\n",
-        getprogname());
+	"[-r restart-point] [-R reject-reason] [-s stop-point] [-t number] "
+	"/path/to/iolog\n", getprogname());
     if (fatal)
 	exit(EXIT_FAILURE);
 }
@@ -136,9 +172,13 @@ help(void)
 #if defined(HAVE_OPENSSL)
     printf("  -k, --key             %s\n",
 	_("private key file"));
+    printf("  -K, --ktls            %s\n",
+	_("use kernel TLS offload if supported"));
     printf("  -n, --no-verify       %s\n",
 	_("do not verify server certificate"));
 #endif
+    printf("  -L, --load            %s\n",
+	_("run a load test with synthetic sessions"));
     printf("  -p, --port            %s\n",
 	_("port to use when connecting to host"));
     printf("  -r, --restart         %s\n",
@@ -151,6 +191,8 @@ help(void)
 	_("test audit server by sending selected I/O log n times in parallel"));
     printf("  -V, --version         %s\n",
 	_("display version information and exit"));
+    printf("  -z, --compress        %s\n",
+	_("compress messages sent to the server if supported"));
     putchar('\n');
     exit(EXIT_SUCCESS);
 }
@@ -160,6 +202,41 @@ help(void)
  * If host has multiple addresses, the first one that connects is used.
  * Returns open socket or -1 on error.
  */
+static int
+connect_server_local(struct peer_info *server)
+{
+    struct sockaddr_un sa_un;
+    int flags, sock;
+    debug_decl(connect_server_local, SUDO_DEBUG_UTIL);
+
+    memset(&sa_un, 0, sizeof(sa_un));
+    sa_un.sun_family = AF_UNIX;
+    if (strlcpy(sa_un.sun_path, server->name, sizeof(sa_un.sun_path)) >=
+	    sizeof(sa_un.sun_path)) {
+	errno = ENAMETOOLONG;
+	sudo_warn("%s", server->name);
+	debug_return_int(-1);
+    }
+    if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+	sudo_warn("socket");
+	debug_return_int(-1);
+    }
+    if (connect(sock, (struct sockaddr *)&sa_un, sizeof(sa_un)) == -1) {
+	sudo_warn("%s", server->name);
+	close(sock);
+	debug_return_int(-1);
+    }
+    flags = fcntl(sock, F_GETFL, 0);
+    if (flags == -1 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) == -1) {
+	sudo_warn("fcntl(O_NONBLOCK)");
+	close(sock);
+	debug_return_int(-1);
+    }
+    (void)strlcpy(server->ipaddr, "local", sizeof(server->ipaddr));
+
+    debug_return_int(sock);
+}
+
 static int
 connect_server(struct peer_info *server, const char *port)
 {
@@ -320,12 +397,23 @@ read_io_buf(struct client_closure *closure)
 static bool
 fmt_client_message(struct client_closure *closure, ClientMessage *msg)
 {
+#ifdef HAVE_ZLIB_H
+    ClientMessage zmsg = CLIENT_MESSAGE__INIT;
+#endif
     struct connection_buffer *buf = NULL;
     uint32_t msg_len;
     bool ret = false;
     size_t len;
     debug_decl(fmt_client_message, SUDO_DEBUG_UTIL);
 
+#ifdef HAVE_ZLIB_H
+    if (closure->deflate != NULL) {
+	if (!msg_deflate(closure->deflate, msg, &zmsg))
+	    goto done;
+	msg = &zmsg;
+    }
+#endif
+
     len = client_message__get_packed_size(msg);
     if (len > MESSAGE_SIZE_MAX) {
     	sudo_warnx(U_("client message too large: %zu"), len);
@@ -335,8 +423,9 @@ fmt_client_message(struct client_closure *closure, ClientMessage *msg)
     msg_len = htonl((uint32_t)len);
     len += sizeof(msg_len);
 
+    /* Append to the last queued buffer if there is room to preserve order. */
     if (!TAILQ_EMPTY(&closure->write_bufs)) {
-	buf = TAILQ_FIRST(&closure->write_bufs);
+	buf = TAILQ_LAST(&closure->write_bufs, connection_buffer_list);
 	if (len > buf->size - buf->len) {
 	    /* Too small. */
 	    buf = NULL;
@@ -353,6 +442,7 @@ fmt_client_message(struct client_closure *closure, ClientMessage *msg)
     memcpy(buf->data + buf->len, &msg_len, sizeof(msg_len));
     client_message__pack(msg, buf->data + buf->len + sizeof(msg_len));
     buf->len += len;
+    messages_sent++;
 
     ret = true;
 
@@ -370,6 +460,10 @@ fmt_client_hello(struct client_closure *closure)
 
     sudo_debug_printf(SUDO_DEBUG_INFO, "%s: sending ClientHello", __func__);
     hello_msg.client_id = (char *)"Sudo Sendlog " PACKAGE_VERSION;
+    hello_msg.iobuf_batch = true;
+#ifdef HAVE_ZLIB_H
+    hello_msg.compression = use_compression;
+#endif
 
     /* Schedule ClientMessage */
     client_msg.u.hello_msg = &hello_msg;
@@ -805,7 +899,12 @@ fmt_exit_message(struct client_closure *closure)
 
     if (evlog->exit_value != -1)
 	exit_msg.exit_value = evlog->exit_value;
-    if (sudo_timespecisset(&evlog->run_time)) {
+    if (closure->load != NULL) {
+	/* A synthetic session runs for as long as its I/O. */
+	run_time.tv_sec = closure->elapsed.tv_sec;
+	run_time.tv_nsec = closure->elapsed.tv_nsec;
+	exit_msg.run_time = &run_time;
+    } else if (sudo_timespecisset(&evlog->run_time)) {
 	run_time.tv_sec = evlog->run_time.tv_sec;
 	run_time.tv_nsec = evlog->run_time.tv_nsec;
 	exit_msg.run_time = &run_time;
@@ -839,8 +938,123 @@ done:
     debug_return_bool(ret);
 }
 
+/*
+ * Build and format an IoBufferBatch wrapped in a ClientMessage from
+ * the I/O buffers collected in closure->batch, if any.
+ * Stores the wire format message in the closure's write buffer list.
+ * Returns true on success, false on failure.
+ */
+static bool
+fmt_io_batch(struct client_closure *closure)
+{
+    ClientMessage client_msg = CLIENT_MESSAGE__INIT;
+    IoBufferBatch batch_msg = IO_BUFFER_BATCH__INIT;
+    struct iobuf_batch *batch = &closure->batch;
+    uint8_t *data = batch->data;
+    bool ret;
+    size_t n;
+    debug_decl(fmt_io_batch, SUDO_DEBUG_UTIL);
+
+    if (batch->nrecords == 0)
+	debug_return_bool(true);
+
+    /* The arrays may have moved as the batch grew, fill in pointers now. */
+    for (n = 0; n < batch->nrecords; n++) {
+	batch->records[n].delay = &batch->delays[n];
+	batch->records[n].data.data = data;
+	data += batch->records[n].data.len;
+	batch->recordp[n] = &batch->records[n];
+    }
+    batch_msg.records = batch->recordp;
+    batch_msg.n_records = batch->nrecords;
+
+    sudo_debug_printf(SUDO_DEBUG_INFO,
+	"%s: sending IoBufferBatch with %zu records, length %zu", __func__,
+	batch->nrecords, batch->len);
+
+    /* Send ClientMessage */
+    client_msg.u.iobuf_batch = &batch_msg;
+    client_msg.type_case = CLIENT_MESSAGE__TYPE_IOBUF_BATCH;
+    ret = fmt_client_message(closure, &client_msg);
+
+    batch->nrecords = 0;
+    batch->len = 0;
+
+    debug_return_bool(ret);
+}
+
+/*
+ * Add the I/O buffer in closure->buf to the pending IoBufferBatch.
+ * The batch is formatted once it holds IOBUF_BATCH_SIZE bytes.
+ * Returns true on success, false on failure.
+ */
+static bool
+add_io_batch(int iofd, struct client_closure *closure)
+{
+    struct iobuf_batch *batch = &closure->batch;
+    const size_t nbytes = closure->timing.u.nbytes;
+    TimeSpec *delay;
+    IoRecord *record;
+    void *ptr;
+    debug_decl(add_io_batch, SUDO_DEBUG_UTIL);
+
+    if (batch->nrecords == batch->maxrecords) {
+	const size_t new_max = batch->maxrecords ? batch->maxrecords * 2 : 64;
+
+	ptr = reallocarray(batch->records, new_max, sizeof(*batch->records));
+	if (ptr == NULL)
+	    goto oom;
+	batch->records = ptr;
+	ptr = reallocarray(batch->recordp, new_max, sizeof(*batch->recordp));
+	if (ptr == NULL)
+	    goto oom;
+	batch->recordp = ptr;
+	ptr = reallocarray(batch->delays, new_max, sizeof(*batch->delays));
+	if (ptr == NULL)
+	    goto oom;
+	batch->delays = ptr;
+	batch->maxrecords = new_max;
+    }
+
+    if (nbytes > batch->size - batch->len) {
+	const size_t new_size = sudo_pow2_roundup(batch->len + nbytes);
+	if (new_size < batch->len + nbytes) {
+	    /* overflow */
+	    errno = ENOMEM;
+	    goto oom;
+	}
+	if ((ptr = realloc(batch->data, new_size)) == NULL)
+	    goto oom;
+	batch->data = ptr;
+	batch->size = new_size;
+    }
+    if (nbytes != 0) {
+	memcpy(batch->data + batch->len, closure->buf, nbytes);
+	batch->len += nbytes;
+    }
+
+    /* Pointers are filled in by fmt_io_batch(). */
+    delay = &batch->delays[batch->nrecords];
+    time_spec__init(delay);
+    delay->tv_sec = closure->timing.delay.tv_sec;
+    delay->tv_nsec = closure->timing.delay.tv_nsec;
+    record = &batch->records[batch->nrecords];
+    io_record__init(record);
+    record->iofd = iofd;
+    record->data.len = nbytes;
+    batch->nrecords++;
+
+    if (batch->len >= IOBUF_BATCH_SIZE)
+	debug_return_bool(fmt_io_batch(closure));
+    debug_return_bool(true);
+oom:
+    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+    debug_return_bool(false);
+}
+
 /*
  * Build and format an IoBuffer wrapped in a ClientMessage.
+ * If the server supports it, the buffer is added to a batch instead.
  * Stores the wire format message in the closure's write buffer list.
  * Returns true on success, false on failure.
  */
@@ -853,8 +1067,15 @@ fmt_io_buf(int type, struct client_closure *closure)
     bool ret = false;
     debug_decl(fmt_io_buf, SUDO_DEBUG_UTIL);
 
-    if (!read_io_buf(closure))
+    /* Synthetic sessions send the data already in closure->buf. */
+    if (closure->load == NULL && !read_io_buf(closure))
+	goto done;
+
+    /* IO_EVENT_* matches IOFD_* for I/O buffers. */
+    if (closure->iobuf_batch) {
+	ret = add_io_batch(closure->timing.event, closure);
 	goto done;
+    }
 
     /* Fill in IoBuffer. */
     /* TODO: split buffer if it is too large */
@@ -964,6 +1185,7 @@ static bool
 fmt_next_iolog(struct client_closure *closure)
 {
     struct timing_closure *timing = &closure->timing;
+    struct connection_buffer *buf;
     bool ret = false;
     debug_decl(fmt_next_iolog, SUDO_DEBUG_UTIL);
 
@@ -977,6 +1199,8 @@ fmt_next_iolog(struct client_closure *closure)
 	case 1:
 	    /* no more IO buffers */
 	    closure->state = SEND_EXIT;
+	    if (!fmt_io_batch(closure))
+		debug_return_bool(false);
 	    debug_return_bool(fmt_exit_message(closure));
 	case -1:
 	default:
@@ -1020,26 +1244,233 @@ fmt_next_iolog(struct client_closure *closure)
 	    ret = fmt_io_buf(CLIENT_MESSAGE__TYPE_TTYOUT_BUF, closure);
 	    break;
 	case IO_EVENT_WINSIZE:
-	    ret = fmt_winsize(closure);
+	    /* Pending I/O buffers must be sent first to preserve order. */
+	    ret = fmt_io_batch(closure) && fmt_winsize(closure);
 	    break;
 	case IO_EVENT_SUSPEND:
-	    ret = fmt_suspend(closure);
+	    ret = fmt_io_batch(closure) && fmt_suspend(closure);
 	    break;
 	default:
 	    sudo_warnx(U_("unexpected I/O event %d"), timing->event);
 	    break;
 	}
 
-	/* Keep filling write buffer as long as we only have one of them. */
+	/*
+	 * Keep filling write buffer as long as we only have one of them.
+	 * There may be none yet if I/O buffers are being batched.
+	 */
 	if (!ret)
 	    break;
-	if (TAILQ_NEXT(TAILQ_FIRST(&closure->write_bufs), entries) != NULL)
+	buf = TAILQ_FIRST(&closure->write_bufs);
+	if (buf != NULL && TAILQ_NEXT(buf, entries) != NULL)
 	    break;
     }
 
     debug_return_bool(ret);
 }
 
+/*
+ * Add a commit point latency in microseconds to the histogram.
+ */
+static void
+latency_add(unsigned long long usec)
+{
+    unsigned int bucket, msb;
+
+    if (usec < (1U << LATENCY_SUB_BITS)) {
+	bucket = (unsigned int)usec;
+    } else {
+	for (msb = LATENCY_SUB_BITS; msb < 63 && (usec >> (msb + 1)) != 0; msb++)
+	    continue;
+	bucket = ((msb - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS) |
+	    ((usec >> (msb - LATENCY_SUB_BITS)) & ((1U << LATENCY_SUB_BITS) - 1));
+    }
+    latency_hist[bucket]++;
+    latency_count++;
+    if (usec > latency_max)
+	latency_max = usec;
+}
+
+/*
+ * Return the latency in milliseconds below which the given fraction
+ * (in tenths of a percent) of the commit point latencies fall.
+ * The upper bound of the matching histogram bucket is used.
+ */
+static double
+latency_percentile(unsigned int permille)
+{
+    const unsigned long long target =
+	(latency_count * permille + 999) / 1000;
+    unsigned long long seen = 0, usec = latency_max;
+    unsigned int bucket, shift;
+
+    for (bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+	seen += latency_hist[bucket];
+	if (seen != 0 && seen >= target) {
+	    if (bucket < (1U << LATENCY_SUB_BITS)) {
+		usec = bucket;
+	    } else {
+		shift = (bucket >> LATENCY_SUB_BITS) - 1;
+		usec = ((unsigned long long)((bucket &
+		    ((1U << LATENCY_SUB_BITS) - 1)) |
+		    (1U << LATENCY_SUB_BITS)) << shift) + ((1ULL << shift) - 1);
+	    }
+	    break;
+	}
+    }
+    if (usec > latency_max)
+	usec = latency_max;
+    return usec / 1000.0;
+}
+
+/*
+ * Remember when the synthetic I/O buffer ending at elapsed was queued.
+ * Returns true on success, false on failure.
+ */
+static bool
+load_sample_add(struct load_session *load, struct timespec *elapsed)
+{
+    struct load_sample *sample;
+    debug_decl(load_sample_add, SUDO_DEBUG_UTIL);
+
+    if (load->nsamples == load->maxsamples) {
+	if (load->first_sample != 0) {
+	    /* Reclaim the space used by committed samples. */
+	    load->nsamples -= load->first_sample;
+	    memmove(load->samples, load->samples + load->first_sample,
+		load->nsamples * sizeof(*load->samples));
+	    load->first_sample = 0;
+	} else {
+	    const size_t new_max = load->maxsamples ? load->maxsamples * 2 : 64;
+
+	    sample = reallocarray(load->samples, new_max, sizeof(*sample));
+	    if (sample == NULL) {
+		sudo_warnx(U_("%s: %s"), __func__,
+		    U_("unable to allocate memory"));
+		debug_return_bool(false);
+	    }
+	    load->samples = sample;
+	    load->maxsamples = new_max;
+	}
+    }
+
+    sample = &load->samples[load->nsamples++];
+    sample->elapsed.tv_sec = elapsed->tv_sec;
+    sample->elapsed.tv_nsec = elapsed->tv_nsec;
+    sudo_gettime_mono(&sample->queued);
+
+    debug_return_bool(true);
+}
+
+/*
+ * Update the commit point for a synthetic session and record the
+ * latency of each I/O buffer it covers.
+ */
+static void
+load_commit(struct load_session *load, struct timespec *committed)
+{
+    struct load_sample *sample;
+    struct timespec now, ts;
+    debug_decl(load_commit, SUDO_DEBUG_UTIL);
+
+    sudo_gettime_mono(&now);
+    while (load->first_sample < load->nsamples) {
+	sample = &load->samples[load->first_sample];
+	if (sudo_timespeccmp(&sample->elapsed, committed, >))
+	    break;
+	sudo_timespecsub(&now, &sample->queued, &ts);
+	latency_add((unsigned long long)ts.tv_sec * 1000000 +
+	    ts.tv_nsec / 1000);
+	load->first_sample++;
+    }
+    if (load->first_sample == load->nsamples) {
+	load->first_sample = 0;
+	load->nsamples = 0;
+    }
+    load->committed.tv_sec = committed->tv_sec;
+    load->committed.tv_nsec = committed->tv_nsec;
+
+    debug_return;
+}
+
+/*
+ * Generate the next synthetic I/O buffer and format a ClientMessage.
+ * If a rate was specified, a single I/O buffer is sent each time the
+ * session's pacing timer fires.
+ * Stores the wire format message in the closure's write buffer list.
+ * Returns true on success, false on failure.
+ */
+static bool
+fmt_next_synthetic(struct client_closure *closure)
+{
+    struct load_session *load = closure->load;
+    struct connection_buffer *buf;
+    debug_decl(fmt_next_synthetic, SUDO_DEBUG_UTIL);
+
+    /* Any restart point has already been sent to the server. */
+    sudo_timespecclear(&closure->restart);
+
+    for (;;) {
+	if (load->nrecords == load_params.records) {
+	    /* no more IO buffers */
+	    closure->state = SEND_EXIT;
+	    if (!fmt_io_batch(closure))
+		debug_return_bool(false);
+	    debug_return_bool(fmt_exit_message(closure));
+	}
+
+	/* Drop the connection once there is a commit point to resume from. */
+	if (load->interrupt_at != 0 && load->nrecords >= load->interrupt_at &&
+		load->log_id != NULL && sudo_timespecisset(&load->committed)) {
+	    sudo_debug_printf(SUDO_DEBUG_INFO,
+		"%s: interrupting session at [%lld, %ld]", __func__,
+		(long long)closure->elapsed.tv_sec, closure->elapsed.tv_nsec);
+	    load->interrupt_at = 0;
+	    load->interrupted = true;
+	    load_session_done(closure);
+	    debug_return_bool(true);
+	}
+
+	if (load_params.rate != 0) {
+	    if (!load->paced) {
+		/* Nothing to write until the pacing timer fires. */
+		sudo_ev_del(closure->evbase, closure->write_ev);
+		if (sudo_ev_add(closure->evbase, closure->pace_ev,
+			&load_delay, false) == -1) {
+		    sudo_warnx("%s", U_("unable to add event to queue"));
+		    debug_return_bool(false);
+		}
+		debug_return_bool(true);
+	    }
+	    load->paced = false;
+	}
+
+	/* Track elapsed time for comparison with commit points. */
+	sudo_timespecadd(&closure->elapsed, &load_delay, &closure->elapsed);
+	closure->timing.event = IO_EVENT_TTYOUT;
+	closure->timing.delay.tv_sec = load_delay.tv_sec;
+	closure->timing.delay.tv_nsec = load_delay.tv_nsec;
+	closure->timing.u.nbytes = load_params.size;
+	if (!fmt_io_buf(CLIENT_MESSAGE__TYPE_TTYOUT_BUF, closure))
+	    debug_return_bool(false);
+	if (!load_sample_add(load, &closure->elapsed))
+	    debug_return_bool(false);
+	load->nrecords++;
+	load_records++;
+
+	/* A paced I/O buffer is sent right away, like sudo would. */
+	if (load_params.rate != 0)
+	    debug_return_bool(fmt_io_batch(closure));
+
+	/* Keep filling write buffer as long as we only have one of them. */
+	buf = TAILQ_FIRST(&closure->write_bufs);
+	if (buf != NULL && TAILQ_NEXT(buf, entries) != NULL)
+	    break;
+    }
+
+    debug_return_bool(true);
+}
+
 /*
  * Additional work to do after a ClientMessage was sent to the server.
  * Advances state and formats the next ClientMessage (if any).
@@ -1065,8 +1496,13 @@ client_message_completion(struct client_closure *closure)
 	FALLTHROUGH;
     case SEND_IO:
 	/* fmt_next_iolog() will advance state on EOF. */
-	if (!fmt_next_iolog(closure))
-	    debug_return_bool(false);
+	if (closure->load != NULL) {
+	    if (!fmt_next_synthetic(closure))
+		debug_return_bool(false);
+	} else {
+	    if (!fmt_next_iolog(closure))
+		debug_return_bool(false);
+	}
 	break;
     case SEND_REJECT:
 	/* Done writing, wait for server to close connection. */
@@ -1116,6 +1552,17 @@ handle_server_hello(ServerHello *msg, struct client_closure *closure)
         }
     }
 
+    /* Send I/O buffers in batches if supported by the server. */
+    closure->iobuf_batch = msg->iobuf_batch;
+
+#ifdef HAVE_ZLIB_H
+    /* Compress the messages that follow if the server supports it. */
+    if (use_compression && msg->compression) {
+	if ((closure->deflate = msg_deflate_alloc()) == NULL)
+	    debug_return_bool(false);
+    }
+#endif
+
     debug_return_bool(true);
 }
 
@@ -1138,6 +1585,8 @@ handle_commit_point(TimeSpec *commit_point, struct client_closure *closure)
 	__func__, (long long)commit_point->tv_sec, commit_point->tv_nsec);
     closure->committed.tv_sec = commit_point->tv_sec;
     closure->committed.tv_nsec = commit_point->tv_nsec;
+    if (closure->load != NULL)
+	load_commit(closure->load, &closure->committed);
 
     debug_return_bool(true);
 }
@@ -1154,6 +1603,15 @@ handle_log_id(char *id, struct client_closure *closure)
     if (!testrun)
         printf("Remote log ID: %s\n", id);
 
+    /* Needed to resume an interrupted synthetic session. */
+    if (closure->load != NULL) {
+	free(closure->load->log_id);
+	if ((closure->load->log_id = strdup(id)) == NULL) {
+	    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	    debug_return_bool(false);
+	}
+    }
+
     debug_return_bool(true);
 }
 
@@ -1195,10 +1653,14 @@ handle_server_message(uint8_t *buf, size_t len,
     bool ret = false;
     debug_decl(handle_server_message, SUDO_DEBUG_UTIL);
 
+    if (server_msg_arena.block_size == 0)
+	protobuf_c_arena_init(&server_msg_arena, 0, NULL);
+
     sudo_debug_printf(SUDO_DEBUG_INFO, "%s: unpacking ServerMessage", __func__);
-    msg = server_message__unpack(NULL, len, buf);
+    msg = server_message__unpack(&server_msg_arena.base, len, buf);
     if (msg == NULL) {
 	sudo_warnx(U_("unable to unpack %s size %zu"), "ServerMessage", len);
+	protobuf_c_arena_reset(&server_msg_arena);
 	debug_return_bool(false);
     }
 
@@ -1219,7 +1681,14 @@ handle_server_message(uint8_t *buf, size_t len,
 	break;
     case SERVER_MESSAGE__TYPE_COMMIT_POINT:
 	ret = handle_commit_point(msg->u.commit_point, closure);
-	if (sudo_timespeccmp(&closure->elapsed, &closure->committed, ==)) {
+	if (closure->load != NULL) {
+	    /* A synthetic session may be fully committed between buffers. */
+	    if (closure->state == CLOSING &&
+		    sudo_timespeccmp(&closure->elapsed, &closure->committed, ==)) {
+		closure->state = FINISHED;
+		load_session_done(closure);
+	    }
+	} else if (sudo_timespeccmp(&closure->elapsed, &closure->committed, ==)) {
 	    sudo_ev_del(closure->evbase, closure->read_ev);
 	    closure->state = FINISHED;
 	    if (++finished_transmissions == nr_of_conns)
@@ -1243,7 +1712,7 @@ handle_server_message(uint8_t *buf, size_t len,
 	break;
     }
 
-    server_message__free_unpacked(msg, NULL);
+    protobuf_c_arena_reset(&server_msg_arena);
     debug_return_bool(ret);
 }
 
@@ -1272,6 +1741,7 @@ server_msg_cb(int fd, int what, void *v)
     }
 
 #if defined(HAVE_OPENSSL)
+again:
     if (cert != NULL) {
 	SSL *ssl = closure->tls_client.ssl;
 	sudo_debug_printf(SUDO_DEBUG_INFO, "%s: reading ServerMessage (TLS)", __func__);
@@ -1370,6 +1840,11 @@ server_msg_cb(int fd, int what, void *v)
 	    /* Incomplete message, we'll read the rest next time. */
 	    if (!expand_buf(buf, msg_len + sizeof(msg_len)))
 		    goto bad;
+#if defined(HAVE_OPENSSL)
+	    /* The rest of the TLS record may already be buffered by OpenSSL. */
+	    if (cert != NULL && SSL_pending(closure->tls_client.ssl) > 0)
+		goto again;
+#endif
 	    debug_return;
 	}
 
@@ -1383,9 +1858,17 @@ server_msg_cb(int fd, int what, void *v)
     }
     buf->len -= buf->off;
     buf->off = 0;
+#if defined(HAVE_OPENSSL)
+    /* Buffered TLS data will not trigger another read event. */
+    if (cert != NULL && SSL_pending(closure->tls_client.ssl) > 0 &&
+	    sudo_ev_pending(closure->read_ev, SUDO_EV_READ, NULL))
+	goto again;
+#endif
     debug_return;
 bad:
     sudo_ev_del(closure->evbase, closure->read_ev);
+    if (closure->load != NULL)
+	load_session_done(closure);
     debug_return;
 }
 
@@ -1397,6 +1880,7 @@ client_msg_cb(int fd, int what, void *v)
 {
     struct client_closure *closure = v;
     struct connection_buffer *buf;
+    bool released = false;
     ssize_t nwritten;
     debug_decl(client_msg_cb, SUDO_DEBUG_UTIL);
 
@@ -1428,6 +1912,18 @@ client_msg_cb(int fd, int what, void *v)
 #if defined(HAVE_OPENSSL)
     if (cert != NULL) {
 	SSL *ssl = closure->tls_client.ssl;
+	struct connection_buffer_list done = TAILQ_HEAD_INITIALIZER(done);
+
+	/* Send as many queued messages as possible in one TLS record. */
+	if (!coalesce_bufs(&closure->write_bufs, &done, TLS_RECORD_SIZE))
+	    goto bad;
+	while ((buf = TAILQ_FIRST(&done)) != NULL) {
+	    TAILQ_REMOVE(&done, buf, entries);
+	    buf->off = 0;
+	    buf->len = 0;
+	    TAILQ_INSERT_TAIL(&closure->free_bufs, buf, entries);
+	}
+	buf = TAILQ_FIRST(&closure->write_bufs);
         nwritten = SSL_write(ssl, buf->data + buf->off, buf->len - buf->off);
         if (nwritten <= 0) {
 	    const char *errstr;
@@ -1460,7 +1956,8 @@ client_msg_cb(int fd, int what, void *v)
     } else
 #endif
     {
-	nwritten = send(fd, buf->data + buf->off, buf->len - buf->off, 0);
+	/* Send all queued messages with a single system call. */
+	nwritten = writev_bufs(fd, &closure->write_bufs);
     }
     if (nwritten == -1) {
 	if (errno == EAGAIN || errno == EINTR)
@@ -1468,16 +1965,25 @@ client_msg_cb(int fd, int what, void *v)
 	sudo_warn("send");
 	goto bad;
     }
-    buf->off += nwritten;
+    bytes_sent += nwritten;
 
-    if (buf->off == buf->len) {
-	/* sent entire message */
+    /* Move the buffers that were sent in their entirety to the free list. */
+    while ((buf = TAILQ_FIRST(&closure->write_bufs)) != NULL) {
+	if ((size_t)nwritten < buf->len - buf->off) {
+	    buf->off += nwritten;
+	    break;
+	}
+	nwritten -= buf->len - buf->off;
 	sudo_debug_printf(SUDO_DEBUG_INFO,
 	    "%s: finished sending %u bytes to server", __func__, buf->len);
 	buf->off = 0;
 	buf->len = 0;
 	TAILQ_REMOVE(&closure->write_bufs, buf, entries);
 	TAILQ_INSERT_TAIL(&closure->free_bufs, buf, entries);
+	released = true;
+    }
+
+    if (released) {
 	if (TAILQ_EMPTY(&closure->write_bufs)) {
 	    /* Write queue empty, check state. */
 	    if (!client_message_completion(closure))
@@ -1489,6 +1995,8 @@ client_msg_cb(int fd, int what, void *v)
 bad:
     sudo_ev_del(closure->evbase, closure->read_ev);
     sudo_ev_del(closure->evbase, closure->write_ev);
+    if (closure->load != NULL)
+	load_session_done(closure);
     debug_return;
 }
 
@@ -1547,8 +2055,16 @@ client_closure_free(struct client_closure *closure)
 #endif
         sudo_ev_free(closure->read_ev);
         sudo_ev_free(closure->write_ev);
+        sudo_ev_free(closure->pace_ev);
         free(closure->read_buf.data);
         free(closure->buf);
+	free(closure->batch.records);
+	free(closure->batch.recordp);
+	free(closure->batch.delays);
+	free(closure->batch.data);
+#ifdef HAVE_ZLIB_H
+	msg_deflate_free(closure->deflate);
+#endif
 	while ((buf = TAILQ_FIRST(&closure->write_bufs)) != NULL) {
 	    sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
 		"discarding write buffer %p, len %u", buf, buf->len - buf->off);
@@ -1643,16 +2159,467 @@ bad:
     debug_return_ptr(NULL);
 }
 
+/*
+ * Start the protocol exchange on a newly-connected client,
+ * either the TLS handshake or the ClientHello message.
+ * Returns true on success, false on failure.
+ */
+static bool
+client_start(struct client_closure *closure)
+{
+    debug_decl(client_start, SUDO_DEBUG_UTIL);
+
 #if defined(HAVE_OPENSSL)
-static const char short_opts[] = "Ah:i:np:r:R:s:t:b:c:k:V";
+    if (cert != NULL) {
+	if (!tls_client_setup(closure->sock, ca_bundle, cert, key, NULL,
+		NULL, NULL, verify_server, false, &closure->tls_client))
+	    debug_return_bool(false);
+	if (use_ktls && !tls_enable_ktls(closure->tls_client.ssl)) {
+	    sudo_warnx("%s",
+		U_("kernel TLS is not supported by the TLS library"));
+	    use_ktls = false;
+	}
+	debug_return_bool(true);
+    }
+#endif
+
+    /* No TLS, send ClientHello */
+    debug_return_bool(fmt_client_hello(closure));
+}
+
+/*
+ * Parse load test parameters on the command line of the form
+ * name=value[,name=value...]
+ */
+static bool
+parse_load_params(char *spec)
+{
+    char *name, *value, *next;
+    const char *errstr;
+    unsigned int *valp;
+    long long minval, maxval;
+    debug_decl(parse_load_params, SUDO_DEBUG_UTIL);
+
+    /* Defaults */
+    load_params.concurrency = 100;
+    load_params.records = 100;
+    load_params.size = 1024;
+
+    for (name = spec; name != NULL; name = next) {
+	if ((next = strchr(name, ',')) != NULL)
+	    *next++ = '\0';
+	if ((value = strchr(name, '=')) == NULL) {
+	    sudo_warnx(U_("invalid load test parameter: %s"), name);
+	    debug_return_bool(false);
+	}
+	*value++ = '\0';
+
+	minval = 1;
+	maxval = INT_MAX;
+	if (strcmp(name, "sessions") == 0) {
+	    valp = &load_params.sessions;
+	} else if (strcmp(name, "concurrency") == 0) {
+	    valp = &load_params.concurrency;
+	} else if (strcmp(name, "records") == 0) {
+	    valp = &load_params.records;
+	} else if (strcmp(name, "size") == 0) {
+	    /* Leave room for the rest of the ClientMessage. */
+	    valp = &load_params.size;
+	    maxval = MESSAGE_SIZE_MAX / 2;
+	} else if (strcmp(name, "rate") == 0) {
+	    valp = &load_params.rate;
+	    minval = 0;
+	    maxval = 1000000;
+	} else if (strcmp(name, "restart") == 0) {
+	    valp = &load_params.restart;
+	    minval = 0;
+	    maxval = 100;
+	} else if (strcmp(name, "retries") == 0) {
+	    valp = &load_params.retries;
+	    minval = 0;
+	} else {
+	    sudo_warnx(U_("unknown load test parameter: %s"), name);
+	    debug_return_bool(false);
+	}
+	*valp = (unsigned int)sudo_strtonum(value, minval, maxval, &errstr);
+	if (errstr != NULL) {
+	    sudo_warnx(U_("%s: %s"), value, U_(errstr));
+	    debug_return_bool(false);
+	}
+    }
+
+    if (load_params.sessions == 0)
+	load_params.sessions = load_params.concurrency;
+    if (load_params.concurrency > load_params.sessions)
+	load_params.concurrency = load_params.sessions;
+
+    debug_return_bool(true);
+}
+
+/*
+ * Free a synthetic session that has completed or failed.
+ */
+static void
+load_session_free(struct load_session *load)
+{
+    debug_decl(load_session_free, SUDO_DEBUG_UTIL);
+
+    if (load != NULL) {
+	free(load->samples);
+	free(load->log_id);
+	free(load);
+    }
+
+    debug_return;
+}
+
+/*
+ * Called when a synthetic session's connection is no longer usable,
+ * either because it finished, failed or was deliberately interrupted.
+ * The closure is freed by load_cb(), not here, since we may be called
+ * from one of its event callbacks.
+ */
+static void
+load_session_done(struct client_closure *closure)
+{
+    struct timespec zero = { 0, 0 };
+    debug_decl(load_session_done, SUDO_DEBUG_UTIL);
+
+    closure->load->done = true;
+    sudo_ev_del(closure->evbase, closure->read_ev);
+    sudo_ev_del(closure->evbase, closure->write_ev);
+    sudo_ev_del(closure->evbase, closure->pace_ev);
+
+    if (!sudo_ev_pending(load_ev, SUDO_EV_TIMEOUT, NULL)) {
+	if (sudo_ev_add(closure->evbase, load_ev, &zero, false) == -1) {
+	    sudo_warnx("%s", U_("unable to add event to queue"));
+	    sudo_ev_loopbreak(closure->evbase);
+	}
+    }
+
+    debug_return;
+}
+
+/*
+ * Pacing timer for a synthetic session, sends the next I/O buffer.
+ */
+static void
+pace_cb(int unused, int what, void *v)
+{
+    struct client_closure *closure = v;
+    debug_decl(pace_cb, SUDO_DEBUG_UTIL);
+
+    closure->load->paced = true;
+    if (!fmt_next_synthetic(closure))
+	goto bad;
+    if (!closure->load->done && !TAILQ_EMPTY(&closure->write_bufs)) {
+	if (sudo_ev_add(closure->evbase, closure->write_ev, NULL, false) == -1) {
+	    sudo_warnx("%s", U_("unable to add event to queue"));
+	    goto bad;
+	}
+    }
+    debug_return;
+bad:
+    load_session_done(closure);
+    debug_return;
+}
+
+/*
+ * Connect a synthetic session to the server and start the protocol.
+ * If the server has committed some of the session's I/O, the
+ * session is resumed from that point, otherwise it starts over.
+ * Returns true on success, false on failure.
+ */
+static bool
+load_session_start(struct load_session *load, struct sudo_event_base *evbase)
+{
+    struct timespec stop_after = { 0, 0 };
+    struct client_closure *closure;
+    unsigned int i;
+    int sock;
+    debug_decl(load_session_start, SUDO_DEBUG_UTIL);
+
+    if (load->log_id != NULL && sudo_timespecisset(&load->committed)) {
+	/* Each synthetic I/O buffer has the same delay. */
+	const long long delay_ns =
+	    load_delay.tv_sec * 1000000000LL + load_delay.tv_nsec;
+	load->nrecords = (load->committed.tv_sec * 1000000000LL +
+	    load->committed.tv_nsec) / delay_ns;
+    } else {
+	free(load->log_id);
+	load->log_id = NULL;
+	sudo_timespecclear(&load->committed);
+	load->nrecords = 0;
+    }
+    load->first_sample = 0;
+    load->nsamples = 0;
+    load->paced = false;
+    load->interrupted = false;
+    load->done = false;
+
+    /* A fully-qualified path is a local Unix domain socket. */
+    if (server_info.name[0] == '/')
+	sock = connect_server_local(&server_info);
+    else
+	sock = connect_server(&server_info, load_port);
+    if (sock == -1)
+	debug_return_bool(false);
+
+    closure = client_closure_alloc(sock, evbase, &load->committed,
+	&stop_after, load->log_id, NULL, false, load_evlog);
+    if (closure == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	debug_return_bool(false);
+    }
+    closure->load = load;
+    load->closure = closure;
+    closure->elapsed.tv_sec = load->committed.tv_sec;
+    closure->elapsed.tv_nsec = load->committed.tv_nsec;
+
+    closure->pace_ev = sudo_ev_alloc(-1, SUDO_EV_TIMEOUT, pace_cb, closure);
+    if (closure->pace_ev == NULL)
+	goto oom;
+
+    /* Synthetic terminal output, the same for every I/O buffer. */
+    if ((closure->buf = malloc(load_params.size)) == NULL)
+	goto oom;
+    closure->bufsize = load_params.size;
+    for (i = 0; i < load_params.size; i++)
+	closure->buf[i] = (i % 80 == 79) ? '\n' : ' ' + (i % 95);
+
+    if (!client_start(closure))
+	goto bad;
+
+    debug_return_bool(true);
+oom:
+    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+bad:
+    load->closure = NULL;
+    client_closure_free(closure);
+    debug_return_bool(false);
+}
+
+/*
+ * Start a synthetic session, retrying on connection failure.
+ */
+static void
+load_session_run(struct load_session *load, struct sudo_event_base *evbase)
+{
+    debug_decl(load_session_run, SUDO_DEBUG_UTIL);
+
+    for (;;) {
+	if (load_session_start(load, evbase)) {
+	    load_active++;
+	    break;
+	}
+	load_conn_failures++;
+	if (load->retries == load_params.retries) {
+	    load_failed++;
+	    load_session_free(load);
+	    break;
+	}
+	load->retries++;
+    }
+
+    debug_return;
+}
+
+/*
+ * Reap synthetic sessions whose connections are done, reconnecting
+ * the ones that were interrupted or failed, and start new sessions
+ * until the requested number have been run.
+ */
+static void
+load_cb(int unused, int what, void *v)
+{
+    struct sudo_event_base *evbase = v;
+    struct client_closure *closure, *next;
+    struct load_session *load;
+    enum client_state state;
+    debug_decl(load_cb, SUDO_DEBUG_UTIL);
+
+    TAILQ_FOREACH_SAFE(closure, &connections, entries, next) {
+	load = closure->load;
+	if (!load->done)
+	    continue;
+	state = closure->state;
+	load->closure = NULL;
+	client_closure_free(closure);
+	load_active--;
+
+	if (state == FINISHED) {
+	    load_completed++;
+	    load_session_free(load);
+	    continue;
+	}
+	if (load->interrupted) {
+	    load_restarts++;
+	} else {
+	    load_conn_failures++;
+	    if (load->retries == load_params.retries) {
+		load_failed++;
+		load_session_free(load);
+		continue;
+	    }
+	    load->retries++;
+	}
+	load_session_run(load, evbase);
+    }
+
+    while (load_active < load_params.concurrency &&
+	    load_started < load_params.sessions) {
+	if ((load = calloc(1, sizeof(*load))) == NULL) {
+	    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	    sudo_ev_loopbreak(evbase);
+	    debug_return;
+	}
+	load_started++;
+	if (load_params.restart != 0 &&
+		arc4random_uniform(100) < load_params.restart) {
+	    load->interrupt_at = 1 + arc4random_uniform(load_params.records);
+	}
+	load_session_run(load, evbase);
+    }
+
+    if (load_active == 0)
+	sudo_ev_loopexit(evbase);
+
+    debug_return;
+}
+
+/*
+ * Display the amount of data sent in the given time and the
+ * throughput per second of wall clock time and of CPU time.
+ */
+static void
+print_throughput(struct timespec *elapsed, struct rusage *ru_start,
+    struct rusage *ru_end)
+{
+    struct timespec cpu_start, cpu_end, ts;
+    double secs, cpu_secs;
+
+    /* CPU time (user + system) spent sending, for bytes/sec per core. */
+    TIMEVAL_TO_TIMESPEC(&ru_start->ru_utime, &cpu_start);
+    TIMEVAL_TO_TIMESPEC(&ru_start->ru_stime, &ts);
+    sudo_timespecadd(&cpu_start, &ts, &cpu_start);
+    TIMEVAL_TO_TIMESPEC(&ru_end->ru_utime, &cpu_end);
+    TIMEVAL_TO_TIMESPEC(&ru_end->ru_stime, &ts);
+    sudo_timespecadd(&cpu_end, &ts, &cpu_end);
+    sudo_timespecsub(&cpu_end, &cpu_start, &ts);
+    secs = elapsed->tv_sec + elapsed->tv_nsec / 1000000000.0;
+    cpu_secs = ts.tv_sec + ts.tv_nsec / 1000000000.0;
+    printf("%llu bytes sent, %.0f bytes/sec, %.0f bytes/sec per CPU "
+	"(%lld.%.3ld CPU seconds)\n", bytes_sent,
+	secs > 0 ? bytes_sent / secs : 0.0,
+	cpu_secs > 0 ? bytes_sent / cpu_secs : 0.0,
+	(long long)ts.tv_sec, ts.tv_nsec / 1000000);
+}
+
+/*
+ * Run a load test using synthetic sessions as specified by load_params.
+ * The I/O log's info is used for each session's AcceptMessage.
+ * Returns the exit value for sudo_sendlog.
+ */
+static int
+load_test_run(struct sudo_event_base *evbase, struct eventlog *evlog,
+    const char *port)
+{
+    struct client_closure *closure;
+    struct timespec t_start, t_end, t_result;
+    struct timespec zero = { 0, 0 };
+    struct rusage ru_start, ru_end;
+    struct rlimit rl;
+    double secs;
+    debug_decl(load_test_run, SUDO_DEBUG_UTIL);
+
+    load_evlog = evlog;
+    load_port = port;
+
+    /* The delay stored with each I/O buffer, nominally 1ms if unpaced. */
+    if (load_params.rate > 1) {
+	load_delay.tv_sec = 0;
+	load_delay.tv_nsec = 1000000000 / load_params.rate;
+    } else if (load_params.rate == 1) {
+	load_delay.tv_sec = 1;
+	load_delay.tv_nsec = 0;
+    } else {
+	load_delay.tv_sec = 0;
+	load_delay.tv_nsec = 1000000;
+    }
+
+    /* Each session needs its own socket. */
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY &&
+	    rl.rlim_cur < (rlim_t)load_params.concurrency + 32) {
+	rl.rlim_cur = rl.rlim_max;
+	if (setrlimit(RLIMIT_NOFILE, &rl) == -1)
+	    sudo_warn("setrlimit(RLIMIT_NOFILE)");
+    }
+
+    load_ev = sudo_ev_alloc(-1, SUDO_EV_TIMEOUT, load_cb, evbase);
+    if (load_ev == NULL)
+	sudo_fatal(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+    if (sudo_ev_add(evbase, load_ev, &zero, false) == -1)
+	sudo_fatal("%s", U_("unable to add event to queue"));
+
+    printf("running %u sessions, %u at a time...\n", load_params.sessions,
+	load_params.concurrency);
+
+    sudo_gettime_real(&t_start);
+    getrusage(RUSAGE_SELF, &ru_start);
+
+    sudo_ev_dispatch(evbase);
+
+    sudo_gettime_real(&t_end);
+    getrusage(RUSAGE_SELF, &ru_end);
+    sudo_timespecsub(&t_end, &t_start, &t_result);
+
+    /* Sessions still connected if the event loop was broken out of. */
+    while ((closure = TAILQ_FIRST(&connections)) != NULL) {
+	load_session_free(closure->load);
+	client_closure_free(closure);
+	load_failed++;
+    }
+    sudo_ev_free(load_ev);
+    sudo_ev_base_free(evbase);
+    eventlog_free(evlog);
+#if defined(HAVE_OPENSSL)
+    SSL_CTX_free(ssl_ctx);
+#endif
+
+    secs = t_result.tv_sec + t_result.tv_nsec / 1000000000.0;
+    printf("%u of %u sessions completed in %lld.%.9ld seconds, %u failed, "
+	"%u restarted, %u connection failures\n", load_completed,
+	load_params.sessions, (long long)t_result.tv_sec, t_result.tv_nsec,
+	load_failed, load_restarts, load_conn_failures);
+    printf("%llu messages sent, %.0f messages/sec, %llu I/O buffers, "
+	"%.0f I/O buffers/sec\n", messages_sent,
+	secs > 0 ? messages_sent / secs : 0.0, load_records,
+	secs > 0 ? load_records / secs : 0.0);
+    print_throughput(&t_result, &ru_start, &ru_end);
+    if (latency_count != 0) {
+	printf("commit point latency (ms): p50 %.3f, p90 %.3f, p99 %.3f, "
+	    "p99.9 %.3f, max %.3f (%llu samples)\n", latency_percentile(500),
+	    latency_percentile(900), latency_percentile(990),
+	    latency_percentile(999), latency_max / 1000.0, latency_count);
+    } else {
+	printf("no commit points received\n");
+    }
+
+    debug_return_int(load_completed == load_params.sessions ?
+	EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+#if defined(HAVE_OPENSSL)
+static const char short_opts[] = "Ah:i:L:np:r:R:s:t:b:c:k:KVz";
 #else
-static const char short_opts[] = "Ah:i:Ip:r:R:t:s:V";
+static const char short_opts[] = "Ah:i:IL:p:r:R:t:s:Vz";
 #endif
 static struct option long_opts[] = {
     { "accept",		no_argument,		NULL,	'A' },
     { "help",		no_argument,		NULL,	1 },
     { "host",		required_argument,	NULL,	'h' },
     { "iolog-id",	required_argument,	NULL,	'i' },
+    { "load",		required_argument,	NULL,	'L' },
     { "port",		required_argument,	NULL,	'p' },
     { "restart",	required_argument,	NULL,	'r' },
     { "reject",		required_argument,	NULL,	'R' },
@@ -1662,9 +2629,11 @@ static struct option long_opts[] = {
     { "ca-bundle",	required_argument,	NULL,	'b' },
     { "cert",		required_argument,	NULL,	'c' },
     { "key",		required_argument,	NULL,	'k' },
+    { "ktls",		no_argument,		NULL,	'K' },
     { "no-verify",	no_argument,		NULL,	'n' },
 #endif
     { "version",	no_argument,		NULL,	'V' },
+    { "compress",	no_argument,		NULL,	'z' },
     { NULL,		no_argument,		NULL,	0 },
 };
 
@@ -1721,6 +2690,11 @@ main(int argc, char *argv[])
 	case 'i':
 	    iolog_id = optarg;
 	    break;
+	case 'L':
+	    if (!parse_load_params(optarg))
+		goto bad;
+	    load_test = true;
+	    break;
 	case 'p':
 	    port = optarg;
 	    break;
@@ -1757,6 +2731,9 @@ main(int argc, char *argv[])
 	case 'k':
 	    key = optarg;
 	    break;
+	case 'K':
+	    use_ktls = true;
+	    break;
 	case 'n':
 	    verify_server = false;
 	    break;
@@ -1765,6 +2742,9 @@ main(int argc, char *argv[])
 	    (void)printf(_("%s version %s\n"), getprogname(),
 		PACKAGE_VERSION);
 	    return 0;
+	case 'z':
+	    use_compression = true;
+	    break;
 	default:
 	    usage(true);
 	}
@@ -1773,6 +2753,10 @@ main(int argc, char *argv[])
     argv += optind;
 
 #if defined(HAVE_OPENSSL)
+    if (cert != NULL && server_info.name[0] == '/') {
+	sudo_warnx("%s", U_("TLS is not supported for local connections"));
+	usage(true);
+    }
     /* if no key file is given explicitly, try to load the key from the cert */
     if (cert != NULL) {
 	if (key == NULL)
@@ -1792,6 +2776,12 @@ main(int argc, char *argv[])
 	sudo_warnx("%s", U_("a restart point may not be set when no I/O is sent"));
 	usage(true);
     }
+    if (load_test && (accept_only || reject_reason || iolog_id != NULL ||
+	    sudo_timespecisset(&stop_after) || testrun)) {
+	sudo_warnx("%s",
+	    U_("a load test may not be combined with -A, -i, -r, -R, -s or -t"));
+	usage(true);
+    }
 
     /* Remaining arg should be to I/O log dir to send. */
     if (argc != 1)
@@ -1809,16 +2799,29 @@ main(int argc, char *argv[])
     if ((evbase = sudo_ev_base_alloc()) == NULL)
 	sudo_fatal(U_("%s: %s"), __func__, U_("unable to allocate memory"));
 
+    if (load_test) {
+	testrun = true;
+	debug_return_int(load_test_run(evbase, evlog, port));
+    }
+
     if (testrun)
         printf("connecting clients...\n");
 
     for (int i = 0; i < nr_of_conns; i++) {
-        sock = connect_server(&server_info, port);
+        /* A fully-qualified path is a local Unix domain socket. */
+        if (server_info.name[0] == '/')
+            sock = connect_server_local(&server_info);
+        else
+            sock = connect_server(&server_info, port);
         if (sock == -1)
             goto bad;
         
-        if (!testrun)
-            printf("Connected to %s:%s\n", server_info.name, port);
+        if (!testrun) {
+            if (server_info.name[0] == '/')
+                printf("Connected to %s\n", server_info.name);
+            else
+                printf("Connected to %s:%s\n", server_info.name, port);
+        }
 
         closure = client_closure_alloc(sock, evbase, &restart, &stop_after,
 	    iolog_id, reject_reason, accept_only, evlog);
@@ -1834,30 +2837,23 @@ main(int argc, char *argv[])
                 goto bad;
         }
 
-#if defined(HAVE_OPENSSL)
-	if (cert != NULL) {
-	    if (!tls_client_setup(closure->sock, ca_bundle, cert, key, NULL,
-		    NULL, NULL, verify_server, false, &closure->tls_client))
-		goto bad;
-	} else
-#endif
-	{
-	    /* No TLS, send ClientHello */
-	    if (!fmt_client_hello(closure))
-		goto bad;
-	}
-    }  
+	if (!client_start(closure))
+	    goto bad;
+    }
 
     if (testrun)
         printf("sending logs...\n");
 
     struct timespec t_start, t_end, t_result;
+    struct rusage ru_start, ru_end;
     sudo_gettime_real(&t_start);
+    getrusage(RUSAGE_SELF, &ru_start);
 
     sudo_ev_dispatch(evbase);
     sudo_ev_base_free(evbase);
 
     sudo_gettime_real(&t_end);
+    getrusage(RUSAGE_SELF, &ru_end);
     sudo_timespecsub(&t_end, &t_start, &t_result);
 
     finished = 0;
@@ -1882,6 +2878,8 @@ main(int argc, char *argv[])
         printf("%d I/O log%s transmitted successfully in %lld.%.9ld seconds\n",
 	    finished, nr_of_conns > 1 ? "s" : "",
             (long long)t_result.tv_sec, t_result.tv_nsec);
+	if (testrun)
+	    print_throughput(&t_result, &ru_start, &ru_end);
         debug_return_int(EXIT_SUCCESS);
     }
 
@@ -49,6 +49,62 @@ enum client_state {
     FINISHED
 };
 
+/*
+ * I/O buffers collected to be sent as a single IoBufferBatch.
+ * The data for each record is stored contiguously in data.
+ */
+struct iobuf_batch {
+    IoRecord *records;
+    IoRecord **recordp;
+    TimeSpec *delays;
+    uint8_t *data;
+    size_t nrecords;
+    size_t maxrecords;
+    size_t len;
+    size_t size;
+};
+
+/*
+ * Parameters for a synthetic load test (-L option).
+ */
+struct load_params {
+    unsigned int sessions;	/* total number of sessions to run */
+    unsigned int concurrency;	/* maximum number of simultaneous sessions */
+    unsigned int records;	/* I/O buffers sent per session */
+    unsigned int size;		/* size of each I/O buffer in bytes */
+    unsigned int rate;		/* I/O buffers per second, 0 for no limit */
+    unsigned int restart;	/* percentage of sessions to interrupt */
+    unsigned int retries;	/* reconnect attempts after a failure */
+};
+
+/*
+ * Time an I/O buffer was queued, matched against commit points
+ * to measure commit latency.
+ */
+struct load_sample {
+    struct timespec elapsed;
+    struct timespec queued;
+};
+
+/*
+ * State for a synthetic session that persists across reconnects.
+ */
+struct load_session {
+    struct client_closure *closure;
+    struct load_sample *samples;
+    char *log_id;
+    struct timespec committed;
+    size_t first_sample;
+    size_t nsamples;
+    size_t maxsamples;
+    unsigned int nrecords;
+    unsigned int interrupt_at;
+    unsigned int retries;
+    bool paced;
+    bool interrupted;
+    bool done;
+};
+
 struct client_closure {
     TAILQ_ENTRY(client_closure) entries;
     int sock;
@@ -56,20 +112,25 @@ struct client_closure {
     bool read_instead_of_write;
     bool write_instead_of_read;
     bool temporary_write_event;
+    bool iobuf_batch;
     struct timespec restart;
     struct timespec stop_after;
     struct timespec elapsed;
     struct timespec committed;
     struct timing_closure timing;
+    struct iobuf_batch batch;
     struct sudo_event_base *evbase;
     struct connection_buffer read_buf;
     struct connection_buffer_list write_bufs;
     struct connection_buffer_list free_bufs;
+    struct msg_deflate *deflate;
 #if defined(HAVE_OPENSSL)
     struct tls_client_closure tls_client;
 #endif
     struct sudo_event *read_ev;
     struct sudo_event *write_ev;
+    struct sudo_event *pace_ev;
+    struct load_session *load;
     struct eventlog *evlog;
     struct iolog_file iolog_files[IOFD_MAX];
     const char *iolog_id;
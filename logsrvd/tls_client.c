@@ -115,8 +115,11 @@ tls_connect_cb(int sock, int what, void *v)
     con_stat = SSL_connect(tls_client->ssl);
 
     if (con_stat == 1) {
+	bool ktls_send, ktls_recv;
+
 	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
 	    "SSL_connect successful");
+	tls_ktls_status(tls_client->ssl, &ktls_send, &ktls_recv);
         tls_client->tls_connect_state = true;
     } else {
         switch (SSL_get_error(tls_client->ssl, con_stat)) {
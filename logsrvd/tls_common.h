@@ -28,6 +28,9 @@
 # include <openssl/ssl.h>
 # include <openssl/err.h>
 
+/* Size of the session ticket key file contents (name, HMAC and AES keys) */
+#define TLS_TICKET_KEY_LEN	80
+
 struct tls_client_closure {
     SSL *ssl;
     void *parent_closure;
@@ -46,6 +49,9 @@ bool tls_ctx_client_setup(SSL_CTX *ssl_ctx, int sock, struct tls_client_closure
 
 /* tls_init.c */
 SSL_CTX *init_tls_context(const char *ca_bundle_file, const char *cert_file, const char *key_file, const char *dhparam_file, const char *ciphers_v12, const char *ciphers_v13, bool verify_cert);
+bool init_tls_session_resumption(SSL_CTX *ctx, const char *sid_ctx, long timeout, const char *ticket_key_file);
+bool tls_enable_ktls(SSL *ssl);
+void tls_ktls_status(SSL *ssl, bool *ktls_send, bool *ktls_recv);
 
 #endif /* HAVE_OPENSSL */
 
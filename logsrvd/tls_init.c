@@ -23,6 +23,8 @@
 
 #include <config.h>
 
+#include <sys/stat.h>
+
 #ifdef HAVE_STDBOOL_H
 # include <stdbool.h>
 #else
@@ -296,6 +298,9 @@ init_tls_context(const char *ca_bundle_file, const char *cert_file,
         SSL_OP_NO_SSLv2|SSL_OP_NO_SSLv3|SSL_OP_NO_TLSv1|SSL_OP_NO_TLSv1_1);
 #endif
 
+    /* Queued messages are combined before a retried SSL_write(). */
+    SSL_CTX_set_mode(ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
     if (ca_bundle_file != NULL) {
 	STACK_OF(X509_NAME) *cacerts =
 	    SSL_load_client_CA_file(ca_bundle_file);
@@ -380,4 +385,142 @@ bad:
 done:
     debug_return_ptr(ctx);
 }
+
+#ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEYS
+/*
+ * Load the session ticket encryption keys from ticket_key_file.
+ * Using the same keys on multiple servers, or across restarts,
+ * allows clients to resume sessions with any of them.
+ */
+static bool
+set_ticket_keys(SSL_CTX *ctx, const char *ticket_key_file)
+{
+    unsigned char keys[TLS_TICKET_KEY_LEN];
+    struct stat sb;
+    bool ret = false;
+    ssize_t nread;
+    int fd;
+    debug_decl(set_ticket_keys, SUDO_DEBUG_UTIL);
+
+    fd = open(ticket_key_file, O_RDONLY);
+    if (fd == -1) {
+	sudo_warn(U_("unable to open %s"), ticket_key_file);
+	debug_return_bool(false);
+    }
+    if (fstat(fd, &sb) == -1) {
+	sudo_warn(U_("unable to stat %s"), ticket_key_file);
+	goto done;
+    }
+    if ((sb.st_mode & (S_IRWXG|S_IRWXO)) != 0) {
+	sudo_warnx(U_("%s: ticket key file must not be accessible by group or other"),
+	    ticket_key_file);
+	goto done;
+    }
+    nread = read(fd, keys, sizeof(keys));
+    if (nread != (ssize_t)sizeof(keys)) {
+	sudo_warnx(U_("%s: ticket key file must contain at least %zu bytes"),
+	    ticket_key_file, sizeof(keys));
+	goto done;
+    }
+    if (SSL_CTX_set_tlsext_ticket_keys(ctx, keys, sizeof(keys)) != 1) {
+	const char *errstr = ERR_reason_error_string(ERR_get_error());
+	sudo_warnx(U_("%s: %s"), ticket_key_file,
+	    errstr ? errstr : strerror(errno));
+	goto done;
+    }
+    ret = true;
+
+done:
+    explicit_bzero(keys, sizeof(keys));
+    close(fd);
+    debug_return_bool(ret);
+}
+#endif /* SSL_CTRL_SET_TLSEXT_TICKET_KEYS */
+
+/*
+ * Enable TLS session resumption for a server context.
+ * Sessions remain valid for timeout seconds, a timeout of 0
+ * disables resumption.  The session ID context is required
+ * for resumption when client certificates are verified.
+ */
+bool
+init_tls_session_resumption(SSL_CTX *ctx, const char *sid_ctx, long timeout,
+    const char *ticket_key_file)
+{
+    debug_decl(init_tls_session_resumption, SUDO_DEBUG_UTIL);
+
+    if (timeout == 0) {
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+	SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	    "TLS session resumption disabled");
+	debug_return_bool(true);
+    }
+
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_set_timeout(ctx, timeout);
+    if (!SSL_CTX_set_session_id_context(ctx, (const unsigned char *)sid_ctx,
+	    (unsigned int)strlen(sid_ctx))) {
+	const char *errstr = ERR_reason_error_string(ERR_get_error());
+	sudo_warnx("SSL_CTX_set_session_id_context: %s",
+	    errstr ? errstr : strerror(errno));
+	debug_return_bool(false);
+    }
+
+    if (ticket_key_file != NULL) {
+#ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEYS
+	if (!set_ticket_keys(ctx, ticket_key_file))
+	    debug_return_bool(false);
+#else
+	sudo_warnx(U_("%s: session ticket keys are not supported"),
+	    ticket_key_file);
+	debug_return_bool(false);
+#endif
+    }
+
+    debug_return_bool(true);
+}
+
+/*
+ * Request kernel TLS offload for ssl.  The TLS library only enables
+ * it after the handshake if both the kernel and the negotiated cipher
+ * support it, otherwise records continue to be processed in user space.
+ * Returns false if the TLS library lacks kernel TLS support.
+ */
+bool
+tls_enable_ktls(SSL *ssl)
+{
+    debug_decl(tls_enable_ktls, SUDO_DEBUG_UTIL);
+
+#ifdef SSL_OP_ENABLE_KTLS
+    SSL_set_options(ssl, SSL_OP_ENABLE_KTLS);
+    debug_return_bool(true);
+#else
+    debug_return_bool(false);
+#endif
+}
+
+/*
+ * Determine whether kernel TLS is active for the send and receive
+ * directions of ssl.  Only meaningful after the handshake completes.
+ */
+void
+tls_ktls_status(SSL *ssl, bool *ktls_send, bool *ktls_recv)
+{
+    debug_decl(tls_ktls_status, SUDO_DEBUG_UTIL);
+
+    *ktls_send = false;
+    *ktls_recv = false;
+#ifdef SSL_OP_ENABLE_KTLS
+    if (SSL_get_options(ssl) & SSL_OP_ENABLE_KTLS) {
+	*ktls_send = BIO_get_ktls_send(SSL_get_wbio(ssl)) > 0;
+	*ktls_recv = BIO_get_ktls_recv(SSL_get_rbio(ssl)) > 0;
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	    "kernel TLS send: %s, receive: %s",
+	    *ktls_send ? "enabled" : "disabled",
+	    *ktls_recv ? "enabled" : "disabled");
+    }
+#endif
+    debug_return;
+}
 #endif /* HAVE_OPENSSL */
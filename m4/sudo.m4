@@ -141,6 +141,7 @@ AC_DEFUN([SUDO_RUNDIR], [
     if test X"$rundir" != X"no"; then
 	SUDO_DEFINE_UNQUOTED(_PATH_SUDO_TIMEDIR, "$rundir/ts")
 	SUDO_DEFINE_UNQUOTED(_PATH_SUDO_LOGSRVD_PID, "$rundir/sudo_logsrvd.pid")
+	SUDO_DEFINE_UNQUOTED(_PATH_SUDO_LOGSRV_SESSION, "$rundir/logsrv_session")
     fi
 ])
 
@@ -695,6 +695,14 @@ struct sudo_defs_types sudo_defs_table[] = {
 	"apparmor_profile", T_STR,
 	N_("AppArmor profile to use in the new security context: %s"),
 	NULL,
+    }, {
+	"log_server_compress", T_FLAG,
+	N_("Compress I/O log data sent to the log server"),
+	NULL,
+    }, {
+	"log_server_session_cache", T_STR|T_BOOL|T_PATH,
+	N_("Path to the log server TLS session cache file: %s"),
+	NULL,
     }, {
 	NULL, 0, NULL
     }
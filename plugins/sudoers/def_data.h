@@ -322,6 +322,10 @@
 #define def_intercept_verify    (sudo_defs_table[I_INTERCEPT_VERIFY].sd_un.flag)
 #define I_APPARMOR_PROFILE      160
 #define def_apparmor_profile    (sudo_defs_table[I_APPARMOR_PROFILE].sd_un.str)
+#define I_LOG_SERVER_COMPRESS   161
+#define def_log_server_compress (sudo_defs_table[I_LOG_SERVER_COMPRESS].sd_un.flag)
+#define I_LOG_SERVER_SESSION_CACHE 162
+#define def_log_server_session_cache (sudo_defs_table[I_LOG_SERVER_SESSION_CACHE].sd_un.str)
 
 enum def_tuple {
     never,
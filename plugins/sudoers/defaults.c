@@ -604,6 +604,10 @@ init_defaults(void)
 	goto oom;
     if ((def_timestampdir = strdup(_PATH_SUDO_TIMEDIR)) == NULL)
 	goto oom;
+#ifdef _PATH_SUDO_LOGSRV_SESSION
+    if ((def_log_server_session_cache = strdup(_PATH_SUDO_LOGSRV_SESSION)) == NULL)
+	goto oom;
+#endif
     if ((def_passprompt = strdup(_(PASSPROMPT))) == NULL)
 	goto oom;
     if ((def_runas_default = strdup(RUNAS_DEFAULT)) == NULL)
@@ -208,6 +208,7 @@ free_iolog_details(void)
     free(iolog_details.ca_bundle);
     free(iolog_details.cert_file);
     free(iolog_details.key_file);
+    free(iolog_details.session_cache);
 #endif /* HAVE_OPENSSL */
 
     debug_return;
@@ -513,6 +514,16 @@ iolog_deserialize_info(struct log_details *details, char * const user_info[],
                 }
                 continue;
             }
+            if (strncmp(*cur, "log_server_compress=", sizeof("log_server_compress=") - 1) == 0) {
+                int val = sudo_strtobool(*cur + sizeof("log_server_compress=") - 1);
+                if (val != -1) {
+                    details->compress = val;
+                } else {
+                    sudo_debug_printf(SUDO_DEBUG_WARN,
+                        "%s: unable to parse %s", __func__, *cur);
+                }
+                continue;
+            }
 #if defined(HAVE_OPENSSL)
             if (strncmp(*cur, "log_server_cabundle=", sizeof("log_server_cabundle=") - 1) == 0) {
 		free(details->ca_bundle);
@@ -535,6 +546,13 @@ iolog_deserialize_info(struct log_details *details, char * const user_info[],
 		    goto oom;
                 continue;
             }
+            if (strncmp(*cur, "log_server_session_cache=", sizeof("log_server_session_cache=") - 1) == 0) {
+		free(details->session_cache);
+                details->session_cache = strdup(*cur + sizeof("log_server_session_cache=") - 1);
+		if (details->session_cache == NULL)
+		    goto oom;
+                continue;
+            }
             if (strncmp(*cur, "log_server_verify=", sizeof("log_server_verify=") - 1) == 0) {
                 int val = sudo_strtobool(*cur + sizeof("log_server_verify=") - 1);
                 if (val != -1) {
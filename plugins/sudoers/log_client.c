@@ -28,6 +28,8 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
@@ -71,6 +73,7 @@
 #include "hostcheck.h"
 #include "log_client.h"
 #include "strlist.h"
+#include "protobuf-c/protobuf-c-arena.h"
 
 /* Shared between iolog.c and audit.c */
 struct client_closure *client_closure;
@@ -79,6 +82,9 @@ struct client_closure *client_closure;
 static void client_msg_cb(int fd, int what, void *v);
 static void server_msg_cb(int fd, int what, void *v);
 
+/* Server messages are unpacked one at a time using a reusable arena. */
+static ProtobufCArena server_msg_arena;
+
 static void
 connect_cb(int sock, int what, void *v)
 {
@@ -180,6 +186,199 @@ verify_peer_identity(int preverify_ok, X509_STORE_CTX *ctx)
     }
 }
 
+/*
+ * Read the TLS session for host and port from the session cache file.
+ * The file contains the host name and port, each followed by a NUL byte,
+ * and the session in DER format.  Returns NULL if there is no usable session.
+ */
+static SSL_SESSION *
+tls_session_load(const char *path, const char *host, const char *port)
+{
+    SSL_SESSION *sess = NULL;
+    const unsigned char *cp;
+    unsigned char *buf = NULL;
+    size_t hostlen = strlen(host);
+    size_t keylen = hostlen + 1 + strlen(port) + 1;
+    struct stat sb;
+    ssize_t nread;
+    int fd;
+    debug_decl(tls_session_load, SUDOERS_DEBUG_UTIL);
+
+    fd = open(path, O_RDONLY|O_NOFOLLOW);
+    if (fd == -1) {
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_ERRNO|SUDO_DEBUG_LINENO,
+	    "unable to open %s", path);
+	goto done;
+    }
+
+    /* The session contains secrets, only use it if it is private. */
+    if (fstat(fd, &sb) == -1 || !S_ISREG(sb.st_mode) ||
+	    sb.st_uid != ROOT_UID || (sb.st_mode & (S_IRWXG|S_IRWXO)) != 0 ||
+	    sb.st_size <= (off_t)keylen || sb.st_size > SESSION_CACHE_MAX) {
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+	    "ignoring TLS session cache %s", path);
+	goto done;
+    }
+    if ((buf = malloc((size_t)sb.st_size)) == NULL) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "unable to allocate memory");
+	goto done;
+    }
+    nread = read(fd, buf, (size_t)sb.st_size);
+    if (nread != sb.st_size) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO|SUDO_DEBUG_LINENO,
+	    "unable to read %s", path);
+	goto done;
+    }
+
+    /* The cache only holds the session for the last server used. */
+    if (memcmp(buf, host, hostlen + 1) != 0 ||
+	    memcmp(buf + hostlen + 1, port, keylen - hostlen - 1) != 0) {
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	    "TLS session cache %s is not for %s:%s", path, host, port);
+	goto done;
+    }
+    cp = buf + keylen;
+    sess = d2i_SSL_SESSION(NULL, &cp, (long)(nread - (ssize_t)keylen));
+    if (sess == NULL) {
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+	    "invalid TLS session in %s", path);
+	goto done;
+    }
+    if (time(NULL) - SSL_SESSION_get_time(sess) >= SSL_SESSION_get_timeout(sess)) {
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	    "TLS session in %s has expired", path);
+	SSL_SESSION_free(sess);
+	sess = NULL;
+    }
+
+done:
+    if (fd != -1)
+	close(fd);
+    free(buf);
+    debug_return_ptr(sess);
+}
+
+/*
+ * Store the TLS session for host and port in the session cache file.
+ * The new file is renamed into place so concurrent readers
+ * always see a complete session.
+ */
+static bool
+tls_session_store(const char *path, const char *host, const char *port,
+    SSL_SESSION *sess)
+{
+    unsigned char *buf = NULL, *cp;
+    size_t hostlen = strlen(host);
+    size_t keylen = hostlen + 1 + strlen(port) + 1;
+    char *tmpfile = NULL;
+    bool ret = false;
+    int fd = -1, len;
+    debug_decl(tls_session_store, SUDOERS_DEBUG_UTIL);
+
+    len = i2d_SSL_SESSION(sess, NULL);
+    if (len <= 0 || keylen + (size_t)len > SESSION_CACHE_MAX) {
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+	    "unable to encode TLS session (%d bytes)", len);
+	goto done;
+    }
+    if ((buf = malloc(keylen + (size_t)len)) == NULL) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "unable to allocate memory");
+	goto done;
+    }
+    memcpy(buf, host, hostlen + 1);
+    memcpy(buf + hostlen + 1, port, keylen - hostlen - 1);
+    cp = buf + keylen;
+    if (i2d_SSL_SESSION(sess, &cp) != len)
+	goto done;
+
+    /* Create the parent directory if needed. */
+    fd = sudo_open_parent_dir(path, ROOT_UID, ROOT_GID,
+	S_IRWXU|S_IXGRP|S_IXOTH, true);
+    if (fd == -1)
+	goto done;
+    close(fd);
+
+    if (asprintf(&tmpfile, "%s.XXXXXX", path) == -1) {
+	tmpfile = NULL;
+	goto done;
+    }
+    if ((fd = mkstemp(tmpfile)) == -1) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO|SUDO_DEBUG_LINENO,
+	    "unable to create %s", tmpfile);
+	free(tmpfile);
+	tmpfile = NULL;
+	goto done;
+    }
+    if (write(fd, buf, keylen + (size_t)len) != (ssize_t)(keylen + (size_t)len)) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO|SUDO_DEBUG_LINENO,
+	    "unable to write %s", tmpfile);
+	goto done;
+    }
+    if (rename(tmpfile, path) == -1) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO|SUDO_DEBUG_LINENO,
+	    "unable to rename %s to %s", tmpfile, path);
+	goto done;
+    }
+    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	"stored TLS session for %s in %s", host, path);
+    ret = true;
+
+done:
+    if (fd != -1)
+	close(fd);
+    if (tmpfile != NULL) {
+	if (!ret)
+	    unlink(tmpfile);
+	free(tmpfile);
+    }
+    free(buf);
+    debug_return_bool(ret);
+}
+
+/*
+ * Called by OpenSSL when the server sends a new session ticket.
+ * We don't keep a reference to the session so always return 0.
+ */
+static int
+tls_new_session_cb(SSL *ssl, SSL_SESSION *sess)
+{
+    struct client_closure *closure = SSL_get_ex_data(ssl, 1);
+    debug_decl(tls_new_session_cb, SUDOERS_DEBUG_UTIL);
+
+    if (closure != NULL && closure->server_name != NULL &&
+	    closure->server_port != NULL) {
+	tls_session_store(closure->log_details->session_cache,
+	    closure->server_name, closure->server_port, sess);
+    }
+
+    debug_return_int(0);
+}
+
+/*
+ * Offer the cached session for host and port, if any, to avoid a
+ * full handshake.
+ */
+static void
+tls_session_resume(struct client_closure *closure, const char *host,
+    const char *port)
+{
+    SSL_SESSION *sess;
+    debug_decl(tls_session_resume, SUDOERS_DEBUG_UTIL);
+
+    sess = tls_session_load(closure->log_details->session_cache, host, port);
+    if (sess != NULL) {
+	if (!SSL_set_session(closure->ssl, sess)) {
+	    sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+		"unable to set TLS session for %s:%s", host, port);
+	}
+	SSL_SESSION_free(sess);
+    }
+
+    debug_return;
+}
+
 static bool
 tls_init(struct client_closure *closure)
 {
@@ -219,6 +418,9 @@ tls_init(struct client_closure *closure)
         SSL_OP_NO_SSLv2|SSL_OP_NO_SSLv3|SSL_OP_NO_TLSv1|SSL_OP_NO_TLSv1_1);
 #endif
 
+    /* Queued messages are combined before a retried SSL_write(). */
+    SSL_CTX_set_mode(closure->ssl_ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
     /* Enable server cert verification if log_server_verify is set in sudoers */
     if (closure->log_details->verify_server) {
         if (closure->log_details->ca_bundle != NULL) {
@@ -240,6 +442,17 @@ tls_init(struct client_closure *closure)
             }
         }
         SSL_CTX_set_verify(closure->ssl_ctx, SSL_VERIFY_PEER, verify_peer_identity);
+
+	/*
+	 * Save sessions sent by the server so the next connection can
+	 * be resumed.  A resumed session skips certificate verification
+	 * so sessions are only cached when the server is verified.
+	 */
+	if (closure->log_details->session_cache != NULL) {
+	    SSL_CTX_set_session_cache_mode(closure->ssl_ctx,
+		SSL_SESS_CACHE_CLIENT|SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	    SSL_CTX_sess_set_new_cb(closure->ssl_ctx, tls_new_session_cb);
+	}
     }
 
     /* Load the client certificate file if it is set in sudoers. */
@@ -320,8 +533,9 @@ tls_connect_cb(int sock, int what, void *v)
 
     if (tls_con == 1) {
         sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
-            "TLS version: %s, negotiated cipher suite: %s",
-            SSL_get_version(closure->ssl), SSL_get_cipher(closure->ssl));
+            "TLS version: %s, negotiated cipher suite: %s%s",
+            SSL_get_version(closure->ssl), SSL_get_cipher(closure->ssl),
+	    SSL_session_reused(closure->ssl) ? " (resumed)" : "");
         closure->tls_conn_status = true;
     } else {
 	const char *errstr;
@@ -538,6 +752,16 @@ connect_server(const char *host, const char *port, bool tls,
 	    sock = -1;
 	    continue;
 	}
+	free(closure->server_port);
+	if ((closure->server_port = strdup(port)) == NULL) {
+	    cause = "strdup";
+	    save_errno = errno;
+	    shutdown(sock, SHUT_RDWR);
+	    close(sock);
+	    errno = save_errno;
+	    sock = -1;
+	    continue;
+	}
 
 #if defined(HAVE_OPENSSL)
         if (tls) {
@@ -550,6 +774,10 @@ connect_server(const char *host, const char *port, bool tls,
                 sock = -1;
                 continue;
             }
+            if (closure->log_details->verify_server &&
+                    closure->log_details->session_cache != NULL) {
+                tls_session_resume(closure, host, port);
+            }
             /* Perform TLS handshake. */
             if (!tls_timed_connect(closure->ssl, host, port, timeout)) {
                 cause = U_("TLS handshake was unsuccessful");
@@ -560,13 +788,8 @@ connect_server(const char *host, const char *port, bool tls,
                 sock = -1;
                 continue;
             }
-        } else {
-            /* No TLS for this connection, make sure it is not initialized. */
-            SSL_free(closure->ssl);
-            closure->ssl = NULL;
-            SSL_CTX_free(closure->ssl_ctx);
-            closure->ssl_ctx = NULL;
         }
+        closure->tls = tls;
 #endif /* HAVE_OPENSSL */
 	break;	/* success */
     }
@@ -578,6 +801,73 @@ connect_server(const char *host, const char *port, bool tls,
     debug_return_int(sock);
 }
 
+/*
+ * Connect to a log server listening on the Unix domain socket path.
+ * The server authenticates us by our credentials, TLS is not used.
+ * Returns open socket or -1 on error.
+ */
+static int
+connect_server_local(const char *path, struct client_closure *closure,
+    const char **reason)
+{
+    const struct timespec *timeout = &closure->log_details->server_timeout;
+    struct sockaddr_un sa_un;
+    const char *cause = NULL;
+    int flags, save_errno, sock = -1;
+    debug_decl(connect_server_local, SUDOERS_DEBUG_UTIL);
+
+    memset(&sa_un, 0, sizeof(sa_un));
+    sa_un.sun_family = AF_UNIX;
+    if (strlcpy(sa_un.sun_path, path, sizeof(sa_un.sun_path)) >=
+	    sizeof(sa_un.sun_path)) {
+	errno = ENAMETOOLONG;
+	cause = path;
+	goto bad;
+    }
+
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock == -1) {
+	cause = "socket";
+	goto bad;
+    }
+    flags = fcntl(sock, F_GETFL, 0);
+    if (flags == -1 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) == -1) {
+	cause = "fcntl(O_NONBLOCK)";
+	goto bad;
+    }
+    if (fcntl(sock, F_SETFD, FD_CLOEXEC) == -1) {
+	cause = "fcntl(FD_CLOEXEC)";
+	goto bad;
+    }
+    if (timed_connect(sock, (struct sockaddr *)&sa_un, sizeof(sa_un),
+	    timeout) == -1) {
+	cause = path;
+	goto bad;
+    }
+    free(closure->server_name);
+    if ((closure->server_name = strdup(path)) == NULL) {
+	cause = "strdup";
+	goto bad;
+    }
+    free(closure->server_port);
+    closure->server_port = NULL;
+    (void)strlcpy(closure->server_ip, "local", sizeof(closure->server_ip));
+
+#if defined(HAVE_OPENSSL)
+    /* No TLS for this connection, keep the TLS state for the next one. */
+    closure->tls = false;
+#endif
+
+    debug_return_int(sock);
+bad:
+    save_errno = errno;
+    if (sock != -1)
+	close(sock);
+    errno = save_errno;
+    *reason = cause;
+    debug_return_int(-1);
+}
+
 /*
  * Connect to the first server in the list.
  * Stores socket in closure with O_NONBLOCK and close-on-exec flags set.
@@ -597,15 +887,22 @@ log_server_connect(struct client_closure *closure)
         free(copy);
 	if ((copy = strdup(server->str)) == NULL)
                 break;
-	if (!iolog_parse_host_port(copy, &host, &port, &tls, DEFAULT_PORT,
-		DEFAULT_PORT_TLS)) {
-            sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
-                "unable to parse %s", copy);
-	    continue;
+	if (server->str[0] == '/') {
+	    /* A fully-qualified path is a local Unix domain socket. */
+	    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+		"connecting to %s", server->str);
+	    sock = connect_server_local(server->str, closure, &cause);
+	} else {
+	    if (!iolog_parse_host_port(copy, &host, &port, &tls, DEFAULT_PORT,
+		    DEFAULT_PORT_TLS)) {
+		sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		    "unable to parse %s", copy);
+		continue;
+	    }
+	    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+		"connecting to %s port %s%s", host, port, tls ? " (tls)" : "");
+	    sock = connect_server(host, port, tls, closure, &cause);
 	}
-        sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
-            "connecting to %s port %s%s", host, port, tls ? " (tls)" : "");
-	sock = connect_server(host, port, tls, closure, &cause);
 	if (sock != -1) {
             if (closure->read_ev->set(closure->read_ev, sock,
                     SUDO_PLUGIN_EV_READ|SUDO_PLUGIN_EV_PERSIST,
@@ -638,6 +935,118 @@ log_server_connect(struct client_closure *closure)
 /*
  * Free client closure and contents, not including log details.
  */
+#ifdef HAVE_ZLIB_H
+/*
+ * Allocate a new zlib stream used to compress ClientMessages.
+ */
+static struct msg_deflate *
+msg_deflate_alloc(void)
+{
+    struct msg_deflate *z;
+    debug_decl(msg_deflate_alloc, SUDOERS_DEBUG_UTIL);
+
+    if ((z = calloc(1, sizeof(*z))) == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	debug_return_ptr(NULL);
+    }
+    if (deflateInit(&z->strm, Z_DEFAULT_COMPRESSION) != Z_OK) {
+	sudo_warnx(U_("%s: %s"), __func__,
+	    z->strm.msg ? z->strm.msg : U_("unable to allocate memory"));
+	free(z);
+	debug_return_ptr(NULL);
+    }
+
+    debug_return_ptr(z);
+}
+
+static void
+msg_deflate_free(struct msg_deflate *z)
+{
+    debug_decl(msg_deflate_free, SUDOERS_DEBUG_UTIL);
+
+    if (z != NULL) {
+	deflateEnd(&z->strm);
+	free(z->inbuf);
+	free(z->outbuf);
+	free(z);
+    }
+
+    debug_return;
+}
+
+/*
+ * Pack and compress a ClientMessage, including its 32-bit size,
+ * and store the result as a compressed ClientMessage in zmsg.
+ * The data in zmsg is only valid until the next call.
+ * Returns true on success, false on failure.
+ */
+static bool
+msg_deflate(struct msg_deflate *z, ClientMessage *msg, ClientMessage *zmsg)
+{
+    size_t len, zlen = 0;
+    uint32_t msg_len;
+    int ret;
+    debug_decl(msg_deflate, SUDOERS_DEBUG_UTIL);
+
+    len = client_message__get_packed_size(msg);
+    if (len > MESSAGE_SIZE_MAX) {
+	sudo_warnx(U_("client message too large: %zu"), len);
+	debug_return_bool(false);
+    }
+    if (z->insize < len + sizeof(msg_len)) {
+	size_t newsize = sudo_pow2_roundup(len + sizeof(msg_len));
+	void *newbuf = realloc(z->inbuf, newsize);
+	if (newbuf == NULL) {
+	    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	    debug_return_bool(false);
+	}
+	z->inbuf = newbuf;
+	z->insize = newsize;
+    }
+
+    /* Wire message size is used for length encoding, precedes message. */
+    msg_len = htonl((uint32_t)len);
+    memcpy(z->inbuf, &msg_len, sizeof(msg_len));
+    client_message__pack(msg, z->inbuf + sizeof(msg_len));
+
+    /* Flush after each message so it can be decompressed on arrival. */
+    z->strm.next_in = z->inbuf;
+    z->strm.avail_in = (uInt)(len + sizeof(msg_len));
+    do {
+	if (z->outsize - zlen < 64) {
+	    size_t newsize = sudo_pow2_roundup(zlen +
+		deflateBound(&z->strm, z->strm.avail_in) + 64);
+	    void *newbuf = realloc(z->outbuf, newsize);
+	    if (newbuf == NULL) {
+		sudo_warnx(U_("%s: %s"), __func__,
+		    U_("unable to allocate memory"));
+		debug_return_bool(false);
+	    }
+	    z->outbuf = newbuf;
+	    z->outsize = newsize;
+	}
+	z->strm.next_out = z->outbuf + zlen;
+	z->strm.avail_out = (uInt)(z->outsize - zlen);
+	ret = deflate(&z->strm, Z_SYNC_FLUSH);
+	if (ret != Z_OK && ret != Z_BUF_ERROR) {
+	    sudo_warnx(U_("unable to compress message: %s"),
+		z->strm.msg ? z->strm.msg : "deflate");
+	    debug_return_bool(false);
+	}
+	zlen = z->outsize - z->strm.avail_out;
+    } while (z->strm.avail_out == 0);
+
+    sudo_debug_printf(SUDO_DEBUG_INFO, "%s: compressed %zu bytes to %zu",
+	__func__, len + sizeof(msg_len), zlen);
+
+    zmsg->u.compressed.data = z->outbuf;
+    zmsg->u.compressed.len = zlen;
+    zmsg->type_case = CLIENT_MESSAGE__TYPE_COMPRESSED;
+
+    debug_return_bool(true);
+}
+#endif /* HAVE_ZLIB_H */
+
 void
 client_closure_free(struct client_closure *closure)
 {
@@ -650,7 +1059,7 @@ client_closure_free(struct client_closure *closure)
 #if defined(HAVE_OPENSSL)
     /* Shut down the TLS connection cleanly and free SSL data. */
     if (closure->ssl != NULL) {
-	if (SSL_shutdown(closure->ssl) == 0)
+	if (closure->tls && SSL_shutdown(closure->ssl) == 0)
 	    SSL_shutdown(closure->ssl);
 	SSL_free(closure->ssl);
     }
@@ -662,6 +1071,7 @@ client_closure_free(struct client_closure *closure)
 	close(closure->sock);
     }
     free(closure->server_name);
+    free(closure->server_port);
     while ((buf = TAILQ_FIRST(&closure->write_bufs)) != NULL) {
 	TAILQ_REMOVE(&closure->write_bufs, buf, entries);
 	free(buf->data);
@@ -677,6 +1087,13 @@ client_closure_free(struct client_closure *closure)
     if (closure->write_ev != NULL)
 	closure->write_ev->free(closure->write_ev);
     free(closure->read_buf.data);
+    free(closure->batch.records);
+    free(closure->batch.recordp);
+    free(closure->batch.delays);
+    free(closure->batch.data);
+#ifdef HAVE_ZLIB_H
+    msg_deflate_free(closure->deflate);
+#endif
     free(closure->iolog_id);
 
     free(closure);
@@ -699,6 +1116,99 @@ get_free_buf(struct client_closure *closure)
     debug_return_ptr(buf);
 }
 
+/* Maximum number of buffers to send with a single writev(). */
+#if defined(IOV_MAX) && IOV_MAX < 64
+# define WRITEV_MAX	IOV_MAX
+#else
+# define WRITEV_MAX	64
+#endif
+
+/*
+ * Write the unsent data in the closure's write queue to fd using
+ * a single writev() call.
+ * Returns the number of bytes written or -1 on error.
+ * TODO - share with logsrvd/sendlog
+ */
+static ssize_t
+writev_bufs(int fd, struct client_closure *closure)
+{
+    struct iovec iov[WRITEV_MAX];
+    struct connection_buffer *buf;
+    int iovcnt = 0;
+    debug_decl(writev_bufs, SUDOERS_DEBUG_UTIL);
+
+    TAILQ_FOREACH(buf, &closure->write_bufs, entries) {
+	iov[iovcnt].iov_base = buf->data + buf->off;
+	iov[iovcnt].iov_len = buf->len - buf->off;
+	if (++iovcnt == WRITEV_MAX)
+	    break;
+    }
+
+    debug_return_ssize_t(writev(fd, iov, iovcnt));
+}
+
+#if defined(HAVE_OPENSSL)
+/*
+ * Append the messages queued after the first buffer in the closure's
+ * write queue to the first buffer, up to TLS_RECORD_SIZE bytes, so they
+ * can be sent with a single SSL_write().  The first buffer may be moved,
+ * which is permitted by SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER.
+ * Returns false on memory allocation failure.
+ * TODO - share with logsrvd/sendlog
+ */
+static bool
+coalesce_bufs(struct client_closure *closure)
+{
+    struct connection_buffer *first, *buf;
+    unsigned int len;
+    debug_decl(coalesce_bufs, SUDOERS_DEBUG_UTIL);
+
+    if ((first = TAILQ_FIRST(&closure->write_bufs)) == NULL)
+	debug_return_bool(true);
+
+    /* Amount of data that will be in the first buffer. */
+    len = first->len - first->off;
+    for (buf = TAILQ_NEXT(first, entries); buf != NULL;
+	    buf = TAILQ_NEXT(buf, entries)) {
+	if (len > TLS_RECORD_SIZE || buf->len > TLS_RECORD_SIZE - len)
+	    break;
+	len += buf->len;
+    }
+    if (len == first->len - first->off)
+	debug_return_bool(true);
+
+    /* Discard data that has already been written. */
+    if (first->off != 0) {
+	first->len -= first->off;
+	memmove(first->data, first->data + first->off, first->len);
+	first->off = 0;
+    }
+    if (len > first->size) {
+	const unsigned int new_size = sudo_pow2_roundup(len);
+	void *newdata;
+
+	if (new_size < len || (newdata = realloc(first->data, new_size)) == NULL) {
+	    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	    debug_return_bool(false);
+	}
+	first->data = newdata;
+	first->size = new_size;
+    }
+
+    /* Buffers other than the first have not been written to yet. */
+    while (first->len < len) {
+	buf = TAILQ_NEXT(first, entries);
+	memcpy(first->data + first->len, buf->data, buf->len);
+	first->len += buf->len;
+	buf->len = 0;
+	TAILQ_REMOVE(&closure->write_bufs, buf, entries);
+	TAILQ_INSERT_TAIL(&closure->free_bufs, buf, entries);
+    }
+
+    debug_return_bool(true);
+}
+#endif /* HAVE_OPENSSL */
+
 /*
  * Format a ClientMessage.
  * Appends the wire format message to the closure's write queue.
@@ -707,6 +1217,9 @@ get_free_buf(struct client_closure *closure)
 bool
 fmt_client_message(struct client_closure *closure, ClientMessage *msg)
 {
+#ifdef HAVE_ZLIB_H
+    ClientMessage zmsg = CLIENT_MESSAGE__INIT;
+#endif
     struct connection_buffer *buf;
     uint32_t msg_len;
     bool ret = false;
@@ -718,6 +1231,14 @@ fmt_client_message(struct client_closure *closure, ClientMessage *msg)
 	goto done;
     }
 
+#ifdef HAVE_ZLIB_H
+    if (closure->deflate != NULL) {
+	if (!msg_deflate(closure->deflate, msg, &zmsg))
+	    goto done;
+	msg = &zmsg;
+    }
+#endif
+
     len = client_message__get_packed_size(msg);
     if (len > MESSAGE_SIZE_MAX) {
     	sudo_warnx(U_("client message too large: %zu"), len);
@@ -780,6 +1301,10 @@ fmt_client_hello(struct client_closure *closure)
 
     /* Client name + version */
     hello_msg.client_id = (char *)"sudoers " PACKAGE_VERSION;
+    hello_msg.iobuf_batch = true;
+#ifdef HAVE_ZLIB_H
+    hello_msg.compression = closure->log_details->compress;
+#endif
 
     /* Schedule ClientMessage */
     client_msg.u.hello_msg = &hello_msg;
@@ -1162,6 +1687,120 @@ fmt_restart_message(struct client_closure *closure)
 }
 #endif
 
+/*
+ * Build and format an IoBufferBatch wrapped in a ClientMessage from
+ * the I/O buffers collected in closure->batch, if any.
+ * Appends the wire format message to the closure's write queue.
+ * Returns true on success, false on failure.
+ */
+static bool
+fmt_io_batch(struct client_closure *closure)
+{
+    ClientMessage client_msg = CLIENT_MESSAGE__INIT;
+    IoBufferBatch batch_msg = IO_BUFFER_BATCH__INIT;
+    struct iobuf_batch *batch = &closure->batch;
+    uint8_t *data = batch->data;
+    bool ret;
+    size_t n;
+    debug_decl(fmt_io_batch, SUDOERS_DEBUG_UTIL);
+
+    if (batch->nrecords == 0)
+	debug_return_bool(true);
+
+    /* The arrays may have moved as the batch grew, fill in pointers now. */
+    for (n = 0; n < batch->nrecords; n++) {
+	batch->records[n].delay = &batch->delays[n];
+	batch->records[n].data.data = data;
+	data += batch->records[n].data.len;
+	batch->recordp[n] = &batch->records[n];
+    }
+    batch_msg.records = batch->recordp;
+    batch_msg.n_records = batch->nrecords;
+
+    sudo_debug_printf(SUDO_DEBUG_INFO,
+	"%s: sending IoBufferBatch with %zu records, length %zu", __func__,
+	batch->nrecords, batch->len);
+
+    /* Schedule ClientMessage */
+    client_msg.u.iobuf_batch = &batch_msg;
+    client_msg.type_case = CLIENT_MESSAGE__TYPE_IOBUF_BATCH;
+    ret = fmt_client_message(closure, &client_msg);
+
+    batch->nrecords = 0;
+    batch->len = 0;
+
+    debug_return_bool(ret);
+}
+
+/*
+ * Add an I/O buffer to the pending IoBufferBatch, the data is copied.
+ * The batch is formatted once it holds IOBUF_BATCH_SIZE bytes.
+ * Returns true on success, false on failure.
+ */
+static bool
+add_io_batch(struct client_closure *closure, int iofd, const char *buf,
+    unsigned int len, struct timespec *delay)
+{
+    struct iobuf_batch *batch = &closure->batch;
+    IoRecord *record;
+    TimeSpec *ts;
+    void *ptr;
+    debug_decl(add_io_batch, SUDOERS_DEBUG_UTIL);
+
+    if (batch->nrecords == batch->maxrecords) {
+	const size_t new_max = batch->maxrecords ? batch->maxrecords * 2 : 64;
+
+	ptr = reallocarray(batch->records, new_max, sizeof(*batch->records));
+	if (ptr == NULL)
+	    goto oom;
+	batch->records = ptr;
+	ptr = reallocarray(batch->recordp, new_max, sizeof(*batch->recordp));
+	if (ptr == NULL)
+	    goto oom;
+	batch->recordp = ptr;
+	ptr = reallocarray(batch->delays, new_max, sizeof(*batch->delays));
+	if (ptr == NULL)
+	    goto oom;
+	batch->delays = ptr;
+	batch->maxrecords = new_max;
+    }
+
+    if (len > batch->size - batch->len) {
+	const size_t new_size = sudo_pow2_roundup(batch->len + len);
+	if (new_size < batch->len + len) {
+	    /* overflow */
+	    errno = ENOMEM;
+	    goto oom;
+	}
+	if ((ptr = realloc(batch->data, new_size)) == NULL)
+	    goto oom;
+	batch->data = ptr;
+	batch->size = new_size;
+    }
+    if (len != 0) {
+	memcpy(batch->data + batch->len, buf, len);
+	batch->len += len;
+    }
+
+    /* Pointers are filled in by fmt_io_batch(). */
+    ts = &batch->delays[batch->nrecords];
+    time_spec__init(ts);
+    ts->tv_sec = delay->tv_sec;
+    ts->tv_nsec = delay->tv_nsec;
+    record = &batch->records[batch->nrecords];
+    io_record__init(record);
+    record->iofd = iofd;
+    record->data.len = len;
+    batch->nrecords++;
+
+    if (batch->len >= IOBUF_BATCH_SIZE)
+	debug_return_bool(fmt_io_batch(closure));
+    debug_return_bool(true);
+oom:
+    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+    debug_return_bool(false);
+}
+
 /*
  * Build and format an ExitMessage wrapped in a ClientMessage.
  * Appends the wire format message to the closure's write queue.
@@ -1178,6 +1817,10 @@ fmt_exit_message(struct client_closure *closure, int exit_status, int error)
     struct timespec run_time;
     debug_decl(fmt_exit_message, SUDOERS_DEBUG_UTIL);
 
+    /* Pending I/O buffers must be sent first to preserve order. */
+    if (!fmt_io_batch(closure))
+	goto done;
+
     if (sudo_gettime_awake(&run_time) == -1) {
 	sudo_warn("%s", U_("unable to get time of day"));
 	goto done;
@@ -1242,6 +1885,9 @@ done:
 
 /*
  * Build and format an IoBuffer wrapped in a ClientMessage.
+ * If the server supports it and earlier messages are still waiting
+ * to be written, the buffer is added to a batch instead.  The batch
+ * is sent when the write queue drains or another message is queued.
  * Appends the wire format message to the closure's write queue.
  * Returns true on success, false on failure.
  */
@@ -1255,6 +1901,29 @@ fmt_io_buf(struct client_closure *closure, int type, const char *buf,
     bool ret = false;
     debug_decl(fmt_io_buf, SUDOERS_DEBUG_UTIL);
 
+    if (closure->iobuf_batch && !TAILQ_EMPTY(&closure->write_bufs)) {
+	int iofd;
+
+	switch (type) {
+	case CLIENT_MESSAGE__TYPE_STDIN_BUF:
+	    iofd = IOFD_STDIN;
+	    break;
+	case CLIENT_MESSAGE__TYPE_STDOUT_BUF:
+	    iofd = IOFD_STDOUT;
+	    break;
+	case CLIENT_MESSAGE__TYPE_STDERR_BUF:
+	    iofd = IOFD_STDERR;
+	    break;
+	case CLIENT_MESSAGE__TYPE_TTYIN_BUF:
+	    iofd = IOFD_TTYIN;
+	    break;
+	default:
+	    iofd = IOFD_TTYOUT;
+	    break;
+	}
+	debug_return_bool(add_io_batch(closure, iofd, buf, len, delay));
+    }
+
     /* Fill in IoBuffer. */
     ts.tv_sec = delay->tv_sec;
     ts.tv_nsec = delay->tv_nsec;
@@ -1293,6 +1962,10 @@ fmt_winsize(struct client_closure *closure, unsigned int lines,
     bool ret = false;
     debug_decl(fmt_winsize, SUDOERS_DEBUG_UTIL);
 
+    /* Pending I/O buffers must be sent first to preserve order. */
+    if (!fmt_io_batch(closure))
+	goto done;
+
     /* Fill in ChangeWindowSize message. */
     ts.tv_sec = delay->tv_sec;
     ts.tv_nsec = delay->tv_nsec;
@@ -1329,6 +2002,10 @@ fmt_suspend(struct client_closure *closure, const char *signame, struct timespec
     bool ret = false;
     debug_decl(fmt_suspend, SUDOERS_DEBUG_UTIL);
 
+    /* Pending I/O buffers must be sent first to preserve order. */
+    if (!fmt_io_batch(closure))
+	goto done;
+
     /* Fill in CommandSuspend message. */
     ts.tv_sec = delay->tv_sec;
     ts.tv_nsec = delay->tv_nsec;
@@ -1492,6 +2169,17 @@ handle_server_hello(ServerHello *msg, struct client_closure *closure)
     /* Does the server support logging sub-commands in a session? */
     closure->subcommands = msg->subcommands;
 
+    /* Can I/O buffers be sent in batches? */
+    closure->iobuf_batch = msg->iobuf_batch;
+
+#ifdef HAVE_ZLIB_H
+    /* Compress the messages that follow if the server supports it. */
+    if (closure->log_details->compress && msg->compression) {
+	if ((closure->deflate = msg_deflate_alloc()) == NULL)
+	    debug_return_bool(false);
+    }
+#endif
+
     debug_return_bool(true);
 }
 
@@ -1584,10 +2272,14 @@ handle_server_message(uint8_t *buf, size_t len,
     bool ret = false;
     debug_decl(handle_server_message, SUDOERS_DEBUG_UTIL);
 
+    if (server_msg_arena.block_size == 0)
+	protobuf_c_arena_init(&server_msg_arena, 0, NULL);
+
     sudo_debug_printf(SUDO_DEBUG_INFO, "%s: unpacking ServerMessage", __func__);
-    msg = server_message__unpack(NULL, len, buf);
+    msg = server_message__unpack(&server_msg_arena.base, len, buf);
     if (msg == NULL) {
 	sudo_warnx(U_("unable to unpack %s size %zu"), "ServerMessage", len);
+	protobuf_c_arena_reset(&server_msg_arena);
 	debug_return_bool(false);
     }
 
@@ -1623,7 +2315,7 @@ handle_server_message(uint8_t *buf, size_t len,
 	break;
     }
 
-    server_message__free_unpacked(msg, NULL);
+    protobuf_c_arena_reset(&server_msg_arena);
     debug_return_bool(ret);
 }
 
@@ -1695,7 +2387,7 @@ server_msg_cb(int fd, int what, void *v)
 
     sudo_debug_printf(SUDO_DEBUG_INFO, "%s: reading ServerMessage", __func__);
 #if defined(HAVE_OPENSSL)
-    if (closure->ssl != NULL) {
+    if (closure->tls) {
         nread = SSL_read(closure->ssl, buf->data + buf->len, buf->size - buf->len);
         if (nread <= 0) {
 	    const char *errstr;
@@ -1829,6 +2521,7 @@ client_msg_cb(int fd, int what, void *v)
 {
     struct client_closure *closure = v;
     struct connection_buffer *buf;
+    bool released = false;
     ssize_t nwritten;
     debug_decl(client_msg_cb, SUDOERS_DEBUG_UTIL);
 
@@ -1859,7 +2552,11 @@ client_msg_cb(int fd, int what, void *v)
     	"%s: sending %u bytes to server", __func__, buf->len - buf->off);
 
 #if defined(HAVE_OPENSSL)
-    if (closure->ssl != NULL) {
+    if (closure->tls) {
+	/* Send as many queued messages as possible in one TLS record. */
+	if (!coalesce_bufs(closure))
+	    goto bad;
+	buf = TAILQ_FIRST(&closure->write_bufs);
         nwritten = SSL_write(closure->ssl, buf->data + buf->off, buf->len - buf->off);
         if (nwritten <= 0) {
 	    const char *errstr;
@@ -1898,24 +2595,37 @@ client_msg_cb(int fd, int what, void *v)
     } else
 #endif /* HAVE_OPENSSL */
     {
-        nwritten = send(fd, buf->data + buf->off, buf->len - buf->off, 0);
+	/* Send all queued messages with a single system call. */
+        nwritten = writev_bufs(fd, closure);
     }
 
     if (nwritten == -1) {
 	sudo_warn("send");
 	goto bad;
     }
-    buf->off += nwritten;
 
-    if (buf->off == buf->len) {
-	/* sent entire message, move buf to free list */
+    /* Move the buffers that were sent in their entirety to the free list. */
+    while ((buf = TAILQ_FIRST(&closure->write_bufs)) != NULL) {
+	if ((size_t)nwritten < buf->len - buf->off) {
+	    buf->off += nwritten;
+	    break;
+	}
+	nwritten -= buf->len - buf->off;
 	sudo_debug_printf(SUDO_DEBUG_INFO,
 	    "%s: finished sending %u bytes to server", __func__, buf->len);
 	buf->off = 0;
 	buf->len = 0;
 	TAILQ_REMOVE(&closure->write_bufs, buf, entries);
 	TAILQ_INSERT_TAIL(&closure->free_bufs, buf, entries);
-	if (TAILQ_EMPTY(&closure->write_bufs)) {
+	released = true;
+    }
+
+    if (released) {
+	if (TAILQ_EMPTY(&closure->write_bufs) && closure->batch.nrecords != 0) {
+	    /* Send I/O buffers that were batched while we were writing. */
+	    if (!fmt_io_batch(closure))
+		goto bad;
+	} else if (TAILQ_EMPTY(&closure->write_bufs)) {
 	    /* Write queue empty, check for state change. */
 	    closure->write_ev->del(closure->write_ev);
 	    if (!client_message_completion(closure))
@@ -27,6 +27,10 @@
 # include <openssl/ssl.h>
 #endif /* HAVE_OPENSSL */
 
+#ifdef HAVE_ZLIB_H
+# include <zlib.h>
+#endif
+
 #include "log_server.pb-c.h"
 
 #ifndef INET_ADDRSTRLEN
@@ -47,6 +51,15 @@
 /* Maximum message size (2Mb) */
 #define MESSAGE_SIZE_MAX	(2 * 1024 * 1024)
 
+/* I/O data to collect in an IoBufferBatch before sending it (64Kb) */
+#define IOBUF_BATCH_SIZE	(64 * 1024)
+
+/* Maximum plaintext in a TLS record, queued messages are combined up to it. */
+#define TLS_RECORD_SIZE		(16 * 1024)
+
+/* Maximum size of the TLS session cache file (16Kb) */
+#define SESSION_CACHE_MAX	(16 * 1024)
+
 /* TODO - share with logsrvd/sendlog */
 struct connection_buffer {
     TAILQ_ENTRY(connection_buffer) entries;
@@ -57,6 +70,36 @@ struct connection_buffer {
 };
 TAILQ_HEAD(connection_buffer_list, connection_buffer);
 
+/*
+ * I/O buffers collected to be sent as a single IoBufferBatch.
+ * The data for each record is stored contiguously in data.
+ * TODO - share with logsrvd/sendlog
+ */
+struct iobuf_batch {
+    IoRecord *records;
+    IoRecord **recordp;
+    TimeSpec *delays;
+    uint8_t *data;
+    size_t nrecords;
+    size_t maxrecords;
+    size_t len;
+    size_t size;
+};
+
+#ifdef HAVE_ZLIB_H
+/*
+ * Compresses ClientMessages sent to the server as a single stream.
+ * TODO - share with logsrvd/sendlog
+ */
+struct msg_deflate {
+    z_stream strm;
+    uint8_t *inbuf;		/* wire format message to compress */
+    uint8_t *outbuf;		/* compressed data */
+    size_t insize;
+    size_t outsize;
+};
+#endif /* HAVE_ZLIB_H */
+
 enum client_state {
     ERROR,
     RECV_HELLO,
@@ -79,6 +122,7 @@ struct client_closure {
     bool disabled;
     bool log_io;
     char *server_name;
+    char *server_port;
 #if defined(HAVE_STRUCT_IN6_ADDR)
     char server_ip[INET6_ADDRSTRLEN];
 #else
@@ -88,13 +132,17 @@ struct client_closure {
     SSL_CTX *ssl_ctx;
     SSL *ssl;
     bool ssl_initialized;
+    bool tls;			/* current connection uses TLS */
 #endif /* HAVE_OPENSSL */
     bool subcommands;
+    bool iobuf_batch;
     enum client_state state;
     enum client_state initial_state; /* XXX - bad name */
     struct connection_buffer_list write_bufs;
     struct connection_buffer_list free_bufs;
     struct connection_buffer read_buf;
+    struct iobuf_batch batch;
+    struct msg_deflate *deflate;
     struct sudo_plugin_event *read_ev;
     struct sudo_plugin_event *write_ev;
     struct log_details *log_details;
@@ -116,10 +116,12 @@ init_log_details(struct log_details *details, struct eventlog *evlog)
     details->log_servers = log_servers;
     details->server_timeout.tv_sec = def_log_server_timeout;
     details->keepalive = def_log_server_keepalive;
+    details->compress = def_log_server_compress;
 #if defined(HAVE_OPENSSL)
     details->ca_bundle = def_log_server_cabundle;
     details->cert_file = def_log_server_peer_cert;
     details->key_file = def_log_server_peer_key;
+    details->session_cache = def_log_server_session_cache;
     details->verify_server = def_log_server_verify;
 #endif /* HAVE_OPENSSL */
 
@@ -31,8 +31,10 @@ struct log_details {
     char *ca_bundle;
     char *cert_file;
     char *key_file;
+    char *session_cache;
 # endif /* HAVE_OPENSSL */
     bool keepalive;
+    bool compress;
     bool verify_server;
     bool ignore_log_errors;
 };
@@ -672,7 +672,7 @@ sudoers_policy_store_result(bool accepted, char *argv[], char *envp[],
     }
 
     /* Increase the length of command_info as needed, it is *not* checked. */
-    command_info = calloc(73, sizeof(char *));
+    command_info = calloc(75, sizeof(char *));
     if (command_info == NULL)
 	goto oom;
 
@@ -909,6 +909,10 @@ sudoers_policy_store_result(bool accepted, char *argv[], char *envp[],
 	    def_log_server_keepalive ? "true" : "false")) == NULL)
         goto oom;
 
+    if ((command_info[info_len++] = sudo_new_key_val("log_server_compress",
+	    def_log_server_compress ? "true" : "false")) == NULL)
+        goto oom;
+
     if ((command_info[info_len++] = sudo_new_key_val("log_server_verify",
 	    def_log_server_verify ? "true" : "false")) == NULL)
         goto oom;
@@ -925,6 +929,10 @@ sudoers_policy_store_result(bool accepted, char *argv[], char *envp[],
         if ((command_info[info_len++] = sudo_new_key_val("log_server_peer_key", def_log_server_peer_key)) == NULL)
             goto oom;
     }
+    if (def_log_server_session_cache != NULL) {
+        if ((command_info[info_len++] = sudo_new_key_val("log_server_session_cache", def_log_server_session_cache)) == NULL)
+            goto oom;
+    }
 
     if (def_command_timeout > 0 || user_timeout > 0) {
 	int timeout = user_timeout;
@@ -0,0 +1,189 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define SUDO_ERROR_WRAP 0
+
+#include "log_client.c"
+
+sudo_dso_public int main(int argc, char *argv[]);
+
+struct sudo_plugin_event * (*plugin_event_alloc)(void);
+
+#if defined(SUDOERS_LOG_CLIENT) && defined(HAVE_OPENSSL)
+static int errors = 0, ntests = 0;
+static bool verbose;
+
+/*
+ * Create a session that can be encoded, using the first cipher
+ * enabled in the default TLS context.
+ */
+static SSL_SESSION *
+new_session(void)
+{
+    static const unsigned char sid[] = "check_log_client session id";
+    const SSL_CIPHER *cipher = NULL;
+    unsigned char key[48];
+    SSL_SESSION *sess;
+    SSL_CTX *ctx;
+    SSL *ssl;
+    size_t i;
+
+    if ((ctx = SSL_CTX_new(TLS_method())) == NULL ||
+	    (ssl = SSL_new(ctx)) == NULL)
+	sudo_fatalx("%s: unable to create TLS context", __func__);
+    if (SSL_get_ciphers(ssl) != NULL)
+	cipher = sk_SSL_CIPHER_value(SSL_get_ciphers(ssl), 0);
+    for (i = 0; i < sizeof(key); i++)
+	key[i] = (unsigned char)i;
+    if (cipher == NULL || (sess = SSL_SESSION_new()) == NULL ||
+	    !SSL_SESSION_set_cipher(sess, cipher) ||
+	    !SSL_SESSION_set_protocol_version(sess, TLS1_2_VERSION) ||
+	    !SSL_SESSION_set1_id(sess, sid, sizeof(sid) - 1) ||
+	    !SSL_SESSION_set1_master_key(sess, key, sizeof(key)))
+	sudo_fatalx("%s: unable to create TLS session", __func__);
+    SSL_SESSION_set_time(sess, (long)time(NULL));
+    SSL_SESSION_set_timeout(sess, 300);
+    SSL_free(ssl);
+    SSL_CTX_free(ctx);
+    return sess;
+}
+
+/*
+ * Load the session for host and port from path.
+ * If orig is NULL, no session should be found, else the loaded
+ * session must match orig.
+ */
+static void
+load_test(const char *path, const char *host, const char *port,
+    SSL_SESSION *orig)
+{
+    const unsigned char *id1, *id2;
+    unsigned int len1, len2;
+    SSL_SESSION *sess;
+
+    ntests++;
+    sess = tls_session_load(path, host, port);
+    if (orig == NULL) {
+	if (sess != NULL) {
+	    sudo_warnx("%s: unexpected TLS session for %s:%s", path, host, port);
+	    errors++;
+	} else if (verbose) {
+	    printf("%s: no TLS session for %s:%s\n", path, host, port);
+	}
+    } else {
+	if (sess == NULL) {
+	    sudo_warnx("%s: unable to load TLS session for %s:%s", path,
+		host, port);
+	    errors++;
+	} else {
+	    id1 = SSL_SESSION_get_id(orig, &len1);
+	    id2 = SSL_SESSION_get_id(sess, &len2);
+	    if (len1 != len2 || memcmp(id1, id2, len1) != 0) {
+		sudo_warnx("%s: TLS session for %s:%s does not match", path,
+		    host, port);
+		errors++;
+	    } else if (verbose) {
+		printf("%s: loaded TLS session for %s:%s\n", path, host, port);
+	    }
+	}
+    }
+    if (sess != NULL)
+	SSL_SESSION_free(sess);
+}
+
+/*
+ * Store a TLS session in the session cache and load it back.
+ */
+int
+main(int argc, char *argv[])
+{
+    const char *host = "logsrv.example.com", *port = "30344";
+    const char *path;
+    SSL_SESSION *sess;
+    struct stat sb;
+    off_t expected;
+    int ch;
+
+    initprogname(argc > 0 ? argv[0] : "check_log_client");
+
+    while ((ch = getopt(argc, argv, "v")) != -1) {
+	switch (ch) {
+	case 'v':
+	    verbose = true;
+	    break;
+	default:
+	    fprintf(stderr, "usage: %s [-v] pathname\n", getprogname());
+	    return EXIT_FAILURE;
+	}
+    }
+    argc -= optind;
+    argv += optind;
+
+    if (argc != 1) {
+	fprintf(stderr, "usage: %s [-v] pathname\n", getprogname());
+	return EXIT_FAILURE;
+    }
+    path = argv[0];
+
+    sess = new_session();
+    unlink(path);
+
+    /* The cache file holds the host, the port and the whole session. */
+    ntests++;
+    expected = (off_t)(strlen(host) + 1 + strlen(port) + 1) +
+	i2d_SSL_SESSION(sess, NULL);
+    if (!tls_session_store(path, host, port, sess)) {
+	sudo_warnx("%s: unable to store TLS session", path);
+	errors++;
+    } else if (stat(path, &sb) == -1) {
+	sudo_warn("%s", path);
+	errors++;
+    } else if (sb.st_size != expected) {
+	sudo_warnx("%s: size %lld, expected %lld", path,
+	    (long long)sb.st_size, (long long)expected);
+	errors++;
+    } else if (verbose) {
+	printf("%s: stored TLS session for %s:%s\n", path, host, port);
+    }
+
+    /* Only a cache file owned by root is trusted. */
+    if (geteuid() == ROOT_UID) {
+	load_test(path, host, port, sess);
+	load_test(path, host, "30343", NULL);
+	load_test(path, "logsrv", port, NULL);
+    } else if (verbose) {
+	printf("%s: not running as root, skipping load tests\n",
+	    getprogname());
+    }
+
+    SSL_SESSION_free(sess);
+    unlink(path);
+
+    if (ntests != 0) {
+	printf("%s: %d tests run, %d errors, %d%% success rate\n",
+	    getprogname(), ntests, errors, (ntests - errors) * 100 / ntests);
+    }
+    return errors;
+}
+#else
+int
+main(int argc, char *argv[])
+{
+    return EXIT_SUCCESS;
+}
+#endif /* SUDOERS_LOG_CLIENT && HAVE_OPENSSL */
@@ -413,7 +413,7 @@ fill_exec_closure_monitor(struct monitor_closure *mc,
     mc->mon_pgrp = getpgrp();
 
     /* Setup event base and events. */
-    mc->evbase = sudo_ev_base_alloc();
+    mc->evbase = sudo_ev_base_alloc_flags(SUDO_EVBASE_OPT_SIGNALFD);
     if (mc->evbase == NULL)
 	sudo_fatalx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
 